@@ -1,11 +1,12 @@
 #ifndef LIBC_ERRNO_H
 #define LIBC_ERRNO_H
 
-#include "syscall.h"
+#include "tls.h"
 
+// errno lives in the thread control block: one %fs load, no syscall
 static inline int *_errno_location(void)
 {
-    return syscall_thread_get_errno_loc();
+    return &tls_self()->errno_val;
 }
 
 #define errno (*_errno_location())
@@ -44,11 +45,13 @@ static inline int *_errno_location(void)
 #define EPIPE        32  /* Broken pipe */
 #define EDOM         33  /* Math argument out of domain of func */
 #define ERANGE       34  /* Math result not representable */
+#define EDEADLK      35  /* Resource deadlock would occur */
 // ...
 #define ENOSYS       38  /* Function not implemented */
 #define ENOTSUP      95  /* Operation not supported */
 #define ENOTEMPTY    39  /* Directory not empty */
 #define EILSEQ       84  /* Illegal byte sequence */
 #define ENAMETOOLONG 36  /* File name too long */
+#define ETIMEDOUT   110  /* Connection timed out */
 
 #endif /* LIBC_ERRNO_H */
\ No newline at end of file
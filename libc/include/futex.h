@@ -0,0 +1,30 @@
+#ifndef LIBC_FUTEX_H
+#define LIBC_FUTEX_H
+
+#include <stdint.h>
+#include "syscall.h"
+
+#define FUTEX_WAIT          0
+#define FUTEX_WAKE          1
+#define FUTEX_REQUEUE       3
+#define FUTEX_CMP_REQUEUE   4
+
+// Sleeps while *uaddr == val. Returns 0, -EAGAIN (value changed) or -ETIMEDOUT.
+// timeout_ns == 0 waits forever.
+static inline long futex_wait(uint32_t *uaddr, uint32_t val, uint64_t timeout_ns) {
+    return syscall_futex(uaddr, FUTEX_WAIT, val, timeout_ns, NULL, 0);
+}
+
+// Wakes up to n waiters, returns how many were woken
+static inline long futex_wake(uint32_t *uaddr, uint32_t n) {
+    return syscall_futex(uaddr, FUTEX_WAKE, n, 0, NULL, 0);
+}
+
+// Wakes n_wake waiters on uaddr and moves up to n_requeue others to uaddr2
+// (only if *uaddr still equals expected)
+static inline long futex_cmp_requeue(uint32_t *uaddr, uint32_t n_wake, uint32_t n_requeue,
+                                     uint32_t *uaddr2, uint32_t expected) {
+    return syscall_futex(uaddr, FUTEX_CMP_REQUEUE, n_wake, n_requeue, uaddr2, expected);
+}
+
+#endif // LIBC_FUTEX_H
@@ -0,0 +1,117 @@
+#ifndef LIBC_PTHREAD_H
+#define LIBC_PTHREAD_H
+
+#include <stdint.h>
+#include "errno.h"
+#include "futex.h"
+
+// Mutex: 0 - free, 1 - locked, 2 - locked and someone may be sleeping in the kernel
+typedef struct {
+    uint32_t state;
+} pthread_mutex_t;
+
+#define PTHREAD_MUTEX_INITIALIZER { 0 }
+
+// Condition variable: waiters sleep on seq, any signal bumps it
+typedef struct {
+    uint32_t seq;
+    pthread_mutex_t *mutex;
+} pthread_cond_t;
+
+#define PTHREAD_COND_INITIALIZER { 0, NULL }
+
+static inline uint32_t _sync_cmpxchg(uint32_t *p, uint32_t expected, uint32_t desired) {
+    __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    return expected;
+}
+
+static inline int pthread_mutex_init(pthread_mutex_t *m, const void *attr) {
+    (void)attr;
+    m->state = 0;
+    return 0;
+}
+
+static inline int pthread_mutex_destroy(pthread_mutex_t *m) {
+    return m->state ? EBUSY : 0;
+}
+
+static inline int pthread_mutex_trylock(pthread_mutex_t *m) {
+    return _sync_cmpxchg(&m->state, 0, 1) == 0 ? 0 : EBUSY;
+}
+
+static inline int pthread_mutex_lock(pthread_mutex_t *m) {
+    uint32_t c = _sync_cmpxchg(&m->state, 0, 1);
+    if (c == 0)
+        return 0;
+
+    // Contended path: mark as 2 so unlock knows to enter the kernel
+    if (c != 2)
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        futex_wait(&m->state, 2, 0);
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+    return 0;
+}
+
+static inline int pthread_mutex_unlock(pthread_mutex_t *m) {
+    if (__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1) {
+        __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+        futex_wake(&m->state, 1);
+    }
+    return 0;
+}
+
+static inline int pthread_cond_init(pthread_cond_t *c, const void *attr) {
+    (void)attr;
+    c->seq = 0;
+    c->mutex = NULL;
+    return 0;
+}
+
+static inline int pthread_cond_destroy(pthread_cond_t *c) {
+    (void)c;
+    return 0;
+}
+
+static inline int pthread_cond_timedwait_ns(pthread_cond_t *c, pthread_mutex_t *m, uint64_t timeout_ns) {
+    uint32_t seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+    c->mutex = m;
+
+    pthread_mutex_unlock(m);
+    long rc = futex_wait(&c->seq, seq, timeout_ns);
+
+    // After a requeue from broadcast we may be woken by the mutex itself,
+    // so always take it in the contended state
+    while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0)
+        futex_wait(&m->state, 2, 0);
+
+    return rc == -ETIMEDOUT ? ETIMEDOUT : 0;
+}
+
+static inline int pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m) {
+    return pthread_cond_timedwait_ns(c, m, 0);
+}
+
+static inline int pthread_cond_signal(pthread_cond_t *c) {
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&c->seq, 1);
+    return 0;
+}
+
+static inline int pthread_cond_broadcast(pthread_cond_t *c) {
+    pthread_mutex_t *m = c->mutex;
+    uint32_t seq = __atomic_add_fetch(&c->seq, 1, __ATOMIC_RELEASE);
+
+    if (!m) {
+        futex_wake(&c->seq, UINT32_MAX);
+        return 0;
+    }
+
+    // Wake one, move the rest straight onto the mutex instead of a thundering herd
+    if (futex_cmp_requeue(&c->seq, 1, UINT32_MAX, &m->state, seq) == -EAGAIN)
+        futex_wake(&c->seq, UINT32_MAX);
+    return 0;
+}
+
+#endif // LIBC_PTHREAD_H
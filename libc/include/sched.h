@@ -0,0 +1,64 @@
+#ifndef LIBC_SCHED_H
+#define LIBC_SCHED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "syscall.h"
+
+// Scheduler statistics and switch trace (layout matches src/multitask/schedstat.h).
+
+#define THREAD_STATE_RUNNING 0
+#define THREAD_STATE_READY   1
+#define THREAD_STATE_BLOCKED 2
+#define THREAD_STATE_ZOMBIE  3
+
+typedef struct {
+    int32_t tid;
+    int32_t pid;
+    uint32_t state;
+    uint32_t last_cpu;
+    uint64_t runtime_ns;      // time spent on the CPU
+    uint64_t wait_ns;         // time spent runnable but not running
+    uint64_t nr_voluntary;    // gave up the CPU: sleep, wait, exit, yield
+    uint64_t nr_involuntary;  // preempted by the timer while still runnable
+} thread_stat_t;
+
+typedef struct {
+    uint64_t seq;
+    uint64_t ts_ns;           // nanoseconds since boot
+    int32_t prev_tid;
+    int32_t next_tid;
+    uint32_t prev_state;      // THREAD_STATE_READY means prev was preempted
+    uint32_t cpu;
+} sched_event_t;
+
+// Kernel keeps the last SCHED_TRACE_SIZE switches; older ones are overwritten.
+#define SCHED_TRACE_SIZE 1024
+
+// Returns the number of entries written (threads that are not zombies).
+static inline size_t sched_thread_stats(thread_stat_t *buf, size_t max) {
+    return syscall_thread_stats(buf, max);
+}
+
+// Copies switches with seq >= from_seq (or the oldest kept one).
+// Pass last seq + 1 to continue reading where the previous call stopped.
+static inline size_t sched_trace(sched_event_t *buf, size_t max, uint64_t from_seq) {
+    return syscall_sched_trace(buf, max, from_seq);
+}
+
+// CPU affinity: bit N allows CPU N. tid 0 means the calling thread.
+// Cores reserved with the isolcpus= boot option only run threads pinned to them.
+typedef uint64_t cpu_mask_t;
+#define CPU_MASK(cpu) ((cpu_mask_t)1 << (cpu))
+
+// Returns 0, -EINVAL (no online CPU in mask), -ESRCH or -EPERM (other process).
+static inline int sched_setaffinity(int tid, cpu_mask_t mask) {
+    return syscall_sched_setaffinity(tid, mask);
+}
+
+// Stores the mask limited to online CPUs.
+static inline int sched_getaffinity(int tid, cpu_mask_t *mask) {
+    return syscall_sched_getaffinity(tid, mask);
+}
+
+#endif // LIBC_SCHED_H
@@ -0,0 +1,55 @@
+#ifndef LIBC_SEMAPHORE_H
+#define LIBC_SEMAPHORE_H
+
+#include <stdint.h>
+#include "errno.h"
+#include "futex.h"
+
+typedef struct {
+    uint32_t value;
+    uint32_t waiters;
+} sem_t;
+
+static inline int sem_init(sem_t *s, int pshared, unsigned int value) {
+    (void)pshared;
+    s->value = value;
+    s->waiters = 0;
+    return 0;
+}
+
+static inline int sem_destroy(sem_t *s) {
+    (void)s;
+    return 0;
+}
+
+static inline int sem_trywait(sem_t *s) {
+    uint32_t v = __atomic_load_n(&s->value, __ATOMIC_RELAXED);
+    while (v > 0) {
+        if (__atomic_compare_exchange_n(&s->value, &v, v - 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return 0;
+    }
+    return EAGAIN;
+}
+
+static inline int sem_wait(sem_t *s) {
+    while (sem_trywait(s) != 0) {
+        __atomic_fetch_add(&s->waiters, 1, __ATOMIC_RELAXED);
+        futex_wait(&s->value, 0, 0);
+        __atomic_fetch_sub(&s->waiters, 1, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+static inline int sem_post(sem_t *s) {
+    __atomic_fetch_add(&s->value, 1, __ATOMIC_RELEASE);
+    if (__atomic_load_n(&s->waiters, __ATOMIC_SEQ_CST))
+        futex_wake(&s->value, 1);
+    return 0;
+}
+
+static inline int sem_getvalue(sem_t *s, int *out) {
+    *out = (int)__atomic_load_n(&s->value, __ATOMIC_RELAXED);
+    return 0;
+}
+
+#endif // LIBC_SEMAPHORE_H
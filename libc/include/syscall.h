@@ -5,6 +5,9 @@
 #include <stddef.h>
 #include "sys/types.h"
 
+// Empty call (entry/exit cost measurement)
+#define SYSCALL_NOP                 1
+
 // State
 #define SYSCALL_GET_TIME            5
 #define SYSCALL_GET_TIME_UP         7
@@ -29,6 +32,7 @@
 #define SYSCALL_PROCESS_EXIT        203
 #define SYSCALL_PROCESS_IS_ALIVE    204
 #define SYSCALL_GETPID              205
+#define SYSCALL_PROCESS_WAIT        206
 
 // Thread management
 #define SYSCALL_THREAD_CREATE       250
@@ -39,9 +43,17 @@
 #define SYSCALL_THREAD_IS_ALIVE     255
 #define SYSCALL_THREAD_GET_ERRNO_LOC 256
 #define SYSCALL_GETTID              257
+#define SYSCALL_FUTEX               258
+#define SYSCALL_THREAD_JOIN         259
+#define SYSCALL_THREAD_STATS        260
+#define SYSCALL_SCHED_TRACE         261
+#define SYSCALL_SCHED_SETAFFINITY   262
+#define SYSCALL_SCHED_GETAFFINITY   263
+#define SYSCALL_ARCH_PRCTL          264
 
 // Exception/debug
 #define THROW_AN_EXCEPTION          300
+#define SYSCALL_LATENCY_STATS       301
 
 // Graphics (framebuffer primitives)
 #define SYSCALL_GFX_DRAW_POINT      400
@@ -111,6 +123,8 @@ typedef struct {
 #define SYSCALL_VFS_FIND            829
 #define SYSCALL_VFS_SEEK            830
 #define SYSCALL_VFS_FILE_SIZE       831
+#define SYSCALL_VFS_SYNC            832
+#define SYSCALL_VFS_FSYNC           833
 
 typedef struct {
     uint64_t size;
@@ -147,6 +161,8 @@ typedef struct {
 #define _SYSCALL_RET(type, res) \
     if (!__builtin_types_compatible_p(type, void)) return (type)res;
 
+// Kernel entry via SYSCALL: the instruction itself clobbers rcx (rip) and r11 (rflags),
+// all other registers are preserved by the kernel. Legacy int 0x80 is still accepted.
 #define _DO_SYSCALL(name, type, ...) do {                                 \
     register uint64_t rax_ __asm__("rax") = SYSCALL_##name;               \
     uint64_t res_;                                                         \
@@ -241,27 +257,42 @@ typedef struct {
 
 typedef void (*thread_entry_t)(void*);
 
+// thread_create flags (kernel THREAD_FLAG_*, passed in r8). Without JOINABLE
+// the thread is reaped on exit and thread_join on it fails
+#define THREAD_FLAG_JOINABLE (1 << 0)
+
+syscall(long, NOP, nop)
 syscall(uint32_t, GET_TIME_UP, get_time_up)
 
 syscall(void*, MALLOC, malloc, size_t, size)
 syscall(void, FREE, free, void*, ptr)
 syscall(void*, REALLOC, realloc, void*, ptr, size_t, size)
 syscall(void, KMALLOC_STATS, kmalloc_stats, void*, stats)
+// Fills latency_stats_t (src/multitask/preempt.h); -1 unless built with CONFIG_LATENCY_AUDIT
+syscall(int, LATENCY_STATS, latency_stats, void*, stats, int, reset)
 
 syscall(int, GETCHAR, getchar)
 syscall(void, POWER_OFF, power_off)
 syscall(void, REBOOT, reboot)
 
-syscall(int, THREAD_CREATE, thread_create, thread_entry_t, entry, size_t, stack_size)
+syscall(int, THREAD_CREATE, thread_create, thread_entry_t, entry, size_t, stack_size, void*, arg, int, is_user, uint64_t, flags)
 syscall(int, THREAD_LIST, thread_list, void*, buf, size_t, max)
 syscall(int, THREAD_STOP, thread_stop, int, tid)
 syscall(void, REAP_ZOMBIES, reap_zombies)
 syscall(void, THREAD_EXIT, thread_exit, int, exit_code)
 syscall(int, THREAD_IS_ALIVE, thread_is_alive, int, tid)
-syscall(int, THREAD_GET_ERRNO_LOC, thread_get_errno_loc)
+syscall(int, THREAD_JOIN, thread_join, int, tid, int*, status)
+syscall(size_t, THREAD_STATS, thread_stats, void*, buf, size_t, max)
+syscall(size_t, SCHED_TRACE, sched_trace, void*, buf, size_t, max, uint64_t, from_seq)
+syscall(int, SCHED_SETAFFINITY, sched_setaffinity, int, tid, uint64_t, mask)
+syscall(int, SCHED_GETAFFINITY, sched_getaffinity, int, tid, uint64_t*, mask)
+syscall(long, ARCH_PRCTL, arch_prctl, int, code, uint64_t, addr)
+syscall(int*, THREAD_GET_ERRNO_LOC, thread_get_errno_loc)
 syscall(int, GETTID, gettid)
+syscall(long, FUTEX, futex, uint32_t*, uaddr, int, op, uint32_t, val, uint64_t, val2, uint32_t*, uaddr2, uint32_t, val3)
 
 syscall(void, PROCESS_EXIT, process_exit, int, exit_code)
+syscall(int, PROCESS_WAIT, process_wait, int, pid, int*, status)
 
 syscall(void, GFX_DRAW_POINT, gfx_draw_point, uint32_t, x, uint32_t, y, uint32_t, color)
 syscall(void, GFX_DRAW_LINE, gfx_draw_line, int32_t, x0, int32_t, y0, int32_t, x1, int32_t, y1, uint32_t, color)
@@ -291,6 +322,8 @@ syscall(int, VFS_UNLINK, vfs_unlink, const char*, path)
 syscall(int, VFS_FIND, vfs_find, const char*, path)
 syscall(int, VFS_SEEK, vfs_seek, int, fd, long, offset, int, whence)
 syscall(size_t, VFS_FILE_SIZE, vfs_file_size, const char*, path)
+syscall(int, VFS_SYNC, vfs_sync)
+syscall(int, VFS_FSYNC, vfs_fsync, int, fd)
 
 syscall(int, CHDIR, chdir, const char*, path)
 syscall(int, GETCWD, getcwd, char*, buf, size_t, size)
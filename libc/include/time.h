@@ -2,6 +2,7 @@
 #define LIBC_TIME_H
 
 #include "syscall.h"
+#include "vdso.h"
 
 struct timespec {
     time_t tv_sec;
@@ -27,7 +28,7 @@ static inline void tzset()
 
 static inline time_t time(time_t* tloc)
 {
-    time_t current_time = (time_t)syscall_get_time_up();
+    time_t current_time = (time_t)vdso_uptime_sec();
     if (tloc)
     {
         *tloc = current_time;
@@ -0,0 +1,41 @@
+#ifndef LIBC_TLS_H
+#define LIBC_TLS_H
+
+#include <stdint.h>
+#include "syscall.h"
+
+// Thread control block (layout matches src/multitask/tls.h).
+// The kernel maps one per user thread, after the static TLS block of the
+// executable, and points FS base at it, so %fs:0 is the TCB address.
+
+typedef struct tls_tcb {
+    uint64_t self;       // %fs:0, address of this TCB
+    uint64_t dtv;        // %fs:8, no dynamic modules, always 0
+    int32_t errno_val;   // %fs:16
+    int32_t tid;         // %fs:20
+    uint64_t user[5];    // zeroed by the kernel, free for per-thread libc state
+} tls_tcb_t;
+
+#define ARCH_SET_FS 0x1002
+#define ARCH_GET_FS 0x1003
+
+static inline tls_tcb_t *tls_self(void) {
+    tls_tcb_t *self;
+    __asm__ volatile("mov %%fs:0, %0" : "=r"(self));
+    return self;
+}
+
+// Cheaper than syscall_gettid(): read straight from the TCB.
+static inline int tls_gettid(void) {
+    int tid;
+    __asm__ volatile("movl %%fs:20, %0" : "=r"(tid));
+    return tid;
+}
+
+// Switch FS base, e.g. to a TCB set up by a user-level thread library.
+// Returns 0, -EFAULT (not a user address) or -EINVAL.
+static inline long arch_prctl(int code, uint64_t addr) {
+    return syscall_arch_prctl(code, addr);
+}
+
+#endif // LIBC_TLS_H
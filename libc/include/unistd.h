@@ -1,6 +1,17 @@
 #ifndef LIBC_UNISTD_H
 #define LIBC_UNISTD_H
 
+#include "vdso.h"
+#include "syscall.h"
+
+static inline int gettid(void) {
+    return vdso_gettid();
+}
+
+static inline int getpid(void) {
+    return vdso_getpid();
+}
+
 // TODO
 static inline int geteuid(void) {
     return 0;
@@ -11,4 +22,14 @@ static inline int getegid(void) {
     return 0;
 }
 
+// Small writes stay in the kernel cache for a few seconds; these push them to disk.
+static inline int sync(void) {
+    return syscall_vfs_sync();
+}
+
+// Flushes the whole file system the file lives on.
+static inline int fsync(int fd) {
+    return syscall_vfs_fsync(fd);
+}
+
 #endif // LIBC_UNISTD_H
\ No newline at end of file
@@ -0,0 +1,96 @@
+#ifndef LIBC_VDSO_H
+#define LIBC_VDSO_H
+
+#include <stdint.h>
+
+// Read-only page the kernel maps into every process (see src/vdso/vdso.h).
+// Time and current tid/pid are plain loads, no syscall needed.
+#define VDSO_ADDR 0x00007FFFFF000000ULL
+
+typedef struct {
+    volatile uint32_t seq;
+    uint32_t tsc_valid;
+    uint64_t tsc_base;
+    uint64_t tsc_mult;
+    uint64_t uptime_ns;
+    uint32_t uptime_sec;
+    uint8_t hh;
+    uint8_t mm;
+    uint8_t ss;
+    uint8_t reserved;
+    volatile int32_t tid;
+    volatile int32_t pid;
+} vdso_data_t;
+
+typedef struct {
+    uint8_t hh;
+    uint8_t mm;
+    uint8_t ss;
+} vdso_clock_t;
+
+#define VDSO ((const volatile vdso_data_t*)VDSO_ADDR)
+
+static inline uint64_t vdso_rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Seqlock reader: retry while the kernel is updating the page
+static inline uint32_t vdso_read_begin(void) {
+    uint32_t seq;
+    while ((seq = VDSO->seq) & 1u)
+        __asm__ volatile("pause" ::: "memory");
+    __asm__ volatile("" ::: "memory");
+    return seq;
+}
+
+static inline int vdso_read_retry(uint32_t seq) {
+    __asm__ volatile("" ::: "memory");
+    return VDSO->seq != seq;
+}
+
+static inline uint64_t vdso_uptime_ns(void) {
+    uint32_t seq;
+    uint64_t ns;
+    do {
+        seq = vdso_read_begin();
+        if (VDSO->tsc_valid)
+            ns = (uint64_t)(((unsigned __int128)(vdso_rdtsc() - VDSO->tsc_base) * VDSO->tsc_mult) >> 32);
+        else
+            ns = VDSO->uptime_ns;
+    } while (vdso_read_retry(seq));
+    return ns;
+}
+
+static inline uint32_t vdso_uptime_sec(void) {
+    uint32_t seq;
+    uint32_t sec;
+    do {
+        seq = vdso_read_begin();
+        sec = VDSO->uptime_sec;
+    } while (vdso_read_retry(seq));
+    return sec;
+}
+
+static inline vdso_clock_t vdso_get_clock(void) {
+    uint32_t seq;
+    vdso_clock_t c;
+    do {
+        seq = vdso_read_begin();
+        c.hh = VDSO->hh;
+        c.mm = VDSO->mm;
+        c.ss = VDSO->ss;
+    } while (vdso_read_retry(seq));
+    return c;
+}
+
+static inline int vdso_gettid(void) {
+    return VDSO->tid;
+}
+
+static inline int vdso_getpid(void) {
+    return VDSO->pid;
+}
+
+#endif // LIBC_VDSO_H
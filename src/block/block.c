@@ -0,0 +1,616 @@
+#include "block.h"
+#include "../mm/pmm.h"
+#include "../malloc/malloc.h"
+#include "../cpu/cpu.h"
+#include "../time/timer.h"
+#include "../libc/string.h"
+#include "../graphics/formatting.h"
+
+/*
+ * Состояние очереди защищено выключенными прерываниями. Драйвер вызывается
+ * с включёнными: синхронный спит до прерывания своего контроллера,
+ * асинхронный завершает запрос прямо из обработчика
+ */
+
+static blk_dev_t devices[BLK_MAX_DEVICES];
+static int num_devices = 0;
+
+blk_dev_t *blk_register(const char *name, const blk_ops_t *ops, void *drv,
+                        uint32_t sector_size, uint64_t total_sectors)
+{
+    if (!name || !ops || !ops->rw || num_devices >= BLK_MAX_DEVICES)
+        return NULL;
+    if (sector_size == 0 || (sector_size & (sector_size - 1)) || sector_size > BLK_MAX_SECTOR_SIZE)
+        return NULL;
+
+    uint8_t *ctx = NULL;
+    if (ops->submit && ops->ctx_size)
+    {
+        ctx = malloc(ops->ctx_size * BLK_QUEUE_DEPTH);
+        if (!ctx)
+            return NULL;
+    }
+
+    blk_dev_t *dev = &devices[num_devices];
+    memset(dev, 0, sizeof(*dev));
+
+    /* Без буферов слияния собрать запрос из несмежных bio нечем - хотя бы один нужен */
+    for (int i = 0; i < BLK_MERGE_BUFS; ++i)
+    {
+        dev->merge_bufs[i] = alloc_pages(BLK_MAX_MERGE_BYTES / PAGE_SIZE);
+        if (dev->merge_bufs[i])
+            dev->merge_free |= 1u << i;
+    }
+    if (!dev->merge_free)
+    {
+        if (ctx)
+            free(ctx);
+        return NULL;
+    }
+
+    strncpy(dev->name, name, BLK_NAME_MAX - 1);
+    dev->ops = ops;
+    dev->drv = drv;
+    dev->sector_size = sector_size;
+    dev->total_sectors = total_sectors;
+    dev->max_sectors = BLK_MAX_MERGE_BYTES / sector_size;
+    wait_queue_init(&dev->space);
+
+    for (int i = 0; i < BLK_QUEUE_DEPTH; ++i)
+    {
+        dev->pool[i].dev = dev;
+        dev->pool[i].ctx = ctx ? ctx + i * ops->ctx_size : NULL;
+        dev->pool[i].next = dev->free;
+        dev->free = &dev->pool[i];
+    }
+
+    num_devices++;
+    return dev;
+}
+
+blk_dev_t *blk_find(const char *name)
+{
+    for (int i = 0; i < num_devices; ++i)
+        if (strcmp(devices[i].name, name) == 0)
+            return &devices[i];
+    return NULL;
+}
+
+int blk_count(void)
+{
+    return num_devices;
+}
+
+blk_dev_t *blk_get(int index)
+{
+    return index >= 0 && index < num_devices ? &devices[index] : NULL;
+}
+
+void blk_poll(blk_dev_t *dev)
+{
+    if (dev && dev->ops->poll)
+        dev->ops->poll(dev->drv);
+}
+
+/* Вызывается с выключенными прерываниями. bio с end_io может быть освобождён в нём - next читаем до вызова */
+static void blk_complete(blk_request_t *r, int rc)
+{
+    blk_bio_t *bio = r->head;
+    while (bio)
+    {
+        blk_bio_t *next = bio->next;
+        bio->rc = rc;
+        bio->done = true;
+        if (bio->end_io)
+            bio->end_io(bio);
+        bio = next;
+    }
+}
+
+/*
+ * Устройство зависло: завершает с ошибкой bio запросов, которые драйвер получил
+ * в буфере слияния, - буфер остаётся занятым, пока драйвер не отпустит запрос.
+ * Запрос с буфером самого bio ждёт драйвер: вызывающий не должен получить
+ * обратно память, в которую ещё идёт DMA. Возвращает число прерванных запросов.
+ * Вызывается с выключенными прерываниями
+ */
+static uint32_t blk_abort(blk_dev_t *dev)
+{
+    uint32_t n = 0;
+    blk_request_t **pp = &dev->inflight;
+    while (*pp)
+    {
+        blk_request_t *r = *pp;
+        if (r->merge < 0)
+        {
+            pp = &r->next;
+            continue;
+        }
+
+        *pp = r->next;
+        dev->inflight_count--;
+        r->aborted = true;
+        dev->stats.errors++;
+        blk_complete(r, BLK_ERR_TIMEOUT);
+        n++;
+    }
+
+    if (n)
+    {
+        dev->events++;
+        wait_queue_wake_all(&dev->space);
+    }
+    return n;
+}
+
+/* Спит до освобождения запроса или завершения. Вызывается с выключенными прерываниями */
+static void blk_sleep(blk_dev_t *dev, uint64_t *flags)
+{
+    if (!wait_queue_sleep(&dev->space, timer_now_ns() + BLK_POLL_TIMEOUT_NS))
+    {
+        restore_irq(*flags);
+        blk_poll(dev);
+        *flags = save_irq_disable();
+
+        /* Без предела ждущие опрашивали бы мёртвое устройство вечно */
+        if (dev->inflight_count && timer_now_ns() - dev->progress_ns >= BLK_IO_TIMEOUT_NS)
+        {
+            uint32_t n = blk_abort(dev);
+            if (n)
+                kprint(KPRINT_ERROR, "BLK: %s does not respond, failed %u requests\n", dev->name, n);
+            dev->progress_ns = timer_now_ns();
+        }
+    }
+}
+
+static inline bool blk_range_overlaps(const blk_request_t *r, const blk_bio_t *bio)
+{
+    return bio->lba < r->lba + r->count && r->lba < bio->lba + bio->count;
+}
+
+/* Лифт или очередь устройства могли бы переставить пересекающиеся запросы - такой bio ждёт, пока все завершатся */
+static bool blk_overlaps(const blk_dev_t *dev, const blk_bio_t *bio)
+{
+    for (const blk_request_t *r = dev->sorted; r; r = r->next)
+        if (blk_range_overlaps(r, bio))
+            return true;
+    for (const blk_request_t *r = dev->inflight; r; r = r->next)
+        if (blk_range_overlaps(r, bio))
+            return true;
+    return false;
+}
+
+static bool blk_try_merge(blk_dev_t *dev, blk_bio_t *bio)
+{
+    for (blk_request_t *r = dev->sorted; r; r = r->next)
+    {
+        if (r->write != bio->write || r->count + bio->count > dev->max_sectors)
+            continue;
+
+        if (r->lba + r->count == bio->lba)
+        {
+            r->tail->next = bio;
+            r->tail = bio;
+            r->count += bio->count;
+            dev->stats.back_merges++;
+            return true;
+        }
+
+        if (bio->lba + bio->count == r->lba)
+        {
+            bio->next = r->head;
+            r->head = bio;
+            r->lba = bio->lba;
+            r->count += bio->count;
+            dev->stats.front_merges++;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void blk_insert(blk_dev_t *dev, blk_bio_t *bio)
+{
+    blk_request_t *r = dev->free;
+    dev->free = r->next;
+
+    r->lba = bio->lba;
+    r->count = bio->count;
+    r->write = bio->write;
+    r->deadline_ns = timer_now_ns() + (bio->write ? BLK_WRITE_EXPIRE_NS : BLK_READ_EXPIRE_NS);
+    r->head = bio;
+    r->tail = bio;
+    r->merge = -1;
+    r->aborted = false;
+
+    blk_request_t **pp = &dev->sorted;
+    while (*pp && (*pp)->lba < r->lba)
+        pp = &(*pp)->next;
+    r->next = *pp;
+    *pp = r;
+
+    int dir = r->write;
+    r->fifo_next = NULL;
+    if (dev->fifo_tail[dir])
+        dev->fifo_tail[dir]->fifo_next = r;
+    else
+        dev->fifo[dir] = r;
+    dev->fifo_tail[dir] = r;
+
+    if (++dev->depth > dev->stats.max_depth)
+        dev->stats.max_depth = dev->depth;
+}
+
+static void blk_unlink(blk_dev_t *dev, blk_request_t *r)
+{
+    blk_request_t **pp = &dev->sorted;
+    while (*pp != r)
+        pp = &(*pp)->next;
+    *pp = r->next;
+
+    int dir = r->write;
+    blk_request_t *prev = NULL;
+    for (blk_request_t *f = dev->fifo[dir]; f != r; f = f->fifo_next)
+        prev = f;
+    if (prev)
+        prev->fifo_next = r->fifo_next;
+    else
+        dev->fifo[dir] = r->fifo_next;
+    if (dev->fifo_tail[dir] == r)
+        dev->fifo_tail[dir] = prev;
+}
+
+/* deadline: сначала просроченные (чтение важнее), иначе C-SCAN от позиции лифта */
+static blk_request_t *blk_pick(blk_dev_t *dev)
+{
+    if (!dev->sorted)
+        return NULL;
+
+    uint64_t now = timer_now_ns();
+    blk_request_t *r = NULL;
+    for (int dir = 0; dir < 2 && !r; ++dir)
+        if (dev->fifo[dir] && dev->fifo[dir]->deadline_ns <= now)
+            r = dev->fifo[dir];
+
+    if (r)
+    {
+        dev->stats.expired++;
+    }
+    else
+    {
+        for (r = dev->sorted; r && r->lba < dev->head_lba; r = r->next)
+            ;
+        if (!r)
+            r = dev->sorted;
+    }
+
+    blk_unlink(dev, r);
+    return r;
+}
+
+/* Конец запроса у драйвера: из потока выдачи или из прерывания, с выключенными прерываниями */
+static void blk_end_request(blk_request_t *r, int rc)
+{
+    blk_dev_t *dev = r->dev;
+    dev->progress_ns = timer_now_ns();
+
+    if (r->merge >= 0)
+    {
+        uint8_t *p = dev->merge_bufs[r->merge];
+        if (!r->write && rc == BLK_OK && !r->aborted)
+            for (blk_bio_t *bio = r->head; bio; bio = bio->next)
+            {
+                memcpy(bio->buf, p, (size_t)bio->count * dev->sector_size);
+                p += (size_t)bio->count * dev->sector_size;
+            }
+        dev->merge_free |= 1u << r->merge;
+        r->merge = -1;
+    }
+
+    /* bio уже завершил blk_abort - осталось вернуть запрос в пул */
+    if (!r->aborted)
+    {
+        blk_request_t **pp = &dev->inflight;
+        while (*pp != r)
+            pp = &(*pp)->next;
+        *pp = r->next;
+        dev->inflight_count--;
+
+        if (rc != BLK_OK)
+            dev->stats.errors++;
+        blk_complete(r, rc);
+    }
+
+    r->next = dev->free;
+    dev->free = r;
+    dev->events++;
+    wait_queue_wake_all(&dev->space);
+}
+
+static void blk_end_io(void *arg, int rc)
+{
+    uint64_t flags = save_irq_disable();
+    blk_end_request((blk_request_t *)arg, rc);
+    restore_irq(flags);
+}
+
+/* Буфер для драйвера: свой у единственного или смежных в памяти bio, иначе буфер слияния */
+static void *blk_map(blk_dev_t *dev, blk_request_t *r)
+{
+    uint8_t *expect = r->head->buf;
+    bool contiguous = true;
+    for (blk_bio_t *bio = r->head; bio; bio = bio->next)
+    {
+        if (bio->buf != expect)
+        {
+            contiguous = false;
+            break;
+        }
+        expect += (size_t)bio->count * dev->sector_size;
+    }
+    if (contiguous)
+        return r->head->buf;
+
+    uint64_t flags = save_irq_disable();
+    while (!dev->merge_free)
+        blk_sleep(dev, &flags);
+    r->merge = __builtin_ctz(dev->merge_free);
+    dev->merge_free &= ~(1u << r->merge);
+    restore_irq(flags);
+
+    uint8_t *buf = dev->merge_bufs[r->merge];
+    uint8_t *p = buf;
+    if (r->write)
+        for (blk_bio_t *bio = r->head; bio; bio = bio->next)
+        {
+            memcpy(p, bio->buf, (size_t)bio->count * dev->sector_size);
+            p += (size_t)bio->count * dev->sector_size;
+        }
+    return buf;
+}
+
+static void blk_dispatch(blk_dev_t *dev, blk_request_t *r)
+{
+    void *buf = blk_map(dev, r);
+
+    if (dev->ops->submit &&
+        dev->ops->submit(dev->drv, r->ctx, r->lba, r->count, buf, r->write, blk_end_io, r) == BLK_OK)
+    {
+        uint64_t flags = save_irq_disable();
+        dev->stats.async++;
+        restore_irq(flags);
+        return;
+    }
+
+    int rc = dev->ops->rw(dev->drv, r->lba, r->count, buf, r->write);
+    blk_end_io(r, rc);
+}
+
+/*
+ * Выдаёт запросы, застанные в очереди: поставленные во время выдачи ждали бы
+ * чужого потока без предела. Если выдаёт другой поток, он заберёт и наши запросы
+ */
+void blk_run_queue(blk_dev_t *dev)
+{
+    uint64_t flags = save_irq_disable();
+    if (dev->dispatching)
+    {
+        restore_irq(flags);
+        return;
+    }
+    dev->dispatching = true;
+
+    uint32_t budget = dev->depth;
+    blk_request_t *r;
+    while (budget-- && (r = blk_pick(dev)) != NULL)
+    {
+        uint32_t depth = dev->depth;
+        int b = 0;
+        while (depth > 1 && b < BLK_DEPTH_BUCKETS - 1)
+        {
+            depth >>= 1;
+            b++;
+        }
+        dev->stats.depth_hist[b]++;
+        dev->stats.depth_sum += dev->depth;
+        dev->stats.dispatched++;
+        dev->depth--;
+
+        dev->head_lba = r->lba + r->count;
+        if (!dev->inflight_count)
+            dev->progress_ns = timer_now_ns();
+        r->next = dev->inflight;
+        dev->inflight = r;
+        if (++dev->inflight_count > dev->stats.max_inflight)
+            dev->stats.max_inflight = dev->inflight_count;
+        restore_irq(flags);
+
+        blk_dispatch(dev, r);
+
+        flags = save_irq_disable();
+    }
+
+    dev->dispatching = false;
+    /* Остаток выдадут его владельцы */
+    if (dev->depth)
+    {
+        dev->events++;
+        wait_queue_wake_all(&dev->space);
+    }
+    restore_irq(flags);
+}
+
+uint64_t blk_wait_event(blk_dev_t *dev, uint64_t seen)
+{
+    uint64_t flags = save_irq_disable();
+    while (dev->events == seen && (dev->depth || dev->inflight_count))
+    {
+        if (dev->depth && !dev->dispatching)
+        {
+            restore_irq(flags);
+            blk_run_queue(dev);
+            flags = save_irq_disable();
+        }
+        else
+        {
+            blk_sleep(dev, &flags);
+        }
+    }
+    seen = dev->events;
+    restore_irq(flags);
+    return seen;
+}
+
+/* Ждёт, пока не завершатся все запросы, выдавая очередь самому, если больше некому */
+static void blk_drain(blk_dev_t *dev)
+{
+    uint64_t flags = save_irq_disable();
+    while (dev->depth || dev->inflight_count)
+    {
+        if (dev->depth && !dev->dispatching)
+        {
+            restore_irq(flags);
+            blk_run_queue(dev);
+            flags = save_irq_disable();
+        }
+        else
+        {
+            blk_sleep(dev, &flags);
+        }
+    }
+    restore_irq(flags);
+}
+
+int blk_submit(blk_dev_t *dev, blk_bio_t *bio)
+{
+    if (!dev || !bio || !bio->buf || bio->count == 0)
+        return BLK_ERR_INVALID;
+    if (bio->lba > dev->total_sectors || bio->count > dev->total_sectors - bio->lba)
+        return BLK_ERR_INVALID;
+
+    bio->rc = BLK_OK;
+    bio->done = false;
+    bio->next = NULL;
+
+    uint64_t flags = save_irq_disable();
+    dev->stats.bios++;
+    for (;;)
+    {
+        if (blk_overlaps(dev, bio))
+        {
+            restore_irq(flags);
+            blk_drain(dev);
+            flags = save_irq_disable();
+            continue;
+        }
+
+        if (blk_try_merge(dev, bio))
+            break;
+
+        if (dev->free)
+        {
+            blk_insert(dev, bio);
+            break;
+        }
+
+        /* Очередь полна даже под пробкой: выдаём её сами или ждём выдающего */
+        if (dev->depth && !dev->dispatching)
+        {
+            restore_irq(flags);
+            blk_run_queue(dev);
+            flags = save_irq_disable();
+        }
+        else
+        {
+            blk_sleep(dev, &flags);
+        }
+    }
+
+    bool run = dev->plugged == 0;
+    restore_irq(flags);
+
+    if (run)
+        blk_run_queue(dev);
+    return BLK_OK;
+}
+
+int blk_wait(blk_dev_t *dev, blk_bio_t *bio)
+{
+    /* Ожидание снимает пробку для своего bio: иначе ждали бы чужого blk_unplug.
+       Выдающий поток мог уйти, оставив его в очереди, - тогда выдаём сами */
+    uint64_t flags = save_irq_disable();
+    while (!bio->done)
+    {
+        if (dev->depth && !dev->dispatching)
+        {
+            restore_irq(flags);
+            blk_run_queue(dev);
+            flags = save_irq_disable();
+        }
+        else
+        {
+            blk_sleep(dev, &flags);
+        }
+    }
+    restore_irq(flags);
+    return bio->rc;
+}
+
+void blk_plug(blk_dev_t *dev)
+{
+    uint64_t flags = save_irq_disable();
+    dev->plugged++;
+    restore_irq(flags);
+}
+
+void blk_unplug(blk_dev_t *dev)
+{
+    uint64_t flags = save_irq_disable();
+    bool run = dev->plugged && --dev->plugged == 0;
+    restore_irq(flags);
+
+    if (run)
+        blk_run_queue(dev);
+}
+
+static int blk_rw(blk_dev_t *dev, uint64_t lba, uint32_t count, void *buf, bool write)
+{
+    blk_bio_t bio = { .lba = lba, .count = count, .write = write, .buf = buf };
+    int rc = blk_submit(dev, &bio);
+    if (rc != BLK_OK)
+        return rc;
+    return blk_wait(dev, &bio);
+}
+
+int blk_read(blk_dev_t *dev, uint64_t lba, uint32_t count, void *buf)
+{
+    return blk_rw(dev, lba, count, buf, false);
+}
+
+int blk_write(blk_dev_t *dev, uint64_t lba, uint32_t count, const void *buf)
+{
+    /* Драйвер только читает буфер, const снимаем ради общего пути */
+    return blk_rw(dev, lba, count, (void *)buf, true);
+}
+
+int blk_flush(blk_dev_t *dev)
+{
+    if (!dev)
+        return BLK_ERR_INVALID;
+
+    blk_drain(dev);
+    return dev->ops->flush ? dev->ops->flush(dev->drv) : BLK_OK;
+}
+
+int blk_get_stats(blk_dev_t *dev, blk_stats_t *out, bool reset)
+{
+    if (!dev || !out)
+        return BLK_ERR_INVALID;
+
+    uint64_t flags = save_irq_disable();
+    *out = dev->stats;
+    if (reset)
+        memset(&dev->stats, 0, sizeof(dev->stats));
+    restore_irq(flags);
+    return BLK_OK;
+}
@@ -0,0 +1,193 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../multitask/completion.h"
+#include "../multitask/waitqueue.h"
+
+/*
+ * Блочный слой между ext4 и драйверами дисков. Запросы (bio) встают в
+ * очередь устройства, соседние по LBA сливаются в один запрос драйверу,
+ * порядок выдачи выбирает планировщик deadline: лифт по LBA, пока ни один
+ * запрос не просрочен. Выдаёт запросы поток, который первым застал
+ * очередь свободной, остальные только ставят свои и спят до завершения.
+ * За один заход он выдаёт не больше запросов, чем застал в очереди:
+ * поставленные позже забирают их владельцы, проснувшись от его ухода.
+ * Драйвер с асинхронной отправкой получает запросы без ожидания друг
+ * друга, завершение приходит из его прерывания
+ */
+
+#define BLK_MAX_DEVICES 16
+#define BLK_NAME_MAX 16
+
+/* Запросов в очереди устройства; bio без свободного запроса ждёт */
+#define BLK_QUEUE_DEPTH 32
+/* Предел слияния: больше за одну команду драйверу не собираем */
+#define BLK_MAX_MERGE_BYTES (128 * 1024)
+#define BLK_MAX_SECTOR_SIZE 4096
+/* Буферов слияния на диск: столько собранных запросов может быть в полёте */
+#define BLK_MERGE_BUFS 4
+
+/* Потерянное прерывание не должно подвесить ждущего: по таймауту опрашиваем драйвер */
+#define BLK_POLL_TIMEOUT_NS 5000000000ULL /* 5 с */
+/* Устройство, не завершившее за это время ни одного запроса, считается зависшим:
+   запросы в полёте из буфера слияния завершаются с BLK_ERR_TIMEOUT. Запрос с
+   буфером самого bio ждёт, пока его отпустит драйвер по своему таймауту */
+#define BLK_IO_TIMEOUT_NS 30000000000ULL /* 30 с */
+
+/* Сроки deadline: чтение ждёт поток, запись - только кэш */
+#define BLK_READ_EXPIRE_NS 500000000ULL   /* 500 мс */
+#define BLK_WRITE_EXPIRE_NS 5000000000ULL /* 5 с */
+
+/* Гистограмма глубины очереди при выдаче: корзина i - от 2^i до 2^(i+1) - 1 запросов */
+#define BLK_DEPTH_BUCKETS 6
+
+/* Коды возврата совпадают с кодами драйверов (IDE_*, VIRTIO_*, AHCI_*, NVME_*) */
+#define BLK_OK 0
+#define BLK_ERR_TIMEOUT -1
+#define BLK_ERR_DEVICE -2
+#define BLK_ERR_INVALID -3
+#define BLK_ERR_NOMEM -4
+
+/* Завершение асинхронной команды драйвера */
+typedef void (*blk_done_t)(void *arg, int rc);
+
+/* Операции драйвера, буфер непрерывен в виртуальной памяти */
+typedef struct blk_ops
+{
+    int (*rw)(void *drv, uint64_t lba, uint32_t count, void *buf, bool write);
+    int (*flush)(void *drv); /* NULL, если у диска нет кэша записи */
+
+    /*
+     * Асинхронная отправка, необязательна. BLK_OK - done будет вызван ровно
+     * один раз: из прерывания или ещё до возврата. Ошибка - done не будет,
+     * запрос выполнится через rw. ctx - ctx_size байт памяти драйвера
+     */
+    int (*submit)(void *drv, void *ctx, uint64_t lba, uint32_t count, void *buf, bool write,
+                  blk_done_t done, void *arg);
+    void (*poll)(void *drv); /* разбирает завершения без прерывания */
+    size_t ctx_size;
+} blk_ops_t;
+
+typedef struct blk_dev blk_dev_t;
+typedef struct blk_bio blk_bio_t;
+
+/* Запрос вызывающего: диапазон секторов и его буфер */
+struct blk_bio
+{
+    uint64_t lba;
+    uint32_t count;
+    bool write;
+    void *buf;
+    int rc;
+    volatile bool done;
+    blk_bio_t *next; /* соседний bio того же запроса, по возрастанию LBA */
+
+    /* NULL - завершения ждут в blk_wait. Иначе зовётся вместо него
+       с выключенными прерываниями, возможно из обработчика */
+    void (*end_io)(blk_bio_t *bio);
+    void *private;
+};
+
+typedef struct blk_request blk_request_t;
+
+/* Непрерывный диапазон из одного или нескольких bio - одна команда драйверу */
+struct blk_request
+{
+    blk_dev_t *dev;
+    uint64_t lba;
+    uint32_t count;
+    bool write;
+    uint64_t deadline_ns;
+    blk_bio_t *head;
+    blk_bio_t *tail;
+    blk_request_t *next;      /* в списке по LBA, в полёте или в списке свободных */
+    blk_request_t *fifo_next; /* в порядке поступления */
+    int merge;                /* занятый буфер слияния или -1 */
+    void *ctx;                /* память драйвера для асинхронной команды */
+    bool aborted;             /* bio завершены по таймауту, драйвер ещё держит запрос и буфер слияния */
+};
+
+typedef struct blk_stats
+{
+    uint64_t bios;
+    uint64_t dispatched;     /* запросов, отданных драйверу */
+    uint64_t async;          /* из них отправлено без ожидания */
+    uint64_t back_merges;    /* bio дописан в конец запроса */
+    uint64_t front_merges;   /* bio встал перед запросом */
+    uint64_t expired;        /* выдано по сроку, а не по лифту */
+    uint64_t errors;
+    uint64_t depth_sum;      /* средняя глубина при выдаче: depth_sum / dispatched */
+    uint32_t max_depth;
+    uint32_t max_inflight;   /* запросов у драйвера одновременно */
+    uint64_t depth_hist[BLK_DEPTH_BUCKETS];
+} blk_stats_t;
+
+struct blk_dev
+{
+    char name[BLK_NAME_MAX];
+    const blk_ops_t *ops;
+    void *drv;
+    uint32_t sector_size;
+    uint64_t total_sectors;
+    uint32_t max_sectors;       /* предел слияния в секторах */
+
+    blk_request_t pool[BLK_QUEUE_DEPTH];
+    blk_request_t *free;
+    blk_request_t *sorted;      /* ждущие запросы по возрастанию LBA */
+    blk_request_t *fifo[2];     /* [0] - чтение, [1] - запись */
+    blk_request_t *fifo_tail[2];
+    uint32_t depth;             /* ждут выдачи */
+    blk_request_t *inflight;    /* отданы драйверу */
+    uint32_t inflight_count;
+    uint64_t head_lba;          /* позиция лифта: конец последнего выданного запроса */
+    uint32_t plugged;
+    bool dispatching;
+    uint8_t *merge_bufs[BLK_MERGE_BUFS]; /* собирают запрос из несмежных в памяти bio */
+    uint32_t merge_free;
+    wait_queue_t space;         /* ждут свободный запрос, буфер слияния или завершение */
+    uint64_t events;            /* завершений и уходов выдающего потока с непустой очередью */
+    uint64_t progress_ns;       /* последнее завершение или выдача в простаивающее устройство */
+
+    blk_stats_t stats;
+};
+
+/* Регистрирует диск; NULL, если места нет или не хватило памяти */
+blk_dev_t *blk_register(const char *name, const blk_ops_t *ops, void *drv,
+                        uint32_t sector_size, uint64_t total_sectors);
+
+blk_dev_t *blk_find(const char *name);
+int blk_count(void);
+blk_dev_t *blk_get(int index);
+
+/* Ставит bio в очередь. Без пробки очередь сразу выдаётся драйверу */
+int blk_submit(blk_dev_t *dev, blk_bio_t *bio);
+
+/* Ждёт завершения bio, при необходимости выдавая очередь самому. Не для bio с end_io */
+int blk_wait(blk_dev_t *dev, blk_bio_t *bio);
+
+/* Выдаёт ждущие запросы драйверу, не дожидаясь снятия пробки; если выдаёт
+   другой поток, сразу возвращается */
+void blk_run_queue(blk_dev_t *dev);
+
+/* Ожидание bio с end_io: спит, пока счётчик событий равен seen, выдавая очередь,
+   если её некому выдать. Возвращает новый счётчик */
+uint64_t blk_wait_event(blk_dev_t *dev, uint64_t seen);
+
+/* Разбирает завершения драйвера, если прерывание потерялось */
+void blk_poll(blk_dev_t *dev);
+
+/* Пробка: bio копятся и сливаются, выдача - при снятии последней */
+void blk_plug(blk_dev_t *dev);
+void blk_unplug(blk_dev_t *dev);
+
+int blk_read(blk_dev_t *dev, uint64_t lba, uint32_t count, void *buf);
+int blk_write(blk_dev_t *dev, uint64_t lba, uint32_t count, const void *buf);
+
+/* Дожидается всех запросов, в том числе асинхронных, и сбрасывает кэш записи диска */
+int blk_flush(blk_dev_t *dev);
+
+int blk_get_stats(blk_dev_t *dev, blk_stats_t *out, bool reset);
+
+#endif // BLOCK_H
@@ -0,0 +1,141 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* MSR */
+#define MSR_IA32_APIC_BASE      0x1B
+#define MSR_IA32_TSC_DEADLINE   0x6E0
+#define MSR_EFER                0xC0000080
+#define MSR_STAR                0xC0000081
+#define MSR_LSTAR               0xC0000082
+#define MSR_SFMASK              0xC0000084
+#define MSR_FS_BASE             0xC0000100
+#define MSR_KERNEL_GS_BASE      0xC0000102
+
+#define EFER_SCE        (1UL << 0)
+
+/* RFLAGS */
+#define RFLAGS_TF       (1UL << 8)
+#define RFLAGS_IF       (1UL << 9)
+#define RFLAGS_DF       (1UL << 10)
+#define RFLAGS_AC       (1UL << 18)
+
+static inline bool irqs_enabled(void)
+{
+    uint64_t rflags;
+    asm volatile("pushfq; pop %0" : "=r"(rflags));
+    return rflags & RFLAGS_IF;
+}
+
+/* CR0 / CR4 */
+#define CR0_MP          (1UL << 1)
+#define CR0_EM          (1UL << 2)
+#define CR0_TS          (1UL << 3)
+#define CR4_OSFXSR      (1UL << 9)
+#define CR4_OSXMMEXCPT  (1UL << 10)
+#define CR4_OSXSAVE     (1UL << 18)
+
+/* CPUID.1:ECX */
+#define CPUID_1_ECX_XSAVE        (1u << 26)
+#define CPUID_1_ECX_AVX          (1u << 28)
+#define CPUID_1_ECX_TSC_DEADLINE (1u << 24)
+
+/* CPUID.(EAX=0Dh,ECX=1):EAX */
+#define CPUID_D_1_EAX_XSAVEOPT   (1u << 0)
+
+/* CPUID.80000007h:EDX */
+#define CPUID_80000007_EDX_INVARIANT_TSC (1u << 8)
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf,
+                         uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+    uint32_t a, b, c, d;
+    asm volatile("cpuid"
+                 : "=a"(a), "=b"(b), "=c"(c), "=d"(d)
+                 : "a"(leaf), "c"(subleaf));
+    if (eax) *eax = a;
+    if (ebx) *ebx = b;
+    if (ecx) *ecx = c;
+    if (edx) *edx = d;
+}
+
+static inline uint32_t cpuid_max_leaf(uint32_t base)
+{
+    uint32_t max;
+    cpuid(base, 0, &max, NULL, NULL, NULL);
+    return max;
+}
+
+static inline uint64_t rdmsr(uint32_t msr)
+{
+    uint32_t lo, hi;
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value)
+{
+    asm volatile("wrmsr"
+                 :
+                 : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32))
+                 : "memory");
+}
+
+static inline uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t read_cr0(void)
+{
+    uint64_t v;
+    asm volatile("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr0(uint64_t v)
+{
+    asm volatile("mov %0, %%cr0" :: "r"(v) : "memory");
+}
+
+static inline uint64_t read_cr4(void)
+{
+    uint64_t v;
+    asm volatile("mov %%cr4, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr4(uint64_t v)
+{
+    asm volatile("mov %0, %%cr4" :: "r"(v) : "memory");
+}
+
+static inline void xsetbv(uint32_t reg, uint64_t value)
+{
+    asm volatile("xsetbv"
+                 :
+                 : "c"(reg), "a"((uint32_t)value), "d"((uint32_t)(value >> 32))
+                 : "memory");
+}
+
+static inline void clts(void)
+{
+    asm volatile("clts" ::: "memory");
+}
+
+static inline void stts(void)
+{
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static inline void cpu_pause(void)
+{
+    asm volatile("pause" ::: "memory");
+}
+
+#endif /* CPU_H */
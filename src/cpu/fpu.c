@@ -0,0 +1,203 @@
+#include "fpu.h"
+#include "cpu.h"
+#include "../multitask/multitask.h"
+#include "../malloc/malloc.h"
+#include "../libc/string.h"
+#include "../spinlock/spinlock.h"
+
+#define XCR0_X87        (1ULL << 0)
+#define XCR0_SSE        (1ULL << 1)
+#define XCR0_AVX        (1ULL << 2)
+#define XCR0_AVX512     (7ULL << 5)
+
+#define FXSAVE_AREA_SIZE 512
+#define XSAVE_ALIGN      64
+
+#define MXCSR_DEFAULT    0x1F80
+#define FCW_DEFAULT      0x037F
+
+static fpu_save_mode_t fpu_mode = FPU_SAVE_FXSAVE;
+static uint32_t fpu_state_size = FXSAVE_AREA_SIZE;
+static uint64_t fpu_xcr0 = 0;
+
+/* Поток, чьё состояние сейчас лежит в регистрах */
+static thread_t *fpu_owner = NULL;
+static fpu_stats_t fpu_stats = { 0 };
+
+void fpu_init(void)
+{
+    uint64_t cr0 = read_cr0();
+    cr0 &= ~CR0_EM;
+    cr0 |= CR0_MP;
+    cr0 &= ~CR0_TS;
+    write_cr0(cr0);
+
+    uint64_t cr4 = read_cr4();
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+
+    uint32_t ecx;
+    cpuid(1, 0, NULL, NULL, &ecx, NULL);
+
+    if ((ecx & CPUID_1_ECX_XSAVE) && cpuid_max_leaf(0) >= 0xD)
+    {
+        write_cr4(cr4 | CR4_OSXSAVE);
+
+        uint32_t supported_lo, supported_hi;
+        cpuid(0xD, 0, &supported_lo, NULL, NULL, &supported_hi);
+        uint64_t supported = ((uint64_t)supported_hi << 32) | supported_lo;
+
+        fpu_xcr0 = XCR0_X87 | XCR0_SSE;
+        if (ecx & CPUID_1_ECX_AVX)
+            fpu_xcr0 |= supported & XCR0_AVX;
+        if ((supported & XCR0_AVX512) == XCR0_AVX512)
+            fpu_xcr0 |= XCR0_AVX512;
+
+        xsetbv(0, fpu_xcr0);
+
+        /* EBX отражает размер области для текущего XCR0 */
+        uint32_t size;
+        cpuid(0xD, 0, NULL, &size, NULL, NULL);
+        fpu_state_size = size;
+
+        uint32_t eax_d1;
+        cpuid(0xD, 1, &eax_d1, NULL, NULL, NULL);
+        fpu_mode = (eax_d1 & CPUID_D_1_EAX_XSAVEOPT) ? FPU_SAVE_XSAVEOPT : FPU_SAVE_XSAVE;
+    }
+    else
+    {
+        write_cr4(cr4);
+        fpu_mode = FPU_SAVE_FXSAVE;
+        fpu_state_size = FXSAVE_AREA_SIZE;
+    }
+
+    asm volatile("fninit");
+
+    /* Первое обращение к FPU любого потока вызовет #NM */
+    stts();
+}
+
+fpu_save_mode_t fpu_get_save_mode(void)
+{
+    return fpu_mode;
+}
+
+uint32_t fpu_get_state_size(void)
+{
+    return fpu_state_size;
+}
+
+void fpu_get_stats(fpu_stats_t *out)
+{
+    if (out)
+        *out = fpu_stats;
+}
+
+static void fpu_save(void *area)
+{
+    uint32_t lo = (uint32_t)fpu_xcr0;
+    uint32_t hi = (uint32_t)(fpu_xcr0 >> 32);
+
+    switch (fpu_mode)
+    {
+        case FPU_SAVE_XSAVEOPT:
+            asm volatile("xsaveopt64 (%0)" :: "r"(area), "a"(lo), "d"(hi) : "memory");
+            break;
+        case FPU_SAVE_XSAVE:
+            asm volatile("xsave64 (%0)" :: "r"(area), "a"(lo), "d"(hi) : "memory");
+            break;
+        default:
+            asm volatile("fxsave64 (%0)" :: "r"(area) : "memory");
+            break;
+    }
+    fpu_stats.saves++;
+}
+
+static void fpu_restore(void *area)
+{
+    uint32_t lo = (uint32_t)fpu_xcr0;
+    uint32_t hi = (uint32_t)(fpu_xcr0 >> 32);
+
+    if (fpu_mode == FPU_SAVE_FXSAVE)
+        asm volatile("fxrstor64 (%0)" :: "r"(area) : "memory");
+    else
+        asm volatile("xrstor64 (%0)" :: "r"(area), "a"(lo), "d"(hi) : "memory");
+    fpu_stats.restores++;
+}
+
+static void *fpu_alloc_state(thread_t *thr)
+{
+    void *raw = malloc(fpu_state_size + XSAVE_ALIGN);
+    if (!raw)
+        return NULL;
+
+    uint8_t *area = (uint8_t *)ALIGN_UP((uintptr_t)raw, XSAVE_ALIGN);
+    memset(area, 0, fpu_state_size);
+
+    /* Чистое состояние: XSTATE_BV = 0 даёт init-значения при XRSTOR,
+       но MXCSR читается из памяти всегда */
+    *(uint16_t *)(area + 0) = FCW_DEFAULT;
+    *(uint32_t *)(area + 24) = MXCSR_DEFAULT;
+
+    thr->fpu_state_raw = raw;
+    thr->fpu_state = area;
+    return area;
+}
+
+void fpu_nm_handler(void)
+{
+    thread_t *cur = get_current_thread();
+
+    clts();
+    fpu_stats.nm_traps++;
+
+    if (!cur || fpu_owner == cur)
+        return;
+
+    if (fpu_owner && fpu_owner->fpu_state)
+        fpu_save(fpu_owner->fpu_state);
+
+    if (!cur->fpu_state && !fpu_alloc_state(cur))
+    {
+        /* Без памяти под состояние работаем с чистым FPU и не запоминаем владельца */
+        asm volatile("fninit");
+        fpu_owner = NULL;
+        return;
+    }
+
+    fpu_restore(cur->fpu_state);
+    fpu_owner = cur;
+}
+
+void fpu_switch_to(thread_t *next)
+{
+    /* Регистры уже принадлежат next - ловушка не нужна */
+    if (next == fpu_owner)
+        clts();
+    else
+        stts();
+}
+
+void fpu_thread_exit(thread_t *thr)
+{
+    if (fpu_owner == thr)
+        fpu_owner = NULL;
+}
+
+uint64_t kernel_fpu_begin(void)
+{
+    uint64_t flags = save_irq_disable();
+    clts();
+
+    if (fpu_owner && fpu_owner->fpu_state)
+        fpu_save(fpu_owner->fpu_state);
+    fpu_owner = NULL;
+
+    return flags;
+}
+
+void kernel_fpu_end(uint64_t flags)
+{
+    /* Следующий пользователь FPU восстановит своё состояние через #NM */
+    stts();
+    restore_irq(flags);
+}
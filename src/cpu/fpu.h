@@ -0,0 +1,38 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct thread thread_t;
+
+typedef enum {
+    FPU_SAVE_FXSAVE,
+    FPU_SAVE_XSAVE,
+    FPU_SAVE_XSAVEOPT
+} fpu_save_mode_t;
+
+typedef struct {
+    uint64_t nm_traps;   /* сколько раз сработал #NM */
+    uint64_t saves;      /* сколько раз реально сохраняли состояние */
+    uint64_t restores;
+} fpu_stats_t;
+
+void fpu_init(void);
+fpu_save_mode_t fpu_get_save_mode(void);
+uint32_t fpu_get_state_size(void);
+void fpu_get_stats(fpu_stats_t *out);
+
+/* Вызываются планировщиком */
+void fpu_switch_to(thread_t *next);
+void fpu_thread_exit(thread_t *thr);
+
+/* Обработчик #NM (Device Not Available) */
+void fpu_nm_handler(void);
+
+/* Использование SSE внутри ядра (ядро собрано с -mgeneral-regs-only) */
+uint64_t kernel_fpu_begin(void);
+void kernel_fpu_end(uint64_t flags);
+
+#endif
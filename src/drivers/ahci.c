@@ -0,0 +1,931 @@
+#include "ahci.h"
+#include "../mm/pmm.h"
+#include "../mm/vmm.h"
+#include "../multitask/completion.h"
+#include "../multitask/multitask.h"
+#include "../time/timer.h"
+#include "../time/lapic/lapic.h"
+#include "../cpu/cpu.h"
+#include "../irq.h"
+#include "../libc/string.h"
+#include "../graphics/formatting.h"
+
+#define AHCI_IRQ_TIMEOUT_NS 5000000000ULL /* 5 с */
+#define AHCI_POLL_LOOPS 50000000U
+#define AHCI_PORT_TIMEOUT_MS 500
+#define AHCI_STOP_SPIN_LOOPS 1000 /* ~1 мс: чтение регистра порта порядка микросекунды */
+#define AHCI_BOUNCE_PAGES (AHCI_MAX_SECTORS * AHCI_SECTOR_SIZE / PAGE_SIZE)
+#define AHCI_DMA_PHYS_LIMIT 0x100000000ULL
+#define AHCI_PRD_MAX_BYTES (4u * 1024 * 1024)
+#define AHCI_PXIE_MASK (AHCI_PXIS_DHRS | AHCI_PXIS_PSS | AHCI_PXIS_DSS | AHCI_PXIS_SDBS | AHCI_PXIS_ERRORS)
+
+/*
+ * Запрос вызывающего: части уходят в очередь NCQ без ожидания друг друга,
+ * последняя завершённая будит поток. Живёт на стеке вызывающего
+ */
+typedef struct
+{
+    volatile uint32_t pending;
+    int rc;
+    completion_t done;
+} ahci_batch_t;
+
+typedef struct
+{
+    uint64_t phys;
+    uint32_t len;
+} ahci_seg_t;
+
+/* Поддерживается один контроллер: первый найденный на шине */
+static struct
+{
+    pci_device_t *pci;
+    volatile uint8_t *abar;
+    uint32_t cap;
+    bool ready;
+    bool irq_ready;
+    bool msi;
+    ahci_disk_t *disks[AHCI_MAX_PORTS];
+} hba;
+
+static inline uint32_t hba_read(uint32_t off)
+{
+    return *(volatile uint32_t *)(hba.abar + off);
+}
+
+static inline void hba_write(uint32_t off, uint32_t v)
+{
+    *(volatile uint32_t *)(hba.abar + off) = v;
+}
+
+static inline uint32_t port_read(const ahci_disk_t *d, uint32_t off)
+{
+    return *(volatile uint32_t *)(d->regs + off);
+}
+
+static inline void port_write(const ahci_disk_t *d, uint32_t off, uint32_t v)
+{
+    *(volatile uint32_t *)(d->regs + off) = v;
+}
+
+static inline uint32_t ahci_slot_mask(uint32_t n)
+{
+    return n >= 32 ? 0xFFFFFFFFu : (1u << n) - 1;
+}
+
+/* В потоке с включёнными прерываниями спит, иначе (загрузка, опрос) крутится на PIT */
+static void ahci_delay_ms(uint32_t ms)
+{
+    if (irqs_enabled() && get_current_thread())
+        thread_sleep_ms(ms);
+    else
+        pit_wait_ms(ms);
+}
+
+static bool ahci_wait_clear(const ahci_disk_t *d, uint32_t off, uint32_t bits)
+{
+    for (int ms = 0; ms < AHCI_PORT_TIMEOUT_MS; ++ms)
+    {
+        if (!(port_read(d, off) & bits))
+            return true;
+        ahci_delay_ms(1);
+    }
+    return !(port_read(d, off) & bits);
+}
+
+/* Останов движка порта; сброс ST очищает CI и SACT */
+static int ahci_port_stop(ahci_disk_t *d)
+{
+    port_write(d, AHCI_PX_CMD, port_read(d, AHCI_PX_CMD) & ~AHCI_PXCMD_ST);
+    if (!ahci_wait_clear(d, AHCI_PX_CMD, AHCI_PXCMD_CR))
+        return AHCI_ERR_TIMEOUT;
+
+    port_write(d, AHCI_PX_CMD, port_read(d, AHCI_PX_CMD) & ~AHCI_PXCMD_FRE);
+    if (!ahci_wait_clear(d, AHCI_PX_CMD, AHCI_PXCMD_FR))
+        return AHCI_ERR_TIMEOUT;
+    return AHCI_OK;
+}
+
+static int ahci_port_start(ahci_disk_t *d)
+{
+    if (!ahci_wait_clear(d, AHCI_PX_TFD, AHCI_TFD_BSY | AHCI_TFD_DRQ))
+        return AHCI_ERR_TIMEOUT;
+
+    /* Приём FIS включается раньше движка команд */
+    port_write(d, AHCI_PX_CMD, port_read(d, AHCI_PX_CMD) | AHCI_PXCMD_FRE);
+    port_write(d, AHCI_PX_CMD, port_read(d, AHCI_PX_CMD) | AHCI_PXCMD_ST);
+    return AHCI_OK;
+}
+
+/* COMRESET: устройство не сняло BSY/DRQ после останова порта */
+static void ahci_comreset(ahci_disk_t *d)
+{
+    uint32_t sctl = port_read(d, AHCI_PX_SCTL) & ~0xFu;
+    port_write(d, AHCI_PX_SCTL, sctl | 1);
+    ahci_delay_ms(2);
+    port_write(d, AHCI_PX_SCTL, sctl);
+
+    for (int ms = 0; ms < AHCI_PORT_TIMEOUT_MS; ++ms)
+    {
+        if ((port_read(d, AHCI_PX_SSTS) & 0xF) == AHCI_SSTS_DET_PRESENT)
+            break;
+        ahci_delay_ms(1);
+    }
+    port_write(d, AHCI_PX_SERR, 0xFFFFFFFFu);
+}
+
+/* Возвращает вызывающим команды в полёте с ошибкой. Прерывания выключены, движок стоит */
+static void ahci_complete_failed(ahci_disk_t *d)
+{
+    for (uint32_t pending = d->outstanding; pending; pending &= pending - 1)
+    {
+        int tag = __builtin_ctz(pending);
+        ahci_batch_t *b = d->batches[tag];
+        if (b)
+        {
+            b->rc = AHCI_ERR_DEVICE;
+            if (--b->pending == 0)
+                complete(&b->done);
+        }
+        d->batches[tag] = NULL;
+    }
+}
+
+/*
+ * Перезапуск порта из потока: ожидания останова и COMRESET спят, а не крутятся
+ * с выключенными прерываниями. Вызывается под reset_lock
+ */
+static void ahci_port_recover(ahci_disk_t *d)
+{
+    int rc = ahci_port_stop(d);
+
+    /* Движок стоит - DMA в буферы оставшихся команд больше не пишет */
+    uint64_t flags = save_irq_disable();
+    ahci_complete_failed(d);
+    restore_irq(flags);
+
+    port_write(d, AHCI_PX_SERR, 0xFFFFFFFFu);
+    port_write(d, AHCI_PX_IS, 0xFFFFFFFFu);
+
+    if (rc != AHCI_OK || (port_read(d, AHCI_PX_TFD) & (AHCI_TFD_BSY | AHCI_TFD_DRQ)))
+        ahci_comreset(d);
+    rc = ahci_port_start(d);
+
+    flags = save_irq_disable();
+    d->outstanding = 0;
+    d->ncq_tags = 0;
+    d->free_slots = ahci_slot_mask(d->depth);
+    d->needs_reset = false;
+    if (rc != AHCI_OK)
+    {
+        kprint(KPRINT_ERROR, "AHCI: port %u does not recover, disabled\n", (uint32_t)d->port);
+        d->broken = true;
+    }
+    wait_queue_wake_all(&d->space);
+    restore_irq(flags);
+}
+
+/* Вызывается с включёнными прерываниями; порт перезапускает первый пришедший поток */
+static void ahci_recover(ahci_disk_t *d)
+{
+    mutex_lock(&d->reset_lock);
+    if (d->needs_reset)
+        ahci_port_recover(d);
+    mutex_unlock(&d->reset_lock);
+}
+
+/*
+ * Проваливает все команды в полёте; слоты освобождает перезапуск порта.
+ * Буферы возвращаются вызывающим только после останова движка: если он не встал
+ * сразу, команды завершит ahci_port_recover. Прерывания выключены
+ */
+static void ahci_fail_all(ahci_disk_t *d)
+{
+    d->needs_reset = true;
+    port_write(d, AHCI_PX_CMD, port_read(d, AHCI_PX_CMD) & ~AHCI_PXCMD_ST);
+
+    for (int i = 0; i < AHCI_STOP_SPIN_LOOPS && (port_read(d, AHCI_PX_CMD) & AHCI_PXCMD_CR); ++i)
+        asm volatile("pause");
+
+    if (!(port_read(d, AHCI_PX_CMD) & AHCI_PXCMD_CR))
+        ahci_complete_failed(d);
+}
+
+/* Команда завершена, когда её бит снят и в CI, и в SACT. Прерывания выключены */
+static void ahci_reap(ahci_disk_t *d, uint32_t pis)
+{
+    if (d->needs_reset)
+        return;
+
+    if (pis & AHCI_PXIS_ERRORS)
+    {
+        kprint(KPRINT_ERROR, "AHCI: port %u error, IS %x TFD %x SERR %x\n", (uint32_t)d->port,
+               pis, port_read(d, AHCI_PX_TFD), port_read(d, AHCI_PX_SERR));
+        ahci_fail_all(d);
+        return;
+    }
+
+    uint32_t active = port_read(d, AHCI_PX_SACT) | port_read(d, AHCI_PX_CI);
+    uint32_t done = d->outstanding & ~active;
+    if (!done)
+        return;
+
+    for (uint32_t left = done; left; left &= left - 1)
+    {
+        int tag = __builtin_ctz(left);
+        ahci_batch_t *b = d->batches[tag];
+        if (b && --b->pending == 0)
+            complete(&b->done);
+        d->batches[tag] = NULL;
+    }
+
+    d->outstanding &= ~done;
+    d->ncq_tags &= ~done;
+    d->free_slots |= done & ahci_slot_mask(d->depth);
+    wait_queue_wake_all(&d->space);
+}
+
+static void ahci_poll(ahci_disk_t *d)
+{
+    uint32_t pis = port_read(d, AHCI_PX_IS);
+    if (pis)
+    {
+        port_write(d, AHCI_PX_IS, pis);
+        hba_write(AHCI_HBA_IS, 1u << d->port);
+    }
+    ahci_reap(d, pis);
+}
+
+/* Общий обработчик контроллера: MSI или линия INTx, возможно разделяемая */
+static bool ahci_irq(void *arg)
+{
+    (void)arg;
+    uint32_t is = hba_read(AHCI_HBA_IS);
+    if (!is)
+        return false;
+
+    for (uint32_t left = is; left; left &= left - 1)
+    {
+        int port = __builtin_ctz(left);
+        ahci_disk_t *d = hba.disks[port];
+        volatile uint8_t *regs = hba.abar + AHCI_PORT_BASE + port * AHCI_PORT_SIZE;
+
+        uint32_t pis = *(volatile uint32_t *)(regs + AHCI_PX_IS);
+        *(volatile uint32_t *)(regs + AHCI_PX_IS) = pis;
+        if (d)
+            ahci_reap(d, pis);
+    }
+
+    /* IS контроллера сбрасывается после IS портов */
+    hba_write(AHCI_HBA_IS, is);
+    return true;
+}
+
+static pci_device_t *ahci_find_controller(void)
+{
+    int n = pci_get_device_count();
+    for (int i = 0; i < n; ++i)
+    {
+        pci_device_t *dev = pci_get_device(i);
+        if (!pci_is_storage_device(dev) || dev->subclass != AHCI_PCI_SUBCLASS ||
+            dev->prog_if != AHCI_PCI_PROG_IF)
+            continue;
+        if (dev->bar_is_io[AHCI_ABAR] || !dev->bar_addr[AHCI_ABAR])
+            continue;
+        return dev;
+    }
+    return NULL;
+}
+
+static void ahci_irq_init(void)
+{
+    /* MSI предпочтительнее: вектор не делится с другими устройствами */
+    if (pci_find_capability(hba.pci, PCI_CAP_ID_MSI, 0))
+    {
+        int vector = irq_alloc_msi(ahci_irq, NULL);
+        if (vector >= 0 && pci_enable_msi(hba.pci, lapic_id(), (uint8_t)vector) == 0)
+        {
+            hba.msi = true;
+            hba.irq_ready = true;
+        }
+        else if (vector >= 0)
+            irq_free_msi(vector);
+    }
+
+    if (!hba.irq_ready)
+    {
+        uint8_t line = pci_read8(hba.pci, 0x3C);
+        hba.irq_ready = irq_register(line, ahci_irq, NULL) == 0;
+    }
+
+    if (hba.irq_ready)
+    {
+        hba_write(AHCI_HBA_IS, 0xFFFFFFFFu);
+        hba_write(AHCI_HBA_GHC, hba_read(AHCI_HBA_GHC) | AHCI_GHC_IE);
+    }
+}
+
+static int ahci_hba_init(void)
+{
+    if (hba.ready)
+        return AHCI_OK;
+
+    hba.pci = ahci_find_controller();
+    if (!hba.pci)
+        return AHCI_ERR_INVALID;
+
+    pci_enable_bus_master(hba.pci);
+
+    uint64_t size = hba.pci->bar_size[AHCI_ABAR];
+    hba.abar = (volatile uint8_t *)vmm_map_mmio(hba.pci->bar_addr[AHCI_ABAR],
+                                                size ? size : AHCI_PORT_BASE + AHCI_MAX_PORTS * AHCI_PORT_SIZE);
+    if (!hba.abar)
+        return AHCI_ERR_NOMEM;
+
+    /* AHCI-режим: регистры таск-файла эмуляции IDE больше не используются */
+    hba_write(AHCI_HBA_GHC, hba_read(AHCI_HBA_GHC) | AHCI_GHC_AE);
+    hba.cap = hba_read(AHCI_HBA_CAP);
+
+    ahci_irq_init();
+    hba.ready = true;
+    return AHCI_OK;
+}
+
+/* Без S64A контроллер адресует только первые 4 ГиБ */
+static uint64_t ahci_dma_limit(void)
+{
+    return (hba.cap & AHCI_CAP_S64A) ? ~0ULL : AHCI_DMA_PHYS_LIMIT;
+}
+
+/* true, если страницы [page, page + pages) доступны контроллеру для DMA */
+static bool ahci_dma_reachable(const void *page, size_t pages)
+{
+    return page && (uint64_t)page - hhdm_offset + pages * PAGE_SIZE <= ahci_dma_limit();
+}
+
+static size_t ahci_table_pages(const ahci_disk_t *d)
+{
+    return ALIGN_UP(d->slots * AHCI_CMD_TABLE_SIZE, PAGE_SIZE) / PAGE_SIZE;
+}
+
+/* Освобождает память порта; движок порта к этому моменту должен стоять */
+static void ahci_port_free(ahci_disk_t *d)
+{
+    if (d->cmd_list)
+        free_page(d->cmd_list);
+    if (d->cmd_tables)
+        for (size_t i = 0; i < ahci_table_pages(d); ++i)
+            free_page(d->cmd_tables + i * PAGE_SIZE);
+    if (d->bounce)
+        for (int i = 0; i < AHCI_BOUNCE_PAGES; ++i)
+            free_page(d->bounce + i * PAGE_SIZE);
+
+    d->cmd_list = NULL;
+    d->cmd_tables = NULL;
+    d->bounce = NULL;
+}
+
+static int ahci_port_alloc(ahci_disk_t *d)
+{
+    /* Список команд (1 КиБ) и принятые FIS (256 байт) - в одной странице */
+    size_t table_pages = ahci_table_pages(d);
+    d->cmd_list = (ahci_cmd_header_t *)alloc_page();
+    d->cmd_tables = alloc_pages(table_pages);
+    d->bounce = alloc_pages(AHCI_BOUNCE_PAGES);
+
+    if (!ahci_dma_reachable(d->cmd_list, 1) ||
+        !ahci_dma_reachable(d->cmd_tables, table_pages) ||
+        !ahci_dma_reachable(d->bounce, AHCI_BOUNCE_PAGES))
+    {
+        ahci_port_free(d);
+        return AHCI_ERR_NOMEM;
+    }
+    memset(d->cmd_list, 0, PAGE_SIZE);
+    memset(d->cmd_tables, 0, table_pages * PAGE_SIZE);
+    d->cmd_tables_phys = (uint64_t)d->cmd_tables - hhdm_offset;
+
+    for (uint32_t i = 0; i < d->slots; ++i)
+        d->cmd_list[i].ctba = d->cmd_tables_phys + i * AHCI_CMD_TABLE_SIZE;
+
+    /* CLB ещё не указывает на наши страницы - их можно сразу отдать */
+    if (ahci_port_stop(d) != AHCI_OK)
+    {
+        ahci_port_free(d);
+        return AHCI_ERR_TIMEOUT;
+    }
+
+    uint64_t clb = (uint64_t)d->cmd_list - hhdm_offset;
+    port_write(d, AHCI_PX_CLB, (uint32_t)clb);
+    port_write(d, AHCI_PX_CLBU, (uint32_t)(clb >> 32));
+    port_write(d, AHCI_PX_FB, (uint32_t)(clb + 1024));
+    port_write(d, AHCI_PX_FBU, (uint32_t)((clb + 1024) >> 32));
+
+    port_write(d, AHCI_PX_SERR, 0xFFFFFFFFu);
+    port_write(d, AHCI_PX_IS, 0xFFFFFFFFu);
+
+    /* Не дождались BSY/DRQ - FRE и ST не выставлены, DMA по CLB не идёт */
+    int rc = ahci_port_start(d);
+    if (rc != AHCI_OK)
+        ahci_port_free(d);
+    return rc;
+}
+
+/* Заполняет слот: H2D Register FIS и PRDT */
+static void ahci_fill_slot(ahci_disk_t *d, int tag, uint8_t cmd, uint64_t lba, uint32_t count,
+                           const ahci_seg_t *segs, int nsegs, bool write, bool ncq)
+{
+    uint8_t *table = d->cmd_tables + tag * AHCI_CMD_TABLE_SIZE;
+    uint8_t *fis = table;
+    memset(table, 0, 0x80);
+
+    fis[0] = AHCI_FIS_REG_H2D;
+    fis[1] = 0x80; /* C: регистр команды */
+    fis[2] = cmd;
+    fis[4] = (uint8_t)lba;
+    fis[5] = (uint8_t)(lba >> 8);
+    fis[6] = (uint8_t)(lba >> 16);
+    fis[8] = (uint8_t)(lba >> 24);
+    fis[9] = (uint8_t)(lba >> 32);
+    fis[10] = (uint8_t)(lba >> 40);
+
+    if (cmd == AHCI_CMD_IDENTIFY)
+    {
+        fis[7] = 0;
+    }
+    else if (ncq)
+    {
+        /* FPDMA: число секторов - в features, тег - в битах 7:3 счётчика */
+        fis[7] = 0x40;
+        fis[3] = (uint8_t)count;
+        fis[11] = (uint8_t)(count >> 8);
+        fis[12] = (uint8_t)(tag << 3);
+    }
+    else
+    {
+        /* LBA28 берёт биты 27:24 из регистра устройства, 256 секторов кодируются нулём */
+        fis[7] = (uint8_t)(0x40 | (d->lba48 ? 0 : (lba >> 24) & 0x0F));
+        fis[12] = (uint8_t)count;
+        fis[13] = (uint8_t)(count >> 8);
+    }
+
+    ahci_prd_t *prdt = (ahci_prd_t *)(table + 0x80);
+    for (int i = 0; i < nsegs; ++i)
+    {
+        prdt[i].dba = segs[i].phys;
+        prdt[i].reserved = 0;
+        prdt[i].dbc = segs[i].len - 1;
+    }
+
+    ahci_cmd_header_t *h = &d->cmd_list[tag];
+    h->flags = (uint16_t)(5 | (write ? AHCI_CMDH_WRITE : 0)); /* FIS - 5 двойных слов */
+    h->prdtl = (uint16_t)nsegs;
+    h->prdbc = 0;
+}
+
+/* Куски буфера по страницам, физически соседние склеиваются; -1, если буфер не годится */
+static int ahci_segments(const void *buffer, size_t bytes, ahci_seg_t *out, int max)
+{
+    page_table_t *pml4 = read_cr3_virt();
+    uint64_t limit = ahci_dma_limit();
+    uintptr_t va = (uintptr_t)buffer;
+    int n = 0;
+
+    while (bytes)
+    {
+        size_t chunk = PAGE_SIZE - (va & (PAGE_SIZE - 1));
+        if (chunk > bytes)
+            chunk = bytes;
+
+        uint64_t phys = vmm_get_phys(pml4, va);
+        if (!phys || (phys & 1) || phys + chunk > limit)
+            return -1;
+
+        if (n > 0 && out[n - 1].phys + out[n - 1].len == phys &&
+            out[n - 1].len + chunk <= AHCI_PRD_MAX_BYTES)
+        {
+            out[n - 1].len += (uint32_t)chunk;
+        }
+        else
+        {
+            if (n >= max)
+                return -1;
+            out[n].phys = phys;
+            out[n].len = (uint32_t)chunk;
+            n++;
+        }
+
+        va += chunk;
+        bytes -= chunk;
+    }
+    return n;
+}
+
+/* Команду NCQ можно ставить рядом с другими NCQ, обычную - только в пустую очередь */
+static inline bool ahci_can_issue(const ahci_disk_t *d, bool ncq)
+{
+    if (!d->free_slots || d->needs_reset)
+        return false;
+    return ncq ? (d->outstanding & ~d->ncq_tags) == 0 : d->outstanding == 0;
+}
+
+static int ahci_submit(ahci_disk_t *d, ahci_batch_t *batch, uint8_t cmd, uint64_t lba, uint32_t count,
+                       const ahci_seg_t *segs, int nsegs, bool write, bool ncq, bool use_irq)
+{
+    uint64_t flags = save_irq_disable();
+    uint32_t loops = 0;
+
+    while (!ahci_can_issue(d, ncq))
+    {
+        if (d->broken)
+        {
+            restore_irq(flags);
+            return AHCI_ERR_DEVICE;
+        }
+
+        if (d->needs_reset)
+        {
+            restore_irq(flags);
+            ahci_recover(d);
+            flags = save_irq_disable();
+            continue;
+        }
+
+        if (use_irq)
+        {
+            /* Потерянное прерывание не должно подвесить поток: по таймауту опрашиваем сами */
+            if (!wait_queue_sleep(&d->space, timer_now_ns() + AHCI_IRQ_TIMEOUT_NS))
+            {
+                ahci_poll(d);
+                if (!ahci_can_issue(d, ncq) && !d->needs_reset)
+                    ahci_fail_all(d);
+            }
+        }
+        else
+        {
+            ahci_poll(d);
+            if (++loops >= AHCI_POLL_LOOPS)
+            {
+                ahci_fail_all(d);
+                loops = 0;
+            }
+            asm volatile("pause");
+        }
+    }
+
+    int tag = __builtin_ctz(d->free_slots);
+    uint32_t bit = 1u << tag;
+    ahci_fill_slot(d, tag, cmd, lba, count, segs, nsegs, write, ncq);
+
+    d->free_slots &= ~bit;
+    d->outstanding |= bit;
+    d->batches[tag] = batch;
+    batch->pending++;
+    d->stats.commands++;
+
+    /* Таблица видна контроллеру раньше, чем он прочтёт CI */
+    asm volatile("mfence" ::: "memory");
+    if (ncq)
+    {
+        d->ncq_tags |= bit;
+        port_write(d, AHCI_PX_SACT, bit);
+    }
+    port_write(d, AHCI_PX_CI, bit);
+
+    restore_irq(flags);
+    return AHCI_OK;
+}
+
+/* Ждёт все отправленные части. По истечении времени порт перезапускается */
+static int ahci_wait(ahci_disk_t *d, ahci_batch_t *batch, bool use_irq)
+{
+    if (use_irq)
+    {
+        uint64_t flags = save_irq_disable();
+        if (batch->pending)
+            d->stats.irq_waits++;
+        restore_irq(flags);
+
+        /* complete() бывает и до отправки последней части - проверяем счётчик */
+        while (batch->pending && !d->needs_reset)
+            if (!wait_for_completion_timeout(&batch->done, AHCI_IRQ_TIMEOUT_NS))
+                break;
+    }
+
+    for (uint32_t i = 0; batch->pending && !d->needs_reset && i < AHCI_POLL_LOOPS; ++i)
+    {
+        uint64_t flags = save_irq_disable();
+        ahci_poll(d);
+        restore_irq(flags);
+        asm volatile("pause");
+    }
+
+    uint64_t flags = save_irq_disable();
+    bool timeout = batch->pending && !d->needs_reset;
+    if (timeout)
+    {
+        kprint(KPRINT_ERROR, "AHCI: port %u command timeout\n", (uint32_t)d->port);
+        ahci_fail_all(d);
+    }
+    restore_irq(flags);
+
+    /* Перезапуск возвращает и части, оставленные ahci_fail_all до останова движка */
+    if (d->needs_reset)
+        ahci_recover(d);
+    return timeout ? AHCI_ERR_TIMEOUT : batch->rc;
+}
+
+static void ahci_ncq_failed(ahci_disk_t *d)
+{
+    kprint(KPRINT_ERROR, "AHCI: NCQ error on port %u, falling back to single commands\n",
+           (uint32_t)d->port);
+
+    uint64_t flags = save_irq_disable();
+    d->ncq = false;
+    d->depth = 1;
+    /* Слоты сверх глубины не возвращаются: ahci_reap освобождает только слоты в пределах depth */
+    d->free_slots &= ahci_slot_mask(d->depth);
+    restore_irq(flags);
+}
+
+static int ahci_transfer(ahci_disk_t *d, uint64_t lba, uint32_t count, uint8_t *buf, bool write, bool use_irq)
+{
+    ahci_batch_t batch = { .pending = 0, .rc = AHCI_OK, .done = COMPLETION_INIT };
+    ahci_seg_t segs[AHCI_PRDT_ENTRIES];
+    bool ncq = d->ncq;
+    int rc = AHCI_OK;
+
+    uint64_t cur_lba = lba;
+    uint32_t left = count;
+    uint8_t *cur = buf;
+
+    while (left)
+    {
+        uint32_t chunk = left > AHCI_MAX_SECTORS ? AHCI_MAX_SECTORS : left;
+
+        int nsegs;
+        while ((nsegs = ahci_segments(cur, (size_t)chunk * d->sector_size, segs, AHCI_PRDT_ENTRIES)) < 0 &&
+               chunk > 1)
+            chunk /= 2;
+        if (nsegs < 0)
+        {
+            rc = AHCI_ERR_INVALID;
+            break;
+        }
+
+        uint8_t cmd = ncq ? (write ? AHCI_CMD_WRITE_FPDMA : AHCI_CMD_READ_FPDMA)
+                    : d->lba48 ? (write ? AHCI_CMD_WRITE_DMA_EXT : AHCI_CMD_READ_DMA_EXT)
+                               : (write ? AHCI_CMD_WRITE_DMA : AHCI_CMD_READ_DMA);
+
+        rc = ahci_submit(d, &batch, cmd, cur_lba, chunk, segs, nsegs, write, ncq, use_irq);
+        if (rc != AHCI_OK)
+            break;
+
+        cur += (size_t)chunk * d->sector_size;
+        cur_lba += chunk;
+        left -= chunk;
+    }
+
+    /* Отправленные части пишут в буфер вызывающего - их дожидаемся всегда */
+    int wrc = ahci_wait(d, &batch, use_irq);
+    if (rc == AHCI_OK)
+        rc = wrc;
+
+    /* Ошибка под NCQ: повторяем весь запрос одиночными командами */
+    if (rc == AHCI_ERR_DEVICE && ncq && d->ncq)
+    {
+        ahci_ncq_failed(d);
+        return ahci_transfer(d, lba, count, buf, write, use_irq);
+    }
+    return rc;
+}
+
+static int ahci_flush_cache(ahci_disk_t *d, bool use_irq)
+{
+    ahci_batch_t batch = { .pending = 0, .rc = AHCI_OK, .done = COMPLETION_INIT };
+    int rc = ahci_submit(d, &batch, d->lba48 ? AHCI_CMD_FLUSH_CACHE_EXT : AHCI_CMD_FLUSH_CACHE,
+                         0, 0, NULL, 0, false, false, use_irq);
+    int wrc = ahci_wait(d, &batch, use_irq);
+    return rc != AHCI_OK ? rc : wrc;
+}
+
+static int ahci_rw(ahci_disk_t *d, uint64_t lba, uint32_t count, uint8_t *buf, bool write)
+{
+    if (!d || !d->cmd_list || !buf || count == 0)
+        return AHCI_ERR_INVALID;
+    if (lba > d->total_sectors || count > d->total_sectors - lba)
+        return AHCI_ERR_INVALID;
+    if (d->broken)
+        return AHCI_ERR_DEVICE;
+
+    bool use_irq = d->irq_ready && irqs_enabled();
+    uint64_t start = timer_now_ns();
+    int rc = AHCI_OK;
+
+    if ((uintptr_t)buf & 1)
+    {
+        /* PRD требует чётного адреса - нечётный буфер идёт через bounce-буфер порта */
+        mutex_lock(&d->bounce_lock);
+        uint64_t cur_lba = lba;
+        uint32_t left = count;
+        uint8_t *cur = buf;
+        while (left && rc == AHCI_OK)
+        {
+            uint32_t chunk = left > AHCI_MAX_SECTORS ? AHCI_MAX_SECTORS : left;
+            size_t bytes = (size_t)chunk * d->sector_size;
+            if (write)
+                memcpy(d->bounce, cur, bytes);
+            rc = ahci_transfer(d, cur_lba, chunk, d->bounce, write, use_irq);
+            if (rc == AHCI_OK && !write)
+                memcpy(cur, d->bounce, bytes);
+
+            cur += bytes;
+            cur_lba += chunk;
+            left -= chunk;
+        }
+        mutex_unlock(&d->bounce_lock);
+    }
+    else
+    {
+        rc = ahci_transfer(d, lba, count, buf, write, use_irq);
+    }
+
+    if (rc == AHCI_OK && write && d->write_cache)
+        rc = ahci_flush_cache(d, use_irq);
+
+    uint64_t flags = save_irq_disable();
+    io_stats_record(&d->stats, count, timer_now_ns() - start, rc != AHCI_OK);
+    restore_irq(flags);
+    return rc;
+}
+
+/* IDENTIFY при инициализации: слот 0, опрос без прерываний */
+static int ahci_identify(ahci_disk_t *d, uint16_t *ident)
+{
+    ahci_seg_t seg = { .phys = (uint64_t)ident - hhdm_offset, .len = 512 };
+    ahci_fill_slot(d, 0, AHCI_CMD_IDENTIFY, 0, 0, &seg, 1, false, false);
+
+    asm volatile("mfence" ::: "memory");
+    port_write(d, AHCI_PX_CI, 1);
+
+    for (uint32_t i = 0; i < AHCI_POLL_LOOPS; ++i)
+    {
+        if (port_read(d, AHCI_PX_IS) & AHCI_PXIS_TFES)
+            break;
+        if (!(port_read(d, AHCI_PX_CI) & 1))
+        {
+            port_write(d, AHCI_PX_IS, 0xFFFFFFFFu);
+            return (port_read(d, AHCI_PX_TFD) & AHCI_TFD_ERR) ? AHCI_ERR_DEVICE : AHCI_OK;
+        }
+        asm volatile("pause");
+    }
+
+    ahci_port_stop(d);
+    port_write(d, AHCI_PX_SERR, 0xFFFFFFFFu);
+    port_write(d, AHCI_PX_IS, 0xFFFFFFFFu);
+    ahci_port_start(d);
+    return AHCI_ERR_DEVICE;
+}
+
+/* Номер порта index-го подключённого SATA-диска или -1 */
+static int ahci_find_port(int index)
+{
+    uint32_t pi = hba_read(AHCI_HBA_PI);
+    for (int port = 0; port < AHCI_MAX_PORTS; ++port)
+    {
+        if (!(pi & (1u << port)))
+            continue;
+
+        volatile uint8_t *regs = hba.abar + AHCI_PORT_BASE + port * AHCI_PORT_SIZE;
+        uint32_t ssts = *(volatile uint32_t *)(regs + AHCI_PX_SSTS);
+        uint32_t sig = *(volatile uint32_t *)(regs + AHCI_PX_SIG);
+
+        /* DET = 3: устройство есть и связь установлена */
+        if ((ssts & 0xF) != AHCI_SSTS_DET_PRESENT || sig != AHCI_SIG_ATA)
+            continue;
+        if (index-- == 0)
+            return port;
+    }
+    return -1;
+}
+
+int ahci_init(ahci_disk_t *disk, int index)
+{
+    if (!disk || index < 0)
+        return AHCI_ERR_INVALID;
+
+    int rc = ahci_hba_init();
+    if (rc != AHCI_OK)
+        return rc;
+
+    int port = ahci_find_port(index);
+    if (port < 0)
+        return AHCI_ERR_INVALID;
+
+    memset(disk, 0, sizeof(*disk));
+    disk->regs = hba.abar + AHCI_PORT_BASE + port * AHCI_PORT_SIZE;
+    disk->port = (uint8_t)port;
+    disk->slots = ((hba.cap >> AHCI_CAP_NCS_SHIFT) & AHCI_CAP_NCS_MASK) + 1;
+    disk->sector_size = AHCI_SECTOR_SIZE;
+    disk->bounce_lock = (mutex_t)MUTEX_INIT;
+    disk->reset_lock = (mutex_t)MUTEX_INIT;
+    wait_queue_init(&disk->space);
+
+    rc = ahci_port_alloc(disk);
+    if (rc != AHCI_OK)
+        return rc;
+
+    /* IDENTIFY пишется DMA, поэтому буфер подчиняется тому же пределу S64A */
+    uint16_t *ident = alloc_page();
+    if (!ahci_dma_reachable(ident, 1))
+    {
+        if (ident)
+            free_page(ident);
+        ident = NULL;
+        rc = AHCI_ERR_NOMEM;
+    }
+    else
+    {
+        rc = ahci_identify(disk, ident);
+    }
+    if (rc != AHCI_OK)
+    {
+        /* Если движок не остановился, контроллер ещё может писать в эту память -
+           тогда лучше её потерять, чем отдать под чужие данные */
+        if (ahci_port_stop(disk) == AHCI_OK)
+        {
+            if (ident)
+                free_page(ident);
+            ahci_port_free(disk);
+        }
+        return rc;
+    }
+
+    /* Слово 83 бит 10 - LBA48, ёмкость в словах 100-103, иначе в 60-61 */
+    disk->lba48 = (ident[83] & (1u << 10)) != 0;
+    if (disk->lba48)
+        disk->total_sectors = (uint64_t)ident[100] | (uint64_t)ident[101] << 16 |
+                              (uint64_t)ident[102] << 32 | (uint64_t)ident[103] << 48;
+    else
+        disk->total_sectors = (uint64_t)ident[60] | (uint64_t)ident[61] << 16;
+
+    /* Слово 85 бит 5 - кэш записи включён */
+    disk->write_cache = (ident[85] & (1u << 5)) != 0;
+
+    /* Слово 76 бит 8 - NCQ, глубина очереди в слове 75 */
+    uint32_t depth = (ident[75] & 0x1F) + 1;
+    if (depth > disk->slots)
+        depth = disk->slots;
+    disk->ncq = (hba.cap & AHCI_CAP_SNCQ) && (ident[76] & (1u << 8)) && disk->lba48 && depth > 1;
+    disk->depth = disk->ncq ? depth : 1;
+    disk->free_slots = ahci_slot_mask(disk->depth);
+    free_page(ident);
+
+    hba.disks[port] = disk;
+    if (hba.irq_ready)
+    {
+        port_write(disk, AHCI_PX_IS, 0xFFFFFFFFu);
+        port_write(disk, AHCI_PX_IE, AHCI_PXIE_MASK);
+        disk->irq_ready = true;
+    }
+
+    kprint(KPRINT_LOG, "AHCI: port %u, %lu sectors, NCQ depth %u, irq %s\n", (uint32_t)port,
+           disk->total_sectors, disk->ncq ? disk->depth : 0,
+           !hba.irq_ready ? "polling" : hba.msi ? "MSI" : "INTx");
+    return AHCI_OK;
+}
+
+int ahci_read_sectors(ahci_disk_t *disk, uint64_t lba, uint32_t count, void *buffer)
+{
+    return ahci_rw(disk, lba, count, (uint8_t *)buffer, false);
+}
+
+int ahci_write_sectors(ahci_disk_t *disk, uint64_t lba, uint32_t count, const void *buffer)
+{
+    /* Контроллер только читает буфер, const снимаем ради общего пути */
+    return ahci_rw(disk, lba, count, (uint8_t *)buffer, true);
+}
+
+int ahci_flush(ahci_disk_t *disk)
+{
+    if (!disk || !disk->cmd_list)
+        return AHCI_ERR_INVALID;
+    if (disk->broken)
+        return AHCI_ERR_DEVICE;
+    if (!disk->write_cache)
+        return AHCI_OK;
+
+    return ahci_flush_cache(disk, disk->irq_ready && irqs_enabled());
+}
+
+int ahci_get_stats(ahci_disk_t *disk, io_stats_t *out, bool reset)
+{
+    if (!disk || !out)
+        return AHCI_ERR_INVALID;
+
+    uint64_t flags = save_irq_disable();
+    *out = disk->stats;
+    if (reset)
+        memset(&disk->stats, 0, sizeof(disk->stats));
+    restore_irq(flags);
+    return AHCI_OK;
+}
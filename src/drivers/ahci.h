@@ -0,0 +1,165 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pci.h"
+#include "iostat.h"
+#include "../multitask/mutex.h"
+#include "../multitask/waitqueue.h"
+
+/* PCI: класс 01h (накопители), подкласс 06h (SATA), prog_if 01h (AHCI 1.0); ABAR - BAR5 */
+#define AHCI_PCI_SUBCLASS 0x06
+#define AHCI_PCI_PROG_IF 0x01
+#define AHCI_ABAR 5
+
+/* Регистры HBA */
+#define AHCI_HBA_CAP 0x00
+#define AHCI_HBA_GHC 0x04
+#define AHCI_HBA_IS 0x08
+#define AHCI_HBA_PI 0x0C
+#define AHCI_HBA_VS 0x10
+
+#define AHCI_CAP_NP_MASK 0x1F       /* портов - 1 */
+#define AHCI_CAP_NCS_SHIFT 8        /* слотов команд - 1 */
+#define AHCI_CAP_NCS_MASK 0x1F
+#define AHCI_CAP_SNCQ (1u << 30)
+#define AHCI_CAP_S64A (1u << 31)
+
+#define AHCI_GHC_HR (1u << 0)
+#define AHCI_GHC_IE (1u << 1)
+#define AHCI_GHC_AE (1u << 31)
+
+/* Регистры порта: 0x100 + 0x80 * номер */
+#define AHCI_PORT_BASE 0x100
+#define AHCI_PORT_SIZE 0x80
+
+#define AHCI_PX_CLB 0x00
+#define AHCI_PX_CLBU 0x04
+#define AHCI_PX_FB 0x08
+#define AHCI_PX_FBU 0x0C
+#define AHCI_PX_IS 0x10
+#define AHCI_PX_IE 0x14
+#define AHCI_PX_CMD 0x18
+#define AHCI_PX_TFD 0x20
+#define AHCI_PX_SIG 0x24
+#define AHCI_PX_SSTS 0x28
+#define AHCI_PX_SCTL 0x2C
+#define AHCI_PX_SERR 0x30
+#define AHCI_PX_SACT 0x34
+#define AHCI_PX_CI 0x38
+
+#define AHCI_PXCMD_ST (1u << 0)
+#define AHCI_PXCMD_SUD (1u << 1)
+#define AHCI_PXCMD_POD (1u << 2)
+#define AHCI_PXCMD_FRE (1u << 4)
+#define AHCI_PXCMD_FR (1u << 14)
+#define AHCI_PXCMD_CR (1u << 15)
+
+#define AHCI_PXIS_DHRS (1u << 0)  /* D2H Register FIS */
+#define AHCI_PXIS_PSS (1u << 1)   /* PIO Setup FIS */
+#define AHCI_PXIS_DSS (1u << 2)   /* DMA Setup FIS */
+#define AHCI_PXIS_SDBS (1u << 3)  /* Set Device Bits: завершение NCQ */
+#define AHCI_PXIS_IFS (1u << 27)
+#define AHCI_PXIS_HBDS (1u << 28)
+#define AHCI_PXIS_HBFS (1u << 29)
+#define AHCI_PXIS_TFES (1u << 30)
+#define AHCI_PXIS_ERRORS (AHCI_PXIS_IFS | AHCI_PXIS_HBDS | AHCI_PXIS_HBFS | AHCI_PXIS_TFES)
+
+#define AHCI_TFD_ERR 0x01
+#define AHCI_TFD_DRQ 0x08
+#define AHCI_TFD_BSY 0x80
+
+#define AHCI_SSTS_DET_PRESENT 0x3
+#define AHCI_SIG_ATA 0x00000101
+
+#define AHCI_FIS_REG_H2D 0x27
+
+/* Команды ATA */
+#define AHCI_CMD_IDENTIFY 0xEC
+#define AHCI_CMD_READ_DMA 0xC8
+#define AHCI_CMD_WRITE_DMA 0xCA
+#define AHCI_CMD_READ_DMA_EXT 0x25
+#define AHCI_CMD_WRITE_DMA_EXT 0x35
+#define AHCI_CMD_FLUSH_CACHE 0xE7
+#define AHCI_CMD_FLUSH_CACHE_EXT 0xEA
+#define AHCI_CMD_READ_FPDMA 0x60
+#define AHCI_CMD_WRITE_FPDMA 0x61
+
+/* Заголовок команды в списке порта (32 байта на слот) */
+typedef struct __attribute__((packed))
+{
+    uint16_t flags;   /* CFL в двойных словах, W - запись, C - сбросить BSY */
+    uint16_t prdtl;   /* записей PRDT */
+    volatile uint32_t prdbc;
+    uint64_t ctba;    /* таблица команды, выровнена на 128 байт */
+    uint32_t reserved[4];
+} ahci_cmd_header_t;
+
+#define AHCI_CMDH_WRITE (1u << 6)
+#define AHCI_CMDH_CLEAR_BUSY (1u << 10)
+
+typedef struct __attribute__((packed))
+{
+    uint64_t dba;
+    uint32_t reserved;
+    uint32_t dbc;     /* байт - 1, не больше 4 МиБ, бит 31 - прерывание по концу */
+} ahci_prd_t;
+
+/* Записей PRDT на команду: часть в 128 КиБ с невыровненным началом и запас */
+#define AHCI_PRDT_ENTRIES 56
+#define AHCI_CMD_TABLE_SIZE (0x80 + AHCI_PRDT_ENTRIES * sizeof(ahci_prd_t))
+
+/* Секторов на одну команду и размер bounce-буфера */
+#define AHCI_MAX_SECTORS 256
+#define AHCI_MAX_PORTS 32
+#define AHCI_MAX_DISKS 4
+#define AHCI_SECTOR_SIZE 512
+
+/* Коды возврата */
+#define AHCI_OK 0
+#define AHCI_ERR_TIMEOUT -1
+#define AHCI_ERR_DEVICE -2
+#define AHCI_ERR_INVALID -3
+#define AHCI_ERR_NOMEM -4
+
+typedef struct ahci_disk
+{
+    volatile uint8_t *regs;      /* регистры порта */
+    uint8_t port;
+    uint32_t slots;              /* слотов команд у HBA */
+    uint32_t depth;              /* команд NCQ одновременно; 1 - без NCQ */
+    bool ncq;
+    bool lba48;
+    bool write_cache;            /* после записи нужен FLUSH CACHE */
+    uint64_t total_sectors;
+    uint16_t sector_size;
+    ahci_cmd_header_t *cmd_list; /* адреса HHDM */
+    uint8_t *cmd_tables;
+    uint64_t cmd_tables_phys;
+    uint8_t *bounce;             /* для буферов с нечётным адресом */
+    mutex_t bounce_lock;
+    uint32_t free_slots;         /* битовые маски по слотам */
+    uint32_t outstanding;
+    uint32_t ncq_tags;           /* из outstanding - команды NCQ */
+    void *batches[32];           /* запрос вызывающего по слоту */
+    wait_queue_t space;          /* ждут слот */
+    bool irq_ready;
+    bool needs_reset;            /* ошибка: порт перезапускается перед следующей командой */
+    mutex_t reset_lock;          /* перезапуск порта - из одного потока */
+    bool broken;
+    io_stats_t stats;            /* под выключенными прерываниями */
+} ahci_disk_t;
+
+/* Инициализирует index-й SATA-диск первого AHCI-контроллера */
+int ahci_init(ahci_disk_t *disk, int index);
+
+/* Большой запрос делится на части, которые при NCQ выполняются одновременно */
+int ahci_read_sectors(ahci_disk_t *disk, uint64_t lba, uint32_t count, void *buffer);
+int ahci_write_sectors(ahci_disk_t *disk, uint64_t lba, uint32_t count, const void *buffer);
+int ahci_flush(ahci_disk_t *disk);
+
+/* Копия статистики запросов, при reset счётчики обнуляются */
+int ahci_get_stats(ahci_disk_t *disk, io_stats_t *out, bool reset);
+
+#endif // AHCI_H
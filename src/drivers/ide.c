@@ -1,5 +1,45 @@
 #include "ide.h"
+#include "pci.h"
 #include "../portio/portio.h"
+#include "../mm/pmm.h"
+#include "../mm/vmm.h"
+#include "../multitask/mutex.h"
+#include "../multitask/completion.h"
+#include "../time/timer.h"
+#include "../cpu/cpu.h"
+#include "../pic.h"
+#include "../graphics/formatting.h"
+
+#define IDE_DMA_BOUNCE_PAGES (IDE_DMA_MAX_SECTORS * 512 / PAGE_SIZE)
+#define IDE_PRDT_ENTRIES (PAGE_SIZE / sizeof(ide_prd_t))
+#define IDE_DMA_PHYS_LIMIT 0x100000000ULL
+#define IDE_IRQ_TIMEOUT_NS 5000000000ULL /* 5 с */
+
+/*
+ * Состояние канала. Запрос владеет каналом целиком (мьютекс): пока он
+ * спит в ожидании прерывания, другие потоки работают, но не на этом канале
+ */
+typedef struct
+{
+    mutex_t lock;
+    uint16_t base_port;
+    uint16_t ctrl_port;
+    uint8_t irq;
+    uint16_t bm_port;
+    ide_prd_t *prdt;  /* одна страница, адрес HHDM */
+    uint32_t prdt_phys;
+    uint8_t *bounce;  /* IDE_DMA_MAX_SECTORS секторов, физически непрерывный */
+    bool irq_ready;   /* линия открыта и прерывания доходят */
+    bool use_irq;     /* текущий запрос спит до INTRQ, а не опрашивает BSY */
+    completion_t done;
+} ide_channel_state_t;
+
+static ide_channel_state_t channels[2] = {
+    { .lock = MUTEX_INIT, .base_port = IDE_BASE_PRIMARY, .ctrl_port = IDE_CTRL_PRIMARY,
+      .irq = 14, .done = COMPLETION_INIT },
+    { .lock = MUTEX_INIT, .base_port = IDE_BASE_SECONDARY, .ctrl_port = IDE_CTRL_SECONDARY,
+      .irq = 15, .done = COMPLETION_INIT },
+};
 
 static inline void io_delay(uint16_t ctrl_port)
 {
@@ -55,6 +95,68 @@ static void select_device_and_delay(uint16_t base, uint16_t ctrl, uint8_t drive,
     io_delay(ctrl);
 }
 
+/* Завершение прошлой команды обнуляется до записи новой: её INTRQ не потеряется */
+static void ide_issue(ide_disk_t *disk, uint8_t cmd)
+{
+    disk->stats.commands++;
+    completion_reinit(&channels[disk->channel].done);
+    outb(disk->base_port + IDE_COMMAND, cmd);
+    /* 400 нс: к концу паузы устройство уже выставило BSY */
+    io_delay(disk->ctrl_port);
+}
+
+static int ide_wait_irq(ide_disk_t *disk, ide_channel_state_t *ch)
+{
+    for (;;)
+    {
+        if (!wait_for_completion_timeout(&ch->done, IDE_IRQ_TIMEOUT_NS))
+        {
+            if (inb(disk->ctrl_port + IDE_ALTSTATUS) & IDE_STATUS_BSY)
+                return IDE_ERR_TIMEOUT;
+
+            /* Команда выполнена, а прерывания не было - линия не доходит, дальше опросом */
+            kprint(KPRINT_ERROR, "IDE: lost IRQ %u, switching to polling\n", ch->irq);
+            ch->irq_ready = false;
+            ch->use_irq = false;
+            return IDE_OK;
+        }
+
+        /* Опоздавшее прерывание прошлой команды: эта ещё выполняется */
+        if (!(inb(disk->ctrl_port + IDE_ALTSTATUS) & IDE_STATUS_BSY))
+        {
+            disk->stats.irq_waits++;
+            return IDE_OK;
+        }
+    }
+}
+
+/* Конец команды: сон до прерывания, если можно, затем прежние проверки состояния */
+static int ide_wait_device(ide_disk_t *disk, bool want_drq)
+{
+    ide_channel_state_t *ch = &channels[disk->channel];
+    if (ch->use_irq)
+    {
+        int rc = ide_wait_irq(disk, ch);
+        if (rc != IDE_OK)
+            return rc;
+    }
+
+    if (wait_bsy_clear(disk->base_port, disk->ctrl_port, IDE_TIMEOUT_LOOPS) != IDE_OK)
+        return IDE_ERR_TIMEOUT;
+    if (want_drq)
+        return wait_drq_or_err(disk->base_port, disk->ctrl_port, IDE_TIMEOUT_LOOPS);
+    if (check_err_and_clear(disk->base_port) != IDE_OK)
+        return IDE_ERR_DEVICE;
+
+    return IDE_OK;
+}
+
+static int ide_flush_cache(ide_disk_t *disk, int lba48)
+{
+    ide_issue(disk, lba48 ? IDE_CMD_CACHE_FLUSH_EXT : IDE_CMD_CACHE_FLUSH);
+    return ide_wait_device(disk, false);
+}
+
 static uint64_t ident_words_to_u64(const uint16_t ident[256], int w)
 {
     uint64_t v = 0;
@@ -155,6 +257,144 @@ int ide_identify(ide_disk_t *disk, uint16_t ident_buffer[256])
     return IDE_OK;
 }
 
+/* Порт bus-master первого PCI IDE-контроллера (BAR4) или 0 */
+static uint16_t ide_find_bm_base(void)
+{
+    int n = pci_get_device_count();
+    for (int i = 0; i < n; ++i)
+    {
+        pci_device_t *dev = pci_get_device(i);
+        if (dev->class_code != 0x01 || dev->subclass != 0x01)
+            continue;
+
+        /* prog_if бит 7 - контроллер умеет bus-master */
+        if (!(dev->prog_if & 0x80) || !dev->bar_is_io[4] || !dev->bar_addr[4])
+            continue;
+
+        pci_enable_bus_master(dev);
+        return (uint16_t)dev->bar_addr[4];
+    }
+    return 0;
+}
+
+static int ide_dma_alloc(ide_channel_state_t *ch)
+{
+    if (ch->prdt)
+        return IDE_OK;
+
+    void *prdt = alloc_page();
+    void *bounce = alloc_pages(IDE_DMA_BOUNCE_PAGES);
+
+    /* Контроллер адресует только первые 4 ГиБ */
+    uint64_t bounce_end = bounce ? (uint64_t)bounce - hhdm_offset + IDE_DMA_BOUNCE_PAGES * PAGE_SIZE : 0;
+    if (!prdt || !bounce ||
+        (uint64_t)prdt - hhdm_offset >= IDE_DMA_PHYS_LIMIT || bounce_end > IDE_DMA_PHYS_LIMIT)
+    {
+        if (prdt)
+            free_page(prdt);
+        if (bounce)
+            for (int i = 0; i < IDE_DMA_BOUNCE_PAGES; ++i)
+                free_page((uint8_t *)bounce + i * PAGE_SIZE);
+        return IDE_ERR_INVALID;
+    }
+
+    ch->prdt = (ide_prd_t *)prdt;
+    ch->prdt_phys = (uint32_t)((uint64_t)prdt - hhdm_offset);
+    ch->bounce = (uint8_t *)bounce;
+    return IDE_OK;
+}
+
+static void ide_dma_init(ide_disk_t *disk, const uint16_t ident[256])
+{
+    /* IDENTIFY, слово 49 бит 8: устройство поддерживает DMA */
+    if (disk->type != IDE_TYPE_ATA || !(ident[49] & (1u << 8)))
+        return;
+
+    ide_channel_state_t *ch = &channels[disk->channel];
+    if (!ch->bm_port)
+    {
+        uint16_t bm = ide_find_bm_base();
+        if (!bm || ide_dma_alloc(ch) != IDE_OK)
+            return;
+        ch->bm_port = bm + (disk->channel == IDE_CHANNEL_SECONDARY ? IDE_BM_SECONDARY_OFFSET : 0);
+    }
+
+    /* Отмечаем диск как DMA-capable, не сбрасывая ERR/IRQ (они сбрасываются записью 1) */
+    uint8_t st = inb(ch->bm_port + IDE_BM_STATUS);
+    st &= (uint8_t)~(IDE_BM_STATUS_ERR | IDE_BM_STATUS_IRQ);
+    outb(ch->bm_port + IDE_BM_STATUS, st | (uint8_t)(IDE_BM_STATUS_DRV0_DMA << disk->drive));
+
+    disk->bm_port = ch->bm_port;
+    disk->dma = 1;
+}
+
+/* SET MULTIPLE MODE: сколько секторов READ/WRITE MULTIPLE передают на одно прерывание */
+static void ide_multiple_init(ide_disk_t *disk, const uint16_t ident[256])
+{
+    /* Слово 47, биты 7:0 - наибольший допустимый блок, 0 - команды не поддерживаются */
+    uint8_t max = ident[47] & 0xFF;
+    if (disk->type != IDE_TYPE_ATA || max == 0)
+        return;
+
+    /* Размер блока - степень двойки */
+    uint8_t n = 1;
+    while (n <= max / 2)
+        n <<= 1;
+
+    select_device_and_delay(disk->base_port, disk->ctrl_port, disk->drive, 0, 0);
+    outb(disk->base_port + IDE_NSECT, n);
+    outb(disk->base_port + IDE_COMMAND, IDE_CMD_SET_MULTIPLE);
+    io_delay(disk->ctrl_port);
+
+    if (wait_bsy_clear(disk->base_port, disk->ctrl_port, IDE_TIMEOUT_LOOPS) != IDE_OK)
+        return;
+    if (check_err_and_clear(disk->base_port) != IDE_OK)
+        return;
+
+    disk->multiple = n;
+}
+
+static void ide_irq_init(ide_disk_t *disk)
+{
+    ide_channel_state_t *ch = &channels[disk->channel];
+    if (ch->irq_ready)
+        return;
+
+    /* nIEN = 0: устройство выставляет INTRQ по концу команды и готовности данных */
+    outb(disk->ctrl_port + IDE_CONTROL, 0);
+    pic_unmask(ch->irq);
+    ch->irq_ready = true;
+}
+
+static void ide_irq(ide_channel_t channel)
+{
+    ide_channel_state_t *ch = &channels[channel];
+    if (pic_is_spurious(ch->irq))
+        return;
+
+    if (ch->bm_port)
+    {
+        /* ERR остаётся для кода передачи, сбрасываем только IRQ */
+        uint8_t st = inb(ch->bm_port + IDE_BM_STATUS);
+        outb(ch->bm_port + IDE_BM_STATUS, (uint8_t)(st & ~IDE_BM_STATUS_ERR) | IDE_BM_STATUS_IRQ);
+    }
+
+    /* Чтение STATUS снимает INTRQ */
+    (void)inb(ch->base_port + IDE_STATUS);
+    complete(&ch->done);
+    pic_send_eoi(ch->irq);
+}
+
+void ide_primary_irq(void)
+{
+    ide_irq(IDE_CHANNEL_PRIMARY);
+}
+
+void ide_secondary_irq(void)
+{
+    ide_irq(IDE_CHANNEL_SECONDARY);
+}
+
 int ide_init(ide_disk_t *disk, ide_channel_t channel, uint8_t drive)
 {
     if (!disk || drive > 1)
@@ -177,12 +417,19 @@ int ide_init(ide_disk_t *disk, ide_channel_t channel, uint8_t drive)
     disk->sector_size = 512;
     disk->supports_lba48 = 0;
     disk->total_sectors = 0;
+    disk->bm_port = 0;
+    disk->dma = 0;
+    disk->multiple = 0;
+    memset(&disk->stats, 0, sizeof(disk->stats));
 
     uint16_t ident[256];
     int rc = ide_identify(disk, ident);
     if (rc != IDE_OK)
         return rc;
 
+    ide_multiple_init(disk, ident);
+    ide_dma_init(disk, ident);
+    ide_irq_init(disk);
     return IDE_OK;
 }
 
@@ -216,7 +463,87 @@ static inline int is_aligned_2(const void *ptr)
     return (((uintptr_t)ptr) & 1u) == 0;
 }
 
-int ide_read_sectors(ide_disk_t *disk, uint64_t lba, uint32_t count, void *buffer)
+static inline int ide_needs_lba48(const ide_disk_t *disk, uint64_t lba, uint32_t count)
+{
+    return disk->supports_lba48 && (lba + count - 1 > 0x0FFFFFFF);
+}
+
+/* Адрес и счётчик одной команды чтения/записи; 256 в NSECT LBA28 записывается как 0 */
+static void ide_setup_rw(ide_disk_t *disk, uint64_t lba, uint32_t count, int lba48)
+{
+    if (lba48)
+        setup_lba48_regs(disk->base_port, disk->ctrl_port, lba, (uint16_t)count, disk->drive);
+    else
+        setup_lba28_regs(disk->base_port, disk->ctrl_port, (uint32_t)lba, (uint8_t)count, disk->drive);
+}
+
+static void ide_pio_in_sector(ide_disk_t *disk, uint8_t *dest)
+{
+    int bytes_per_sector = disk->sector_size;
+    int words_per_sector = bytes_per_sector / 2;
+
+    if (is_aligned_2(dest) && bytes_per_sector == 512)
+    {
+        uint16_t *wptr = (uint16_t *)dest;
+        for (int i = 0; i < words_per_sector; ++i)
+            wptr[i] = inw(disk->base_port + IDE_DATA);
+    }
+    else if (bytes_per_sector == 512)
+    {
+        uint16_t tmp_sector_words[256];
+        read_sector_words_to(disk->base_port, tmp_sector_words);
+        memcpy(dest, tmp_sector_words, 512);
+    }
+    else
+    {
+        for (int i = 0; i < words_per_sector; ++i)
+        {
+            uint16_t w = inw(disk->base_port + IDE_DATA);
+            dest[2 * i + 0] = (uint8_t)(w & 0xFF);
+            dest[2 * i + 1] = (uint8_t)((w >> 8) & 0xFF);
+        }
+    }
+}
+
+static void ide_pio_out_sector(ide_disk_t *disk, const uint8_t *src)
+{
+    int bytes_per_sector = disk->sector_size;
+    int words_per_sector = bytes_per_sector / 2;
+
+    if (is_aligned_2(src) && bytes_per_sector == 512)
+    {
+        const uint16_t *wptr = (const uint16_t *)src;
+        for (int i = 0; i < words_per_sector; ++i)
+            outw(disk->base_port + IDE_DATA, wptr[i]);
+    }
+    else if (bytes_per_sector == 512)
+    {
+        uint16_t tmp_sector_words[256];
+        memcpy(tmp_sector_words, src, 512);
+        write_sector_words_from(disk->base_port, tmp_sector_words);
+    }
+    else
+    {
+        for (int i = 0; i < words_per_sector; ++i)
+        {
+            uint16_t w = (uint16_t)src[2 * i] | ((uint16_t)src[2 * i + 1] << 8);
+            outw(disk->base_port + IDE_DATA, w);
+        }
+    }
+}
+
+/* Секторов в блоке DRQ: после каждого блока устройство выставляет INTRQ */
+static inline uint32_t ide_drq_block(const ide_disk_t *disk, uint32_t left)
+{
+    uint32_t block = disk->multiple ? disk->multiple : 1;
+    return block < left ? block : left;
+}
+
+/*
+ * Одна команда на кусок до IDE_PIO_MAX_SECTORS. С READ MULTIPLE прерывание
+ * приходит на блок из disk->multiple секторов, иначе - на каждый сектор
+ */
+static int ide_pio_read(ide_disk_t *disk, uint64_t lba, uint32_t count, void *buffer)
 {
     if (!disk || !buffer || count == 0)
         return IDE_ERR_INVALID;
@@ -224,78 +551,44 @@ int ide_read_sectors(ide_disk_t *disk, uint64_t lba, uint32_t count, void *buffe
     if (disk->total_sectors && lba > disk->total_sectors - (uint64_t)count)
         return IDE_ERR_INVALID;
 
-    const uint32_t max_per_op = 256;
-    uint8_t *user_buf = (uint8_t *)buffer;
-    uint32_t remaining = count;
-
-    uint16_t tmp_sector_words[256];
+    uint8_t *dest = (uint8_t *)buffer;
 
-    while (remaining)
+    while (count)
     {
-        uint32_t chunk = remaining > max_per_op ? max_per_op : remaining;
+        uint32_t chunk = count > IDE_PIO_MAX_SECTORS ? IDE_PIO_MAX_SECTORS : count;
+        int lba48 = ide_needs_lba48(disk, lba, chunk);
 
-        for (uint32_t s = 0; s < chunk; ++s)
-        {
-            uint64_t cur_lba = lba + (count - remaining) + s;
-
-            if (disk->supports_lba48 && (cur_lba > 0x0FFFFFFF))
-            {
-                setup_lba48_regs(disk->base_port, disk->ctrl_port, cur_lba, 1, disk->drive);
-                outb(disk->base_port + IDE_COMMAND, IDE_CMD_READ_SECTORS_EXT);
-            }
-            else
-            {
-                uint32_t cur_lba32 = (uint32_t)cur_lba;
-                setup_lba28_regs(disk->base_port, disk->ctrl_port, cur_lba32, 1, disk->drive);
-                outb(disk->base_port + IDE_COMMAND, IDE_CMD_READ_SECTORS);
-            }
+        ide_setup_rw(disk, lba, chunk, lba48);
+        if (disk->multiple)
+            ide_issue(disk, lba48 ? IDE_CMD_READ_MULTIPLE_EXT : IDE_CMD_READ_MULTIPLE);
+        else
+            ide_issue(disk, lba48 ? IDE_CMD_READ_SECTORS_EXT : IDE_CMD_READ_SECTORS);
 
-            int rc = wait_bsy_clear(disk->base_port, disk->ctrl_port, IDE_TIMEOUT_LOOPS);
-            if (rc != IDE_OK)
-                return rc;
+        for (uint32_t done = 0; done < chunk;)
+        {
+            uint32_t block = ide_drq_block(disk, chunk - done);
 
-            rc = wait_drq_or_err(disk->base_port, disk->ctrl_port, IDE_TIMEOUT_LOOPS);
+            /* Данные блока готовы - устройство выставило INTRQ */
+            int rc = ide_wait_device(disk, true);
             if (rc != IDE_OK)
                 return rc;
 
-            int bytes_per_sector = disk->sector_size;
-            int words_per_sector = bytes_per_sector / 2;
-
-            uint8_t *dest = user_buf + ((count - remaining) + s) * (size_t)bytes_per_sector;
-            if (is_aligned_2(dest) && bytes_per_sector == 512)
-            {
-                uint16_t *wptr = (uint16_t *)dest;
-                for (int i = 0; i < words_per_sector; ++i)
-                    wptr[i] = inw(disk->base_port + IDE_DATA);
-            }
-            else
+            for (uint32_t s = 0; s < block; ++s)
             {
-                if (bytes_per_sector == 512)
-                {
-                    read_sector_words_to(disk->base_port, tmp_sector_words);
-                    memcpy(dest, tmp_sector_words, 512);
-                }
-                else
-                {
-                    for (int i = 0; i < words_per_sector; ++i)
-                    {
-                        uint16_t w = inw(disk->base_port + IDE_DATA);
-                        dest[2 * i + 0] = (uint8_t)(w & 0xFF);
-                        dest[2 * i + 1] = (uint8_t)((w >> 8) & 0xFF);
-                    }
-                }
+                ide_pio_in_sector(disk, dest);
+                dest += disk->sector_size;
             }
+            done += block;
         }
 
-        user_buf += (size_t)chunk * disk->sector_size;
-        remaining -= chunk;
         lba += chunk;
+        count -= chunk;
     }
 
     return IDE_OK;
 }
 
-int ide_write_sectors(ide_disk_t *disk, uint64_t lba, uint32_t count, const void *buffer)
+static int ide_pio_write(ide_disk_t *disk, uint64_t lba, uint32_t count, const void *buffer)
 {
     if (!disk || !buffer || count == 0)
         return IDE_ERR_INVALID;
@@ -303,93 +596,304 @@ int ide_write_sectors(ide_disk_t *disk, uint64_t lba, uint32_t count, const void
     if (disk->total_sectors && lba > disk->total_sectors - (uint64_t)count)
         return IDE_ERR_INVALID;
 
-    const uint32_t max_per_op = 256;
-    const uint8_t *user_buf = (const uint8_t *)buffer;
-    uint32_t remaining = count;
+    const uint8_t *src = (const uint8_t *)buffer;
     int used_lba48 = 0;
 
-    uint16_t tmp_sector_words[256];
-
-    while (remaining)
+    while (count)
     {
-        uint32_t chunk = remaining > max_per_op ? max_per_op : remaining;
+        uint32_t chunk = count > IDE_PIO_MAX_SECTORS ? IDE_PIO_MAX_SECTORS : count;
+        int lba48 = ide_needs_lba48(disk, lba, chunk);
+        used_lba48 |= lba48;
 
-        for (uint32_t s = 0; s < chunk; ++s)
-        {
-            uint64_t cur_lba = lba + (count - remaining) + s;
+        ide_setup_rw(disk, lba, chunk, lba48);
+        if (disk->multiple)
+            ide_issue(disk, lba48 ? IDE_CMD_WRITE_MULTIPLE_EXT : IDE_CMD_WRITE_MULTIPLE);
+        else
+            ide_issue(disk, lba48 ? IDE_CMD_WRITE_SECTORS_EXT : IDE_CMD_WRITE_SECTORS);
 
-            int use_lba48 = disk->supports_lba48 && (cur_lba > 0x0FFFFFFF);
+        /* Перед первым блоком записи прерывания нет: DRQ только опросом */
+        int rc = wait_bsy_clear(disk->base_port, disk->ctrl_port, IDE_TIMEOUT_LOOPS);
+        if (rc != IDE_OK)
+            return rc;
 
-            if (use_lba48)
-            {
-                setup_lba48_regs(disk->base_port, disk->ctrl_port, cur_lba, 1, disk->drive);
-                outb(disk->base_port + IDE_COMMAND, IDE_CMD_WRITE_SECTORS_EXT);
-                used_lba48 = 1;
-            }
-            else
+        rc = wait_drq_or_err(disk->base_port, disk->ctrl_port, IDE_TIMEOUT_LOOPS);
+        if (rc != IDE_OK)
+            return rc;
+
+        for (uint32_t done = 0; done < chunk;)
+        {
+            uint32_t block = ide_drq_block(disk, chunk - done);
+            for (uint32_t s = 0; s < block; ++s)
             {
-                uint32_t cur_lba32 = (uint32_t)cur_lba;
-                setup_lba28_regs(disk->base_port, disk->ctrl_port, cur_lba32, 1, disk->drive);
-                outb(disk->base_port + IDE_COMMAND, IDE_CMD_WRITE_SECTORS);
+                ide_pio_out_sector(disk, src);
+                src += disk->sector_size;
             }
+            done += block;
 
-            int rc = wait_bsy_clear(disk->base_port, disk->ctrl_port, IDE_TIMEOUT_LOOPS);
+            /* INTRQ после блока: дальше либо DRQ следующего, либо конец команды */
+            rc = ide_wait_device(disk, done < chunk);
             if (rc != IDE_OK)
                 return rc;
+        }
 
-            rc = wait_drq_or_err(disk->base_port, disk->ctrl_port, IDE_TIMEOUT_LOOPS);
-            if (rc != IDE_OK)
-                return rc;
+        lba += chunk;
+        count -= chunk;
+    }
 
-            int bytes_per_sector = disk->sector_size;
-            int words_per_sector = bytes_per_sector / 2;
-            const uint8_t *src = user_buf + ((count - remaining) + s) * (size_t)bytes_per_sector;
+    return ide_flush_cache(disk, used_lba48);
+}
 
-            if (is_aligned_2(src) && bytes_per_sector == 512)
-            {
-                const uint16_t *wptr = (const uint16_t *)src;
-                for (int i = 0; i < words_per_sector; ++i)
-                    outw(disk->base_port + IDE_DATA, wptr[i]);
-            }
-            else
-            {
-                if (bytes_per_sector == 512)
-                {
-                    memcpy(tmp_sector_words, src, 512);
-                    for (int i = 0; i < words_per_sector; ++i)
-                        outw(disk->base_port + IDE_DATA, tmp_sector_words[i]);
-                }
-                else
-                {
-                    for (int i = 0; i < words_per_sector; ++i)
-                    {
-                        uint16_t w = (uint16_t)src[2 * i] | ((uint16_t)src[2 * i + 1] << 8);
-                        outw(disk->base_port + IDE_DATA, w);
-                    }
-                }
-            }
+/* Таблица PRD по страницам буфера; -1, если буфер не годится для DMA напрямую */
+static int ide_dma_build_prdt(ide_channel_state_t *ch, const void *buffer, size_t bytes)
+{
+    page_table_t *pml4 = read_cr3_virt();
+    uintptr_t va = (uintptr_t)buffer;
+    int n = -1;
+    uint64_t start = 0;
+    uint32_t len = 0;
 
-            if (wait_bsy_clear(disk->base_port, disk->ctrl_port, IDE_TIMEOUT_LOOPS) != IDE_OK)
-                return IDE_ERR_TIMEOUT;
+    while (bytes)
+    {
+        size_t chunk = PAGE_SIZE - (va & (PAGE_SIZE - 1));
+        if (chunk > bytes)
+            chunk = bytes;
 
-            if (check_err_and_clear(disk->base_port) != IDE_OK)
-                return IDE_ERR_DEVICE;
+        uint64_t phys = vmm_get_phys(pml4, va);
+        if (!phys || (phys & 1) || phys + chunk > IDE_DMA_PHYS_LIMIT)
+            return -1;
+
+        /* Соседние физические куски склеиваем, пока не пересекли границу 64 КиБ */
+        if (n >= 0 && start + len == phys && (start >> 16) == ((phys + chunk - 1) >> 16))
+        {
+            len += (uint32_t)chunk;
+        }
+        else
+        {
+            if (++n >= (int)IDE_PRDT_ENTRIES)
+                return -1;
+            start = phys;
+            len = (uint32_t)chunk;
+            ch->prdt[n].phys = (uint32_t)phys;
+            ch->prdt[n].flags = 0;
         }
+        /* 65536 усекается до 0 - так PRD и кодирует 64 КиБ */
+        ch->prdt[n].bytes = (uint16_t)len;
+
+        va += chunk;
+        bytes -= chunk;
+    }
+
+    if (n < 0)
+        return -1;
+    ch->prdt[n].flags = IDE_PRD_EOT;
+    return 0;
+}
 
-        user_buf += (size_t)chunk * disk->sector_size;
-        remaining -= chunk;
+static int ide_dma_poll(ide_disk_t *disk, uint16_t bm)
+{
+    for (uint32_t i = 0; i < IDE_DMA_TIMEOUT_LOOPS; ++i)
+    {
+        uint8_t st = inb(bm + IDE_BM_STATUS);
+        if (st & IDE_BM_STATUS_ERR)
+            return IDE_ERR_DEVICE;
+        /* IRQ мог уже сбросить обработчик прерывания - тогда конец виден по ACTIVE и BSY */
+        if ((st & IDE_BM_STATUS_IRQ) ||
+            (!(st & IDE_BM_STATUS_ACTIVE) && !(inb(disk->ctrl_port + IDE_ALTSTATUS) & IDE_STATUS_BSY)))
+            return IDE_OK;
+    }
+    return IDE_ERR_TIMEOUT;
+}
+
+static int ide_dma_transfer(ide_disk_t *disk, uint64_t lba, uint32_t count, uint8_t *buffer, int write)
+{
+    ide_channel_state_t *ch = &channels[disk->channel];
+    size_t bytes = (size_t)count * disk->sector_size;
+    uint8_t *dma_buf = buffer;
+
+    if (ide_dma_build_prdt(ch, buffer, bytes) != 0)
+    {
+        /* Нечётный адрес или страницы выше 4 ГиБ - через bounce-буфер */
+        dma_buf = ch->bounce;
+        if (write)
+            memcpy(dma_buf, buffer, bytes);
+        if (ide_dma_build_prdt(ch, dma_buf, bytes) != 0)
+            return IDE_ERR_INVALID;
+    }
+
+    uint16_t bm = ch->bm_port;
+    uint8_t dir = write ? 0 : IDE_BM_CMD_READ;
+
+    /* Направление и таблица задаются при остановленном движке */
+    outb(bm + IDE_BM_COMMAND, dir);
+    outl(bm + IDE_BM_PRDT, ch->prdt_phys);
+    outb(bm + IDE_BM_STATUS, inb(bm + IDE_BM_STATUS) | IDE_BM_STATUS_ERR | IDE_BM_STATUS_IRQ);
+
+    int rc = wait_bsy_clear(disk->base_port, disk->ctrl_port, IDE_TIMEOUT_LOOPS);
+    if (rc != IDE_OK)
+        return rc;
+
+    if (ide_needs_lba48(disk, lba, count))
+    {
+        setup_lba48_regs(disk->base_port, disk->ctrl_port, lba, (uint16_t)count, disk->drive);
+        ide_issue(disk, write ? IDE_CMD_WRITE_DMA_EXT : IDE_CMD_READ_DMA_EXT);
+    }
+    else
+    {
+        /* count 256 превращается в 0 - для LBA28 это и есть 256 секторов */
+        setup_lba28_regs(disk->base_port, disk->ctrl_port, (uint32_t)lba, (uint8_t)count, disk->drive);
+        ide_issue(disk, write ? IDE_CMD_WRITE_DMA : IDE_CMD_READ_DMA);
+    }
+
+    outb(bm + IDE_BM_COMMAND, dir | IDE_BM_CMD_START);
+
+    rc = ch->use_irq ? ide_wait_irq(disk, ch) : ide_dma_poll(disk, bm);
+    if (rc == IDE_OK && (inb(bm + IDE_BM_STATUS) & IDE_BM_STATUS_ERR))
+        rc = IDE_ERR_DEVICE;
+
+    outb(bm + IDE_BM_COMMAND, dir);
+    outb(bm + IDE_BM_STATUS, inb(bm + IDE_BM_STATUS) | IDE_BM_STATUS_ERR | IDE_BM_STATUS_IRQ);
+
+    if (rc == IDE_OK)
+        rc = wait_bsy_clear(disk->base_port, disk->ctrl_port, IDE_TIMEOUT_LOOPS);
+    if (rc == IDE_OK)
+        rc = check_err_and_clear(disk->base_port);
+    else
+        (void)inb(disk->base_port + IDE_STATUS);
+
+    if (rc == IDE_OK && !write && dma_buf != buffer)
+        memcpy(buffer, dma_buf, bytes);
+
+    return rc;
+}
+
+static void ide_dma_failed(ide_disk_t *disk, uint64_t lba, int rc)
+{
+    kprint(KPRINT_ERROR, "IDE: DMA error %d at LBA %lu, falling back to PIO\n", rc, lba);
+    disk->dma = 0;
+}
+
+/* Захват канала. Спать до прерывания можно, только если вызывающий сам не держит IF = 0 */
+static uint64_t ide_request_begin(ide_disk_t *disk)
+{
+    ide_channel_state_t *ch = &channels[disk->channel];
+    uint64_t start = timer_now_ns();
+
+    mutex_lock(&ch->lock);
+    ch->use_irq = ch->irq_ready && irqs_enabled();
+    return start;
+}
+
+/* Задержка считается от вызова: ожидание занятого канала в неё входит */
+static void ide_request_end(ide_disk_t *disk, uint64_t start, uint32_t sectors, int rc)
+{
+    io_stats_record(&disk->stats, sectors, timer_now_ns() - start, rc != IDE_OK);
+    mutex_unlock(&channels[disk->channel].lock);
+}
+
+int ide_read_sectors(ide_disk_t *disk, uint64_t lba, uint32_t count, void *buffer)
+{
+    if (!disk || !buffer || count == 0)
+        return IDE_ERR_INVALID;
+
+    if (disk->total_sectors && lba > disk->total_sectors - (uint64_t)count)
+        return IDE_ERR_INVALID;
+
+    uint8_t *buf = (uint8_t *)buffer;
+    uint32_t sectors = count;
+    int rc = IDE_OK;
+
+    uint64_t start = ide_request_begin(disk);
+
+    while (count && disk->dma)
+    {
+        uint32_t chunk = count > IDE_DMA_MAX_SECTORS ? IDE_DMA_MAX_SECTORS : count;
+        rc = ide_dma_transfer(disk, lba, chunk, buf, 0);
+        if (rc != IDE_OK)
+        {
+            ide_dma_failed(disk, lba, rc);
+            break;
+        }
+
+        buf += (size_t)chunk * disk->sector_size;
         lba += chunk;
+        count -= chunk;
     }
 
-    if (used_lba48)
-        outb(disk->base_port + IDE_COMMAND, IDE_CMD_CACHE_FLUSH_EXT);
+    /* Остаток (или всё, если DMA нет) - по старому пути */
+    if (count)
+        rc = ide_pio_read(disk, lba, count, buf);
+
+    ide_request_end(disk, start, sectors, rc);
+    return rc;
+}
+
+int ide_write_sectors(ide_disk_t *disk, uint64_t lba, uint32_t count, const void *buffer)
+{
+    if (!disk || !buffer || count == 0)
+        return IDE_ERR_INVALID;
+
+    if (disk->total_sectors && lba > disk->total_sectors - (uint64_t)count)
+        return IDE_ERR_INVALID;
+
+    const uint8_t *buf = (const uint8_t *)buffer;
+    uint32_t sectors = count;
+    int used_lba48 = 0;
+    int rc = IDE_OK;
+
+    uint64_t start = ide_request_begin(disk);
+
+    while (count && disk->dma)
+    {
+        uint32_t chunk = count > IDE_DMA_MAX_SECTORS ? IDE_DMA_MAX_SECTORS : count;
+        used_lba48 |= ide_needs_lba48(disk, lba, chunk);
+
+        /* Контроллер только читает буфер, const снимаем ради общего пути */
+        rc = ide_dma_transfer(disk, lba, chunk, (uint8_t *)buf, 1);
+        if (rc != IDE_OK)
+        {
+            ide_dma_failed(disk, lba, rc);
+            break;
+        }
+
+        buf += (size_t)chunk * disk->sector_size;
+        lba += chunk;
+        count -= chunk;
+    }
+
+    /* PIO-запись сама сбрасывает кэш диска */
+    if (count)
+        rc = ide_pio_write(disk, lba, count, buf);
     else
-        outb(disk->base_port + IDE_COMMAND, IDE_CMD_CACHE_FLUSH);
+        rc = ide_flush_cache(disk, used_lba48);
 
-    if (wait_bsy_clear(disk->base_port, disk->ctrl_port, IDE_TIMEOUT_LOOPS) != IDE_OK)
-        return IDE_ERR_TIMEOUT;
-    if (check_err_and_clear(disk->base_port) != IDE_OK)
-        return IDE_ERR_DEVICE;
+    ide_request_end(disk, start, sectors, rc);
+    return rc;
+}
+
+int ide_set_dma(ide_disk_t *disk, int enable)
+{
+    if (!disk)
+        return IDE_ERR_INVALID;
+    if (enable && !disk->bm_port)
+        return IDE_ERR_INVALID;
+
+    ide_channel_state_t *ch = &channels[disk->channel];
+    mutex_lock(&ch->lock);
+    disk->dma = enable ? 1 : 0;
+    mutex_unlock(&ch->lock);
+    return IDE_OK;
+}
+
+int ide_get_stats(ide_disk_t *disk, io_stats_t *out, bool reset)
+{
+    if (!disk || !out)
+        return IDE_ERR_INVALID;
 
+    ide_channel_state_t *ch = &channels[disk->channel];
+    mutex_lock(&ch->lock);
+    *out = disk->stats;
+    if (reset)
+        memset(&disk->stats, 0, sizeof(disk->stats));
+    mutex_unlock(&ch->lock);
     return IDE_OK;
 }
\ No newline at end of file
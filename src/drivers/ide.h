@@ -3,7 +3,9 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include "../libc/string.h"
+#include "iostat.h"
 
 /* Базовые порты (compatibility mode) */
 #define IDE_BASE_PRIMARY 0x1F0
@@ -43,9 +45,49 @@
 #define IDE_CMD_WRITE_SECTORS_EXT 0x34
 #define IDE_CMD_CACHE_FLUSH 0xE7
 #define IDE_CMD_CACHE_FLUSH_EXT 0xEA
+#define IDE_CMD_READ_DMA 0xC8
+#define IDE_CMD_WRITE_DMA 0xCA
+#define IDE_CMD_READ_DMA_EXT 0x25
+#define IDE_CMD_WRITE_DMA_EXT 0x35
+#define IDE_CMD_READ_MULTIPLE 0xC4
+#define IDE_CMD_WRITE_MULTIPLE 0xC5
+#define IDE_CMD_READ_MULTIPLE_EXT 0x29
+#define IDE_CMD_WRITE_MULTIPLE_EXT 0x39
+#define IDE_CMD_SET_MULTIPLE 0xC6
+
+/* Секторов на одну PIO-команду: предел счётчика LBA28 */
+#define IDE_PIO_MAX_SECTORS 256
+
+/* Bus-master DMA (PCI IDE, BAR4): регистры канала, вторичный канал +8 */
+#define IDE_BM_COMMAND 0x00
+#define IDE_BM_STATUS 0x02
+#define IDE_BM_PRDT 0x04
+#define IDE_BM_SECONDARY_OFFSET 0x08
+
+#define IDE_BM_CMD_START 0x01
+#define IDE_BM_CMD_READ 0x08 /* направление: устройство -> память */
+
+#define IDE_BM_STATUS_ACTIVE 0x01
+#define IDE_BM_STATUS_ERR 0x02
+#define IDE_BM_STATUS_IRQ 0x04
+#define IDE_BM_STATUS_DRV0_DMA 0x20
+
+/* Запись PRD: физический адрес < 4 ГиБ, не пересекает границу 64 КиБ, bytes = 0 значит 64 КиБ */
+typedef struct __attribute__((packed))
+{
+    uint32_t phys;
+    uint16_t bytes;
+    uint16_t flags;
+} ide_prd_t;
+
+#define IDE_PRD_EOT 0x8000
+
+/* Секторов на одну DMA-команду и размер bounce-буфера */
+#define IDE_DMA_MAX_SECTORS 256
 
 /* Таймаут (итерации опроса) */
 #define IDE_TIMEOUT_LOOPS 100000U
+#define IDE_DMA_TIMEOUT_LOOPS 10000000U
 
 /* Коды возврата */
 #define IDE_OK 0
@@ -76,6 +118,10 @@ typedef struct
     uint64_t total_sectors;
     uint16_t sector_size;
     int supports_lba48;
+    uint16_t bm_port; /* 0 - контроллер или диск не умеют DMA */
+    int dma;          /* 1 - передачи через bus-master, иначе PIO */
+    uint8_t multiple; /* секторов на блок DRQ для READ/WRITE MULTIPLE, 0 - посекторно */
+    io_stats_t stats; /* запросы ide_read/write_sectors, под мьютексом канала */
 } ide_disk_t;
 
 int ide_init(ide_disk_t *disk, ide_channel_t channel, uint8_t drive);
@@ -83,4 +129,14 @@ int ide_identify(ide_disk_t *disk, uint16_t ident_buffer[256]);
 int ide_read_sectors(ide_disk_t *disk, uint64_t lba, uint32_t count, void *buffer);
 int ide_write_sectors(ide_disk_t *disk, uint64_t lba, uint32_t count, const void *buffer);
 
+/* Переключает режим передачи; IDE_ERR_INVALID, если DMA недоступен */
+int ide_set_dma(ide_disk_t *disk, int enable);
+
+/* Копия статистики запросов диска, при reset счётчики обнуляются */
+int ide_get_stats(ide_disk_t *disk, io_stats_t *out, bool reset);
+
+/* Обработчики IRQ 14/15 (isr46/isr47) */
+void ide_primary_irq(void);
+void ide_secondary_irq(void);
+
 #endif /* IDE_H */
\ No newline at end of file
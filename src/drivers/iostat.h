@@ -0,0 +1,48 @@
+#ifndef IOSTAT_H
+#define IOSTAT_H
+
+#include <stdint.h>
+
+/* Гистограмма задержек: корзина 0 - до 2 мкс, i - от 2^i до 2^(i+1) мкс, последняя - всё дольше */
+#define IO_LAT_BUCKETS 16
+
+typedef struct io_stats
+{
+    uint64_t requests;
+    uint64_t commands;    /* команд устройству, включая сброс кэша */
+    uint64_t sectors;     /* по 512 байт */
+    uint64_t errors;
+    uint64_t irq_waits;   /* команды, завершение которых ждали во сне до прерывания */
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t hist[IO_LAT_BUCKETS];
+} io_stats_t;
+
+/* Вызывается под блокировкой устройства */
+static inline void io_stats_record(io_stats_t *s, uint32_t sectors, uint64_t ns, int failed)
+{
+    s->requests++;
+    s->sectors += sectors;
+    if (failed)
+        s->errors++;
+    s->total_ns += ns;
+    if (ns > s->max_ns)
+        s->max_ns = ns;
+
+    uint64_t us = ns / 1000;
+    int b = 0;
+    while (us > 1 && b < IO_LAT_BUCKETS - 1)
+    {
+        us >>= 1;
+        b++;
+    }
+    s->hist[b]++;
+}
+
+/* Команд на МиБ данных: 2048 при посекторном PIO, 8 при DMA по 128 КиБ */
+static inline uint64_t io_stats_cmds_per_mib(const io_stats_t *s)
+{
+    return s->sectors ? s->commands * 2048 / s->sectors : 0;
+}
+
+#endif // IOSTAT_H
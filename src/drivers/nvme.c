@@ -0,0 +1,854 @@
+#include "nvme.h"
+#include "../mm/pmm.h"
+#include "../mm/vmm.h"
+#include "../multitask/completion.h"
+#include "../multitask/multitask.h"
+#include "../time/timer.h"
+#include "../time/lapic/lapic.h"
+#include "../cpu/cpu.h"
+#include "../irq.h"
+#include "../libc/string.h"
+#include "../graphics/formatting.h"
+
+#define NVME_IRQ_TIMEOUT_NS 5000000000ULL /* 5 с */
+#define NVME_POLL_LOOPS 50000000U
+#define NVME_BOUNCE_PAGES (NVME_MAX_TRANSFER / PAGE_SIZE)
+#define NVME_PRP_LIST_PAGES (ALIGN_UP(NVME_QUEUE_SLOTS * NVME_PRP_ENTRIES * sizeof(uint64_t), PAGE_SIZE) / PAGE_SIZE)
+
+/* Синхронный запрос живёт на стеке вызывающего, асинхронный - в памяти блочного слоя */
+typedef nvme_aio_t nvme_batch_t;
+
+#define NVME_BATCH_INIT { .pending = 0, .rc = NVME_OK, .result = 0, .done = COMPLETION_INIT }
+
+static inline uint32_t nvme_read32(const nvme_disk_t *d, uint32_t off)
+{
+    return *(volatile uint32_t *)(d->regs + off);
+}
+
+static inline void nvme_write32(const nvme_disk_t *d, uint32_t off, uint32_t v)
+{
+    *(volatile uint32_t *)(d->regs + off) = v;
+}
+
+static inline uint64_t nvme_read64(const nvme_disk_t *d, uint32_t off)
+{
+    return nvme_read32(d, off) | (uint64_t)nvme_read32(d, off + 4) << 32;
+}
+
+static inline void nvme_write64(const nvme_disk_t *d, uint32_t off, uint64_t v)
+{
+    nvme_write32(d, off, (uint32_t)v);
+    nvme_write32(d, off + 4, (uint32_t)(v >> 32));
+}
+
+static pci_device_t *nvme_find(int index)
+{
+    int n = pci_get_device_count();
+    for (int i = 0; i < n; ++i)
+    {
+        pci_device_t *dev = pci_get_device(i);
+        if (!pci_is_storage_device(dev) || dev->subclass != NVME_PCI_SUBCLASS ||
+            dev->prog_if != NVME_PCI_PROG_IF)
+            continue;
+        if (dev->bar_is_io[0] || !dev->bar_addr[0])
+            continue;
+        if (index-- == 0)
+            return dev;
+    }
+    return NULL;
+}
+
+/* Ждёт CSTS.RDY == ready не дольше CAP.TO */
+static int nvme_wait_ready(nvme_disk_t *d, bool ready)
+{
+    uint32_t timeout_ms = (NVME_CAP_TO(d->cap) + 1) * 500;
+    for (uint32_t ms = 0; ms < timeout_ms; ++ms)
+    {
+        uint32_t csts = nvme_read32(d, NVME_REG_CSTS);
+        if (csts & NVME_CSTS_CFS)
+            return NVME_ERR_DEVICE;
+        if (((csts & NVME_CSTS_RDY) != 0) == ready)
+            return NVME_OK;
+        pit_wait_ms(1);
+    }
+    return NVME_ERR_TIMEOUT;
+}
+
+static int nvme_queue_alloc(nvme_disk_t *d, nvme_queue_t *q, uint16_t qid, uint16_t size, bool prp)
+{
+    /* SQ и CQ занимают по странице: 64 x 64 и 64 x 16 байт */
+    uint8_t *sq = alloc_page();
+    uint8_t *cq = alloc_page();
+    size_t prp_pages = NVME_PRP_LIST_PAGES;
+    uint8_t *lists = prp ? alloc_pages(prp_pages) : NULL;
+    if (!sq || !cq || (prp && !lists))
+    {
+        if (sq)
+            free_page(sq);
+        if (cq)
+            free_page(cq);
+        if (lists)
+            for (size_t i = 0; i < prp_pages; ++i)
+                free_page(lists + i * PAGE_SIZE);
+        return NVME_ERR_NOMEM;
+    }
+    memset(sq, 0, PAGE_SIZE);
+    memset(cq, 0, PAGE_SIZE);
+
+    uint32_t stride = 4u << NVME_CAP_DSTRD(d->cap);
+
+    q->disk = d;
+    q->qid = qid;
+    q->size = size;
+    q->sq = (volatile nvme_sqe_t *)sq;
+    q->cq = (volatile nvme_cqe_t *)cq;
+    q->sq_phys = (uint64_t)sq - hhdm_offset;
+    q->cq_phys = (uint64_t)cq - hhdm_offset;
+    q->sq_db = (volatile uint32_t *)(d->regs + NVME_REG_DOORBELL + (2 * qid) * stride);
+    q->cq_db = (volatile uint32_t *)(d->regs + NVME_REG_DOORBELL + (2 * qid + 1) * stride);
+    q->sq_tail = 0;
+    q->cq_head = 0;
+    q->phase = 1;
+    q->prp_lists = (uint64_t *)lists;
+    q->prp_phys = lists ? (uint64_t)lists - hhdm_offset : 0;
+
+    /* SQ не переполнится: в полёте меньше команд, чем в ней записей */
+    q->slots = size - 1 < NVME_QUEUE_SLOTS ? size - 1u : NVME_QUEUE_SLOTS;
+    q->free_slots = q->slots >= 32 ? 0xFFFFFFFFu : (1u << q->slots) - 1;
+    memset(q->batches, 0, sizeof(q->batches));
+    wait_queue_init(&q->space);
+    q->irq_ready = false;
+    return NVME_OK;
+}
+
+/* Возвращает страницы очереди; контроллер к ней больше не обращается */
+static void nvme_queue_free(nvme_queue_t *q)
+{
+    if (q->sq)
+        free_page((void *)q->sq);
+    if (q->cq)
+        free_page((void *)q->cq);
+    if (q->prp_lists)
+        for (size_t i = 0; i < NVME_PRP_LIST_PAGES; ++i)
+            free_page((uint8_t *)q->prp_lists + i * PAGE_SIZE);
+
+    q->sq = NULL;
+    q->cq = NULL;
+    q->prp_lists = NULL;
+    q->irq_ready = false;
+}
+
+/* Завершилась последняя часть. Вызывается с выключенными прерываниями */
+static void nvme_batch_done(nvme_disk_t *d, nvme_batch_t *b)
+{
+    if (!b->cb)
+    {
+        complete(&b->done);
+        return;
+    }
+
+    io_stats_record(&d->stats, b->sectors, timer_now_ns() - b->start_ns, b->rc != NVME_OK);
+    b->cb(b->arg, b->rc);
+}
+
+/*
+ * Команда потерялась в контроллере. Он выключается (CC.EN, ждём CSTS.RDY = 0)
+ * и теряет захват шины - только тогда буферы команд в полёте, в том числе
+ * асинхронных блочного слоя, можно вернуть с ошибкой: DMA в них больше не будет.
+ * Прерывания выключены
+ */
+static void nvme_mark_broken(nvme_disk_t *d)
+{
+    d->broken = true;
+    kprint(KPRINT_ERROR, "NVMe: controller does not respond, disabled\n");
+
+    nvme_write32(d, NVME_REG_CC, nvme_read32(d, NVME_REG_CC) & ~NVME_CC_EN);
+    nvme_wait_ready(d, false);
+    /* Не снявший RDY контроллер не должен писать в память и после сдачи буферов */
+    pci_disable_bus_master(d->pci);
+
+    for (uint32_t qi = 0; qi <= d->io_queues; ++qi)
+    {
+        nvme_queue_t *q = qi == 0 ? &d->admin : &d->io[qi - 1];
+        for (int i = 0; i < NVME_QUEUE_SLOTS; ++i)
+        {
+            nvme_batch_t *b = q->batches[i];
+            if (!b)
+                continue;
+            q->batches[i] = NULL;
+            b->rc = NVME_ERR_TIMEOUT;
+            if (--b->pending == 0)
+                nvme_batch_done(d, b);
+        }
+        wait_queue_wake_all(&q->space);
+    }
+}
+
+/* Разбирает новые записи CQ по биту фазы. Вызывается с выключенными прерываниями */
+static void nvme_reap(nvme_queue_t *q)
+{
+    bool reaped = false;
+
+    for (;;)
+    {
+        volatile nvme_cqe_t *e = &q->cq[q->cq_head];
+        uint16_t status = e->status;
+        if ((status & 1) != q->phase)
+            break;
+
+        /* Остальные поля читаем только после бита фазы */
+        asm volatile("" ::: "memory");
+        uint16_t cid = e->cid;
+        if (cid < NVME_QUEUE_SLOTS && !(q->free_slots & (1u << cid)))
+        {
+            nvme_batch_t *b = q->batches[cid];
+            if (b)
+            {
+                b->result = e->result;
+                if (status >> 1)
+                    b->rc = NVME_ERR_DEVICE;
+                if (--b->pending == 0)
+                    nvme_batch_done(q->disk, b);
+            }
+            q->batches[cid] = NULL;
+            q->free_slots |= 1u << cid;
+        }
+
+        if (++q->cq_head == q->size)
+        {
+            q->cq_head = 0;
+            q->phase ^= 1;
+        }
+        reaped = true;
+    }
+
+    if (reaped)
+    {
+        *q->cq_db = q->cq_head;
+        wait_queue_wake_all(&q->space);
+    }
+}
+
+/* Вектор MSI-X принадлежит одной очереди */
+static bool nvme_irq(void *arg)
+{
+    nvme_reap((nvme_queue_t *)arg);
+    return true;
+}
+
+/*
+ * Ставит команду в SQ. Ждёт свободный идентификатор: во сне до прерывания
+ * или, если прерываний нет, разбирая CQ сам. prps - адреса страниц после первой
+ */
+static int nvme_submit(nvme_queue_t *q, nvme_batch_t *batch, nvme_sqe_t *cmd,
+                       const uint64_t *prps, int nprps, bool use_irq)
+{
+    nvme_disk_t *d = q->disk;
+    uint64_t flags = save_irq_disable();
+    uint32_t loops = 0;
+
+    while (!q->free_slots)
+    {
+        if (d->broken)
+        {
+            restore_irq(flags);
+            return NVME_ERR_DEVICE;
+        }
+
+        if (use_irq)
+        {
+            /* Потерянное прерывание не должно подвесить поток: по таймауту разбираем сами */
+            if (!wait_queue_sleep(&q->space, timer_now_ns() + NVME_IRQ_TIMEOUT_NS))
+            {
+                nvme_reap(q);
+                if (!q->free_slots)
+                    nvme_mark_broken(d);
+            }
+        }
+        else
+        {
+            nvme_reap(q);
+            if (++loops >= NVME_POLL_LOOPS)
+                nvme_mark_broken(d);
+            asm volatile("pause");
+        }
+    }
+
+    uint16_t cid = (uint16_t)__builtin_ctz(q->free_slots);
+    q->free_slots &= ~(1u << cid);
+
+    /* Две страницы адресуются PRP1/PRP2 напрямую, больше - через список слота */
+    if (nprps == 1)
+    {
+        cmd->prp2 = prps[0];
+    }
+    else if (nprps > 1)
+    {
+        uint64_t *list = q->prp_lists + cid * NVME_PRP_ENTRIES;
+        for (int i = 0; i < nprps; ++i)
+            list[i] = prps[i];
+        cmd->prp2 = q->prp_phys + cid * NVME_PRP_ENTRIES * sizeof(uint64_t);
+    }
+
+    cmd->cdw0 = (cmd->cdw0 & 0xFFFF) | ((uint32_t)cid << 16);
+    q->sq[q->sq_tail] = *cmd;
+    if (++q->sq_tail == q->size)
+        q->sq_tail = 0;
+
+    q->batches[cid] = batch;
+    batch->pending++;
+    d->stats.commands++;
+
+    /* Команда видна контроллеру раньше звонка */
+    asm volatile("mfence" ::: "memory");
+    *q->sq_db = q->sq_tail;
+
+    restore_irq(flags);
+    return NVME_OK;
+}
+
+/* Ждёт все отправленные части. По истечении времени контроллер выключается через nvme_mark_broken */
+static int nvme_wait(nvme_queue_t *q, nvme_batch_t *batch, bool use_irq)
+{
+    nvme_disk_t *d = q->disk;
+
+    if (use_irq)
+    {
+        uint64_t flags = save_irq_disable();
+        if (batch->pending)
+            d->stats.irq_waits++;
+        restore_irq(flags);
+
+        /* complete() бывает и до отправки последней части - проверяем счётчик */
+        while (batch->pending)
+            if (!wait_for_completion_timeout(&batch->done, NVME_IRQ_TIMEOUT_NS))
+                break;
+    }
+
+    for (uint32_t i = 0; batch->pending && i < NVME_POLL_LOOPS; ++i)
+    {
+        uint64_t flags = save_irq_disable();
+        nvme_reap(q);
+        restore_irq(flags);
+        asm volatile("pause");
+    }
+
+    uint64_t flags = save_irq_disable();
+    int rc = batch->rc;
+    if (batch->pending)
+    {
+        nvme_mark_broken(d);
+        rc = NVME_ERR_TIMEOUT;
+    }
+    restore_irq(flags);
+    return rc;
+}
+
+/* Команды администратора выполняются только при инициализации, опросом */
+static int nvme_admin(nvme_disk_t *d, nvme_sqe_t *cmd, uint32_t *result)
+{
+    nvme_batch_t batch = NVME_BATCH_INIT;
+    int rc = nvme_submit(&d->admin, &batch, cmd, NULL, 0, false);
+    int wrc = nvme_wait(&d->admin, &batch, false);
+    if (rc == NVME_OK)
+        rc = wrc;
+    if (rc == NVME_OK && result)
+        *result = batch.result;
+    return rc;
+}
+
+static int nvme_identify(nvme_disk_t *d, uint32_t cns, uint32_t nsid, void *page)
+{
+    nvme_sqe_t cmd = { 0 };
+    cmd.cdw0 = NVME_ADMIN_IDENTIFY;
+    cmd.nsid = nsid;
+    cmd.prp1 = (uint64_t)page - hhdm_offset;
+    cmd.cdw10 = cns;
+    return nvme_admin(d, &cmd, NULL);
+}
+
+/* PRP1 и адреса следующих страниц буфера; -1, если буфер не выровнен на 4 байта */
+static int nvme_prps(const void *buffer, size_t bytes, uint64_t *prp1, uint64_t *prps, int max)
+{
+    page_table_t *pml4 = read_cr3_virt();
+    uintptr_t va = (uintptr_t)buffer;
+    if (va & 3)
+        return -1;
+
+    *prp1 = vmm_get_phys(pml4, va);
+    if (!*prp1)
+        return -1;
+
+    size_t first = PAGE_SIZE - (va & (PAGE_SIZE - 1));
+    if (first >= bytes)
+        return 0;
+
+    int n = 0;
+    for (uintptr_t p = va + first; p < va + bytes; p += PAGE_SIZE)
+    {
+        if (n >= max)
+            return -1;
+        uint64_t phys = vmm_get_phys(pml4, p);
+        if (!phys)
+            return -1;
+        prps[n++] = phys;
+    }
+    return n;
+}
+
+/* Очередь текущего процессора */
+static inline nvme_queue_t *nvme_this_queue(nvme_disk_t *d)
+{
+    return &d->io[sched_current_cpu() % d->io_queues];
+}
+
+/* Ставит все части запроса в очередь, не дожидаясь их */
+static int nvme_queue_rw(nvme_queue_t *q, nvme_batch_t *batch, uint64_t lba, uint32_t count,
+                         uint8_t *buf, bool write, bool use_irq)
+{
+    nvme_disk_t *d = q->disk;
+    uint64_t prps[NVME_PRP_ENTRIES];
+    int rc = NVME_OK;
+
+    while (count)
+    {
+        uint32_t chunk = count > d->max_sectors ? d->max_sectors : count;
+
+        uint64_t prp1;
+        int nprps = nvme_prps(buf, (size_t)chunk * d->sector_size, &prp1, prps, NVME_PRP_ENTRIES);
+        if (nprps < 0)
+        {
+            rc = NVME_ERR_INVALID;
+            break;
+        }
+
+        nvme_sqe_t cmd = { 0 };
+        cmd.cdw0 = write ? NVME_CMD_WRITE : NVME_CMD_READ;
+        cmd.nsid = d->nsid;
+        cmd.prp1 = prp1;
+        cmd.cdw10 = (uint32_t)lba;
+        cmd.cdw11 = (uint32_t)(lba >> 32);
+        cmd.cdw12 = chunk - 1; /* NLB считается от нуля */
+
+        rc = nvme_submit(q, batch, &cmd, prps, nprps, use_irq);
+        if (rc != NVME_OK)
+            break;
+
+        buf += (size_t)chunk * d->sector_size;
+        lba += chunk;
+        count -= chunk;
+    }
+    return rc;
+}
+
+static int nvme_transfer(nvme_disk_t *d, uint64_t lba, uint32_t count, uint8_t *buf, bool write)
+{
+    nvme_queue_t *q = nvme_this_queue(d);
+    bool use_irq = q->irq_ready && irqs_enabled();
+    nvme_batch_t batch = NVME_BATCH_INIT;
+
+    int rc = nvme_queue_rw(q, &batch, lba, count, buf, write, use_irq);
+
+    /* Отправленные части пишут в буфер вызывающего - их дожидаемся всегда */
+    int wrc = nvme_wait(q, &batch, use_irq);
+    return rc != NVME_OK ? rc : wrc;
+}
+
+static int nvme_flush_cache(nvme_disk_t *d)
+{
+    nvme_queue_t *q = nvme_this_queue(d);
+    bool use_irq = q->irq_ready && irqs_enabled();
+    nvme_batch_t batch = NVME_BATCH_INIT;
+
+    nvme_sqe_t cmd = { 0 };
+    cmd.cdw0 = NVME_CMD_FLUSH;
+    cmd.nsid = d->nsid;
+
+    int rc = nvme_submit(q, &batch, &cmd, NULL, 0, use_irq);
+    int wrc = nvme_wait(q, &batch, use_irq);
+    return rc != NVME_OK ? rc : wrc;
+}
+
+static int nvme_check(const nvme_disk_t *d, uint64_t lba, uint32_t count, const void *buf)
+{
+    if (!d || !d->io_queues || !buf || count == 0)
+        return NVME_ERR_INVALID;
+    if (lba > d->total_sectors || count > d->total_sectors - lba)
+        return NVME_ERR_INVALID;
+    if (d->broken)
+        return NVME_ERR_DEVICE;
+    return NVME_OK;
+}
+
+static int nvme_rw(nvme_disk_t *d, uint64_t lba, uint32_t count, uint8_t *buf, bool write)
+{
+    int rc = nvme_check(d, lba, count, buf);
+    if (rc != NVME_OK)
+        return rc;
+
+    uint64_t start = timer_now_ns();
+
+    if ((uintptr_t)buf & 3)
+    {
+        /* PRP требует выравнивания на двойное слово - остальное идёт через bounce-буфер */
+        mutex_lock(&d->bounce_lock);
+        uint32_t per = NVME_MAX_TRANSFER / d->sector_size;
+        uint64_t cur_lba = lba;
+        uint32_t left = count;
+        uint8_t *cur = buf;
+        while (left && rc == NVME_OK)
+        {
+            uint32_t chunk = left > per ? per : left;
+            size_t bytes = (size_t)chunk * d->sector_size;
+            if (write)
+                memcpy(d->bounce, cur, bytes);
+            rc = nvme_transfer(d, cur_lba, chunk, d->bounce, write);
+            if (rc == NVME_OK && !write)
+                memcpy(cur, d->bounce, bytes);
+
+            cur += bytes;
+            cur_lba += chunk;
+            left -= chunk;
+        }
+        mutex_unlock(&d->bounce_lock);
+    }
+    else
+    {
+        rc = nvme_transfer(d, lba, count, buf, write);
+    }
+
+    if (rc == NVME_OK && write && d->write_cache)
+        rc = nvme_flush_cache(d);
+
+    uint64_t flags = save_irq_disable();
+    io_stats_record(&d->stats, (uint32_t)((uint64_t)count * d->sector_size / 512),
+                    timer_now_ns() - start, rc != NVME_OK);
+    restore_irq(flags);
+    return rc;
+}
+
+static int nvme_enable(nvme_disk_t *d)
+{
+    /* Контроллер мог остаться включённым прошивкой */
+    if (nvme_read32(d, NVME_REG_CC) & NVME_CC_EN)
+    {
+        nvme_write32(d, NVME_REG_CC, nvme_read32(d, NVME_REG_CC) & ~NVME_CC_EN);
+        int rc = nvme_wait_ready(d, false);
+        if (rc != NVME_OK)
+            return rc;
+    }
+
+    uint32_t mqes = NVME_CAP_MQES(d->cap) + 1;
+    uint16_t size = mqes < NVME_ADMIN_QUEUE_SIZE ? (uint16_t)mqes : NVME_ADMIN_QUEUE_SIZE;
+    int rc = nvme_queue_alloc(d, &d->admin, 0, size, false);
+    if (rc != NVME_OK)
+        return rc;
+
+    nvme_write32(d, NVME_REG_AQA, ((uint32_t)(size - 1) << 16) | (size - 1));
+    nvme_write64(d, NVME_REG_ASQ, d->admin.sq_phys);
+    nvme_write64(d, NVME_REG_ACQ, d->admin.cq_phys);
+
+    /* Страница 4 КиБ (MPS = 0), набор команд NVM, round-robin */
+    nvme_write32(d, NVME_REG_CC, NVME_CC_EN | NVME_CC_IOSQES | NVME_CC_IOCQES);
+    rc = nvme_wait_ready(d, true);
+    if (rc != NVME_OK)
+        return rc;
+
+    /* Прерывания по линии не используются: только MSI-X или опрос */
+    nvme_write32(d, NVME_REG_INTMS, 0xFFFFFFFFu);
+    return NVME_OK;
+}
+
+static int nvme_identify_all(nvme_disk_t *d)
+{
+    uint8_t *id = alloc_page();
+    if (!id)
+        return NVME_ERR_NOMEM;
+
+    int rc = nvme_identify(d, NVME_IDENTIFY_CONTROLLER, 0, id);
+    if (rc == NVME_OK)
+    {
+        /* MDTS (байт 77): предел передачи 2^MDTS минимальных страниц, 0 - без предела */
+        uint8_t mdts = id[77];
+        d->write_cache = (id[525] & 1) != 0;
+
+        d->nsid = 1;
+        rc = nvme_identify(d, NVME_IDENTIFY_NAMESPACE, d->nsid, id);
+        if (rc == NVME_OK)
+        {
+            uint64_t nsze;
+            memcpy(&nsze, id, sizeof(nsze));
+            /* FLBAS (байт 26) выбирает формат, LBADS - log2 размера блока */
+            uint8_t lbaf = id[26] & 0xF;
+            uint8_t lbads = id[128 + lbaf * 4 + 2];
+
+            if (nsze == 0 || lbads < 9 || (1u << lbads) > NVME_MAX_SECTOR_SIZE)
+            {
+                rc = NVME_ERR_INVALID;
+            }
+            else
+            {
+                d->total_sectors = nsze;
+                d->sector_size = (uint16_t)(1u << lbads);
+                uint32_t max_bytes = NVME_MAX_TRANSFER;
+                if (mdts && mdts < 16 && ((uint32_t)PAGE_SIZE << mdts) < max_bytes)
+                    max_bytes = (uint32_t)PAGE_SIZE << mdts;
+                d->max_sectors = max_bytes / d->sector_size;
+            }
+        }
+    }
+
+    free_page(id);
+    return rc;
+}
+
+/* Пара очередей на процессор, векторы MSI-X - по номеру очереди */
+static int nvme_create_io_queues(nvme_disk_t *d)
+{
+    uint32_t want = (uint32_t)__builtin_popcountll(sched_get_online_cpus());
+    if (want > NVME_MAX_IO_QUEUES)
+        want = NVME_MAX_IO_QUEUES;
+
+    /* Векторы MSI делят все устройства: очередей не больше, чем свободных векторов */
+    uint32_t avail = (uint32_t)irq_msi_available();
+    if (avail && want > avail)
+        want = avail;
+
+    nvme_sqe_t cmd = { 0 };
+    cmd.cdw0 = NVME_ADMIN_SET_FEATURES;
+    cmd.cdw10 = NVME_FEAT_NUM_QUEUES;
+    cmd.cdw11 = ((want - 1) << 16) | (want - 1);
+    uint32_t granted = 0;
+    int rc = nvme_admin(d, &cmd, &granted);
+    if (rc != NVME_OK)
+        return rc;
+
+    /* Контроллер сообщает выделенное число очередей (от нуля) */
+    uint32_t n = want;
+    if ((granted & 0xFFFF) + 1 < n)
+        n = (granted & 0xFFFF) + 1;
+    if ((granted >> 16) + 1 < n)
+        n = (granted >> 16) + 1;
+
+    /* Запись 0 таблицы MSI-X - у очереди администратора, она работает опросом */
+    uint8_t vectors[NVME_MAX_IO_QUEUES + 1] = { 0 };
+    bool msix = false;
+    if (pci_find_capability(d->pci, PCI_CAP_ID_MSIX, 0))
+    {
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            int v = irq_alloc_msi(nvme_irq, &d->io[i]);
+            vectors[i + 1] = v >= 0 ? (uint8_t)v : 0;
+        }
+        msix = pci_enable_msix(d->pci, lapic_id(), vectors, (int)n + 1) == 0;
+
+        /* Очереди работают опросом - векторы возвращаются другим устройствам */
+        if (!msix)
+            for (uint32_t i = 1; i <= n; ++i)
+                irq_free_msi(vectors[i]);
+    }
+
+    uint32_t mqes = NVME_CAP_MQES(d->cap) + 1;
+    uint16_t size = mqes < NVME_IO_QUEUE_SIZE ? (uint16_t)mqes : NVME_IO_QUEUE_SIZE;
+
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        nvme_queue_t *q = &d->io[i];
+        uint16_t qid = (uint16_t)(i + 1);
+        bool irq = msix && vectors[qid];
+
+        rc = nvme_queue_alloc(d, q, qid, size, true);
+        if (rc != NVME_OK)
+            break;
+
+        /* CQ: физически непрерывная (PC), прерывания по вектору qid (IEN) */
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.cdw0 = NVME_ADMIN_CREATE_CQ;
+        cmd.prp1 = q->cq_phys;
+        cmd.cdw10 = ((uint32_t)(size - 1) << 16) | qid;
+        cmd.cdw11 = 1u | (irq ? (2u | ((uint32_t)qid << 16)) : 0);
+        rc = nvme_admin(d, &cmd, NULL);
+        if (rc != NVME_OK)
+            break;
+
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.cdw0 = NVME_ADMIN_CREATE_SQ;
+        cmd.prp1 = q->sq_phys;
+        cmd.cdw10 = ((uint32_t)(size - 1) << 16) | qid;
+        cmd.cdw11 = 1u | ((uint32_t)qid << 16);
+        rc = nvme_admin(d, &cmd, NULL);
+        if (rc != NVME_OK)
+            break;
+
+        q->irq_ready = irq;
+        d->io_queues = i + 1;
+    }
+
+    /* Недосозданная очередь: SQ у контроллера нет, и в её CQ ничего не придёт */
+    if (d->io_queues < n)
+        nvme_queue_free(&d->io[d->io_queues]);
+    if (msix)
+        for (uint32_t i = d->io_queues + 1; i <= n; ++i)
+            irq_free_msi(vectors[i]);
+
+    return d->io_queues ? NVME_OK : rc;
+}
+
+/*
+ * Откат неудачной инициализации: контроллер выключается и теряет захват шины
+ * (с ним - и MSI-X), после чего очереди и bounce-буфер можно отдать
+ */
+static void nvme_teardown(nvme_disk_t *d)
+{
+    if (d->regs)
+    {
+        nvme_write32(d, NVME_REG_CC, nvme_read32(d, NVME_REG_CC) & ~NVME_CC_EN);
+        nvme_wait_ready(d, false);
+    }
+    pci_disable_bus_master(d->pci);
+
+    nvme_queue_free(&d->admin);
+    for (uint32_t i = 0; i < NVME_MAX_IO_QUEUES; ++i)
+        nvme_queue_free(&d->io[i]);
+    d->io_queues = 0;
+
+    if (d->bounce)
+        for (int i = 0; i < NVME_BOUNCE_PAGES; ++i)
+            free_page(d->bounce + i * PAGE_SIZE);
+    d->bounce = NULL;
+}
+
+int nvme_init(nvme_disk_t *disk, int index)
+{
+    if (!disk || index < 0)
+        return NVME_ERR_INVALID;
+
+    pci_device_t *pci = nvme_find(index);
+    if (!pci)
+        return NVME_ERR_INVALID;
+
+    memset(disk, 0, sizeof(*disk));
+    disk->pci = pci;
+    disk->bounce_lock = (mutex_t)MUTEX_INIT;
+
+    pci_enable_bus_master(pci);
+    uint64_t size = pci->bar_size[0];
+    disk->regs = (volatile uint8_t *)vmm_map_mmio(pci->bar_addr[0], size ? size : 0x2000);
+    if (!disk->regs)
+    {
+        nvme_teardown(disk);
+        return NVME_ERR_NOMEM;
+    }
+    disk->cap = nvme_read64(disk, NVME_REG_CAP);
+
+    /* Драйвер работает страницами 4 КиБ */
+    int rc = NVME_OK;
+    if (NVME_CAP_MPSMIN(disk->cap) > 0)
+        rc = NVME_ERR_INVALID;
+
+    if (rc == NVME_OK)
+    {
+        disk->bounce = alloc_pages(NVME_BOUNCE_PAGES);
+        if (!disk->bounce)
+            rc = NVME_ERR_NOMEM;
+    }
+    if (rc == NVME_OK)
+        rc = nvme_enable(disk);
+    if (rc == NVME_OK)
+        rc = nvme_identify_all(disk);
+    if (rc == NVME_OK)
+        rc = nvme_create_io_queues(disk);
+    if (rc != NVME_OK)
+    {
+        kprint(KPRINT_ERROR, "NVMe%d: init failed (%d)\n", index, rc);
+        nvme_teardown(disk);
+        return rc;
+    }
+
+    kprint(KPRINT_LOG, "NVMe%d: %lu blocks of %u bytes, %u I/O queues, %s\n", index,
+           disk->total_sectors, (uint32_t)disk->sector_size, disk->io_queues,
+           disk->io[0].irq_ready ? "MSI-X" : "polling");
+    return NVME_OK;
+}
+
+int nvme_read_sectors(nvme_disk_t *disk, uint64_t lba, uint32_t count, void *buffer)
+{
+    return nvme_rw(disk, lba, count, (uint8_t *)buffer, false);
+}
+
+int nvme_write_sectors(nvme_disk_t *disk, uint64_t lba, uint32_t count, const void *buffer)
+{
+    /* Контроллер только читает буфер, const снимаем ради общего пути */
+    return nvme_rw(disk, lba, count, (uint8_t *)buffer, true);
+}
+
+int nvme_flush(nvme_disk_t *disk)
+{
+    if (!disk || !disk->io_queues)
+        return NVME_ERR_INVALID;
+    if (disk->broken)
+        return NVME_ERR_DEVICE;
+    if (!disk->write_cache)
+        return NVME_OK;
+
+    return nvme_flush_cache(disk);
+}
+
+int nvme_submit_async(nvme_disk_t *disk, uint64_t lba, uint32_t count, void *buffer, bool write,
+                      nvme_aio_t *aio, nvme_done_t cb, void *arg)
+{
+    int rc = nvme_check(disk, lba, count, buffer);
+    if (rc != NVME_OK)
+        return rc;
+    if (!aio || !cb)
+        return NVME_ERR_INVALID;
+
+    /* Опрос и bounce-буфер - только на синхронном пути */
+    nvme_queue_t *q = nvme_this_queue(disk);
+    if (!q->irq_ready || !irqs_enabled() || ((uintptr_t)buffer & 3))
+        return NVME_ERR_INVALID;
+
+    /* Ссылка самой отправки: cb не раньше, чем в очередь уйдут все части */
+    aio->pending = 1;
+    aio->rc = NVME_OK;
+    aio->result = 0;
+    completion_reinit(&aio->done);
+    aio->cb = cb;
+    aio->arg = arg;
+    aio->start_ns = timer_now_ns();
+    aio->sectors = (uint32_t)((uint64_t)count * disk->sector_size / 512);
+
+    rc = nvme_queue_rw(q, aio, lba, count, (uint8_t *)buffer, write, true);
+
+    uint64_t flags = save_irq_disable();
+    if (rc != NVME_OK)
+        aio->rc = rc;
+    if (--aio->pending == 0)
+        nvme_batch_done(disk, aio);
+    restore_irq(flags);
+    return NVME_OK;
+}
+
+void nvme_poll(nvme_disk_t *disk)
+{
+    if (!disk)
+        return;
+
+    uint64_t flags = save_irq_disable();
+    for (uint32_t i = 0; i < disk->io_queues; ++i)
+        nvme_reap(&disk->io[i]);
+    restore_irq(flags);
+}
+
+int nvme_get_stats(nvme_disk_t *disk, io_stats_t *out, bool reset)
+{
+    if (!disk || !out)
+        return NVME_ERR_INVALID;
+
+    uint64_t flags = save_irq_disable();
+    *out = disk->stats;
+    if (reset)
+        memset(&disk->stats, 0, sizeof(disk->stats));
+    restore_irq(flags);
+    return NVME_OK;
+}
@@ -0,0 +1,186 @@
+#ifndef NVME_H
+#define NVME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pci.h"
+#include "iostat.h"
+#include "../multitask/mutex.h"
+#include "../multitask/waitqueue.h"
+#include "../multitask/completion.h"
+
+/* PCI: класс 01h, подкласс 08h (NVM), prog_if 02h (NVMe); регистры - BAR0 */
+#define NVME_PCI_SUBCLASS 0x08
+#define NVME_PCI_PROG_IF 0x02
+
+/* Регистры контроллера */
+#define NVME_REG_CAP 0x00
+#define NVME_REG_VS 0x08
+#define NVME_REG_INTMS 0x0C
+#define NVME_REG_CC 0x14
+#define NVME_REG_CSTS 0x1C
+#define NVME_REG_AQA 0x24
+#define NVME_REG_ASQ 0x28
+#define NVME_REG_ACQ 0x30
+#define NVME_REG_DOORBELL 0x1000
+
+#define NVME_CAP_MQES(cap) ((uint32_t)((cap) & 0xFFFF))
+#define NVME_CAP_TO(cap) ((uint32_t)(((cap) >> 24) & 0xFF))     /* единицы по 500 мс */
+#define NVME_CAP_DSTRD(cap) ((uint32_t)(((cap) >> 32) & 0xF))
+#define NVME_CAP_MPSMIN(cap) ((uint32_t)(((cap) >> 48) & 0xF))
+
+#define NVME_CC_EN (1u << 0)
+#define NVME_CC_IOSQES (6u << 16) /* 64 байта */
+#define NVME_CC_IOCQES (4u << 20) /* 16 байт */
+
+#define NVME_CSTS_RDY (1u << 0)
+#define NVME_CSTS_CFS (1u << 1)
+
+/* Команды администратора */
+#define NVME_ADMIN_CREATE_SQ 0x01
+#define NVME_ADMIN_CREATE_CQ 0x05
+#define NVME_ADMIN_IDENTIFY 0x06
+#define NVME_ADMIN_SET_FEATURES 0x09
+
+#define NVME_IDENTIFY_NAMESPACE 0
+#define NVME_IDENTIFY_CONTROLLER 1
+#define NVME_FEAT_NUM_QUEUES 0x07
+
+/* Команды ввода-вывода */
+#define NVME_CMD_FLUSH 0x00
+#define NVME_CMD_WRITE 0x01
+#define NVME_CMD_READ 0x02
+
+typedef struct __attribute__((packed))
+{
+    uint32_t cdw0;    /* opcode 7:0, идентификатор команды 31:16 */
+    uint32_t nsid;
+    uint64_t reserved;
+    uint64_t mptr;
+    uint64_t prp1;
+    uint64_t prp2;
+    uint32_t cdw10;
+    uint32_t cdw11;
+    uint32_t cdw12;
+    uint32_t cdw13;
+    uint32_t cdw14;
+    uint32_t cdw15;
+} nvme_sqe_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t result;
+    uint32_t reserved;
+    uint16_t sq_head;
+    uint16_t sq_id;
+    uint16_t cid;
+    uint16_t status;  /* бит 0 - фаза, 15:1 - код завершения */
+} nvme_cqe_t;
+
+#define NVME_ADMIN_QUEUE_SIZE 32
+#define NVME_IO_QUEUE_SIZE 64
+/* Команд в полёте на очередь: по биту маски и списку PRP на каждую */
+#define NVME_QUEUE_SLOTS 32
+#define NVME_MAX_IO_QUEUES 4
+
+/* Байт на команду; список PRP части - не больше NVME_PRP_ENTRIES адресов */
+#define NVME_MAX_TRANSFER (128 * 1024)
+#define NVME_PRP_ENTRIES (NVME_MAX_TRANSFER / 4096)
+
+#define NVME_MAX_DISKS 4
+/* Поддерживаемые форматы LBA: от 512 байт до 4 КиБ */
+#define NVME_MAX_SECTOR_SIZE 4096
+
+/* Коды возврата */
+#define NVME_OK 0
+#define NVME_ERR_TIMEOUT -1
+#define NVME_ERR_DEVICE -2
+#define NVME_ERR_INVALID -3
+#define NVME_ERR_NOMEM -4
+
+/* Завершение асинхронного запроса: с выключенными прерываниями, обычно из обработчика */
+typedef void (*nvme_done_t)(void *arg, int rc);
+
+/*
+ * Запрос вызывающего: части уходят в очередь без ожидания друг друга.
+ * Синхронный путь спит на done, асинхронный получает вызов cb
+ */
+typedef struct nvme_aio
+{
+    volatile uint32_t pending;
+    int rc;
+    uint32_t result;              /* DW0 последнего завершения, нужен командам администратора */
+    completion_t done;
+    nvme_done_t cb;
+    void *arg;
+    uint64_t start_ns;
+    uint32_t sectors;             /* по 512 байт, для статистики */
+} nvme_aio_t;
+
+/* Пара очередей: подача (SQ) и завершение (CQ) с одним номером */
+typedef struct nvme_queue
+{
+    struct nvme_disk *disk;
+    uint16_t qid;
+    uint16_t size;
+    volatile nvme_sqe_t *sq;      /* адреса HHDM */
+    volatile nvme_cqe_t *cq;
+    uint64_t sq_phys;
+    uint64_t cq_phys;
+    volatile uint32_t *sq_db;
+    volatile uint32_t *cq_db;
+    uint16_t sq_tail;
+    uint16_t cq_head;
+    uint16_t phase;               /* ожидаемый бит фазы новых записей CQ */
+    uint64_t *prp_lists;          /* NVME_PRP_ENTRIES адресов на слот */
+    uint64_t prp_phys;
+    uint32_t slots;
+    uint32_t free_slots;          /* битовая маска идентификаторов команд */
+    void *batches[NVME_QUEUE_SLOTS];
+    wait_queue_t space;           /* ждут свободный идентификатор */
+    bool irq_ready;               /* вектор MSI-X назначен */
+} nvme_queue_t;
+
+typedef struct nvme_disk
+{
+    pci_device_t *pci;
+    volatile uint8_t *regs;
+    uint64_t cap;
+    uint32_t nsid;
+    uint64_t total_sectors;       /* блоков пространства имён */
+    uint16_t sector_size;         /* размер блока, 512 или 4096 */
+    uint32_t max_sectors;         /* блоков на команду */
+    bool write_cache;             /* после записи нужен Flush */
+    bool broken;
+    nvme_queue_t admin;
+    nvme_queue_t io[NVME_MAX_IO_QUEUES];
+    uint32_t io_queues;           /* по паре на процессор, если контроллер даёт */
+    uint8_t *bounce;              /* для буферов, не выровненных на 4 байта */
+    mutex_t bounce_lock;
+    io_stats_t stats;             /* под выключенными прерываниями */
+} nvme_disk_t;
+
+/* Инициализирует index-й NVMe-контроллер (первое пространство имён) */
+int nvme_init(nvme_disk_t *disk, int index);
+
+/* Большой запрос делится на части, которые выполняются одновременно */
+int nvme_read_sectors(nvme_disk_t *disk, uint64_t lba, uint32_t count, void *buffer);
+int nvme_write_sectors(nvme_disk_t *disk, uint64_t lba, uint32_t count, const void *buffer);
+int nvme_flush(nvme_disk_t *disk);
+
+/*
+ * Асинхронные чтение и запись в очередь текущего процессора, только при
+ * MSI-X и буфере, выровненном на 4 байта. NVME_OK - cb будет вызван ровно
+ * один раз, ошибка - ничего не отправлено. aio нужен до вызова cb.
+ * Кэш записи не сбрасывается: для этого nvme_flush
+ */
+int nvme_submit_async(nvme_disk_t *disk, uint64_t lba, uint32_t count, void *buffer, bool write,
+                      nvme_aio_t *aio, nvme_done_t cb, void *arg);
+
+/* Разбирает завершения всех очередей, если прерывание потерялось */
+void nvme_poll(nvme_disk_t *disk);
+
+/* Копия статистики запросов, при reset счётчики обнуляются */
+int nvme_get_stats(nvme_disk_t *disk, io_stats_t *out, bool reset);
+
+#endif // NVME_H
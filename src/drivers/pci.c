@@ -3,6 +3,7 @@
 #include "../malloc/malloc.h"
 #include "../graphics/formatting.h"
 #include "../libc/string.h"
+#include "../mm/vmm.h"
 #include <stdint.h>
 
 #define CONFIG_ADDRESS_PORT 0xCF8
@@ -260,4 +261,151 @@ bool pci_is_storage_device(pci_device_t *dev)
     }
 
     return false;
+}
+
+void pci_enable_bus_master(pci_device_t *dev)
+{
+    if (!dev)
+        return;
+
+    uint16_t cmd = pci_config_read16(dev->bus, dev->device, dev->function, 0x04);
+    cmd |= (1u << 0) | (1u << 1) | (1u << 2);
+    pci_config_write32(dev->bus, dev->device, dev->function, 0x04, (uint32_t)cmd);
+}
+
+void pci_disable_bus_master(pci_device_t *dev)
+{
+    if (!dev)
+        return;
+
+    uint16_t cmd = pci_config_read16(dev->bus, dev->device, dev->function, 0x04);
+    pci_write16(dev, 0x04, (uint16_t)(cmd & ~(1u << 2)));
+}
+
+uint8_t pci_read8(pci_device_t *dev, uint8_t offset)
+{
+    return pci_config_read8(dev->bus, dev->device, dev->function, offset);
+}
+
+uint16_t pci_read16(pci_device_t *dev, uint8_t offset)
+{
+    return pci_config_read16(dev->bus, dev->device, dev->function, offset);
+}
+
+uint32_t pci_read32(pci_device_t *dev, uint8_t offset)
+{
+    return pci_config_read32(dev->bus, dev->device, dev->function, offset);
+}
+
+void pci_write16(pci_device_t *dev, uint8_t offset, uint16_t value)
+{
+    /* Запись только 32-битная: соседнюю половину сохраняем */
+    uint32_t v = pci_read32(dev, offset & 0xFC);
+    int shift = (offset & 2) * 8;
+    v = (v & ~(0xFFFFu << shift)) | ((uint32_t)value << shift);
+    pci_write32(dev, offset & 0xFC, v);
+}
+
+void pci_write32(pci_device_t *dev, uint8_t offset, uint32_t value)
+{
+    pci_config_write32(dev->bus, dev->device, dev->function, offset, value);
+}
+
+uint8_t pci_find_capability(pci_device_t *dev, uint8_t id, uint8_t start)
+{
+    if (!dev)
+        return 0;
+
+    /* Status, бит 4: список capabilities есть */
+    if (!(pci_read16(dev, 0x06) & (1u << 4)))
+        return 0;
+
+    uint8_t ptr = start ? pci_read8(dev, start + 1) : pci_read8(dev, 0x34);
+
+    /* Ограничение шагов - защита от зацикленного списка */
+    for (int i = 0; i < 48 && ptr >= 0x40; ++i)
+    {
+        ptr &= 0xFC;
+        if (pci_read8(dev, ptr) == id)
+            return ptr;
+        ptr = pci_read8(dev, ptr + 1);
+    }
+    return 0;
+}
+
+int pci_enable_msi(pci_device_t *dev, uint32_t apic_id, uint8_t vector)
+{
+    uint8_t cap = pci_find_capability(dev, PCI_CAP_ID_MSI, 0);
+    if (!cap)
+        return -1;
+
+    uint16_t ctrl = pci_read16(dev, cap + 2);
+
+    /* Адрес 0xFEExxxxx: физическая адресация, получатель в битах 19:12 */
+    pci_write32(dev, cap + 4, 0xFEE00000u | ((apic_id & 0xFF) << 12));
+    if (ctrl & (1u << 7))
+    {
+        /* 64-битный адрес: данные сдвинуты на двойное слово */
+        pci_write32(dev, cap + 8, 0);
+        pci_write16(dev, cap + 12, vector);
+    }
+    else
+    {
+        pci_write16(dev, cap + 8, vector);
+    }
+
+    /* Одно сообщение (Multiple Message Enable = 0) и включение */
+    ctrl = (uint16_t)((ctrl & ~(0x7u << 4)) | 1u);
+    pci_write16(dev, cap + 2, ctrl);
+
+    pci_write16(dev, 0x04, pci_read16(dev, 0x04) | (1u << 10));
+    return 0;
+}
+
+int pci_enable_msix(pci_device_t *dev, uint32_t apic_id, const uint8_t *vectors, int count)
+{
+    uint8_t cap = pci_find_capability(dev, PCI_CAP_ID_MSIX, 0);
+    if (!cap)
+        return -1;
+
+    uint16_t ctrl = pci_read16(dev, cap + 2);
+    int size = (ctrl & 0x7FF) + 1;
+    if (count > size)
+        return -1;
+
+    /* Таблица в BAR с номером BIR (биты 2:0), смещение - остальные биты */
+    uint32_t table = pci_read32(dev, cap + 4);
+    uint8_t bir = table & 0x7;
+    if (bir > 5 || dev->bar_is_io[bir] || !dev->bar_addr[bir])
+        return -1;
+
+    volatile uint32_t *entries = (volatile uint32_t *)vmm_map_mmio(
+        dev->bar_addr[bir] + (table & ~0x7u), (size_t)size * 16);
+    if (!entries)
+        return -1;
+
+    /* Пока таблица меняется, функция целиком замаскирована */
+    pci_write16(dev, cap + 2, ctrl | (1u << 14));
+
+    for (int i = 0; i < size; ++i)
+    {
+        volatile uint32_t *e = entries + i * 4;
+        if (i < count && vectors[i])
+        {
+            e[0] = 0xFEE00000u | ((apic_id & 0xFF) << 12);
+            e[1] = 0;
+            e[2] = vectors[i];
+            e[3] = 0;
+        }
+        else
+        {
+            e[3] = 1;
+        }
+    }
+
+    ctrl = (uint16_t)((ctrl & ~(1u << 14)) | (1u << 15));
+    pci_write16(dev, cap + 2, ctrl);
+
+    pci_write16(dev, 0x04, pci_read16(dev, 0x04) | (1u << 10));
+    return 0;
 }
\ No newline at end of file
@@ -28,5 +28,31 @@ void pci_init(void);
 int pci_get_device_count(void);
 pci_device_t *pci_get_device(int idx);
 bool pci_is_storage_device(pci_device_t *dev);
+/* Разрешает устройству I/O, память (MMIO) и захват шины (DMA) */
+void pci_enable_bus_master(pci_device_t *dev);
+/* Запрещает захват шины: зависшее устройство больше не пишет в память */
+void pci_disable_bus_master(pci_device_t *dev);
+
+/* Конфигурационное пространство найденного устройства */
+uint8_t pci_read8(pci_device_t *dev, uint8_t offset);
+uint16_t pci_read16(pci_device_t *dev, uint8_t offset);
+uint32_t pci_read32(pci_device_t *dev, uint8_t offset);
+void pci_write16(pci_device_t *dev, uint8_t offset, uint16_t value);
+void pci_write32(pci_device_t *dev, uint8_t offset, uint32_t value);
+
+#define PCI_CAP_ID_MSI    0x05
+#define PCI_CAP_ID_VENDOR 0x09
+#define PCI_CAP_ID_MSIX   0x11
+
+/* Следующая после start capability с данным ID (start = 0 - с начала списка); 0, если нет */
+uint8_t pci_find_capability(pci_device_t *dev, uint8_t id, uint8_t start);
+
+/* Одно сообщение MSI с вектором vector на Local APIC apic_id, INTx запрещается.
+   -1, если capability MSI нет */
+int pci_enable_msi(pci_device_t *dev, uint32_t apic_id, uint8_t vector);
+
+/* MSI-X: запись i таблицы получает vectors[i] (0 - остаётся замаскированной),
+   остальные маскируются, INTx запрещается. -1, если capability нет или таблица меньше count */
+int pci_enable_msix(pci_device_t *dev, uint32_t apic_id, const uint8_t *vectors, int count);
 
 #endif /* PCI_H */
\ No newline at end of file
@@ -0,0 +1,405 @@
+#include "virtio.h"
+#include "../portio/portio.h"
+#include "../mm/pmm.h"
+#include "../mm/vmm.h"
+#include "../malloc/malloc.h"
+#include "../libc/string.h"
+
+#define VIRTIO_RESET_LOOPS 1000000U
+
+/* Modern: все поля common cfg читаются и пишутся своей шириной */
+static inline uint8_t mmio_read8(volatile uint8_t *base, uint32_t off)
+{
+    return *(volatile uint8_t *)(base + off);
+}
+
+static inline uint16_t mmio_read16(volatile uint8_t *base, uint32_t off)
+{
+    return *(volatile uint16_t *)(base + off);
+}
+
+static inline uint32_t mmio_read32(volatile uint8_t *base, uint32_t off)
+{
+    return *(volatile uint32_t *)(base + off);
+}
+
+static inline void mmio_write8(volatile uint8_t *base, uint32_t off, uint8_t v)
+{
+    *(volatile uint8_t *)(base + off) = v;
+}
+
+static inline void mmio_write16(volatile uint8_t *base, uint32_t off, uint16_t v)
+{
+    *(volatile uint16_t *)(base + off) = v;
+}
+
+static inline void mmio_write32(volatile uint8_t *base, uint32_t off, uint32_t v)
+{
+    *(volatile uint32_t *)(base + off) = v;
+}
+
+/* 64-битные поля - двумя 32-битными записями, младшая половина первой */
+static inline void mmio_write64(volatile uint8_t *base, uint32_t off, uint64_t v)
+{
+    mmio_write32(base, off, (uint32_t)v);
+    mmio_write32(base, off + 4, (uint32_t)(v >> 32));
+}
+
+static uint8_t virtio_get_status(virtio_dev_t *vd)
+{
+    if (vd->modern)
+        return mmio_read8(vd->common, VIRTIO_COMMON_STATUS);
+    return inb(vd->io_base + VIRTIO_LEGACY_STATUS);
+}
+
+static void virtio_set_status(virtio_dev_t *vd, uint8_t status)
+{
+    if (vd->modern)
+        mmio_write8(vd->common, VIRTIO_COMMON_STATUS, status);
+    else
+        outb(vd->io_base + VIRTIO_LEGACY_STATUS, status);
+}
+
+static void virtio_add_status(virtio_dev_t *vd, uint8_t bits)
+{
+    virtio_set_status(vd, virtio_get_status(vd) | bits);
+}
+
+/* Отображает структуру из vendor capability; NULL, если BAR не память
+   или отобразить его не удалось */
+static volatile uint8_t *virtio_map_cap(pci_device_t *pci, uint8_t cap)
+{
+    uint8_t bar = pci_read8(pci, cap + 4);
+    uint32_t offset = pci_read32(pci, cap + 8);
+    uint32_t length = pci_read32(pci, cap + 12);
+
+    if (bar > 5 || pci->bar_is_io[bar] || !pci->bar_addr[bar] || !length)
+        return NULL;
+    return (volatile uint8_t *)vmm_map_mmio(pci->bar_addr[bar] + offset, length);
+}
+
+/* Ищет структуры modern-интерфейса; false - устройство только legacy */
+static bool virtio_find_modern(virtio_dev_t *vd)
+{
+    pci_device_t *pci = vd->pci;
+    uint8_t caps[5] = { 0 };
+
+    for (uint8_t cap = pci_find_capability(pci, PCI_CAP_ID_VENDOR, 0); cap;
+         cap = pci_find_capability(pci, PCI_CAP_ID_VENDOR, cap))
+    {
+        /* Берём первую структуру каждого типа - так рекомендует спецификация */
+        uint8_t type = pci_read8(pci, cap + 3);
+        if (type >= VIRTIO_PCI_CAP_COMMON && type <= VIRTIO_PCI_CAP_DEVICE && !caps[type])
+            caps[type] = cap;
+    }
+
+    if (!caps[VIRTIO_PCI_CAP_COMMON] || !caps[VIRTIO_PCI_CAP_NOTIFY] || !caps[VIRTIO_PCI_CAP_ISR])
+        return false;
+
+    vd->common = virtio_map_cap(pci, caps[VIRTIO_PCI_CAP_COMMON]);
+    vd->notify = virtio_map_cap(pci, caps[VIRTIO_PCI_CAP_NOTIFY]);
+    vd->isr = virtio_map_cap(pci, caps[VIRTIO_PCI_CAP_ISR]);
+    vd->device = caps[VIRTIO_PCI_CAP_DEVICE] ? virtio_map_cap(pci, caps[VIRTIO_PCI_CAP_DEVICE]) : NULL;
+    if (!vd->common || !vd->notify || !vd->isr)
+        return false;
+    if (caps[VIRTIO_PCI_CAP_DEVICE] && !vd->device)
+        return false;
+
+    vd->notify_mult = pci_read32(pci, caps[VIRTIO_PCI_CAP_NOTIFY] + 16);
+    return true;
+}
+
+int virtio_init(virtio_dev_t *vd, pci_device_t *pci)
+{
+    if (!vd || !pci || pci->vendor_id != VIRTIO_PCI_VENDOR)
+        return VIRTIO_ERR_INVALID;
+
+    memset(vd, 0, sizeof(*vd));
+    vd->pci = pci;
+
+    /* I/O, память и bus-master; бит 10 (запрет INTx) снимаем */
+    uint16_t cmd = pci_read16(pci, 0x04);
+    cmd = (uint16_t)((cmd | 0x07) & ~(1u << 10));
+    pci_write16(pci, 0x04, cmd);
+
+    vd->modern = virtio_find_modern(vd);
+    if (!vd->modern)
+    {
+        if (!pci->bar_is_io[0] || !pci->bar_addr[0])
+            return VIRTIO_ERR_INVALID;
+        vd->io_base = (uint16_t)pci->bar_addr[0];
+    }
+
+    uint8_t line = pci_read8(pci, 0x3C);
+    vd->irq = line < 16 ? line : 0xFF;
+
+    if (virtio_reset(vd) != VIRTIO_OK)
+        return VIRTIO_ERR_TIMEOUT;
+
+    virtio_add_status(vd, VIRTIO_STATUS_ACK);
+    virtio_add_status(vd, VIRTIO_STATUS_DRIVER);
+    return VIRTIO_OK;
+}
+
+int virtio_negotiate(virtio_dev_t *vd, uint64_t wanted, uint64_t *accepted)
+{
+    uint64_t features;
+
+    if (vd->modern)
+    {
+        mmio_write32(vd->common, VIRTIO_COMMON_DFSELECT, 0);
+        features = mmio_read32(vd->common, VIRTIO_COMMON_DF);
+        mmio_write32(vd->common, VIRTIO_COMMON_DFSELECT, 1);
+        features |= (uint64_t)mmio_read32(vd->common, VIRTIO_COMMON_DF) << 32;
+
+        /* Без VERSION_1 modern-интерфейс не работает */
+        wanted |= VIRTIO_F_VERSION_1;
+        features &= wanted;
+        if (!(features & VIRTIO_F_VERSION_1))
+            return VIRTIO_ERR_DEVICE;
+
+        mmio_write32(vd->common, VIRTIO_COMMON_GFSELECT, 0);
+        mmio_write32(vd->common, VIRTIO_COMMON_GF, (uint32_t)features);
+        mmio_write32(vd->common, VIRTIO_COMMON_GFSELECT, 1);
+        mmio_write32(vd->common, VIRTIO_COMMON_GF, (uint32_t)(features >> 32));
+
+        virtio_add_status(vd, VIRTIO_STATUS_FEATURES_OK);
+        if (!(virtio_get_status(vd) & VIRTIO_STATUS_FEATURES_OK))
+            return VIRTIO_ERR_DEVICE;
+    }
+    else
+    {
+        /* У legacy только 32 бита признаков */
+        features = inl(vd->io_base + VIRTIO_LEGACY_DEVICE_FEATURES) & wanted & 0xFFFFFFFFULL;
+        outl(vd->io_base + VIRTIO_LEGACY_DRIVER_FEATURES, (uint32_t)features);
+    }
+
+    if (accepted)
+        *accepted = features;
+    return VIRTIO_OK;
+}
+
+/* Раскладка legacy: дескрипторы, avail, used с границы страницы. Modern принимает её же */
+static size_t virtq_bytes(uint16_t size, size_t *used_off)
+{
+    size_t avail_end = sizeof(virtq_desc_t) * size + sizeof(uint16_t) * (3 + size);
+    *used_off = ALIGN_UP(avail_end, PAGE_SIZE);
+    return *used_off + ALIGN_UP(sizeof(uint16_t) * 3 + sizeof(virtq_used_elem_t) * size, PAGE_SIZE);
+}
+
+static int virtq_alloc(virtq_t *vq, uint16_t index, uint16_t size)
+{
+    size_t used_off;
+    size_t pages = virtq_bytes(size, &used_off) / PAGE_SIZE;
+
+    uint8_t *mem = alloc_pages(pages);
+    void **cookies = malloc(sizeof(void *) * size);
+    if (!mem || !cookies)
+    {
+        if (mem)
+            for (size_t i = 0; i < pages; ++i)
+                free_page(mem + i * PAGE_SIZE);
+        if (cookies)
+            free(cookies);
+        return VIRTIO_ERR_NOMEM;
+    }
+    memset(mem, 0, pages * PAGE_SIZE);
+    memset(cookies, 0, sizeof(void *) * size);
+
+    vq->index = index;
+    vq->size = size;
+    vq->desc = (virtq_desc_t *)mem;
+    vq->avail = (volatile virtq_avail_t *)(mem + sizeof(virtq_desc_t) * size);
+    vq->used = (volatile virtq_used_t *)(mem + used_off);
+    vq->phys = (uint64_t)mem - hhdm_offset;
+    vq->pages = pages;
+    vq->cookies = cookies;
+    vq->last_used = 0;
+
+    for (uint16_t i = 0; i < size; ++i)
+        vq->desc[i].next = (uint16_t)(i + 1);
+    vq->free_head = 0;
+    vq->num_free = size;
+    return VIRTIO_OK;
+}
+
+int virtio_setup_queue(virtio_dev_t *vd, virtq_t *vq, uint16_t index, uint16_t max_size)
+{
+    if (!vd || !vq || !max_size)
+        return VIRTIO_ERR_INVALID;
+
+    if (vd->modern)
+    {
+        mmio_write16(vd->common, VIRTIO_COMMON_Q_SELECT, index);
+        uint16_t size = mmio_read16(vd->common, VIRTIO_COMMON_Q_SIZE);
+        if (!size)
+            return VIRTIO_ERR_DEVICE;
+        if (size > max_size)
+            size = max_size;
+
+        int rc = virtq_alloc(vq, index, size);
+        if (rc != VIRTIO_OK)
+            return rc;
+
+        size_t used_off = (uint8_t *)vq->used - (uint8_t *)vq->desc;
+        mmio_write16(vd->common, VIRTIO_COMMON_Q_SIZE, size);
+        /* MSI-X не используем: прерывания идут по INTx */
+        mmio_write16(vd->common, VIRTIO_COMMON_Q_MSIX, VIRTIO_MSI_NO_VECTOR);
+        mmio_write64(vd->common, VIRTIO_COMMON_Q_DESC, vq->phys);
+        mmio_write64(vd->common, VIRTIO_COMMON_Q_DRIVER, vq->phys + sizeof(virtq_desc_t) * size);
+        mmio_write64(vd->common, VIRTIO_COMMON_Q_DEVICE, vq->phys + used_off);
+        vq->notify_off = mmio_read16(vd->common, VIRTIO_COMMON_Q_NOFF);
+        mmio_write16(vd->common, VIRTIO_COMMON_Q_ENABLE, 1);
+    }
+    else
+    {
+        /* Legacy не даёт выбрать размер очереди */
+        outw(vd->io_base + VIRTIO_LEGACY_QUEUE_SELECT, index);
+        uint16_t size = inw(vd->io_base + VIRTIO_LEGACY_QUEUE_SIZE);
+        if (!size)
+            return VIRTIO_ERR_DEVICE;
+
+        int rc = virtq_alloc(vq, index, size);
+        if (rc != VIRTIO_OK)
+            return rc;
+
+        outl(vd->io_base + VIRTIO_LEGACY_QUEUE_PFN, (uint32_t)(vq->phys / PAGE_SIZE));
+    }
+
+    return VIRTIO_OK;
+}
+
+void virtio_driver_ok(virtio_dev_t *vd)
+{
+    if (vd->modern)
+        mmio_write16(vd->common, VIRTIO_COMMON_MSIX, VIRTIO_MSI_NO_VECTOR);
+    virtio_add_status(vd, VIRTIO_STATUS_DRIVER_OK);
+}
+
+int virtio_reset(virtio_dev_t *vd)
+{
+    /* modern подтверждает сброс чтением нуля */
+    virtio_set_status(vd, 0);
+    for (uint32_t i = 0; virtio_get_status(vd) != 0; ++i)
+        if (i >= VIRTIO_RESET_LOOPS)
+            return VIRTIO_ERR_TIMEOUT;
+    return VIRTIO_OK;
+}
+
+void virtio_fail(virtio_dev_t *vd)
+{
+    virtio_add_status(vd, VIRTIO_STATUS_FAILED);
+}
+
+uint8_t virtio_isr_ack(virtio_dev_t *vd)
+{
+    if (vd->modern)
+        return mmio_read8(vd->isr, 0);
+    return inb(vd->io_base + VIRTIO_LEGACY_ISR);
+}
+
+uint8_t virtio_config_read8(virtio_dev_t *vd, uint16_t offset)
+{
+    if (vd->modern)
+        return vd->device ? mmio_read8(vd->device, offset) : 0;
+    return inb(vd->io_base + VIRTIO_LEGACY_CONFIG + offset);
+}
+
+uint32_t virtio_config_read32(virtio_dev_t *vd, uint16_t offset)
+{
+    if (vd->modern)
+        return vd->device ? mmio_read32(vd->device, offset) : 0;
+    return inl(vd->io_base + VIRTIO_LEGACY_CONFIG + offset);
+}
+
+uint64_t virtio_config_read64(virtio_dev_t *vd, uint16_t offset)
+{
+    if (!vd->modern)
+        return inl(vd->io_base + VIRTIO_LEGACY_CONFIG + offset) |
+               (uint64_t)inl(vd->io_base + VIRTIO_LEGACY_CONFIG + offset + 4) << 32;
+
+    if (!vd->device)
+        return 0;
+
+    /* Половины согласованы, если поколение конфигурации не сменилось между чтениями */
+    uint8_t gen;
+    uint64_t v;
+    do
+    {
+        gen = mmio_read8(vd->common, VIRTIO_COMMON_CFGGEN);
+        v = mmio_read32(vd->device, offset) | (uint64_t)mmio_read32(vd->device, offset + 4) << 32;
+    } while (gen != mmio_read8(vd->common, VIRTIO_COMMON_CFGGEN));
+    return v;
+}
+
+int virtq_add(virtq_t *vq, const virtq_buf_t *bufs, int count, void *cookie)
+{
+    if (count <= 0 || count > vq->num_free)
+        return -1;
+
+    uint16_t head = vq->free_head;
+    uint16_t idx = head;
+    for (int i = 0; i < count; ++i)
+    {
+        virtq_desc_t *d = &vq->desc[idx];
+        d->addr = bufs[i].phys;
+        d->len = bufs[i].len;
+        d->flags = (uint16_t)((bufs[i].device_writes ? VIRTQ_DESC_F_WRITE : 0) |
+                              (i + 1 < count ? VIRTQ_DESC_F_NEXT : 0));
+        if (i + 1 < count)
+            idx = d->next;
+    }
+    vq->free_head = vq->desc[idx].next;
+    vq->num_free = (uint16_t)(vq->num_free - count);
+    vq->cookies[head] = cookie;
+
+    /* Дескрипторы должны стать видны раньше нового индекса */
+    uint16_t avail = vq->avail->idx;
+    vq->avail->ring[avail % vq->size] = head;
+    asm volatile("" ::: "memory");
+    vq->avail->idx = (uint16_t)(avail + 1);
+    return head;
+}
+
+void virtq_kick(virtio_dev_t *vd, virtq_t *vq)
+{
+    /* Новый avail->idx виден раньше, чем читаем флаг подавления уведомлений */
+    asm volatile("mfence" ::: "memory");
+    if (vq->used->flags & VIRTQ_USED_F_NO_NOTIFY)
+        return;
+
+    if (vd->modern)
+        mmio_write16(vd->notify, (uint32_t)vq->notify_off * vd->notify_mult, vq->index);
+    else
+        outw(vd->io_base + VIRTIO_LEGACY_QUEUE_NOTIFY, vq->index);
+}
+
+void *virtq_get_used(virtq_t *vq, uint32_t *len)
+{
+    if (!virtq_has_used(vq))
+        return NULL;
+
+    /* Элемент кольца читаем только после индекса */
+    asm volatile("" ::: "memory");
+    volatile virtq_used_elem_t *e = &vq->used->ring[vq->last_used % vq->size];
+    uint16_t head = (uint16_t)e->id;
+    if (len)
+        *len = e->len;
+    vq->last_used++;
+
+    /* Цепочку целиком возвращаем в список свободных */
+    uint16_t idx = head;
+    uint16_t n = 1;
+    while (vq->desc[idx].flags & VIRTQ_DESC_F_NEXT)
+    {
+        idx = vq->desc[idx].next;
+        n++;
+    }
+    vq->desc[idx].next = vq->free_head;
+    vq->free_head = head;
+    vq->num_free = (uint16_t)(vq->num_free + n);
+
+    void *cookie = vq->cookies[head];
+    vq->cookies[head] = NULL;
+    return cookie;
+}
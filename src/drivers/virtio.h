@@ -0,0 +1,182 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "pci.h"
+
+/* Транспорт virtio поверх PCI: legacy (регистры в BAR0, порты) и modern (capabilities, MMIO) */
+
+#define VIRTIO_PCI_VENDOR 0x1AF4
+
+/* Legacy-интерфейс: смещения в BAR0 при выключенном MSI-X */
+#define VIRTIO_LEGACY_DEVICE_FEATURES 0x00
+#define VIRTIO_LEGACY_DRIVER_FEATURES 0x04
+#define VIRTIO_LEGACY_QUEUE_PFN 0x08
+#define VIRTIO_LEGACY_QUEUE_SIZE 0x0C
+#define VIRTIO_LEGACY_QUEUE_SELECT 0x0E
+#define VIRTIO_LEGACY_QUEUE_NOTIFY 0x10
+#define VIRTIO_LEGACY_STATUS 0x12
+#define VIRTIO_LEGACY_ISR 0x13
+#define VIRTIO_LEGACY_CONFIG 0x14
+
+/* Modern: тип структуры в vendor capability */
+#define VIRTIO_PCI_CAP_COMMON 1
+#define VIRTIO_PCI_CAP_NOTIFY 2
+#define VIRTIO_PCI_CAP_ISR 3
+#define VIRTIO_PCI_CAP_DEVICE 4
+
+/* Modern: поля common configuration */
+#define VIRTIO_COMMON_DFSELECT 0x00
+#define VIRTIO_COMMON_DF 0x04
+#define VIRTIO_COMMON_GFSELECT 0x08
+#define VIRTIO_COMMON_GF 0x0C
+#define VIRTIO_COMMON_MSIX 0x10
+#define VIRTIO_COMMON_NUMQ 0x12
+#define VIRTIO_COMMON_STATUS 0x14
+#define VIRTIO_COMMON_CFGGEN 0x15
+#define VIRTIO_COMMON_Q_SELECT 0x16
+#define VIRTIO_COMMON_Q_SIZE 0x18
+#define VIRTIO_COMMON_Q_MSIX 0x1A
+#define VIRTIO_COMMON_Q_ENABLE 0x1C
+#define VIRTIO_COMMON_Q_NOFF 0x1E
+#define VIRTIO_COMMON_Q_DESC 0x20
+#define VIRTIO_COMMON_Q_DRIVER 0x28
+#define VIRTIO_COMMON_Q_DEVICE 0x30
+
+#define VIRTIO_MSI_NO_VECTOR 0xFFFF
+
+#define VIRTIO_STATUS_ACK 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FEATURES_OK 0x08
+#define VIRTIO_STATUS_FAILED 0x80
+
+#define VIRTIO_F_VERSION_1 (1ULL << 32)
+
+/* ISR status: бит 0 - очередь, бит 1 - изменилась конфигурация. Чтение сбрасывает */
+#define VIRTIO_ISR_QUEUE 0x01
+#define VIRTIO_ISR_CONFIG 0x02
+
+/* Коды возврата */
+#define VIRTIO_OK 0
+#define VIRTIO_ERR_TIMEOUT -1
+#define VIRTIO_ERR_DEVICE -2
+#define VIRTIO_ERR_INVALID -3
+#define VIRTIO_ERR_NOMEM -4
+
+/* Split virtqueue: дескрипторы, кольцо драйвера (avail) и кольцо устройства (used) */
+#define VIRTQ_DESC_F_NEXT 1
+#define VIRTQ_DESC_F_WRITE 2 /* буфер пишет устройство */
+
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 1
+#define VIRTQ_USED_F_NO_NOTIFY 1
+
+/* Больше дескрипторов очереди не берём: кольца укладываются в несколько страниц */
+#define VIRTQ_MAX_SIZE 256
+
+typedef struct __attribute__((packed))
+{
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} virtq_desc_t;
+
+typedef struct __attribute__((packed))
+{
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} virtq_avail_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t id;
+    uint32_t len;
+} virtq_used_elem_t;
+
+typedef struct __attribute__((packed))
+{
+    uint16_t flags;
+    uint16_t idx;
+    virtq_used_elem_t ring[];
+} virtq_used_t;
+
+/* Один физически непрерывный кусок цепочки */
+typedef struct
+{
+    uint64_t phys;
+    uint32_t len;
+    bool device_writes;
+} virtq_buf_t;
+
+typedef struct
+{
+    uint16_t index;
+    uint16_t size;
+    virtq_desc_t *desc; /* адреса HHDM, кольца в одном блоке страниц */
+    volatile virtq_avail_t *avail;
+    volatile virtq_used_t *used;
+    uint64_t phys;
+    size_t pages;
+    uint16_t free_head; /* свободные дескрипторы связаны через next */
+    uint16_t num_free;
+    uint16_t last_used;
+    void **cookies;     /* значение вызывающего по голове цепочки */
+    uint16_t notify_off; /* modern: смещение в области notify */
+} virtq_t;
+
+typedef struct
+{
+    pci_device_t *pci;
+    bool modern;
+    uint16_t io_base;           /* legacy: BAR0 */
+    volatile uint8_t *common;   /* modern: отображённые структуры */
+    volatile uint8_t *isr;
+    volatile uint8_t *device;
+    volatile uint8_t *notify;
+    uint32_t notify_mult;
+    uint8_t irq;                /* линия INTx из конфигурации PCI, 0xFF - нет */
+} virtio_dev_t;
+
+/* Сброс устройства и статусы ACK | DRIVER */
+int virtio_init(virtio_dev_t *vd, pci_device_t *pci);
+
+/* Предлагает wanted & features устройства; для modern VERSION_1 обязателен.
+   Согласованный набор возвращается в *accepted */
+int virtio_negotiate(virtio_dev_t *vd, uint64_t wanted, uint64_t *accepted);
+
+/* Создаёт очередь: не больше max_size дескрипторов (legacy - ровно размер устройства) */
+int virtio_setup_queue(virtio_dev_t *vd, virtq_t *vq, uint16_t index, uint16_t max_size);
+
+void virtio_driver_ok(virtio_dev_t *vd);
+void virtio_fail(virtio_dev_t *vd);
+/* Сброс: устройство забывает очереди и перестаёт обращаться к памяти */
+int virtio_reset(virtio_dev_t *vd);
+
+/* Читает и сбрасывает ISR status; вызывается из обработчика INTx */
+uint8_t virtio_isr_ack(virtio_dev_t *vd);
+
+uint8_t virtio_config_read8(virtio_dev_t *vd, uint16_t offset);
+uint32_t virtio_config_read32(virtio_dev_t *vd, uint16_t offset);
+uint64_t virtio_config_read64(virtio_dev_t *vd, uint16_t offset);
+
+/*
+ * Операции с очередью не блокируются и не защищены: вызывающий сериализует
+ * их сам (у virtio-blk - выключенными прерываниями).
+ * virtq_add возвращает голову цепочки или -1, если дескрипторов не хватает
+ */
+int virtq_add(virtq_t *vq, const virtq_buf_t *bufs, int count, void *cookie);
+void virtq_kick(virtio_dev_t *vd, virtq_t *vq);
+
+/* Забирает одну завершённую цепочку: cookie или NULL, если новых нет */
+void *virtq_get_used(virtq_t *vq, uint32_t *len);
+
+static inline bool virtq_has_used(const virtq_t *vq)
+{
+    return vq->last_used != vq->used->idx;
+}
+
+#endif // VIRTIO_H
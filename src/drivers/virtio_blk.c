@@ -0,0 +1,525 @@
+#include "virtio_blk.h"
+#include "../mm/pmm.h"
+#include "../mm/vmm.h"
+#include "../malloc/malloc.h"
+#include "../multitask/completion.h"
+#include "../time/timer.h"
+#include "../cpu/cpu.h"
+#include "../irq.h"
+#include "../libc/string.h"
+#include "../graphics/formatting.h"
+
+#define VIRTIO_BLK_IRQ_TIMEOUT_NS 5000000000ULL /* 5 с */
+#define VIRTIO_BLK_POLL_LOOPS 50000000U
+/* Кусков данных на запрос: VIRTIO_BLK_REQ_SECTORS с невыровненным началом */
+#define VIRTIO_BLK_MAX_SEGS (VIRTIO_BLK_REQ_SECTORS * VIRTIO_BLK_SECTOR_SIZE / PAGE_SIZE + 1)
+#define VIRTIO_BLK_ALL_FREE ((uint32_t)((1ULL << VIRTIO_BLK_MAX_REQUESTS) - 1))
+
+/* Синхронный запрос живёт на стеке вызывающего, асинхронный - в памяти блочного слоя */
+typedef virtio_blk_aio_t vblk_batch_t;
+
+/* Слот очереди: заголовок и байт статуса лежат в общей DMA-странице */
+struct virtio_blk_req
+{
+    virtio_blk_req_hdr_t *hdr;
+    volatile uint8_t *status;
+    uint64_t hdr_phys;
+    uint64_t status_phys;
+    vblk_batch_t *batch;
+    uint8_t slot;
+};
+
+/* Заголовок и статус слота: по 16 байт, все слоты в одной странице */
+#define VIRTIO_BLK_SLOT_BYTES 32
+
+static pci_device_t *vblk_find(int index)
+{
+    int n = pci_get_device_count();
+    for (int i = 0; i < n; ++i)
+    {
+        pci_device_t *dev = pci_get_device(i);
+        if (dev->vendor_id != VIRTIO_PCI_VENDOR)
+            continue;
+        if (dev->device_id != VIRTIO_BLK_DEVICE_LEGACY && dev->device_id != VIRTIO_BLK_DEVICE_MODERN)
+            continue;
+        if (index-- == 0)
+            return dev;
+    }
+    return NULL;
+}
+
+static int vblk_alloc_reqs(virtio_blk_t *blk)
+{
+    uint8_t *page = alloc_page();
+    virtio_blk_req_t *reqs = malloc(sizeof(virtio_blk_req_t) * VIRTIO_BLK_MAX_REQUESTS);
+    if (!page || !reqs)
+    {
+        if (page)
+            free_page(page);
+        if (reqs)
+            free(reqs);
+        return VIRTIO_ERR_NOMEM;
+    }
+    memset(page, 0, PAGE_SIZE);
+
+    for (int i = 0; i < VIRTIO_BLK_MAX_REQUESTS; ++i)
+    {
+        uint8_t *slot = page + i * VIRTIO_BLK_SLOT_BYTES;
+        reqs[i].hdr = (virtio_blk_req_hdr_t *)slot;
+        reqs[i].status = slot + sizeof(virtio_blk_req_hdr_t);
+        reqs[i].hdr_phys = (uint64_t)slot - hhdm_offset;
+        reqs[i].status_phys = reqs[i].hdr_phys + sizeof(virtio_blk_req_hdr_t);
+        reqs[i].batch = NULL;
+        reqs[i].slot = (uint8_t)i;
+    }
+
+    blk->reqs = reqs;
+    blk->free_reqs = VIRTIO_BLK_ALL_FREE;
+    return VIRTIO_OK;
+}
+
+/* Завершилась последняя часть. Вызывается с выключенными прерываниями */
+static void vblk_batch_done(virtio_blk_t *blk, vblk_batch_t *b)
+{
+    if (!b->cb)
+    {
+        complete(&b->done);
+        return;
+    }
+
+    io_stats_record(&blk->stats, b->sectors, timer_now_ns() - b->start_ns, b->rc != VIRTIO_OK);
+    b->cb(b->arg, b->rc);
+}
+
+/*
+ * Устройство потеряло запрос. Сброс (статус 0) останавливает его очереди, запрет
+ * захвата шины - DMA, даже если сброс не подтверждён. После этого части в полёте
+ * отдаются с ошибкой: асинхронные иначе ждали бы мёртвое устройство без конца.
+ * Прерывания выключены
+ */
+static void vblk_mark_broken(virtio_blk_t *blk)
+{
+    blk->broken = true;
+    kprint(KPRINT_ERROR, "virtio-blk: request lost, device reset and disabled\n");
+
+    virtio_reset(&blk->dev);
+    pci_disable_bus_master(blk->dev.pci);
+
+    for (int i = 0; i < VIRTIO_BLK_MAX_REQUESTS; ++i)
+    {
+        vblk_batch_t *b = blk->reqs[i].batch;
+        if (!b)
+            continue;
+        blk->reqs[i].batch = NULL;
+        b->rc = VIRTIO_ERR_TIMEOUT;
+        if (--b->pending == 0)
+            vblk_batch_done(blk, b);
+    }
+    wait_queue_wake_all(&blk->space);
+}
+
+/* Разбирает кольцо used. Вызывается с выключенными прерываниями */
+static void vblk_reap(virtio_blk_t *blk)
+{
+    bool reaped = false;
+    virtio_blk_req_t *req;
+
+    while ((req = virtq_get_used(&blk->vq, NULL)) != NULL)
+    {
+        vblk_batch_t *b = req->batch;
+        if (b)
+        {
+            if (*req->status != VIRTIO_BLK_S_OK)
+                b->rc = VIRTIO_ERR_DEVICE;
+            if (--b->pending == 0)
+                vblk_batch_done(blk, b);
+        }
+
+        req->batch = NULL;
+        blk->free_reqs |= 1u << req->slot;
+        reaped = true;
+    }
+
+    if (reaped)
+        wait_queue_wake_all(&blk->space);
+}
+
+/* Линия INTx может быть общей: ISR status говорит, наше ли прерывание */
+static bool vblk_irq(void *arg)
+{
+    virtio_blk_t *blk = (virtio_blk_t *)arg;
+    if (!virtio_isr_ack(&blk->dev))
+        return false;
+
+    vblk_reap(blk);
+    return true;
+}
+
+/* Куски буфера по страницам, физически соседние склеиваются; -1, если не влезли в max */
+static int vblk_segments(const void *buffer, size_t bytes, bool device_writes, virtq_buf_t *out, int max)
+{
+    page_table_t *pml4 = read_cr3_virt();
+    uintptr_t va = (uintptr_t)buffer;
+    int n = 0;
+
+    while (bytes)
+    {
+        size_t chunk = PAGE_SIZE - (va & (PAGE_SIZE - 1));
+        if (chunk > bytes)
+            chunk = bytes;
+
+        uint64_t phys = vmm_get_phys(pml4, va);
+        if (!phys)
+            return -1;
+
+        if (n > 0 && out[n - 1].phys + out[n - 1].len == phys)
+        {
+            out[n - 1].len += (uint32_t)chunk;
+        }
+        else
+        {
+            if (n >= max)
+                return -1;
+            out[n].phys = phys;
+            out[n].len = (uint32_t)chunk;
+            out[n].device_writes = device_writes;
+            n++;
+        }
+
+        va += chunk;
+        bytes -= chunk;
+    }
+    return n;
+}
+
+static inline int vblk_seg_limit(const virtio_blk_t *blk)
+{
+    uint32_t segs = blk->seg_max;
+    if (segs > VIRTIO_BLK_MAX_SEGS)
+        segs = VIRTIO_BLK_MAX_SEGS;
+    /* Плюс заголовок и статус - цепочка должна поместиться в очередь */
+    if (segs > (uint32_t)blk->vq.size - 2)
+        segs = blk->vq.size - 2;
+    return (int)segs;
+}
+
+/*
+ * Ставит одну часть в очередь. Ждёт, пока освободятся слот и дескрипторы:
+ * во сне до прерывания или, если прерываний нет, разбирая кольцо сам
+ */
+static int vblk_submit(virtio_blk_t *blk, vblk_batch_t *batch, uint32_t type, uint64_t lba,
+                       const virtq_buf_t *data, int segs, bool use_irq)
+{
+    virtq_buf_t bufs[VIRTIO_BLK_MAX_SEGS + 2];
+    int n = segs + 2;
+
+    uint64_t flags = save_irq_disable();
+    uint32_t loops = 0;
+
+    while (!blk->free_reqs || blk->vq.num_free < n)
+    {
+        if (blk->broken)
+        {
+            restore_irq(flags);
+            return VIRTIO_ERR_DEVICE;
+        }
+
+        if (use_irq)
+        {
+            /* Потерянное прерывание не должно подвесить поток: по таймауту разбираем сами */
+            if (!wait_queue_sleep(&blk->space, timer_now_ns() + VIRTIO_BLK_IRQ_TIMEOUT_NS))
+            {
+                vblk_reap(blk);
+                if (!blk->free_reqs || blk->vq.num_free < n)
+                    vblk_mark_broken(blk);
+            }
+        }
+        else
+        {
+            vblk_reap(blk);
+            if (++loops >= VIRTIO_BLK_POLL_LOOPS)
+                vblk_mark_broken(blk);
+            asm volatile("pause");
+        }
+    }
+
+    virtio_blk_req_t *req = &blk->reqs[__builtin_ctz(blk->free_reqs)];
+    blk->free_reqs &= ~(1u << req->slot);
+
+    req->hdr->type = type;
+    req->hdr->reserved = 0;
+    req->hdr->sector = lba;
+    *req->status = 0xFF;
+    req->batch = batch;
+
+    bufs[0].phys = req->hdr_phys;
+    bufs[0].len = sizeof(virtio_blk_req_hdr_t);
+    bufs[0].device_writes = false;
+    for (int i = 0; i < segs; ++i)
+        bufs[i + 1] = data[i];
+    bufs[n - 1].phys = req->status_phys;
+    bufs[n - 1].len = 1;
+    bufs[n - 1].device_writes = true;
+
+    batch->pending++;
+    virtq_add(&blk->vq, bufs, n, req);
+    virtq_kick(&blk->dev, &blk->vq);
+    blk->stats.commands++;
+
+    restore_irq(flags);
+    return VIRTIO_OK;
+}
+
+/* Ждёт все отправленные части. По истечении времени устройство сбрасывается через vblk_mark_broken */
+static int vblk_wait(virtio_blk_t *blk, vblk_batch_t *batch, bool use_irq)
+{
+    if (use_irq)
+    {
+        uint64_t flags = save_irq_disable();
+        if (batch->pending)
+            blk->stats.irq_waits++;
+        restore_irq(flags);
+
+        /* complete() бывает и до отправки последней части - проверяем счётчик */
+        while (batch->pending)
+            if (!wait_for_completion_timeout(&batch->done, VIRTIO_BLK_IRQ_TIMEOUT_NS))
+                break;
+    }
+
+    for (uint32_t i = 0; batch->pending && i < VIRTIO_BLK_POLL_LOOPS; ++i)
+    {
+        uint64_t flags = save_irq_disable();
+        vblk_reap(blk);
+        restore_irq(flags);
+        asm volatile("pause");
+    }
+
+    uint64_t flags = save_irq_disable();
+    int rc = batch->rc;
+    if (batch->pending)
+    {
+        vblk_mark_broken(blk);
+        rc = VIRTIO_ERR_TIMEOUT;
+    }
+    restore_irq(flags);
+    return rc;
+}
+
+static int vblk_flush(virtio_blk_t *blk, bool use_irq)
+{
+    vblk_batch_t batch = { .pending = 0, .rc = VIRTIO_OK, .done = COMPLETION_INIT };
+    int rc = vblk_submit(blk, &batch, VIRTIO_BLK_T_FLUSH, 0, NULL, 0, use_irq);
+    int wrc = vblk_wait(blk, &batch, use_irq);
+    return rc != VIRTIO_OK ? rc : wrc;
+}
+
+static int vblk_check(const virtio_blk_t *blk, uint64_t lba, uint32_t count, const void *buf, bool write)
+{
+    if (!blk || !blk->reqs || !buf || count == 0)
+        return VIRTIO_ERR_INVALID;
+    if (lba > blk->total_sectors || count > blk->total_sectors - lba)
+        return VIRTIO_ERR_INVALID;
+    if (write && blk->read_only)
+        return VIRTIO_ERR_INVALID;
+    if (blk->broken)
+        return VIRTIO_ERR_DEVICE;
+    return VIRTIO_OK;
+}
+
+/* Ставит все части запроса в очередь, не дожидаясь их */
+static int vblk_queue_rw(virtio_blk_t *blk, vblk_batch_t *batch, uint64_t lba, uint32_t count,
+                         uint8_t *buf, bool write, bool use_irq)
+{
+    virtq_buf_t data[VIRTIO_BLK_MAX_SEGS];
+    int max_segs = vblk_seg_limit(blk);
+    int rc = VIRTIO_OK;
+
+    while (count)
+    {
+        uint32_t chunk = count > VIRTIO_BLK_REQ_SECTORS ? VIRTIO_BLK_REQ_SECTORS : count;
+
+        /* Не хватило кусков (seg_max устройства) - уменьшаем часть */
+        int segs;
+        while ((segs = vblk_segments(buf, (size_t)chunk * VIRTIO_BLK_SECTOR_SIZE, !write,
+                                     data, max_segs)) < 0 && chunk > 1)
+            chunk /= 2;
+        if (segs < 0)
+        {
+            rc = VIRTIO_ERR_INVALID;
+            break;
+        }
+
+        rc = vblk_submit(blk, batch, write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN, lba, data, segs, use_irq);
+        if (rc != VIRTIO_OK)
+            break;
+
+        buf += (size_t)chunk * VIRTIO_BLK_SECTOR_SIZE;
+        lba += chunk;
+        count -= chunk;
+    }
+    return rc;
+}
+
+static int vblk_rw(virtio_blk_t *blk, uint64_t lba, uint32_t count, uint8_t *buf, bool write)
+{
+    int rc = vblk_check(blk, lba, count, buf, write);
+    if (rc != VIRTIO_OK)
+        return rc;
+
+    vblk_batch_t batch = { .pending = 0, .rc = VIRTIO_OK, .done = COMPLETION_INIT };
+    bool use_irq = blk->irq_ready && irqs_enabled();
+    uint64_t start = timer_now_ns();
+    uint32_t sectors = count;
+
+    rc = vblk_queue_rw(blk, &batch, lba, count, buf, write, use_irq);
+
+    /* Отправленные части пишут в буфер вызывающего - их дожидаемся всегда */
+    int wrc = vblk_wait(blk, &batch, use_irq);
+    if (rc == VIRTIO_OK)
+        rc = wrc;
+
+    if (rc == VIRTIO_OK && write && blk->flush)
+        rc = vblk_flush(blk, use_irq);
+
+    uint64_t flags = save_irq_disable();
+    io_stats_record(&blk->stats, sectors, timer_now_ns() - start, rc != VIRTIO_OK);
+    restore_irq(flags);
+    return rc;
+}
+
+int virtio_blk_init(virtio_blk_t *blk, int index)
+{
+    if (!blk || index < 0)
+        return VIRTIO_ERR_INVALID;
+
+    pci_device_t *pci = vblk_find(index);
+    if (!pci)
+        return VIRTIO_ERR_INVALID;
+
+    memset(blk, 0, sizeof(*blk));
+    wait_queue_init(&blk->space);
+
+    int rc = virtio_init(&blk->dev, pci);
+    if (rc != VIRTIO_OK)
+        return rc;
+
+    uint64_t features = 0;
+    rc = virtio_negotiate(&blk->dev,
+                          VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_RO | VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_FLUSH,
+                          &features);
+    if (rc == VIRTIO_OK)
+        rc = virtio_setup_queue(&blk->dev, &blk->vq, 0, VIRTQ_MAX_SIZE);
+    if (rc == VIRTIO_OK && blk->vq.size < 3)
+        rc = VIRTIO_ERR_DEVICE;
+    if (rc == VIRTIO_OK)
+        rc = vblk_alloc_reqs(blk);
+    if (rc != VIRTIO_OK)
+    {
+        virtio_fail(&blk->dev);
+        return rc;
+    }
+
+    blk->total_sectors = virtio_config_read64(&blk->dev, VIRTIO_BLK_CFG_CAPACITY);
+    blk->sector_size = VIRTIO_BLK_SECTOR_SIZE;
+    blk->blk_size = (features & VIRTIO_BLK_F_BLK_SIZE)
+                        ? virtio_config_read32(&blk->dev, VIRTIO_BLK_CFG_BLK_SIZE)
+                        : VIRTIO_BLK_SECTOR_SIZE;
+    blk->seg_max = (features & VIRTIO_BLK_F_SEG_MAX)
+                       ? virtio_config_read32(&blk->dev, VIRTIO_BLK_CFG_SEG_MAX)
+                       : 1;
+    if (blk->seg_max == 0)
+        blk->seg_max = 1;
+    blk->read_only = (features & VIRTIO_BLK_F_RO) != 0;
+    blk->flush = (features & VIRTIO_BLK_F_FLUSH) != 0;
+
+    virtio_driver_ok(&blk->dev);
+
+    /* Без линии INTx работаем опросом */
+    if (blk->dev.irq != 0xFF && irq_register(blk->dev.irq, vblk_irq, blk) == 0)
+        blk->irq_ready = true;
+
+    kprint(KPRINT_LOG, "virtio-blk%d: %s, %lu sectors, queue %u, seg_max %u, irq %d%s\n",
+           index, blk->dev.modern ? "modern" : "legacy", blk->total_sectors,
+           (uint32_t)blk->vq.size, blk->seg_max, blk->irq_ready ? blk->dev.irq : -1,
+           blk->read_only ? ", read-only" : "");
+    return VIRTIO_OK;
+}
+
+int virtio_blk_read(virtio_blk_t *blk, uint64_t lba, uint32_t count, void *buffer)
+{
+    return vblk_rw(blk, lba, count, (uint8_t *)buffer, false);
+}
+
+int virtio_blk_write(virtio_blk_t *blk, uint64_t lba, uint32_t count, const void *buffer)
+{
+    /* Устройство только читает буфер, const снимаем ради общего пути */
+    return vblk_rw(blk, lba, count, (uint8_t *)buffer, true);
+}
+
+int virtio_blk_flush(virtio_blk_t *blk)
+{
+    if (!blk || !blk->reqs)
+        return VIRTIO_ERR_INVALID;
+    if (!blk->flush)
+        return VIRTIO_OK;
+    if (blk->broken)
+        return VIRTIO_ERR_DEVICE;
+
+    return vblk_flush(blk, blk->irq_ready && irqs_enabled());
+}
+
+int virtio_blk_submit(virtio_blk_t *blk, uint64_t lba, uint32_t count, void *buffer, bool write,
+                      virtio_blk_aio_t *aio, virtio_blk_done_t cb, void *arg)
+{
+    int rc = vblk_check(blk, lba, count, buffer, write);
+    if (rc != VIRTIO_OK)
+        return rc;
+    if (!aio || !cb)
+        return VIRTIO_ERR_INVALID;
+
+    /* Опросом завершения пришлось бы ждать здесь же - такой запрос идёт синхронным путём */
+    if (!blk->irq_ready || !irqs_enabled())
+        return VIRTIO_ERR_INVALID;
+
+    /* Ссылка самой отправки: cb не раньше, чем в очередь уйдут все части */
+    aio->pending = 1;
+    aio->rc = VIRTIO_OK;
+    completion_reinit(&aio->done);
+    aio->cb = cb;
+    aio->arg = arg;
+    aio->start_ns = timer_now_ns();
+    aio->sectors = count;
+
+    rc = vblk_queue_rw(blk, aio, lba, count, (uint8_t *)buffer, write, true);
+
+    uint64_t flags = save_irq_disable();
+    if (rc != VIRTIO_OK)
+        aio->rc = rc;
+    if (--aio->pending == 0)
+        vblk_batch_done(blk, aio);
+    restore_irq(flags);
+    return VIRTIO_OK;
+}
+
+void virtio_blk_poll(virtio_blk_t *blk)
+{
+    if (!blk || !blk->reqs)
+        return;
+
+    uint64_t flags = save_irq_disable();
+    vblk_reap(blk);
+    restore_irq(flags);
+}
+
+int virtio_blk_get_stats(virtio_blk_t *blk, io_stats_t *out, bool reset)
+{
+    if (!blk || !out)
+        return VIRTIO_ERR_INVALID;
+
+    uint64_t flags = save_irq_disable();
+    *out = blk->stats;
+    if (reset)
+        memset(&blk->stats, 0, sizeof(blk->stats));
+    restore_irq(flags);
+    return VIRTIO_OK;
+}
@@ -0,0 +1,109 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "virtio.h"
+#include "iostat.h"
+#include "../multitask/waitqueue.h"
+#include "../multitask/completion.h"
+
+/* PCI ID: transitional (legacy + modern) и только modern */
+#define VIRTIO_BLK_DEVICE_LEGACY 0x1001
+#define VIRTIO_BLK_DEVICE_MODERN 0x1042
+
+/* Признаки устройства */
+#define VIRTIO_BLK_F_SEG_MAX (1ULL << 2)
+#define VIRTIO_BLK_F_RO (1ULL << 5)
+#define VIRTIO_BLK_F_BLK_SIZE (1ULL << 6)
+#define VIRTIO_BLK_F_FLUSH (1ULL << 9)
+
+/* Поля конфигурации устройства */
+#define VIRTIO_BLK_CFG_CAPACITY 0x00 /* в секторах по 512 байт */
+#define VIRTIO_BLK_CFG_SEG_MAX 0x0C
+#define VIRTIO_BLK_CFG_BLK_SIZE 0x14
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_T_FLUSH 4
+
+#define VIRTIO_BLK_S_OK 0
+#define VIRTIO_BLK_S_IOERR 1
+#define VIRTIO_BLK_S_UNSUPP 2
+
+#define VIRTIO_BLK_SECTOR_SIZE 512
+
+/* Запросов в очереди одновременно и секторов на один запрос */
+#define VIRTIO_BLK_MAX_REQUESTS 32
+#define VIRTIO_BLK_REQ_SECTORS 256
+
+#define VIRTIO_BLK_MAX_DEVICES 4
+
+typedef struct __attribute__((packed))
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} virtio_blk_req_hdr_t;
+
+typedef struct virtio_blk_req virtio_blk_req_t;
+
+/* Завершение асинхронного запроса: с выключенными прерываниями, обычно из обработчика */
+typedef void (*virtio_blk_done_t)(void *arg, int rc);
+
+/*
+ * Запрос вызывающего: части уходят в очередь без ожидания друг друга.
+ * Синхронный путь спит на done, асинхронный получает вызов cb
+ */
+typedef struct virtio_blk_aio
+{
+    volatile uint32_t pending;
+    int rc;
+    completion_t done;
+    virtio_blk_done_t cb;
+    void *arg;
+    uint64_t start_ns;
+    uint32_t sectors;
+} virtio_blk_aio_t;
+
+typedef struct
+{
+    virtio_dev_t dev;
+    virtq_t vq;
+    uint64_t total_sectors;
+    uint16_t sector_size;     /* единица адресации интерфейса, всегда 512 */
+    uint32_t blk_size;        /* оптимальный размер блока устройства */
+    uint32_t seg_max;         /* кусков данных на запрос */
+    bool read_only;
+    bool flush;               /* кэш записи: после записи нужен VIRTIO_BLK_T_FLUSH */
+    bool irq_ready;
+    bool broken;              /* запрос потерялся в устройстве - слоты больше не трогаем */
+    virtio_blk_req_t *reqs;   /* VIRTIO_BLK_MAX_REQUESTS слотов */
+    uint32_t free_reqs;       /* битовая маска свободных слотов */
+    wait_queue_t space;       /* ждут слот или дескрипторы */
+    io_stats_t stats;         /* под выключенными прерываниями */
+} virtio_blk_t;
+
+/* Инициализирует index-е устройство virtio-blk на шине PCI */
+int virtio_blk_init(virtio_blk_t *blk, int index);
+
+/* Большой запрос делится на части, которые уходят в очередь одновременно */
+int virtio_blk_read(virtio_blk_t *blk, uint64_t lba, uint32_t count, void *buffer);
+int virtio_blk_write(virtio_blk_t *blk, uint64_t lba, uint32_t count, const void *buffer);
+int virtio_blk_flush(virtio_blk_t *blk);
+
+/*
+ * Асинхронные чтение и запись, только при работающем прерывании. VIRTIO_OK -
+ * cb будет вызван ровно один раз, ошибка - ничего не отправлено. aio нужен
+ * до вызова cb. Кэш записи не сбрасывается: для этого virtio_blk_flush
+ */
+int virtio_blk_submit(virtio_blk_t *blk, uint64_t lba, uint32_t count, void *buffer, bool write,
+                      virtio_blk_aio_t *aio, virtio_blk_done_t cb, void *arg);
+
+/* Разбирает завершения, если прерывание потерялось */
+void virtio_blk_poll(virtio_blk_t *blk);
+
+/* Копия статистики запросов, при reset счётчики обнуляются */
+int virtio_blk_get_stats(virtio_blk_t *blk, io_stats_t *out, bool reset);
+
+#endif // VIRTIO_BLK_H
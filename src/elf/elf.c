@@ -1,8 +1,9 @@
 #include "elf.h"
 #include "../libc/string.h"
 #include "../mm/pmm.h"
+#include "../multitask/tls.h"
 
-bool load_elf(void *elf_buf, size_t size, page_table_t **out_pml4, Elf64_Addr *entry)
+bool load_elf(void *elf_buf, size_t size, page_table_t **out_pml4, Elf64_Addr *entry, process_t *proc)
 {
     Elf64_Ehdr *ehdr = (Elf64_Ehdr*)elf_buf;
 
@@ -13,10 +14,19 @@ bool load_elf(void *elf_buf, size_t size, page_table_t **out_pml4, Elf64_Addr *e
     if (!pml4) return false;
 
     Elf64_Phdr *phdr = (Elf64_Phdr*)((char*)elf_buf + ehdr->e_phoff);
+    Elf64_Phdr *tls = NULL;
 
     for (int i = 0; i < ehdr->e_phnum; i++)
     {
-        if (phdr[i].p_type == PT_LOAD)
+        if (phdr[i].p_type == PT_TLS)
+        {
+            if (phdr[i].p_filesz > phdr[i].p_memsz ||
+                phdr[i].p_offset + phdr[i].p_filesz > size)
+                return false;
+
+            tls = &phdr[i];
+        }
+        else if (phdr[i].p_type == PT_LOAD)
         {
             uint64_t virt_start = phdr[i].p_vaddr;
             uint64_t virt_end = virt_start + phdr[i].p_memsz;
@@ -27,23 +37,28 @@ bool load_elf(void *elf_buf, size_t size, page_table_t **out_pml4, Elf64_Addr *e
 
             for (uint64_t j = 0; j < pages; j++)
             {
-                uint64_t phys_addr = (uint64_t)alloc_page();
-                memset(virt(phys_addr), 0, PAGE_SIZE);
+                void *page = alloc_page();
+                if (!page) return false;
+                uint64_t phys_addr = (uint64_t)page - hhdm_offset;
+                memset(page, 0, PAGE_SIZE);
 
-                uint64_t page_vaddr = ALIGN_UP(virt_start, PAGE_SIZE) + (j * PAGE_SIZE);
+                uint64_t page_vaddr = ALIGN_DOWN(virt_start, PAGE_SIZE) + (j * PAGE_SIZE);
 
                 mmap(pml4, page_vaddr, phys_addr, map_flags);
 
                 uint64_t copy_off = 0;
                 if (page_vaddr < virt_start) copy_off = virt_start - page_vaddr;
 
-                if (copy_off < phdr[i].p_filesz)
+                // Смещение начала копии внутри сегмента
+                uint64_t seg_off = page_vaddr + copy_off - virt_start;
+
+                if (seg_off < phdr[i].p_filesz)
                 {
-                    uint64_t to_copy = phdr[i].p_filesz - copy_off;
+                    uint64_t to_copy = phdr[i].p_filesz - seg_off;
                     if (to_copy > (PAGE_SIZE - copy_off)) to_copy = PAGE_SIZE - copy_off;
 
-                    memcpy((char*)virt(phys_addr) + copy_off,
-                            (char*)elf_buf + phdr[i].p_offset + (page_vaddr + copy_off - virt_start),
+                    memcpy((char*)page + copy_off,
+                            (char*)elf_buf + phdr[i].p_offset + seg_off,
                         to_copy
                     );
                 }
@@ -51,6 +66,14 @@ bool load_elf(void *elf_buf, size_t size, page_table_t **out_pml4, Elf64_Addr *e
         }
     }
 
+    // Шаблон копируется в память ядра: elf_buf можно освобождать
+    if (proc && tls && tls->p_memsz &&
+        tls_set_template(proc, (char*)elf_buf + tls->p_offset, tls->p_filesz, tls->p_memsz, tls->p_align) != 0)
+    {
+        destroy_address_space(pml4);
+        return false;
+    }
+
     *out_pml4 = pml4;
     *entry = ehdr->e_entry;
 
@@ -73,7 +73,12 @@ typedef struct {
 #define EM_X86_64   62
 #define ET_EXEC     2
 #define PT_LOAD     1
+#define PT_TLS      7
 
-bool load_elf(void *elf_buf, size_t size, page_table_t **out_pml4, Elf64_Addr *entry);
+typedef struct process process_t;
+
+// Образ PT_TLS (.tdata + .tbss) становится шаблоном TLS процесса proc,
+// блоки потоков создаёт tls_thread_setup. proc может быть NULL - PT_TLS не читается
+bool load_elf(void *elf_buf, size_t size, page_table_t **out_pml4, Elf64_Addr *entry, process_t *proc);
 
 #endif
\ No newline at end of file
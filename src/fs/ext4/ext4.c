@@ -730,6 +730,30 @@ int ext4_mount_point_stats(const char *mount_point,
 	return EOK;
 }
 
+int ext4_ra_stats(const char *mount_point, struct ext4_ra_stats *stats,
+		  bool reset)
+{
+	struct ext4_mountpoint *mp = ext4_get_mount(mount_point);
+	struct ext4_blockdev *bdev;
+
+	if (!mp)
+		return ENOENT;
+
+	EXT4_MP_LOCK(mp);
+	bdev = mp->fs.bdev;
+	stats->issued = bdev->ra_issued;
+	stats->hits = bdev->ra_hits;
+	stats->misses = bdev->ra_misses;
+	if (reset) {
+		bdev->ra_issued = 0;
+		bdev->ra_hits = 0;
+		bdev->ra_misses = 0;
+	}
+	EXT4_MP_UNLOCK(mp);
+
+	return EOK;
+}
+
 int ext4_mount_setup_locks(const char *mount_point,
 			   const struct ext4_lock *locks)
 {
@@ -1083,6 +1107,9 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
 		f->fsize = ext4_inode_get_size(sb, ref.inode);
 		f->inode = ref.index;
 		f->fpos = 0;
+		f->ra_next = 0;
+		f->ra_size = 0;
+		f->ra_end = 0;
 
 		if (f->flags & O_APPEND)
 			f->fpos = f->fsize;
@@ -1404,6 +1431,8 @@ int ext4_get_sblock(const char *mount_point, struct ext4_sblock **sb)
 	return EOK;
 }
 
+/* The mount point is looked up unlocked: a concurrent umount is caught
+ * by the mounted check under the lock. */
 int ext4_cache_write_back(const char *path, bool on)
 {
 	struct ext4_mountpoint *mp = ext4_get_mount(path);
@@ -1413,7 +1442,22 @@ int ext4_cache_write_back(const char *path, bool on)
 		return ENOENT;
 
 	EXT4_MP_LOCK(mp);
-	ret = ext4_block_cache_write_back(mp->fs.bdev, on);
+	ret = mp->mounted ? ext4_block_cache_write_back(mp->fs.bdev, on) : ENOENT;
+	EXT4_MP_UNLOCK(mp);
+	return ret;
+}
+
+int ext4_cache_write_expired(const char *path, uint32_t max_age,
+			     uint32_t max_dirty)
+{
+	struct ext4_mountpoint *mp = ext4_get_mount(path);
+	int ret;
+
+	if (!mp)
+		return ENOENT;
+
+	EXT4_MP_LOCK(mp);
+	ret = mp->mounted ? ext4_block_cache_write_expired(mp->fs.bdev, max_age, max_dirty) : ENOENT;
 	EXT4_MP_UNLOCK(mp);
 	return ret;
 }
@@ -1427,7 +1471,7 @@ int ext4_cache_flush(const char *path)
 		return ENOENT;
 
 	EXT4_MP_LOCK(mp);
-	ret = ext4_block_cache_flush(mp->fs.bdev);
+	ret = mp->mounted ? ext4_block_cache_flush(mp->fs.bdev) : ENOENT;
 	EXT4_MP_UNLOCK(mp);
 	return ret;
 }
@@ -1665,12 +1709,111 @@ int ext4_ftruncate(ext4_file *f, uint64_t size)
 	return r;
 }
 
+/**@brief   Read part of a file block: from the cache if read-ahead
+ *          brought it there, otherwise from the device.*/
+static int ext4_fread_block(struct ext4_blockdev *bdev, ext4_fsblk_t fblock,
+			    uint32_t off, void *buf, uint32_t len)
+{
+	if (ext4_block_read_cached(bdev, fblock, off, buf, len) == EOK) {
+		bdev->ra_hits++;
+		return EOK;
+	}
+
+	bdev->ra_misses++;
+	return ext4_block_readbytes(bdev, fblock * bdev->lg_bsize + off, buf,
+				    len);
+}
+
+/**@brief   Read-ahead after a file read of blocks [first, last].
+ *
+ * A read starting where the previous one stopped is sequential: the
+ * blocks after it are requested asynchronously. The window starts at a
+ * quarter of CONFIG_EXT4_READAHEAD_BLOCKS and doubles each time the
+ * reader gets within half a window of its end. Any other read resets
+ * the window.*/
+static void ext4_fread_ahead(ext4_file *file, struct ext4_inode_ref *ref,
+			     uint32_t first, uint32_t last)
+{
+#if CONFIG_EXT4_READAHEAD_BLOCKS
+	struct ext4_blockdev *bdev = file->mp->fs.bdev;
+	uint32_t block_size = bdev->lg_bsize;
+	uint32_t file_blocks;
+	uint32_t start, end, i;
+	ext4_fsblk_t run_start = 0;
+	uint32_t run_cnt = 0;
+	bool sequential = first == file->ra_next;
+
+	/* Synchronous-only devices: read-ahead would stall the reader. */
+	if (!bdev->bdif->bread_async)
+		return;
+
+	file->ra_next = (uint32_t)(file->fpos / block_size);
+	if (!sequential) {
+		file->ra_size = 0;
+		file->ra_end = 0;
+		return;
+	}
+
+	/* Enough is still requested ahead of the reader. */
+	if (file->ra_end > last + 1 &&
+	    file->ra_end - (last + 1) > file->ra_size / 2)
+		return;
+
+	if (!file->ra_size)
+		file->ra_size = CONFIG_EXT4_READAHEAD_BLOCKS / 4 ?
+				CONFIG_EXT4_READAHEAD_BLOCKS / 4 : 1;
+	else if (file->ra_size < CONFIG_EXT4_READAHEAD_BLOCKS / 2)
+		file->ra_size *= 2;
+	else
+		file->ra_size = CONFIG_EXT4_READAHEAD_BLOCKS;
+
+	file_blocks = (uint32_t)((file->fsize + block_size - 1) / block_size);
+	start = file->ra_end > last + 1 ? file->ra_end : last + 1;
+	end = last + 1 + file->ra_size;
+	if (end > file_blocks)
+		end = file_blocks;
+
+	/* One request per physically contiguous run. */
+	for (i = start; i < end; i++) {
+		ext4_fsblk_t fblock;
+		if (ext4_fs_get_inode_dblk_idx(ref, i, &fblock, true) != EOK)
+			break;
+
+		if (run_cnt && fblock == run_start + run_cnt) {
+			run_cnt++;
+			continue;
+		}
+
+		if (run_cnt &&
+		    ext4_block_readahead(bdev, run_start, run_cnt) != EOK) {
+			run_cnt = 0;
+			break;
+		}
+
+		/* Unwritten blocks read as zeros, nothing to fetch. */
+		run_start = fblock;
+		run_cnt = fblock ? 1 : 0;
+	}
+
+	if (run_cnt)
+		ext4_block_readahead(bdev, run_start, run_cnt);
+
+	file->ra_end = i;
+#else
+	(void)file;
+	(void)ref;
+	(void)first;
+	(void)last;
+#endif
+}
+
 int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
 {
 	uint32_t unalg;
 	uint32_t iblock_idx;
-	uint32_t iblock_last;
 	uint32_t block_size;
+	uint32_t ra_first;
+	uint32_t ra_last;
 
 	ext4_fsblk_t fblock;
 	ext4_fsblk_t fblock_start;
@@ -1710,9 +1853,12 @@ int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
 		? ((size_t)(file->fsize - file->fpos)) : size;
 
 	iblock_idx = (uint32_t)((file->fpos) / block_size);
-	iblock_last = (uint32_t)((file->fpos + size) / block_size);
 	unalg = (file->fpos) % block_size;
 
+	ra_first = iblock_idx;
+	ra_last = size ? (uint32_t)((file->fpos + size - 1) / block_size) :
+			 iblock_idx;
+
 	/*If the size of symlink is smaller than 60 bytes*/
 	bool softlink;
 	softlink = ext4_inode_is_type(sb, ref.inode, EXT4_INODE_MODE_SOFTLINK);
@@ -1745,8 +1891,8 @@ int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
 
 		/* Do we get an unwritten range? */
 		if (fblock != 0) {
-			uint64_t off = fblock * block_size + unalg;
-			r = ext4_block_readbytes(file->mp->fs.bdev, off, u8_buf, len);
+			r = ext4_fread_block(fs->bdev, fblock, unalg, u8_buf,
+					     len);
 			if (r != EOK)
 				goto Finish;
 
@@ -1765,52 +1911,70 @@ int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
 		iblock_idx++;
 	}
 
-	fblock_start = 0;
-	fblock_count = 0;
 	while (size >= block_size) {
-		while (iblock_idx < iblock_last) {
-			r = ext4_fs_get_inode_dblk_idx(&ref, iblock_idx,
-						       &fblock, true);
-			if (r != EOK)
-				goto Finish;
+		r = ext4_fs_get_inode_dblk_idx(&ref, iblock_idx, &fblock, true);
+		if (r != EOK)
+			goto Finish;
 
-			iblock_idx++;
+		fblock_start = fblock;
+		fblock_count = 1;
+		if (!fblock_start) {
+			memset(u8_buf, 0, block_size);
+		} else if (ext4_block_read_cached(fs->bdev, fblock_start, 0,
+						  u8_buf, block_size) == EOK) {
+			fs->bdev->ra_hits++;
+		} else {
+			/* Read the physically contiguous run at once, up to
+			 * a block that read-ahead has already requested. */
+			while (size >= block_size * (fblock_count + 1)) {
+				struct ext4_buf *cbuf;
+				r = ext4_fs_get_inode_dblk_idx(&ref,
+						iblock_idx + fblock_count,
+						&fblock, true);
+				if (r != EOK)
+					goto Finish;
 
-			if (!fblock_start)
-				fblock_start = fblock;
+				if (fblock != fblock_start + fblock_count)
+					break;
 
-			if ((fblock_start + fblock_count) != fblock)
-				break;
+				cbuf = ext4_bcache_lookup(fs->bdev->bc, fblock);
+				if (cbuf &&
+				    (ext4_bcache_test_flag(cbuf, BC_UPTODATE) ||
+				     ext4_bcache_test_flag(cbuf, BC_READAHEAD)))
+					break;
 
-			fblock_count++;
-		}
+				fblock_count++;
+			}
 
-		r = ext4_blocks_get_direct(file->mp->fs.bdev, u8_buf, fblock_start,
-					   fblock_count);
-		if (r != EOK)
-			goto Finish;
+			r = ext4_blocks_get_direct(fs->bdev, u8_buf,
+						   fblock_start, fblock_count);
+			if (r != EOK)
+				goto Finish;
+
+			fs->bdev->ra_misses += fblock_count;
+		}
 
+		iblock_idx += fblock_count;
 		size -= block_size * fblock_count;
 		u8_buf += block_size * fblock_count;
 		file->fpos += block_size * fblock_count;
 
 		if (rcnt)
 			*rcnt += block_size * fblock_count;
-
-		fblock_start = fblock;
-		fblock_count = 1;
 	}
 
 	if (size) {
-		uint64_t off;
 		r = ext4_fs_get_inode_dblk_idx(&ref, iblock_idx, &fblock, true);
 		if (r != EOK)
 			goto Finish;
 
-		off = fblock * block_size;
-		r = ext4_block_readbytes(file->mp->fs.bdev, off, u8_buf, size);
-		if (r != EOK)
-			goto Finish;
+		if (fblock != 0) {
+			r = ext4_fread_block(fs->bdev, fblock, 0, u8_buf, size);
+			if (r != EOK)
+				goto Finish;
+		} else {
+			memset(u8_buf, 0, size);
+		}
 
 		file->fpos += size;
 
@@ -1818,12 +1982,41 @@ int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
 			*rcnt += size;
 	}
 
+	ext4_fread_ahead(file, &ref, ra_first, ra_last);
+
 Finish:
 	ext4_fs_put_inode_ref(&ref);
 	EXT4_MP_UNLOCK(file->mp);
 	return r;
 }
 
+/**@brief   Write part of a file block through the block cache, so
+ *          small writes are merged there and written back later.
+ * @param   fresh block was just allocated: its old contents are not read*/
+static int ext4_fwrite_block(struct ext4_blockdev *bdev, ext4_fsblk_t fblock,
+			     uint32_t off, const void *buf, uint32_t len,
+			     bool fresh)
+{
+	int r;
+	struct ext4_block b;
+
+	if (fresh) {
+		r = ext4_block_get_noread(bdev, &b, fblock);
+		if (r != EOK)
+			return r;
+
+		memset(b.data, 0, bdev->lg_bsize);
+	} else {
+		r = ext4_block_get(bdev, &b, fblock);
+		if (r != EOK)
+			return r;
+	}
+
+	memcpy(b.data + off, buf, len);
+	ext4_bcache_set_dirty(b.buf);
+	return ext4_block_set(bdev, &b);
+}
+
 int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
 {
 	uint32_t unalg;
@@ -1879,7 +2072,6 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
 
 	if (unalg) {
 		size_t len =  size;
-		uint64_t off;
 		if (size > (block_size - unalg))
 			len = block_size - unalg;
 
@@ -1887,8 +2079,8 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
 		if (r != EOK)
 			goto Finish;
 
-		off = fblk * block_size + unalg;
-		r = ext4_block_writebytes(file->mp->fs.bdev, off, u8_buf, len);
+		r = ext4_fwrite_block(file->mp->fs.bdev, fblk, unalg, u8_buf,
+				      len, false);
 		if (r != EOK)
 			goto Finish;
 
@@ -1940,6 +2132,8 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
 			fblock_count++;
 		}
 
+		ext4_bcache_invalidate_lba(file->mp->fs.bdev->bc, fblock_start,
+					   fblock_count);
 		r = ext4_blocks_set_direct(file->mp->fs.bdev, u8_buf, fblock_start,
 					   fblock_count);
 		if (r != EOK)
@@ -1971,8 +2165,8 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
 		goto Finish;
 
 	if (size) {
-		uint64_t off;
-		if (iblk_idx < ifile_blocks) {
+		bool fresh = iblk_idx >= ifile_blocks;
+		if (!fresh) {
 			r = ext4_fs_init_inode_dblk_idx(&ref, iblk_idx, &fblk);
 			if (r != EOK)
 				goto Finish;
@@ -1983,8 +2177,8 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
 				goto out_fsize;
 		}
 
-		off = fblk * block_size;
-		r = ext4_block_writebytes(file->mp->fs.bdev, off, u8_buf, size);
+		r = ext4_fwrite_block(file->mp->fs.bdev, fblk, 0, u8_buf,
+				      size, fresh);
 		if (r != EOK)
 			goto Finish;
 
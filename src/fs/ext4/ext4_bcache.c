@@ -76,6 +76,8 @@ int ext4_bcache_init_dynamic(struct ext4_bcache *bc, uint32_t cnt,
 	bc->itemsize = itemsize;
 	bc->ref_blocks = 0;
 	bc->max_ref_blocks = 0;
+	/* dirty_tick == 0 means clean, so ticks start at 1. */
+	bc->tick = 1;
 
 	return EOK;
 }
@@ -83,10 +85,15 @@ int ext4_bcache_init_dynamic(struct ext4_bcache *bc, uint32_t cnt,
 void ext4_bcache_cleanup(struct ext4_bcache *bc)
 {
 	struct ext4_buf *buf, *tmp;
+
+	ext4_block_wait_all(bc->bdev);
 	RB_FOREACH_SAFE(buf, ext4_buf_lba, &bc->lba_root, tmp) {
 		ext4_block_flush_buf(bc->bdev, buf);
 		ext4_bcache_drop_buf(bc, buf);
 	}
+
+	if (bc->bdev->bdif->bwrite_async && bc->bdev->bdif->bsync)
+		bc->bdev->bdif->bsync(bc->bdev);
 }
 
 int ext4_bcache_fini_dynamic(struct ext4_bcache *bc)
@@ -151,6 +158,11 @@ ext4_buf_lookup(struct ext4_bcache *bc, uint64_t lba)
 	return RB_FIND(ext4_buf_lba, &bc->lba_root, &tmp);
 }
 
+struct ext4_buf *ext4_bcache_lookup(struct ext4_bcache *bc, uint64_t lba)
+{
+	return ext4_buf_lookup(bc, lba);
+}
+
 struct ext4_buf *ext4_buf_lowest_lru(struct ext4_bcache *bc)
 {
 	return RB_MIN(ext4_buf_lru, &bc->lru_root);
@@ -158,6 +170,10 @@ struct ext4_buf *ext4_buf_lowest_lru(struct ext4_bcache *bc)
 
 void ext4_bcache_drop_buf(struct ext4_bcache *bc, struct ext4_buf *buf)
 {
+	/* The device may still be using the data. */
+	if (ext4_bcache_in_flight(buf))
+		ext4_block_wait_buf(bc->bdev, buf);
+
 	/* Warn on dropping any referenced buffers.*/
 	if (buf->refctr) {
 		ext4_dbg(DEBUG_BCACHE, DBG_WARN "Buffer is still referenced. "
@@ -179,6 +195,11 @@ void ext4_bcache_drop_buf(struct ext4_bcache *bc, struct ext4_buf *buf)
 void ext4_bcache_invalidate_buf(struct ext4_bcache *bc,
 				struct ext4_buf *buf)
 {
+	/* A stale write in flight must not land after later ones,
+	 * a read in flight must not mark stale data up to date. */
+	if (ext4_bcache_in_flight(buf))
+		ext4_block_wait_buf(bc->bdev, buf);
+
 	buf->end_write = NULL;
 	buf->end_write_arg = NULL;
 
@@ -194,7 +215,11 @@ void ext4_bcache_invalidate_lba(struct ext4_bcache *bc,
 				uint32_t cnt)
 {
 	uint64_t end = from + cnt - 1;
-	struct ext4_buf *tmp = ext4_buf_lookup(bc, from), *buf;
+	struct ext4_buf key = {
+		.lba = from
+	};
+	/* The first block of the range may be missing from the cache. */
+	struct ext4_buf *tmp = RB_NFIND(ext4_buf_lba, &bc->lba_root, &key), *buf;
 	RB_FOREACH_FROM(buf, ext4_buf_lba, tmp) {
 		if (buf->lba > end)
 			break;
@@ -312,6 +337,15 @@ int ext4_bcache_free(struct ext4_bcache *bc, struct ext4_block *b)
 	return EOK;
 }
 
+void ext4_bcache_put_buf(struct ext4_bcache *bc, struct ext4_buf *buf)
+{
+	ext4_assert(buf->refctr);
+
+	ext4_bcache_dec_ref(buf);
+	if (!buf->refctr)
+		RB_INSERT(ext4_buf_lru, &bc->lru_root, buf);
+}
+
 bool ext4_bcache_is_full(struct ext4_bcache *bc)
 {
 	return (bc->cnt <= bc->ref_blocks);
@@ -82,6 +82,21 @@ static int ext4_bdif_bwrite(struct ext4_blockdev *bdev, const void *buf,
 	return r;
 }
 
+static void ext4_bdif_plug(struct ext4_blockdev *bdev, bool on)
+{
+	if (bdev->bdif->plug)
+		bdev->bdif->plug(bdev, on);
+}
+
+/**@brief   Completion of an asynchronous write. May run in interrupt
+ *          context, so it only records the result for ext4_block_reap().*/
+static void ext4_block_end_async(void *arg, int res)
+{
+	struct ext4_buf *buf = arg;
+	buf->io_res = res;
+	buf->io_done = true;
+}
+
 int ext4_block_init(struct ext4_blockdev *bdev)
 {
 	int rc;
@@ -138,11 +153,186 @@ int ext4_block_fini(struct ext4_blockdev *bdev)
 	return bdev->bdif->close(bdev);
 }
 
+static struct ext4_buf *ext4_block_io_pop_done(struct ext4_bcache *bc)
+{
+	struct ext4_buf *buf;
+	SLIST_FOREACH(buf, &bc->io_list, io_node) {
+		if (buf->io_done) {
+			SLIST_REMOVE(&bc->io_list, buf, ext4_buf, io_node);
+			bc->io_cnt--;
+			return buf;
+		}
+	}
+	return NULL;
+}
+
+/**@brief   Reap completed asynchronous writes and read-ahead.
+ * @return  first write error among them, EOK if all succeeded*/
+static int ext4_block_reap_res(struct ext4_blockdev *bdev)
+{
+	int r = EOK;
+	struct ext4_buf *buf;
+	struct ext4_bcache *bc = bdev->bc;
+
+	if (!bc)
+		return EOK;
+
+	/* end_write() may get back here, so take buffers off the list
+	 * one by one before calling it. */
+	while (bc->io_cnt && (buf = ext4_block_io_pop_done(bc)) != NULL) {
+		int res = buf->io_res;
+		bool dont_shake = bc->dont_shake;
+
+		/* A failed read-ahead is not an error: the block will
+		 * simply be read again when it is needed. */
+		if (ext4_bcache_test_flag(buf, BC_READAHEAD)) {
+			ext4_bcache_clear_flag(buf, BC_READAHEAD);
+			if (res == EOK)
+				ext4_bcache_set_flag(buf, BC_UPTODATE);
+
+			ext4_bcache_put_buf(bc, buf);
+			continue;
+		}
+
+		ext4_bcache_clear_flag(buf, BC_WRITEBACK);
+		if (res == EOK) {
+			ext4_bcache_clear_flag(buf, BC_DIRTY);
+			buf->dirty_tick = 0;
+		} else {
+			if (r == EOK)
+				r = res;
+			/* Referenced buffer goes back on release. */
+			if (!buf->refctr &&
+			    ext4_bcache_test_flag(buf, BC_DIRTY))
+				ext4_bcache_insert_dirty_node(bc, buf);
+		}
+
+		if (buf->end_write) {
+			bc->dont_shake = true;
+			buf->end_write(bc, buf, res, buf->end_write_arg);
+			bc->dont_shake = dont_shake;
+		}
+	}
+	return r;
+}
+
+void ext4_block_reap(struct ext4_blockdev *bdev)
+{
+	ext4_block_reap_res(bdev);
+}
+
+void ext4_block_wait_buf(struct ext4_blockdev *bdev, struct ext4_buf *buf)
+{
+	for (;;) {
+		ext4_block_reap(bdev);
+		if (!ext4_bcache_in_flight(buf))
+			return;
+
+		bdev->bdif->bwait(bdev);
+	}
+}
+
+int ext4_block_wait_all(struct ext4_blockdev *bdev)
+{
+	int r = EOK;
+	for (;;) {
+		int res = ext4_block_reap_res(bdev);
+		if (r == EOK)
+			r = res;
+
+		if (SLIST_EMPTY(&bdev->bc->io_list))
+			return r;
+
+		bdev->bdif->bwait(bdev);
+	}
+}
+
+/**@brief   Start an asynchronous write of a dirty buffer.
+ * @return  EOK, EBUSY if the device has no free slot, or error code*/
+static int ext4_block_flush_buf_async(struct ext4_blockdev *bdev,
+				      struct ext4_buf *buf)
+{
+	int r;
+	uint64_t pba;
+	uint32_t pb_cnt;
+	struct ext4_bcache *bc = bdev->bc;
+
+	pba = (buf->lba * bdev->lg_bsize + bdev->part_offset) /
+	      bdev->bdif->ph_bsize;
+	pb_cnt = bdev->lg_bsize / bdev->bdif->ph_bsize;
+
+	/* The write may complete before bwrite_async() returns. */
+	buf->io_done = false;
+	ext4_bcache_set_flag(buf, BC_WRITEBACK);
+
+	ext4_bdif_lock(bdev);
+	r = bdev->bdif->bwrite_async(bdev, buf->data, pba, pb_cnt,
+				     ext4_block_end_async, buf);
+	if (r == EOK)
+		bdev->bdif->bwrite_ctr++;
+	ext4_bdif_unlock(bdev);
+
+	if (r != EOK) {
+		ext4_bcache_clear_flag(buf, BC_WRITEBACK);
+		return r;
+	}
+
+	ext4_bcache_remove_dirty_node(bc, buf);
+	SLIST_INSERT_HEAD(&bc->io_list, buf, io_node);
+	bc->io_cnt++;
+	return EOK;
+}
+
+/**@brief   Start writes of all dirty buffers without waiting for them.
+ *          Does nothing if the device can't write asynchronously.
+ * @return  standard error code*/
+static int ext4_block_cache_submit(struct ext4_blockdev *bdev)
+{
+	int r = EOK;
+	struct ext4_bcache *bc = bdev->bc;
+
+	if (!bdev->bdif->bwrite_async)
+		return EOK;
+
+	ext4_bdif_plug(bdev, true);
+	while (!SLIST_EMPTY(&bc->dirty_list)) {
+		struct ext4_buf *buf = SLIST_FIRST(&bc->dirty_list);
+		ext4_assert(buf);
+
+		r = ext4_block_flush_buf_async(bdev, buf);
+		if (r == EBUSY) {
+			/* Issue the batch and wait for a free slot. A failed
+			 * write returns to dirty_list: leave it to the caller
+			 * instead of resubmitting it forever. */
+			ext4_bdif_plug(bdev, false);
+			bdev->bdif->bwait(bdev);
+			r = ext4_block_reap_res(bdev);
+			ext4_bdif_plug(bdev, true);
+			if (r != EOK)
+				break;
+
+			continue;
+		}
+
+		if (r != EOK) {
+			r = ext4_block_flush_buf(bdev, buf);
+			if (r != EOK)
+				break;
+		}
+	}
+	ext4_bdif_plug(bdev, false);
+	return r;
+}
+
 int ext4_block_flush_buf(struct ext4_blockdev *bdev, struct ext4_buf *buf)
 {
 	int r;
 	struct ext4_bcache *bc = bdev->bc;
 
+	/* Let the write in flight finish: a failed one is retried below. */
+	if (ext4_bcache_test_flag(buf, BC_WRITEBACK))
+		ext4_block_wait_buf(bdev, buf);
+
 	if (ext4_bcache_test_flag(buf, BC_DIRTY) &&
 	    ext4_bcache_test_flag(buf, BC_UPTODATE)) {
 		r = ext4_blocks_set_direct(bdev, buf->data, buf->lba, 1);
@@ -158,6 +348,7 @@ int ext4_block_flush_buf(struct ext4_blockdev *bdev, struct ext4_buf *buf)
 
 		ext4_bcache_remove_dirty_node(bc, buf);
 		ext4_bcache_clear_flag(buf, BC_DIRTY);
+		buf->dirty_tick = 0;
 		if (buf->end_write) {
 			bc->dont_shake = true;
 			buf->end_write(bc, buf, r, buf->end_write_arg);
@@ -235,6 +426,12 @@ int ext4_block_get_noread(struct ext4_blockdev *bdev, struct ext4_block *b,
 	if (!b->data)
 		return ENOMEM;
 
+	/* The caller may modify the data: wait until the device has it.
+	 * A block being read ahead becomes up to date here. */
+	ext4_block_reap(bdev);
+	if (ext4_bcache_in_flight(b->buf))
+		ext4_block_wait_buf(bdev, b->buf);
+
 	return EOK;
 }
 
@@ -275,6 +472,108 @@ int ext4_block_set(struct ext4_blockdev *bdev, struct ext4_block *b)
 	return ext4_bcache_free(bdev->bc, b);
 }
 
+int ext4_block_readahead(struct ext4_blockdev *bdev, uint64_t lba,
+			 uint32_t cnt)
+{
+	int r = EOK;
+	uint64_t pba;
+	uint32_t pb_cnt;
+	struct ext4_bcache *bc = bdev->bc;
+
+	ext4_assert(bdev);
+
+	if (!bdev->bdif->ph_refctr)
+		return EIO;
+
+	if (!bdev->bdif->bread_async)
+		return ENOTSUP;
+
+	pb_cnt = bdev->lg_bsize / bdev->bdif->ph_bsize;
+
+	/* Adjacent buffers are merged into one request by the device. */
+	ext4_bdif_plug(bdev, true);
+	for (; cnt && lba < bdev->lg_bcnt; lba++, cnt--) {
+		bool is_new;
+		struct ext4_block b = { .lb_id = lba };
+
+		/* Cached or already on its way. */
+		if (ext4_bcache_lookup(bc, lba))
+			continue;
+
+		r = ext4_block_cache_shake(bdev);
+		if (r != EOK)
+			break;
+
+		r = ext4_bcache_alloc(bc, &b, &is_new);
+		if (r != EOK)
+			break;
+
+		ext4_assert(is_new);
+		b.buf->io_done = false;
+		ext4_bcache_set_flag(b.buf, BC_READAHEAD);
+
+		pba = (lba * bdev->lg_bsize + bdev->part_offset) /
+		      bdev->bdif->ph_bsize;
+
+		ext4_bdif_lock(bdev);
+		r = bdev->bdif->bread_async(bdev, b.data, pba, pb_cnt,
+					    ext4_block_end_async, b.buf);
+		if (r == EOK) {
+			bdev->bdif->bread_ctr++;
+			bdev->ra_issued++;
+		}
+		ext4_bdif_unlock(bdev);
+
+		if (r != EOK) {
+			/* Not up to date, so the buffer is dropped. */
+			ext4_bcache_clear_flag(b.buf, BC_READAHEAD);
+			ext4_bcache_free(bc, &b);
+			break;
+		}
+
+		/* The reference is dropped when the read is reaped. */
+		SLIST_INSERT_HEAD(&bc->io_list, b.buf, io_node);
+		bc->io_cnt++;
+	}
+	ext4_bdif_plug(bdev, false);
+
+	/* Out of request slots: read-ahead is only a hint. */
+	return r == EBUSY ? EOK : r;
+}
+
+int ext4_block_read_cached(struct ext4_blockdev *bdev, uint64_t lba,
+			   uint32_t off, void *buf, uint32_t len)
+{
+	struct ext4_block b;
+	struct ext4_buf *cbuf;
+	int r = ENOENT;
+
+	ext4_assert(bdev && buf && off + len <= bdev->lg_bsize);
+
+	cbuf = ext4_bcache_lookup(bdev->bc, lba);
+	if (!cbuf || !(ext4_bcache_test_flag(cbuf, BC_UPTODATE) ||
+		       ext4_bcache_test_flag(cbuf, BC_READAHEAD)))
+		return ENOENT;
+
+	ext4_bcache_find_get(bdev->bc, &b, lba);
+	if (ext4_bcache_in_flight(b.buf))
+		ext4_block_wait_buf(bdev, b.buf);
+
+	if (ext4_bcache_test_flag(b.buf, BC_UPTODATE)) {
+		memcpy(buf, b.data + off, len);
+		r = EOK;
+
+		/* A file block read to its end is not needed any more:
+		 * don't let streamed data push metadata out of the cache. */
+		if (off + len == bdev->lg_bsize && b.buf->refctr == 1 &&
+		    !ext4_bcache_test_flag(b.buf, BC_DIRTY))
+			ext4_bcache_set_flag(b.buf, BC_TMP);
+	}
+
+	ext4_bcache_free(bdev->bc, &b);
+	return r;
+}
+
 int ext4_blocks_get_direct(struct ext4_blockdev *bdev, void *buf, uint64_t lba,
 			   uint32_t cnt)
 {
@@ -440,6 +739,11 @@ int ext4_block_readbytes(struct ext4_blockdev *bdev, uint64_t off, void *buf,
 
 int ext4_block_cache_flush(struct ext4_blockdev *bdev)
 {
+	/* Start all writes at once so the device can overlap them, then
+	 * retry synchronously whatever failed. */
+	ext4_block_cache_submit(bdev);
+	ext4_block_wait_all(bdev);
+
 	while (!SLIST_EMPTY(&bdev->bc->dirty_list)) {
 		int r;
 		struct ext4_buf *buf = SLIST_FIRST(&bdev->bc->dirty_list);
@@ -449,6 +753,11 @@ int ext4_block_cache_flush(struct ext4_blockdev *bdev)
 			return r;
 
 	}
+
+	/* Synchronous bwrite() is durable on return, bwrite_async() is not. */
+	if (bdev->bdif->bwrite_async && bdev->bdif->bsync)
+		return bdev->bdif->bsync(bdev);
+
 	return EOK;
 }
 
@@ -463,10 +772,68 @@ int ext4_block_cache_write_back(struct ext4_blockdev *bdev, uint8_t on_off)
 	if (bdev->cache_write_back)
 		return EOK;
 
-	/*Flush data in all delayed cache blocks*/
+	/*Flush data in all delayed cache blocks. With asynchronous writes
+	 *they are only started: ext4_block_cache_flush() waits for them.*/
+	if (bdev->bdif->bwrite_async)
+		return ext4_block_cache_submit(bdev);
+
 	return ext4_block_cache_flush(bdev);
 }
 
+int ext4_block_cache_write_expired(struct ext4_blockdev *bdev,
+				   uint32_t max_age, uint32_t max_dirty)
+{
+	int r = EOK;
+	bool all;
+	struct ext4_buf *buf, *next;
+	struct ext4_bcache *bc = bdev->bc;
+
+	if (!bc)
+		return EOK;
+
+	/* Finished writes leave the dirty list before it is counted. */
+	ext4_block_reap(bdev);
+
+	/* dirty_tick == 0 marks a clean buffer. */
+	if (!++bc->tick)
+		bc->tick = 1;
+
+	all = bc->dirty_cnt > max_dirty;
+
+	ext4_bdif_plug(bdev, true);
+	buf = SLIST_FIRST(&bc->dirty_list);
+	while (buf) {
+		next = SLIST_NEXT(buf, dirty_node);
+		if (!all && bc->tick - buf->dirty_tick < max_age) {
+			buf = next;
+			continue;
+		}
+
+		if (bdev->bdif->bwrite_async) {
+			r = ext4_block_flush_buf_async(bdev, buf);
+			/* No free slot: the rest waits for the next tick. */
+			if (r == EBUSY) {
+				r = EOK;
+				break;
+			}
+
+			if (r == EOK) {
+				buf = next;
+				continue;
+			}
+		}
+
+		/* end_write() may change the dirty list: start over. */
+		r = ext4_block_flush_buf(bdev, buf);
+		if (r != EOK)
+			break;
+
+		buf = SLIST_FIRST(&bc->dirty_list);
+	}
+	ext4_bdif_plug(bdev, false);
+	return r;
+}
+
 /**
  * @}
  */
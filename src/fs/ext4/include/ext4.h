@@ -84,6 +84,15 @@ typedef struct ext4_file {
 
 	/**@brief   Actual file position.*/
 	uint64_t fpos;
+
+	/**@brief   Read-ahead: file block where a sequential read goes on.*/
+	uint32_t ra_next;
+
+	/**@brief   Read-ahead: window size in blocks, 0 - not sequential.*/
+	uint32_t ra_size;
+
+	/**@brief   Read-ahead: first file block not requested yet.*/
+	uint32_t ra_end;
 } ext4_file;
 
 /*****************************DIRECTORY DESCRIPTOR***************************/
@@ -206,6 +215,23 @@ struct ext4_mount_stats {
 int ext4_mount_point_stats(const char *mount_point,
 			   struct ext4_mount_stats *stats);
 
+/**@brief   Read-ahead counters, in filesystem blocks. */
+struct ext4_ra_stats {
+	uint64_t issued;
+	uint64_t hits;
+	uint64_t misses;
+};
+
+/**@brief   Get read-ahead counters of a mount point.
+ *
+ * @param   mount_point Mount point.
+ * @param   stats Read-ahead counters.
+ * @param   reset Zero the counters after reading.
+ *
+ * @return Standard error code. */
+int ext4_ra_stats(const char *mount_point, struct ext4_ra_stats *stats,
+		  bool reset);
+
 /**@brief   Setup OS lock routines.
  *
  * @param   mount_point Mount point.
@@ -260,6 +286,18 @@ int ext4_get_sblock(const char *mount_point, struct ext4_sblock **sb);
  * @return Standard error code. */
 int ext4_cache_write_back(const char *path, bool on);
 
+/**@brief   Write back cache buffers that stayed dirty too long.
+ *          Meant to be called periodically while write back mode is
+ *          enabled, each call advances the buffer age by one tick.
+ *
+ * @param   path Mount point.
+ * @param   max_age Write buffers dirty for at least this many calls.
+ * @param   max_dirty Write all dirty buffers if there are more of them.
+ *
+ * @return  Standard error code. */
+int ext4_cache_write_expired(const char *path, uint32_t max_age,
+			     uint32_t max_dirty);
+
 
 /**@brief   Force cache flush.
  *
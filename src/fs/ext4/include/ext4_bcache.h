@@ -91,6 +91,10 @@ struct ext4_buf {
 	/**@brief   Whether or not buffer is on dirty list.*/
 	bool on_dirty_list;
 
+	/**@brief   Cache tick when the buffer first went on the dirty list,
+	 *          0 while its data is clean on disk.*/
+	uint32_t dirty_tick;
+
 	/**@brief   LBA tree node*/
 	RB_ENTRY(ext4_buf) lba_node;
 
@@ -100,6 +104,15 @@ struct ext4_buf {
 	/**@brief   Dirty list node*/
 	SLIST_ENTRY(ext4_buf) dirty_node;
 
+	/**@brief   In-flight list node (asynchronous write or read-ahead)*/
+	SLIST_ENTRY(ext4_buf) io_node;
+
+	/**@brief   Result of the asynchronous I/O, valid once io_done is set*/
+	volatile int io_res;
+
+	/**@brief   Set by the completion callback, possibly from IRQ context*/
+	volatile bool io_done;
+
 	/**@brief   Callback routine after a disk-write operation.
 	 * @param   bc block cache descriptor
 	 * @param   buf buffer descriptor
@@ -146,6 +159,19 @@ struct ext4_bcache {
 
 	/**@brief   A singly-linked list holding dirty buffers*/
 	SLIST_HEAD(ext4_buf_dirty, ext4_buf) dirty_list;
+
+	/**@brief   Buffers with an asynchronous write or read in flight*/
+	SLIST_HEAD(ext4_buf_io, ext4_buf) io_list;
+
+	/**@brief   Number of buffers on io_list*/
+	uint32_t io_cnt;
+
+	/**@brief   Number of buffers on dirty_list*/
+	uint32_t dirty_cnt;
+
+	/**@brief   Write-back age counter, advanced by
+	 *          ext4_block_cache_write_expired()*/
+	uint32_t tick;
 };
 
 /**@brief buffer state bits
@@ -156,12 +182,18 @@ struct ext4_bcache {
  *              when no one references it.
  *  - BC_TMP: Buffer will be dropped once its refctr
  *            reaches zero.
+ *  - BC_WRITEBACK: Asynchronous write of the buffer is in flight,
+ *                  its data must not change until it is reaped.
+ *  - BC_READAHEAD: Asynchronous read of the buffer is in flight,
+ *                  the read-ahead holds a reference until it is reaped.
  */
 enum bcache_state_bits {
 	BC_UPTODATE,
 	BC_DIRTY,
 	BC_FLUSH,
-	BC_TMP
+	BC_TMP,
+	BC_WRITEBACK,
+	BC_READAHEAD
 };
 
 #define ext4_bcache_set_flag(buf, b)    \
@@ -181,6 +213,13 @@ static inline void ext4_bcache_set_dirty(struct ext4_buf *buf) {
 static inline void ext4_bcache_clear_dirty(struct ext4_buf *buf) {
 	ext4_bcache_clear_flag(buf, BC_UPTODATE);
 	ext4_bcache_clear_flag(buf, BC_DIRTY);
+	buf->dirty_tick = 0;
+}
+
+/**@brief   Asynchronous I/O of the buffer is in flight.*/
+static inline bool ext4_bcache_in_flight(struct ext4_buf *buf) {
+	return ext4_bcache_test_flag(buf, BC_WRITEBACK) ||
+	       ext4_bcache_test_flag(buf, BC_READAHEAD);
 }
 
 /**@brief   Increment reference counter of buf by 1.*/
@@ -197,6 +236,10 @@ ext4_bcache_insert_dirty_node(struct ext4_bcache *bc, struct ext4_buf *buf) {
 	if (!buf->on_dirty_list) {
 		SLIST_INSERT_HEAD(&bc->dirty_list, buf, dirty_node);
 		buf->on_dirty_list = true;
+		bc->dirty_cnt++;
+		/* A buffer that comes back keeps its age. */
+		if (!buf->dirty_tick)
+			buf->dirty_tick = bc->tick;
 	}
 }
 
@@ -208,6 +251,7 @@ ext4_bcache_remove_dirty_node(struct ext4_bcache *bc, struct ext4_buf *buf) {
 	if (buf->on_dirty_list) {
 		SLIST_REMOVE(&bc->dirty_list, buf, ext4_buf, dirty_node);
 		buf->on_dirty_list = false;
+		bc->dirty_cnt--;
 	}
 }
 
@@ -253,6 +297,12 @@ void ext4_bcache_invalidate_lba(struct ext4_bcache *bc,
 				uint64_t from,
 				uint32_t cnt);
 
+/**@brief   Look up a buffer without referencing it.
+ * @param   bc block cache descriptor
+ * @param   lba logical block address
+ * @return  block cache buffer or NULL */
+struct ext4_buf *ext4_bcache_lookup(struct ext4_bcache *bc, uint64_t lba);
+
 /**@brief   Find existing buffer from block cache memory.
  *          Unreferenced block allocation is based on LRU
  *          (Last Recently Used) algorithm.
@@ -280,6 +330,13 @@ int ext4_bcache_alloc(struct ext4_bcache *bc, struct ext4_block *b,
  * @return  standard error code*/
 int ext4_bcache_free(struct ext4_bcache *bc, struct ext4_block *b);
 
+/**@brief   Drop a reference taken without a block descriptor
+ *          (read-ahead). Unlike ext4_bcache_free() the buffer is
+ *          kept even if it is not up to date.
+ * @param   bc block cache descriptor
+ * @param   buf buffer*/
+void ext4_bcache_put_buf(struct ext4_bcache *bc, struct ext4_buf *buf);
+
 /**@brief   Return a full status of block cache.
  * @param   bc block cache descriptor
  * @return  full status*/
@@ -70,6 +70,52 @@ struct ext4_blockdev_iface {
 	 * @param   bdev block device.*/
 	int (*close)(struct ext4_blockdev *bdev);
 
+	/**@brief   Asynchronous block write function. Not mandatory field.
+	 *          On EOK end() is called exactly once, possibly from
+	 *          interrupt context; buf must stay untouched until then.
+	 * @param   bdev block device
+	 * @param   buf input buffer
+	 * @param   blk_id block id
+	 * @param   blk_cnt block count
+	 * @param   end completion callback
+	 * @param   arg argument passed to end()
+	 * @return  EOK, EBUSY if no request slot is free, or error code*/
+	int (*bwrite_async)(struct ext4_blockdev *bdev, const void *buf,
+			    uint64_t blk_id, uint32_t blk_cnt,
+			    void (*end)(void *arg, int res), void *arg);
+
+	/**@brief   Asynchronous block read function (read-ahead). Not
+	 *          mandatory field. Same contract as bwrite_async. Leave
+	 *          it NULL if the device completes requests only
+	 *          synchronously: read-ahead would then stall the reader.
+	 * @param   bdev block device
+	 * @param   buf output buffer
+	 * @param   blk_id block id
+	 * @param   blk_cnt block count
+	 * @param   end completion callback
+	 * @param   arg argument passed to end()
+	 * @return  EOK, EBUSY if no request slot is free, or error code*/
+	int (*bread_async)(struct ext4_blockdev *bdev, void *buf,
+			   uint64_t blk_id, uint32_t blk_cnt,
+			   void (*end)(void *arg, int res), void *arg);
+
+	/**@brief   Wait until some asynchronous request completes (or a
+	 *          timeout passes). Required with bwrite_async or
+	 *          bread_async.
+	 * @param   bdev block device.*/
+	void (*bwait)(struct ext4_blockdev *bdev);
+
+	/**@brief   Batch following writes (on) or issue them (off).
+	 *          Not mandatory field.
+	 * @param   bdev block device
+	 * @param   on start or end of the batch*/
+	void (*plug)(struct ext4_blockdev *bdev, bool on);
+
+	/**@brief   Make completed writes durable (device write cache).
+	 *          Not mandatory field.
+	 * @param   bdev block device.*/
+	int (*bsync)(struct ext4_blockdev *bdev);
+
 	/**@brief   Lock block device. Required in multi partition mode
 	 *          operations. Not mandatory field.
 	 * @param   bdev block device.*/
@@ -128,6 +174,15 @@ struct ext4_blockdev {
 	/**@brief   The filesystem this block device belongs to. */
 	struct ext4_fs *fs;
 
+	/**@brief   Blocks requested by read-ahead*/
+	uint64_t ra_issued;
+
+	/**@brief   File blocks read from the cache*/
+	uint64_t ra_hits;
+
+	/**@brief   File blocks read from the device*/
+	uint64_t ra_misses;
+
 	void *journal;
 };
 
@@ -174,6 +229,22 @@ int ext4_block_fini(struct ext4_blockdev *bdev);
  * @return  standard error code*/
 int ext4_block_flush_buf(struct ext4_blockdev *bdev, struct ext4_buf *buf);
 
+/**@brief   Wait for the asynchronous write of a buffer, if any.
+ * @param   bdev block device descriptor
+ * @param   buf buffer*/
+void ext4_block_wait_buf(struct ext4_blockdev *bdev, struct ext4_buf *buf);
+
+/**@brief   Finish completed asynchronous I/O: clear dirty state
+ *          of written buffers and call their end_write() callbacks,
+ *          mark read-ahead buffers up to date.
+ * @param   bdev block device descriptor*/
+void ext4_block_reap(struct ext4_blockdev *bdev);
+
+/**@brief   Wait for all asynchronous I/O in flight.
+ * @param   bdev block device descriptor
+ * @return  first write error, EOK if all writes succeeded*/
+int ext4_block_wait_all(struct ext4_blockdev *bdev);
+
 /**@brief   Flush data in buffer of given lba to disk,
  *          if that buffer exists in block cache.
  * @param   bdev block device descriptor
@@ -208,6 +279,26 @@ int ext4_block_get(struct ext4_blockdev *bdev, struct ext4_block *b,
  * @return  standard error code*/
 int ext4_block_set(struct ext4_blockdev *bdev, struct ext4_block *b);
 
+/**@brief   Start asynchronous reads of blocks missing in the cache.
+ *          Stops quietly when the device runs out of request slots.
+ * @param   bdev block device descriptor
+ * @param   lba first logical block address
+ * @param   cnt block count
+ * @return  standard error code, ENOTSUP without bread_async*/
+int ext4_block_readahead(struct ext4_blockdev *bdev, uint64_t lba,
+			 uint32_t cnt);
+
+/**@brief   Copy part of a block if the cache has it (waits for the
+ *          read-ahead in flight).
+ * @param   bdev block device descriptor
+ * @param   lba logical block address
+ * @param   off offset in the block
+ * @param   buf output buffer
+ * @param   len length to copy
+ * @return  EOK, or ENOENT if the block has to be read from the device*/
+int ext4_block_read_cached(struct ext4_blockdev *bdev, uint64_t lba,
+			   uint32_t off, void *buf, uint32_t len);
+
 /**@brief   Block read procedure (without cache)
  * @param   bdev block device descriptor
  * @param   buf output buffer
@@ -255,6 +346,16 @@ int ext4_block_cache_flush(struct ext4_blockdev *bdev);
  * @return  standard error code*/
 int ext4_block_cache_write_back(struct ext4_blockdev *bdev, uint8_t on_off);
 
+/**@brief   Write back dirty buffers that stayed dirty too long.
+ *          Each call is one tick of the write-back age counter.
+ *          With asynchronous writes the buffers are only submitted.
+ * @param   bdev block device descriptor
+ * @param   max_age buffers dirty for this many ticks are written
+ * @param   max_dirty if more buffers are dirty, all of them are written
+ * @return  standard error code*/
+int ext4_block_cache_write_expired(struct ext4_blockdev *bdev,
+				   uint32_t max_age, uint32_t max_dirty);
+
 #ifdef __cplusplus
 }
 #endif
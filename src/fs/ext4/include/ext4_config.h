@@ -127,6 +127,12 @@ extern "C" {
 #define CONFIG_BLOCK_DEV_CACHE_SIZE 64
 #endif
 
+/**@brief   Maximum read-ahead window of a file, in blocks (0 - off).
+ *          The window grows from a quarter of it on sequential reads.*/
+#ifndef CONFIG_EXT4_READAHEAD_BLOCKS
+#define CONFIG_EXT4_READAHEAD_BLOCKS (CONFIG_BLOCK_DEV_CACHE_SIZE / 2)
+#endif
+
 
 /**@brief   Maximum block device name*/
 #ifndef CONFIG_EXT4_MAX_BLOCKDEV_NAME
@@ -53,6 +53,7 @@ extern "C" {
 #define ENOMEM 12    /* Out of memory */
 #define EACCES 13    /* Permission denied */
 #define EFAULT 14    /* Bad address */
+#define EBUSY 16     /* Device or resource busy */
 #define EEXIST 17    /* File exists */
 #define ENODEV 19    /* No such device */
 #define ENOTDIR 20   /* Not a directory */
@@ -0,0 +1,188 @@
+#include "ext4_blockdev_blk.h"
+#include <stddef.h>
+#include <stdint.h>
+#include "../cpu/cpu.h"
+#include "../malloc/malloc.h"
+#include "../libc/string.h"
+
+/* Асинхронных записей и упреждающих чтений кэша lwext4: столько bio может ждать в очереди */
+#define BLK_AIO_SLOTS 64
+
+typedef struct blk_aio_slot
+{
+    blk_bio_t bio; /* первым полем: end_io получает слот по адресу bio */
+    void (*end)(void *arg, int res);
+    void *arg;
+} blk_aio_slot_t;
+
+typedef struct blk_aio
+{
+    blk_dev_t *dev;
+    blk_aio_slot_t slots[BLK_AIO_SLOTS];
+    volatile uint64_t free_mask; /* бит i - слот i свободен */
+    uint64_t seen;               /* счётчик событий устройства на последнем blk_bwait */
+} blk_aio_t;
+
+static struct ext4_blockdev_iface blk_ifaces[BLK_MAX_DEVICES];
+static struct ext4_blockdev blk_bdevs[BLK_MAX_DEVICES];
+static uint8_t blk_bbufs[BLK_MAX_DEVICES][BLK_MAX_SECTOR_SIZE];
+static blk_aio_t *blk_aios[BLK_MAX_DEVICES];
+static int blk_bdev_count = 0;
+
+static int blk_to_ext4_error(int rc) {
+    if (rc == BLK_OK) return 0;
+    if (rc == BLK_ERR_INVALID) return -EINVAL;
+    if (rc == BLK_ERR_NOMEM) return -ENOMEM;
+    return -EIO;
+}
+
+static int blk_open(struct ext4_blockdev *bdev) { (void)bdev; return 0; }
+static int blk_close(struct ext4_blockdev *bdev) { (void)bdev; return 0; }
+/* Очередь устройства сама сериализует запросы */
+static int blk_lock(struct ext4_blockdev *bdev) { (void)bdev; return 0; }
+static int blk_unlock(struct ext4_blockdev *bdev) { (void)bdev; return 0; }
+
+static int blk_bread(struct ext4_blockdev *bdev, void *buf, uint64_t blk_id, uint32_t blk_cnt) {
+    blk_dev_t *dev = (blk_dev_t *)bdev->bdif->p_user;
+    int block_size = bdev->bdif->ph_bsize;
+    uint32_t total = blk_cnt * block_size / dev->sector_size;
+    uint64_t lba = blk_id * (block_size / dev->sector_size);
+    return blk_to_ext4_error(blk_read(dev, lba, total, buf));
+}
+
+static int blk_bwrite(struct ext4_blockdev *bdev, const void *buf, uint64_t blk_id, uint32_t blk_cnt) {
+    blk_dev_t *dev = (blk_dev_t *)bdev->bdif->p_user;
+    int block_size = bdev->bdif->ph_bsize;
+    uint32_t total = blk_cnt * block_size / dev->sector_size;
+    uint64_t lba = blk_id * (block_size / dev->sector_size);
+    return blk_to_ext4_error(blk_write(dev, lba, total, buf));
+}
+
+static blk_aio_t *blk_aio_of(struct ext4_blockdev *bdev) {
+    return blk_aios[bdev->bdif - blk_ifaces];
+}
+
+/* Из обработчика прерывания или из потока выдачи, прерывания выключены */
+static void blk_aio_end_io(blk_bio_t *bio) {
+    blk_aio_slot_t *slot = (blk_aio_slot_t *)bio;
+    blk_aio_t *aio = (blk_aio_t *)bio->private;
+    void (*end)(void *, int) = slot->end;
+    void *arg = slot->arg;
+
+    aio->free_mask |= 1ULL << (slot - aio->slots);
+    end(arg, blk_to_ext4_error(bio->rc));
+}
+
+/* Ввод-вывод без ожидания: bio встаёт в очередь, завершение приходит в end_io */
+static int blk_aio_submit(struct ext4_blockdev *bdev, void *buf, uint64_t blk_id, uint32_t blk_cnt, bool write,
+                          void (*end)(void *arg, int res), void *arg) {
+    blk_aio_t *aio = blk_aio_of(bdev);
+    blk_dev_t *dev = aio->dev;
+
+    uint64_t flags = save_irq_disable();
+    if (!aio->free_mask) {
+        restore_irq(flags);
+        return EBUSY;
+    }
+    int i = __builtin_ctzll(aio->free_mask);
+    aio->free_mask &= ~(1ULL << i);
+    restore_irq(flags);
+
+    int block_size = bdev->bdif->ph_bsize;
+    blk_aio_slot_t *slot = &aio->slots[i];
+    slot->end = end;
+    slot->arg = arg;
+    memset(&slot->bio, 0, sizeof(slot->bio));
+    slot->bio.lba = blk_id * (block_size / dev->sector_size);
+    slot->bio.count = blk_cnt * block_size / dev->sector_size;
+    slot->bio.write = write;
+    slot->bio.buf = buf;
+    slot->bio.end_io = blk_aio_end_io;
+    slot->bio.private = aio;
+
+    int rc = blk_submit(dev, &slot->bio);
+    if (rc != BLK_OK) {
+        flags = save_irq_disable();
+        aio->free_mask |= 1ULL << i;
+        restore_irq(flags);
+        return blk_to_ext4_error(rc);
+    }
+    return 0;
+}
+
+static int blk_bwrite_async(struct ext4_blockdev *bdev, const void *buf, uint64_t blk_id, uint32_t blk_cnt,
+                            void (*end)(void *arg, int res), void *arg) {
+    return blk_aio_submit(bdev, (void *)buf, blk_id, blk_cnt, true, end, arg);
+}
+
+static int blk_bread_async(struct ext4_blockdev *bdev, void *buf, uint64_t blk_id, uint32_t blk_cnt,
+                           void (*end)(void *arg, int res), void *arg) {
+    return blk_aio_submit(bdev, buf, blk_id, blk_cnt, false, end, arg);
+}
+
+static void blk_bwait(struct ext4_blockdev *bdev) {
+    blk_aio_t *aio = blk_aio_of(bdev);
+    if (aio->free_mask == ~0ULL)
+        return;
+
+    /* Завершение после прошлого вызова не теряется: счётчик событий его помнит.
+       bio под чужой пробкой или оставленный выдающим потоком выдаём сами */
+    aio->seen = blk_wait_event(aio->dev, aio->seen);
+}
+
+static void blk_bplug(struct ext4_blockdev *bdev, bool on) {
+    blk_dev_t *dev = (blk_dev_t *)bdev->bdif->p_user;
+    if (on)
+        blk_plug(dev);
+    else
+        blk_unplug(dev);
+}
+
+/* Асинхронная запись обходит сброс кэша диска после каждой команды */
+static int blk_bsync(struct ext4_blockdev *bdev) {
+    return blk_to_ext4_error(blk_flush((blk_dev_t *)bdev->bdif->p_user));
+}
+
+struct ext4_blockdev *ext4_blockdev_blk(blk_dev_t *dev) {
+    if (!dev || blk_bdev_count >= BLK_MAX_DEVICES)
+        return NULL;
+
+    int i = blk_bdev_count++;
+    struct ext4_blockdev_iface *iface = &blk_ifaces[i];
+    memset(iface, 0, sizeof(*iface));
+    iface->open = blk_open;
+    iface->bread = blk_bread;
+    iface->bwrite = blk_bwrite;
+    iface->close = blk_close;
+    iface->lock = blk_lock;
+    iface->unlock = blk_unlock;
+    iface->ph_bsize = dev->sector_size;
+    iface->ph_bcnt = dev->total_sectors;
+    iface->ph_bbuf = blk_bbufs[i];
+    iface->p_user = dev;
+
+    /* Без памяти под слоты кэш пишет синхронно и не читает наперёд */
+    blk_aio_t *aio = malloc(sizeof(blk_aio_t));
+    if (aio) {
+        memset(aio, 0, sizeof(*aio));
+        aio->dev = dev;
+        aio->free_mask = ~0ULL;
+        aio->seen = dev->events;
+        blk_aios[i] = aio;
+        iface->bwrite_async = blk_bwrite_async;
+        /* Без асинхронной отправки драйвера окно упреждения выполнил бы
+           синхронно сам читающий поток при снятии пробки */
+        if (dev->ops->submit)
+            iface->bread_async = blk_bread_async;
+        iface->bwait = blk_bwait;
+        iface->plug = blk_bplug;
+        iface->bsync = blk_bsync;
+    }
+
+    struct ext4_blockdev *bdev = &blk_bdevs[i];
+    memset(bdev, 0, sizeof(*bdev));
+    bdev->bdif = iface;
+    bdev->part_offset = 0;
+    bdev->part_size = dev->total_sectors * dev->sector_size;
+    return bdev;
+}
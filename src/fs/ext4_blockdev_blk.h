@@ -0,0 +1,10 @@
+#ifndef EXT4_BLOCKDEV_BLK_H
+#define EXT4_BLOCKDEV_BLK_H
+
+#include "ext4/include/ext4_blockdev.h"
+#include "../block/block.h"
+
+/* Блочное устройство lwext4 поверх очереди блочного слоя; NULL, если экземпляры кончились */
+struct ext4_blockdev *ext4_blockdev_blk(blk_dev_t *dev);
+
+#endif // EXT4_BLOCKDEV_BLK_H
@@ -1,9 +1,80 @@
 #include "fs.h"
 #include "vfs.h"
+#include "ext4_blockdev_blk.h"
+#include "../block/block.h"
+#include "../drivers/virtio_blk.h"
+#include "../drivers/ahci.h"
+#include "../drivers/nvme.h"
 
 static ide_disk_t g_primary_master_disk;
 static int g_disk_initialized = 0;
 
+static virtio_blk_t g_virtio_disks[VIRTIO_BLK_MAX_DEVICES];
+static ahci_disk_t g_ahci_disks[AHCI_MAX_DISKS];
+static nvme_disk_t g_nvme_disks[NVME_MAX_DISKS];
+
+/* Драйверы для блочного слоя: коды возврата у всех совпадают с BLK_* */
+static int ide_blk_rw(void *drv, uint64_t lba, uint32_t count, void *buf, bool write) {
+    return write ? ide_write_sectors(drv, lba, count, buf) : ide_read_sectors(drv, lba, count, buf);
+}
+
+static int virtio_blk_rw(void *drv, uint64_t lba, uint32_t count, void *buf, bool write) {
+    return write ? virtio_blk_write(drv, lba, count, buf) : virtio_blk_read(drv, lba, count, buf);
+}
+
+static int virtio_blk_flush_drv(void *drv) { return virtio_blk_flush(drv); }
+
+static int virtio_blk_submit_drv(void *drv, void *ctx, uint64_t lba, uint32_t count, void *buf, bool write,
+                                 blk_done_t done, void *arg) {
+    return virtio_blk_submit(drv, lba, count, buf, write, ctx, done, arg);
+}
+
+static void virtio_blk_poll_drv(void *drv) { virtio_blk_poll(drv); }
+
+static int ahci_blk_rw(void *drv, uint64_t lba, uint32_t count, void *buf, bool write) {
+    return write ? ahci_write_sectors(drv, lba, count, buf) : ahci_read_sectors(drv, lba, count, buf);
+}
+
+static int ahci_blk_flush(void *drv) { return ahci_flush(drv); }
+
+static int nvme_blk_rw(void *drv, uint64_t lba, uint32_t count, void *buf, bool write) {
+    return write ? nvme_write_sectors(drv, lba, count, buf) : nvme_read_sectors(drv, lba, count, buf);
+}
+
+static int nvme_blk_flush(void *drv) { return nvme_flush(drv); }
+
+static int nvme_blk_submit(void *drv, void *ctx, uint64_t lba, uint32_t count, void *buf, bool write,
+                           blk_done_t done, void *arg) {
+    return nvme_submit_async(drv, lba, count, buf, write, ctx, done, arg);
+}
+
+static void nvme_blk_poll(void *drv) { nvme_poll(drv); }
+
+/* IDE и AHCI отвечают только синхронно: их запросы выполняет поток выдачи блочного слоя,
+   упреждающего чтения у них нет */
+static const blk_ops_t ide_blk_ops = { .rw = ide_blk_rw, .flush = NULL };
+static const blk_ops_t virtio_blk_ops = {
+    .rw = virtio_blk_rw, .flush = virtio_blk_flush_drv,
+    .submit = virtio_blk_submit_drv, .poll = virtio_blk_poll_drv, .ctx_size = sizeof(virtio_blk_aio_t),
+};
+static const blk_ops_t ahci_blk_ops = { .rw = ahci_blk_rw, .flush = ahci_blk_flush };
+static const blk_ops_t nvme_blk_ops = {
+    .rw = nvme_blk_rw, .flush = nvme_blk_flush,
+    .submit = nvme_blk_submit, .poll = nvme_blk_poll, .ctx_size = sizeof(nvme_aio_t),
+};
+
+/* Диск встаёт в блочный слой и регистрируется в VFS под тем же именем */
+static void fs_add_disk(const char *name, const blk_ops_t *ops, void *drv,
+                        uint32_t sector_size, uint64_t total_sectors) {
+    blk_dev_t *dev = blk_register(name, ops, drv, sector_size, total_sectors);
+    if (!dev)
+        return;
+
+    struct ext4_blockdev *bdev = ext4_blockdev_blk(dev);
+    if (bdev)
+        vfs_register_device(name, bdev);
+}
+
 static void ensure_disk_init(void) {
     if (!g_disk_initialized) {
         if (ide_init(&g_primary_master_disk, IDE_CHANNEL_PRIMARY, 0) == IDE_OK) {
@@ -16,6 +87,44 @@ void fs_init(void) {
     vfs_init();
     
     ensure_disk_init();
+
+    /* Первичный ведущий IDE - ide0 */
+    if (g_disk_initialized)
+        fs_add_disk("ide0", &ide_blk_ops, &g_primary_master_disk,
+                    g_primary_master_disk.sector_size, g_primary_master_disk.total_sectors);
+
+    /* Диски virtio-blk регистрируются как virtio0, virtio1, ... */
+    for (int i = 0; i < VIRTIO_BLK_MAX_DEVICES; i++) {
+        virtio_blk_t *disk = &g_virtio_disks[i];
+        if (virtio_blk_init(disk, i) != VIRTIO_OK)
+            break;
+
+        char name[] = "virtio0";
+        name[6] = (char)('0' + i);
+        fs_add_disk(name, &virtio_blk_ops, disk, disk->sector_size, disk->total_sectors);
+    }
+
+    /* Диски SATA первого AHCI-контроллера - ahci0, ahci1, ... */
+    for (int i = 0; i < AHCI_MAX_DISKS; i++) {
+        ahci_disk_t *disk = &g_ahci_disks[i];
+        if (ahci_init(disk, i) != AHCI_OK)
+            break;
+
+        char name[] = "ahci0";
+        name[4] = (char)('0' + i);
+        fs_add_disk(name, &ahci_blk_ops, disk, disk->sector_size, disk->total_sectors);
+    }
+
+    /* Контроллеры NVMe, пространство имён 1 каждого - nvme0, nvme1, ... */
+    for (int i = 0; i < NVME_MAX_DISKS; i++) {
+        nvme_disk_t *disk = &g_nvme_disks[i];
+        if (nvme_init(disk, i) != NVME_OK)
+            break;
+
+        char name[] = "nvme0";
+        name[4] = (char)('0' + i);
+        fs_add_disk(name, &nvme_blk_ops, disk, disk->sector_size, disk->total_sectors);
+    }
 }
 
 ide_disk_t *get_primary_master_disk(void) {
@@ -4,14 +4,61 @@
 #include "../libc/string.h"
 #include "ext4/include/ext4_fs.h"
 #include "ext4/include/ext4_inode.h"
+#include "../spinlock/spinlock.h"
+#include "../multitask/rcu.h"
+#include "../multitask/mutex.h"
 
 #define VFS_MAX_FD 256
-
+/* Слот fd занят, но файл ещё не опубликован */
+#define VFS_FD_RESERVED ((vfs_file_t*)1)
+
+/*
+ * g_mounts и fd_table читаются без блокировок под RCU: разбор пути и поиск
+ * файла по fd не ждут писателей. Писатели сериализуются спинлоками,
+ * а старые версии освобождают после периода ожидания.
+ * Вызовы ext4 спят, а сон завершает секцию RCU: за её пределы объект выносят
+ * только со ссылкой (refcnt), взятой внутри секции.
+ * device_table только растёт и защищён rwlock
+ */
 static vfs_mount_t* g_mounts = NULL;
+static spinlock_t mount_lock = SPINLOCK_INIT;
 static vfs_file_t* fd_table[VFS_MAX_FD];
+static spinlock_t fd_lock = SPINLOCK_INIT;
 static int g_next_fd = 3;
 static vfs_dev_t device_table[8];
 static int num_devices = 0;
+static rwlock_t device_lock = RWLOCK_INIT;
+
+/* lwext4 не реентерабелен, а диск теперь ждёт прерывания во сне: вызовы в ext4 сериализуем */
+static mutex_t ext4_mutex = MUTEX_INIT;
+
+static void vfs_ext4_lock(void) { mutex_lock(&ext4_mutex); }
+static void vfs_ext4_unlock(void) { mutex_unlock(&ext4_mutex); }
+
+static const struct ext4_lock vfs_ext4_locks = {
+    .lock = vfs_ext4_lock,
+    .unlock = vfs_ext4_unlock,
+};
+
+/* Ссылка на объект, найденный под RCU: 0 - его уже удаляют */
+static int vfs_ref_get(unsigned int* ref) {
+    unsigned int r = __atomic_load_n(ref, __ATOMIC_RELAXED);
+    while (r) {
+        if (__atomic_compare_exchange_n(ref, &r, r + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return 1;
+    }
+    return 0;
+}
+
+/* 1, если ссылка была последней */
+static int vfs_ref_put(unsigned int* ref) {
+    return __atomic_sub_fetch(ref, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+void vfs_mount_put(vfs_mount_t* m) {
+    /* Последнюю ссылку (за список) снимает только vfs_umount */
+    if (m) vfs_ref_put(&m->refcnt);
+}
 
 void vfs_init(void) {
     memset(fd_table, 0, sizeof(fd_table));
@@ -21,50 +68,88 @@ void vfs_init(void) {
 }
 
 int vfs_register_device(const char* dev_name, struct ext4_blockdev* dev) {
-    if (num_devices >= (int)(sizeof(device_table)/sizeof(device_table[0]))) return -1;
+    write_lock(&device_lock);
+    if (num_devices >= (int)(sizeof(device_table)/sizeof(device_table[0]))) {
+        write_unlock(&device_lock);
+        return -1;
+    }
     strncpy(device_table[num_devices].name, dev_name, sizeof(device_table[0].name)-1);
     device_table[num_devices].blockdev = dev;
     num_devices++;
+    write_unlock(&device_lock);
     return 0;
 }
 
 int vfs_mount(const char* dev_name, const char* mount_path, int read_only) {
     struct ext4_blockdev* dev = NULL;
+    read_lock(&device_lock);
     for (int i = 0; i < num_devices; ++i) {
         if (strcmp(device_table[i].name, dev_name) == 0) {
             dev = device_table[i].blockdev;
             break;
         }
     }
+    read_unlock(&device_lock);
     if (!dev) return -1;
 
     if (ext4_device_register(dev, dev_name) != 0) return -1;
     if (ext4_mount(dev_name, mount_path, !!read_only) != 0) return -2;
+    ext4_mount_setup_locks(mount_path, &vfs_ext4_locks);
+    /* Мелкие записи копятся в кэше, на диск их уносит vfs_writeback() */
+    if (!read_only) ext4_cache_write_back(mount_path, true);
 
     vfs_mount_t* m = malloc(sizeof(vfs_mount_t));
+    if (!m) {
+        if (!read_only) ext4_cache_write_back(mount_path, false);
+        vfs_ext4_lock();
+        ext4_umount(mount_path);
+        vfs_ext4_unlock();
+        return -1;
+    }
+    memset(m, 0, sizeof(vfs_mount_t));
     strncpy(m->mount_path, mount_path, VFS_MOUNT_PATH_MAX-1);
     strncpy(m->dev_name, dev_name, sizeof(m->dev_name)-1);
     m->blockdev = dev;
     m->read_only = read_only;
+    m->refcnt = 1;
+
+    spin_lock(&mount_lock);
     m->next = g_mounts;
-    g_mounts = m;
+    rcu_assign_pointer(g_mounts, m);
+    spin_unlock(&mount_lock);
     return 0;
 }
 
+/* -1 - не смонтировано, -2 - занято: есть открытые файлы */
 int vfs_umount(const char* mount_path) {
     vfs_mount_t **pptr = &g_mounts, *to_free = NULL;
+    int busy = 0;
 
+    spin_lock(&mount_lock);
     while (*pptr) {
         if (strcmp((*pptr)->mount_path, mount_path) == 0) {
-            to_free = *pptr;
-            *pptr = (*pptr)->next;
+            /* 1 -> 0: новые vfs_ref_get на этой точке уже не пройдут */
+            unsigned int one = 1;
+            if (__atomic_compare_exchange_n(&(*pptr)->refcnt, &one, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                to_free = *pptr;
+                rcu_assign_pointer(*pptr, to_free->next);
+            } else busy = 1;
             break;
         }
         pptr = &(*pptr)->next;
     }
+    spin_unlock(&mount_lock);
+    if (busy) return -2;
     if (!to_free) return -1;
 
+    /* Разбор пути мог ещё идти по старому списку */
+    synchronize_rcu();
+
+    /* Выключение отложенной записи сбрасывает грязные блоки */
+    if (!to_free->read_only) ext4_cache_write_back(mount_path, false);
+    vfs_ext4_lock();
     ext4_umount(mount_path);
+    vfs_ext4_unlock();
     free(to_free);
     return 0;
 }
@@ -72,7 +157,8 @@ int vfs_umount(const char* mount_path) {
 vfs_mount_t* vfs_resolve_path(const char* path, char* out_rel) {
     size_t best_len = 0;
     vfs_mount_t* best = NULL;
-    for (vfs_mount_t* m = g_mounts; m; m = m->next) {
+    rcu_read_lock();
+    for (vfs_mount_t* m = rcu_dereference(g_mounts); m; m = rcu_dereference(m->next)) {
         size_t l = strlen(m->mount_path);
         if (strncmp(path, m->mount_path, l) == 0) {
             if (path[l] == '/' || path[l] == '\0') {
@@ -80,6 +166,7 @@ vfs_mount_t* vfs_resolve_path(const char* path, char* out_rel) {
             }
         }
     }
+    if (best && !vfs_ref_get(&best->refcnt)) best = NULL;
     if (best && out_rel) {
         size_t len = strlen(best->mount_path);
         if (strncmp(path, best->mount_path, len) == 0) {
@@ -87,20 +174,24 @@ vfs_mount_t* vfs_resolve_path(const char* path, char* out_rel) {
             if (out_rel[0] == '/') memmove(out_rel, out_rel+1, strlen(out_rel+1)+1);
         } else out_rel[0] = 0;
     }
+    rcu_read_unlock();
     return best;
 }
 
 int vfs_seek(int fb, uint64_t offset, uint32_t origin)
 {
     vfs_file_t *f = vfs_get_file(fb);
-    if (!f || f->is_dir) return -1;
+    if (!f) return -1;
+    if (f->is_dir)
+    {
+        vfs_put_file(f);
+        return -1;
+    }
     ext4_file *ext_file = f->handle;
     int res = ext4_fseek(ext_file, offset, origin);
     if (res == 0)
-    {
         f->offset = ext4_ftell(ext_file);
-        return 0;
-    }
+    vfs_put_file(f);
     return res;
 }
 
@@ -110,12 +201,20 @@ int vfs_find(const char* path)
     vfs_mount_t* m = vfs_resolve_path(path, rel);
     if (!m) return -1;
     int fb = vfs_alloc_fd();
-    if (fb < 0) return -1;
+    if (fb < 0) {
+        vfs_mount_put(m);
+        return -1;
+    }
 
     vfs_file_t* f = malloc(sizeof(vfs_file_t));
-    if (!f) return -1;
+    if (!f) {
+        vfs_free_fd(fb);
+        vfs_mount_put(m);
+        return -1;
+    }
     memset(f, 0, sizeof(vfs_file_t));
     f->mount = m;
+    f->refcnt = 1;
     strncpy(f->canonical_path, path, VFS_PATH_MAX-1);
 
     ext4_dir* d = malloc(sizeof(ext4_dir));
@@ -123,7 +222,7 @@ int vfs_find(const char* path)
         if (ext4_dir_open(d, path) == 0) {
             f->is_dir = 1;
             f->handle = d;
-            fd_table[fb] = f;
+            vfs_install_fd(fb, f);
             return fb;
         }
         free(d);
@@ -137,13 +236,15 @@ int vfs_find(const char* path)
             f->offset = 0;
             f->size = ext4_fsize(ef);
             f->flags = 0;
-            fd_table[fb] = f;
+            vfs_install_fd(fb, f);
             return fb;
         }
         free(ef);
     }
 
     free(f);
+    vfs_free_fd(fb);
+    vfs_mount_put(m);
     return -1;
 }
 
@@ -160,24 +261,69 @@ size_t vfs_get_file_size(const char *path)
     return 0;
 }
 
+/* Резервирует слот: до vfs_install_fd vfs_get_file его не видит */
 int vfs_alloc_fd(void) {
+    int fd = -1;
+    spin_lock(&fd_lock);
     for (int i = 3; i < VFS_MAX_FD; ++i) {
-        if (!fd_table[i]) return i;
+        if (!fd_table[i]) {
+            fd_table[i] = VFS_FD_RESERVED;
+            fd = i;
+            break;
+        }
     }
-    return -1;
+    spin_unlock(&fd_lock);
+    return fd;
+}
+
+void vfs_install_fd(int fd, vfs_file_t* f) {
+    rcu_assign_pointer(fd_table[fd], f);
+}
+
+static void vfs_file_free_rcu(rcu_head_t* head) {
+    free(container_of(head, vfs_file_t, rcu));
+}
+
+/* Освобождает слот; ссылка слота на файл переходит к вызывающему */
+static vfs_file_t* vfs_take_fd(int fd) {
+    if (fd < 3 || fd >= VFS_MAX_FD) return NULL;
+
+    spin_lock(&fd_lock);
+    vfs_file_t* f = fd_table[fd];
+    rcu_assign_pointer(fd_table[fd], NULL);
+    spin_unlock(&fd_lock);
+
+    return f == VFS_FD_RESERVED ? NULL : f;
 }
 
 void vfs_free_fd(int fd) {
-    if (fd < 3 || fd >= VFS_MAX_FD) return;
-    if (fd_table[fd]) {
-        free(fd_table[fd]);
-        fd_table[fd] = NULL;
-    }
+    vfs_put_file(vfs_take_fd(fd));
 }
 
 vfs_file_t* vfs_get_file(int fd) {
     if (fd < 3 || fd >= VFS_MAX_FD) return NULL;
-    return fd_table[fd];
+    rcu_read_lock();
+    vfs_file_t* f = rcu_dereference(fd_table[fd]);
+    if (f == VFS_FD_RESERVED || (f && !vfs_ref_get(&f->refcnt))) f = NULL;
+    rcu_read_unlock();
+    return f;
+}
+
+/* Последняя ссылка закрывает файл: операции на нём уже завершились */
+void vfs_put_file(vfs_file_t* f) {
+    if (!f || !vfs_ref_put(&f->refcnt)) return;
+
+    if (f->is_dir) {
+        ext4_dir* d = f->handle;
+        ext4_dir_close(d); free(d);
+    } else {
+        ext4_file* extfile = f->handle;
+        ext4_fclose(extfile); free(extfile);
+    }
+    vfs_mount_put(f->mount);
+
+    /* vfs_get_file на другом ядре мог успеть прочитать указатель из слота */
+    call_rcu(&f->rcu, vfs_file_free_rcu);
 }
 
 int vfs_open(const char* path, int flags) {
@@ -185,23 +331,30 @@ int vfs_open(const char* path, int flags) {
     vfs_mount_t* m = vfs_resolve_path(path, rel);
     if (!m) return -1;
     int fd = vfs_alloc_fd();
-    if (fd < 0) return -1;
+    if (fd < 0) {
+        vfs_mount_put(m);
+        return -1;
+    }
 
     vfs_file_t* f = malloc(sizeof(vfs_file_t));
+    ext4_file* ext_file = malloc(sizeof(ext4_file));
+    if (!f || !ext_file) {
+        free(ext_file); free(f); vfs_free_fd(fd); vfs_mount_put(m); return -1;
+    }
     memset(f, 0, sizeof(vfs_file_t));
     f->mount = m;
+    f->refcnt = 1;
     strncpy(f->canonical_path, path, VFS_PATH_MAX-1);
 
-    ext4_file* ext_file = malloc(sizeof(ext4_file));
     if (ext4_fopen2(ext_file, path, flags) != 0) {
-        free(ext_file); free(f); return -1;
+        free(ext_file); free(f); vfs_free_fd(fd); vfs_mount_put(m); return -1;
     }
     f->is_dir = 0;
     f->handle = ext_file;
     f->offset = 0;
     f->size = ext4_fsize(ext_file);
     f->flags = flags;
-    fd_table[fd] = f;
+    vfs_install_fd(fd, f);
     return fd;
 }
 
@@ -210,92 +363,154 @@ int vfs_opendir(const char* path) {
     vfs_mount_t* m = vfs_resolve_path(path, rel);
     if (!m) return -1;
     int fd = vfs_alloc_fd();
-    if (fd < 0) return -1;
+    if (fd < 0) {
+        vfs_mount_put(m);
+        return -1;
+    }
 
     vfs_file_t* f = malloc(sizeof(vfs_file_t));
+    ext4_dir* extdir = malloc(sizeof(ext4_dir));
+    if (!f || !extdir) {
+        free(extdir); free(f); vfs_free_fd(fd); vfs_mount_put(m); return -1;
+    }
     memset(f, 0, sizeof(vfs_file_t));
     f->mount = m;
+    f->refcnt = 1;
     strncpy(f->canonical_path, path, VFS_PATH_MAX-1);
 
-    ext4_dir* extdir = malloc(sizeof(ext4_dir));
     if (ext4_dir_open(extdir, path) != 0) {
-        free(extdir); free(f); return -1;
+        free(extdir); free(f); vfs_free_fd(fd); vfs_mount_put(m); return -1;
     }
     f->is_dir = 1;
     f->handle = extdir;
-    fd_table[fd] = f;
+    vfs_install_fd(fd, f);
     return fd;
 }
 
 ssize_t vfs_read(int fd, void* buffer, size_t count) {
     vfs_file_t* f = vfs_get_file(fd);
-    if (!f || f->is_dir) return -1;
+    if (!f) return -1;
+    if (f->is_dir) { vfs_put_file(f); return -1; }
     size_t rcnt = 0;
     ext4_file* ext_file = f->handle;
-    int res = ext4_fread(ext_file, buffer, count, &rcnt);
+    ssize_t res = ext4_fread(ext_file, buffer, count, &rcnt);
     if (res == 0) {
         f->offset += rcnt;
-        return rcnt;
+        res = rcnt;
     }
+    vfs_put_file(f);
     return res;
 }
 
 ssize_t vfs_write(int fd, const void* buffer, size_t count) {
     vfs_file_t* f = vfs_get_file(fd);
-    if (!f || f->is_dir) return -1;
+    if (!f) return -1;
+    if (f->is_dir) { vfs_put_file(f); return -1; }
     size_t wcnt = 0;
     ext4_file* ext_file = f->handle;
-    int res = ext4_fwrite(ext_file, buffer, count, &wcnt);
+    ssize_t res = ext4_fwrite(ext_file, buffer, count, &wcnt);
     if (res == 0) {
         f->offset += wcnt;
-        return wcnt;
+        res = wcnt;
     }
+    vfs_put_file(f);
     return res;
 }
 
+/* Закрытие ждёт идущие на файле операции: handle освобождает последняя ссылка */
 int vfs_close(int fd) {
-    vfs_file_t* f = vfs_get_file(fd);
+    vfs_file_t* f = vfs_take_fd(fd);
     if (!f) return -1;
-
-    if (f->is_dir) {
-        ext4_dir* d = f->handle;
-        ext4_dir_close(d); free(d);
-    } else {
-        ext4_file* extfile = f->handle;
-        ext4_fclose(extfile); free(extfile);
-    }
-
-    vfs_free_fd(fd);
+    vfs_put_file(f);
     return 0;
 }
 
 int vfs_stat(const char* path, vfs_stat_t* st) {
     char rel[VFS_PATH_MAX];
+    /* Ссылка держит точку монтирования до конца разбора inode */
     vfs_mount_t* m = vfs_resolve_path(path, rel);
     if (!m) return -1;
+    struct ext4_blockdev* bdev = m->blockdev;
 
     struct ext4_inode inode;
-    if (ext4_raw_inode_fill(path, 0, &inode) != 0) return -1;
-    st->size = ext4_inode_get_size(&m->blockdev->fs->sb, &inode);
-    st->mode = ext4_inode_get_mode(&m->blockdev->fs->sb, &inode);
-    uint32_t type = ext4_inode_type(&m->blockdev->fs->sb, &inode);
+    if (ext4_raw_inode_fill(path, 0, &inode) != 0) {
+        vfs_mount_put(m);
+        return -1;
+    }
+    st->size = ext4_inode_get_size(&bdev->fs->sb, &inode);
+    st->mode = ext4_inode_get_mode(&bdev->fs->sb, &inode);
+    uint32_t type = ext4_inode_type(&bdev->fs->sb, &inode);
     st->type = (type == EXT4_INODE_MODE_DIRECTORY)? VFS_TYPE_DIR : VFS_TYPE_FILE;
     st->ctime = ext4_inode_get_change_inode_time(&inode);
     st->mtime = ext4_inode_get_modif_time(&inode);
+    vfs_mount_put(m);
     return 0;
 }
 
 int vfs_readdir(int fd, vfs_dirent_t* dirent) {
     vfs_file_t* f = vfs_get_file(fd);
-    if (!f || !f->is_dir) return -1;
+    if (!f) return -1;
+    if (!f->is_dir) { vfs_put_file(f); return -1; }
+    int res = 0;
     ext4_dir* d = f->handle;
     const ext4_direntry* de = ext4_dir_entry_next(d);
-    if (!de) return 0;
-    strncpy(dirent->name, (const char*)de->name, de->name_length);
-    dirent->name[de->name_length] = 0;
-    dirent->size = 0;
-    dirent->type = (de->inode_type == EXT4_DE_DIR)? VFS_TYPE_DIR : VFS_TYPE_FILE;
-    return 1;
+    if (de) {
+        strncpy(dirent->name, (const char*)de->name, de->name_length);
+        dirent->name[de->name_length] = 0;
+        dirent->size = 0;
+        dirent->type = (de->inode_type == EXT4_DE_DIR)? VFS_TYPE_DIR : VFS_TYPE_FILE;
+        res = 1;
+    }
+    vfs_put_file(f);
+    return res;
+}
+
+/* Пути доступных на запись точек монтирования: сброс спит, под RCU его не вызвать */
+static int vfs_writable_mounts(char paths[][VFS_MOUNT_PATH_MAX], int max) {
+    int n = 0;
+    rcu_read_lock();
+    for (vfs_mount_t* m = rcu_dereference(g_mounts); m && n < max; m = rcu_dereference(m->next)) {
+        if (!m->read_only) strcpy(paths[n++], m->mount_path);
+    }
+    rcu_read_unlock();
+    return n;
+}
+
+#define VFS_MAX_MOUNTS ((int)(sizeof(device_table)/sizeof(device_table[0])))
+
+int vfs_sync(void) {
+    char paths[VFS_MAX_MOUNTS][VFS_MOUNT_PATH_MAX];
+    int n = vfs_writable_mounts(paths, VFS_MAX_MOUNTS);
+    int res = 0;
+    for (int i = 0; i < n; i++) {
+        if (ext4_cache_flush(paths[i]) != 0) res = -1;
+    }
+    return res;
+}
+
+/* lwext4 не знает, чьи блоки в кэше: сбрасывается вся точка монтирования файла */
+int vfs_fsync(int fd) {
+    vfs_file_t* f = vfs_get_file(fd);
+    if (!f) return -1;
+    /* Файл держит ссылку на точку монтирования. Каталогу и файлу только
+       для чтения сбрасывать нечего */
+    int res = 0;
+    if (!f->is_dir && !f->mount->read_only)
+        res = ext4_cache_flush(f->mount->mount_path) == 0 ? 0 : -1;
+    vfs_put_file(f);
+    return res;
+}
+
+/*
+ * Тик потока фоновой записи: блоки, грязные дольше VFS_WRITEBACK_EXPIRE тиков,
+ * уходят на диск. Если грязной стала половина кэша - уходят все, не дожидаясь,
+ * пока вытеснение начнёт писать их синхронно из-под чужого вызова
+ */
+void vfs_writeback(void) {
+    char paths[VFS_MAX_MOUNTS][VFS_MOUNT_PATH_MAX];
+    int n = vfs_writable_mounts(paths, VFS_MAX_MOUNTS);
+    for (int i = 0; i < n; i++)
+        ext4_cache_write_expired(paths[i], VFS_WRITEBACK_EXPIRE, CONFIG_BLOCK_DEV_CACHE_SIZE / 2);
 }
 
 int vfs_mkdir(const char* path, uint32_t mode) {
@@ -4,6 +4,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "../multitask/rcu.h"
 
 #define ssize_t long
 
@@ -20,6 +21,10 @@
 #define VFS_TYPE_FILE   0
 #define VFS_TYPE_DIR    1
 
+/* Фоновая запись: тик потока-сборщика и возраст грязного блока в тиках */
+#define VFS_WRITEBACK_MS        1000
+#define VFS_WRITEBACK_EXPIRE    5
+
 typedef struct vfs_dev {
     char name[32];
     void* blockdev;
@@ -30,6 +35,7 @@ typedef struct vfs_mount {
     char dev_name[32];
     struct ext4_blockdev* blockdev;
     int read_only;
+    unsigned int refcnt;        /* 1 за список g_mounts + открытые файлы и прочие пользователи */
     struct vfs_mount* next;
 } vfs_mount_t;
 
@@ -40,7 +46,9 @@ typedef struct vfs_file {
     int flags;
     uint64_t size;
     uint64_t offset;
+    unsigned int refcnt;        /* 1 за слот fd_table + идущие операции */
     struct vfs_file* next;
+    rcu_head_t rcu;
     char canonical_path[VFS_PATH_MAX];
 } vfs_file_t;
 
@@ -60,7 +68,9 @@ typedef struct {
 int vfs_register_device(const char* dev_name, struct ext4_blockdev* dev);
 int vfs_mount(const char* dev_name, const char* mount_path, int read_only);
 int vfs_umount(const char* mount_path);
+/* Возвращает точку монтирования со ссылкой: освободить через vfs_mount_put */
 vfs_mount_t* vfs_resolve_path(const char* path, char* out_rel);
+void vfs_mount_put(vfs_mount_t* m);
 
 int vfs_open(const char* path, int flags);
 int vfs_opendir(const char* path);
@@ -78,8 +88,15 @@ int vfs_unlink(const char* path);
 
 int vfs_readdir(int fd, vfs_dirent_t* dirent);
 
+int vfs_sync(void);
+int vfs_fsync(int fd);
+void vfs_writeback(void);
+
+/* Файл со ссылкой: не закроется, пока не вызван vfs_put_file */
 vfs_file_t* vfs_get_file(int fd);
+void vfs_put_file(vfs_file_t* f);
 int vfs_alloc_fd(void);
+void vfs_install_fd(int fd, vfs_file_t* f);
 void vfs_free_fd(int fd);
 void vfs_init(void);
 
@@ -9,8 +9,8 @@ uint64_t gdt[7] __attribute__((aligned(8))) = {
     0x0000000000000000, // 0x00: Null
     0x00AF9A000000FFFF, // 0x08: Kernel Code (64-bit)
     0x00AF92000000FFFF, // 0x10: Kernel Data
-    0x00AFFA000000FFFF, // 0x18: User Code
-    0x00AFF2000000FFFF, // 0x20: User Data
+    0x00AFF2000000FFFF, // 0x18: User Data (SYSRET: STAR[63:48] + 8)
+    0x00AFFA000000FFFF, // 0x20: User Code (SYSRET: STAR[63:48] + 16)
     0x0000000000000000, // 0x28: TSS Low
     0x0000000000000000  // 0x30: TSS High
 };
@@ -77,7 +77,7 @@ void gfx_update_screen(void)
     if (!g_fb || !g_backbuffer) return;
 
     uint8_t *fb_ptr = (uint8_t *)((uint64_t)g_fb->address);
-    memcpy(fb_ptr, g_backbuffer, g_fb->pitch * g_fb->height);
+    memcpy_simd(fb_ptr, g_backbuffer, g_fb->pitch * g_fb->height);
 }
 
 int gfx_draw_string(int x, int y, int size, uint32_t color, const char *s)
@@ -108,6 +108,7 @@ int gfx_draw_string(int x, int y, int size, uint32_t color, const char *s)
         s += (ret > 0) ? ret : 1;
     }
 
+    screen_refresh_request();
     return dest_buf.x;
 }
 
@@ -172,6 +173,7 @@ void gfx_fill_rect(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t colo
     {
         draw_hline_clipped(x0, x1, y, color);
     }
+    screen_refresh_request();
 }
 
 void gfx_draw_rect(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t color)
@@ -183,8 +185,12 @@ void gfx_draw_rect(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t colo
 
     draw_hline_clipped(x0, x1, y0, color);
     draw_hline_clipped(x0, x1, y1, color);
-    gfx_draw_line(x0, y0, x0, y1, color);
-    gfx_draw_line(x1, y0, x1, y1, color);
+    for (int32_t y = y0; y <= y1; ++y)
+    {
+        gfx_put_pixel_backbuffer(x0, y, color);
+        gfx_put_pixel_backbuffer(x1, y, color);
+    }
+    screen_refresh_request();
 }
 
 void gfx_draw_line(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t color)
@@ -199,11 +205,13 @@ void gfx_draw_line(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t colo
         for (int32_t y = y0; y <= y1; y++) {
             gfx_put_pixel_backbuffer(x0, y, color);
         }
+        screen_refresh_request();
         return;
     }
     
     if (dy == 0) {
         draw_hline_clipped(x0, x1, y0, color);
+        screen_refresh_request();
         return;
     }
 
@@ -217,6 +225,7 @@ void gfx_draw_line(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t colo
         if (e2 > -dy) { err -= dy; x0 += sx; }
         if (e2 < dx) { err += dx; y0 += sy; }
     }
+    screen_refresh_request();
 }
 
 void gfx_draw_circle(int32_t xc, int32_t yc, int32_t radius, uint32_t color)
@@ -247,6 +256,7 @@ void gfx_draw_circle(int32_t xc, int32_t yc, int32_t radius, uint32_t color)
             d = d + 4 * x + 6;
         }
     }
+    screen_refresh_request();
 }
 
 void gfx_fill_circle(int32_t xc, int32_t yc, int32_t radius, uint32_t color)
@@ -273,6 +283,7 @@ void gfx_fill_circle(int32_t xc, int32_t yc, int32_t radius, uint32_t color)
             d = d + 4 * x + 6;
         }
     }
+    screen_refresh_request();
 }
 
 void gfx_draw_window(int x, int y, int w, int h, const char *title)
@@ -283,6 +294,9 @@ void gfx_draw_window(int x, int y, int w, int h, const char *title)
     gfx_draw_string(x + 5, y + 16, 16, 0x00FFFFFF, title);
 }
 
+// Точка рисуется только в backbuffer: запрос обновления на каждый пиксель
+// будил бы поток перерисовки на каждый вызов. Вызывающий рисует серию точек
+// и затем сам выводит кадр через gfx_update_screen
 void gfx_draw_point(uint32_t x, uint32_t y, uint32_t color)
 {
     gfx_put_pixel_backbuffer(x, y, color);
@@ -2,6 +2,7 @@
 #include "portio/portio.h"
 #include "isr.h"
 #include "pic.h"
+#include "irq.h"
 
 static struct idt_entry idt[IDT_ENTRIES];
 static struct idt_ptr idtp;
@@ -45,7 +46,12 @@ void idt_install(void)
 
     idt_set_gate(TIMER, isr32, KERNEL_CODE_SEL, IDT_GATE_INT);
     idt_set_gate(KEYBOARD, isr33, KERNEL_CODE_SEL, IDT_GATE_INT);
+    idt_set_gate(IDE_PRIMARY, isr46, KERNEL_CODE_SEL, IDT_GATE_INT);
+    idt_set_gate(IDE_SECONDARY, isr47, KERNEL_CODE_SEL, IDT_GATE_INT);
     idt_set_gate(INTERRUPT, isr80, KERNEL_CODE_SEL, IDT_GATE_SYSCALL);
+    idt_set_gate(YIELD, isr81, KERNEL_CODE_SEL, IDT_GATE_INT);
+    idt_set_gate(SPURIOUS, isr255, KERNEL_CODE_SEL, IDT_GATE_INT);
+    irq_install();
 
     lidt_load(&idtp);
 }
\ No newline at end of file
@@ -6,7 +6,11 @@
 
 #define TIMER 32
 #define KEYBOARD 33
+#define IDE_PRIMARY 46
+#define IDE_SECONDARY 47
 #define INTERRUPT 0x80
+#define YIELD 0x81
+#define SPURIOUS 0xFF
 #define PAGE_FAULT_INT 0x0E
 
 #define KERNEL_CODE_SEL 0x08
@@ -0,0 +1,10 @@
+[BITS 64]
+
+global isr255
+
+; Spurious-прерывание Local APIC: EOI не требуется
+isr255:
+    iretq
+
+section .note.GNU-stack
+; empty
@@ -0,0 +1,44 @@
+[BITS 64]
+
+global isr47
+extern ide_secondary_irq  ; void ide_secondary_irq(void);
+
+isr47:
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rbp
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+
+    call ide_secondary_irq
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rbp
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+
+    iretq
+
+section .note.GNU-stack
+; empty
\ No newline at end of file
@@ -16,26 +16,27 @@ isr80:
     push    rbx
     push    rcx
 
-    push    r9
-    push    r8
-    push    r10
-    push    rdx
-    push    rsi
-    push    rdi
+    ; порядок совпадает с struct syscall_regs: r9 лежит по младшему адресу
     push    rax
+    push    rdi
+    push    rsi
+    push    rdx
+    push    r10
+    push    r8
+    push    r9
     
     mov     rdi, rsp
     call    syscall_handler
     
-    mov     [rsp], rax
+    mov     [rsp + 48], rax
 
-    pop     rax
-    pop     rdi
-    pop     rsi
-    pop     rdx
-    pop     r10
-    pop     r8
     pop     r9
+    pop     r8
+    pop     r10
+    pop     rdx
+    pop     rsi
+    pop     rdi
+    pop     rax
     pop     rcx
     pop     rbx
     pop     rbp
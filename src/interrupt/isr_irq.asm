@@ -0,0 +1,67 @@
+; isr_irq.asm — общие обработчики линий PIC 3..13 (векторы 35..45) и векторов MSI
+[BITS 64]
+
+extern irq_dispatch  ; void irq_dispatch(uint64_t irq);
+extern msi_dispatch  ; void msi_dispatch(uint64_t index);
+
+%macro PUSH_GPRS 0
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rbp
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+%endmacro
+
+%macro POP_GPRS 0
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rbp
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+%endmacro
+
+; %1 - префикс метки, %2 - номер (он же аргумент), %3 - C-обработчик
+%macro DISPATCH_STUB 3
+global %1%2
+%1%2:
+    PUSH_GPRS
+    mov rdi, %2
+    call %3
+    POP_GPRS
+    iretq
+%endmacro
+
+%assign i 3
+%rep 11
+    DISPATCH_STUB isr_irq_, i, irq_dispatch
+    %assign i i+1
+%endrep
+
+%assign i 0
+%rep 8
+    DISPATCH_STUB isr_msi_, i, msi_dispatch
+    %assign i i+1
+%endrep
+
+section .note.GNU-stack
+; empty
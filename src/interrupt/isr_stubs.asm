@@ -43,11 +43,39 @@ isr_stub_%1:
 
 %assign i 0
 %rep 32
-    %if i != 14
+    %if i != 7 && i != 14
         ISR_STUB i
     %endif
     %assign i i+1
 %endrep
 
+; #NM: ленивое переключение FPU/SSE/AVX-состояния (CR0.TS)
+global isr_stub_7
+extern fpu_nm_handler
+isr_stub_7:
+    push rax
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+
+    call fpu_nm_handler
+
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
+
+    iretq
+
 section .note.GNU-stack
 ; empty
\ No newline at end of file
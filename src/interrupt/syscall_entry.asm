@@ -0,0 +1,47 @@
+; syscall_entry.asm
+[bits 64]
+
+extern syscall_handler
+extern g_syscall_kstack_top
+global syscall_entry
+
+; Вход по инструкции SYSCALL (MSR_LSTAR).
+; CPU кладёт rip пользователя в rcx, rflags в r11 и сбрасывает биты из SFMASK (IF = 0),
+; стек при этом не переключает - это делаем сами через g_syscall_kstack_top.
+; На стеке ядра собирается та же struct syscall_regs, что и в isr80.
+syscall_entry:
+    swapgs
+    mov     [gs:0], rsp                     ; syscall_cpu.user_rsp
+    mov     rsp, [rel g_syscall_kstack_top]
+    push    qword [gs:0]
+    swapgs
+
+    push    r11
+    push    rcx
+
+    push    rax
+    push    rdi
+    push    rsi
+    push    rdx
+    push    r10
+    push    r8
+    push    r9
+
+    mov     rdi, rsp
+    call    syscall_handler
+
+    pop     r9
+    pop     r8
+    pop     r10
+    pop     rdx
+    pop     rsi
+    pop     rdi
+    add     rsp, 8                          ; rax - результат обработчика
+
+    pop     rcx
+    pop     r11
+    pop     rsp
+
+    o64 sysret
+
+section .note.GNU-stack
@@ -0,0 +1,144 @@
+// irq.c
+#include "irq.h"
+#include "idt.h"
+#include "pic.h"
+#include "spinlock/spinlock.h"
+#include "time/lapic/lapic.h"
+
+extern void isr_irq_3();
+extern void isr_irq_4();
+extern void isr_irq_5();
+extern void isr_irq_6();
+extern void isr_irq_7();
+extern void isr_irq_8();
+extern void isr_irq_9();
+extern void isr_irq_10();
+extern void isr_irq_11();
+extern void isr_irq_12();
+extern void isr_irq_13();
+
+extern void isr_msi_0();
+extern void isr_msi_1();
+extern void isr_msi_2();
+extern void isr_msi_3();
+extern void isr_msi_4();
+extern void isr_msi_5();
+extern void isr_msi_6();
+extern void isr_msi_7();
+
+typedef struct
+{
+    irq_handler_t handler;
+    void *arg;
+} irq_action_t;
+
+static irq_action_t irq_actions[IRQ_SHARED_LAST + 1][IRQ_MAX_HANDLERS];
+static uint8_t irq_counts[IRQ_SHARED_LAST + 1];
+
+/* Вектор MSI принадлежит одному устройству */
+static irq_action_t msi_actions[IRQ_MSI_COUNT];
+static uint8_t msi_used; /* битовая маска занятых векторов */
+
+void irq_install(void)
+{
+    static void (*const stubs[])() = {
+        isr_irq_3, isr_irq_4, isr_irq_5, isr_irq_6,
+        isr_irq_7, isr_irq_8, isr_irq_9, isr_irq_10,
+        isr_irq_11, isr_irq_12, isr_irq_13};
+
+    for (int irq = IRQ_SHARED_FIRST; irq <= IRQ_SHARED_LAST; ++irq)
+        idt_set_gate(TIMER + irq, stubs[irq - IRQ_SHARED_FIRST], KERNEL_CODE_SEL, IDT_GATE_INT);
+
+    static void (*const msi_stubs[IRQ_MSI_COUNT])() = {
+        isr_msi_0, isr_msi_1, isr_msi_2, isr_msi_3,
+        isr_msi_4, isr_msi_5, isr_msi_6, isr_msi_7};
+
+    for (int i = 0; i < IRQ_MSI_COUNT; ++i)
+        idt_set_gate(IRQ_MSI_VECTOR_BASE + i, msi_stubs[i], KERNEL_CODE_SEL, IDT_GATE_INT);
+}
+
+int irq_register(uint8_t irq, irq_handler_t handler, void *arg)
+{
+    if (irq < IRQ_SHARED_FIRST || irq > IRQ_SHARED_LAST || !handler)
+        return -1;
+
+    uint64_t flags = save_irq_disable();
+    if (irq_counts[irq] >= IRQ_MAX_HANDLERS)
+    {
+        restore_irq(flags);
+        return -1;
+    }
+
+    irq_actions[irq][irq_counts[irq]].handler = handler;
+    irq_actions[irq][irq_counts[irq]].arg = arg;
+    irq_counts[irq]++;
+
+    pic_unmask(irq);
+    restore_irq(flags);
+    return 0;
+}
+
+int irq_alloc_msi(irq_handler_t handler, void *arg)
+{
+    if (!handler || !lapic_is_enabled())
+        return -1;
+
+    uint64_t flags = save_irq_disable();
+    uint8_t i = 0;
+    while (i < IRQ_MSI_COUNT && (msi_used & (1u << i)))
+        ++i;
+
+    if (i == IRQ_MSI_COUNT)
+    {
+        restore_irq(flags);
+        return -1;
+    }
+
+    msi_actions[i].handler = handler;
+    msi_actions[i].arg = arg;
+    msi_used |= (uint8_t)(1u << i);
+    restore_irq(flags);
+    return IRQ_MSI_VECTOR_BASE + i;
+}
+
+void irq_free_msi(int vector)
+{
+    if (vector < IRQ_MSI_VECTOR_BASE || vector >= IRQ_MSI_VECTOR_BASE + IRQ_MSI_COUNT)
+        return;
+
+    uint8_t i = (uint8_t)(vector - IRQ_MSI_VECTOR_BASE);
+    uint64_t flags = save_irq_disable();
+    msi_used &= (uint8_t)~(1u << i);
+    msi_actions[i].handler = NULL;
+    msi_actions[i].arg = NULL;
+    restore_irq(flags);
+}
+
+int irq_msi_available(void)
+{
+    if (!lapic_is_enabled())
+        return 0;
+    return IRQ_MSI_COUNT - __builtin_popcount(msi_used);
+}
+
+void irq_dispatch(uint64_t irq)
+{
+    if (irq < IRQ_SHARED_FIRST || irq > IRQ_SHARED_LAST)
+        return;
+
+    if (pic_is_spurious((uint8_t)irq))
+        return;
+
+    for (uint8_t i = 0; i < irq_counts[irq]; ++i)
+        irq_actions[irq][i].handler(irq_actions[irq][i].arg);
+
+    pic_send_eoi((uint8_t)irq);
+}
+
+void msi_dispatch(uint64_t index)
+{
+    if (index < IRQ_MSI_COUNT && (msi_used & (1u << index)))
+        msi_actions[index].handler(msi_actions[index].arg);
+
+    lapic_eoi();
+}
@@ -0,0 +1,37 @@
+// irq.h
+#ifndef IRQ_H
+#define IRQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Линии PIC с общими обработчиками (isr_irq.asm); 0, 1, 14, 15 заняты своими */
+#define IRQ_SHARED_FIRST 3
+#define IRQ_SHARED_LAST 13
+#define IRQ_MAX_HANDLERS 4
+
+/*
+ * Обработчик возвращает true, если прерывание было от его устройства.
+ * Линии PCI INTx общие и срабатывают по уровню: опрашиваются все
+ * обработчики линии, EOI отправляет irq_dispatch
+ */
+typedef bool (*irq_handler_t)(void *arg);
+
+/* Векторы MSI: сообщение идёт прямо в Local APIC, мимо PIC */
+#define IRQ_MSI_VECTOR_BASE 0x40
+#define IRQ_MSI_COUNT 8
+
+void irq_install(void);
+int irq_register(uint8_t irq, irq_handler_t handler, void *arg);
+
+/* Выделяет вектор MSI под обработчик; -1, если векторы кончились или Local APIC выключен */
+int irq_alloc_msi(irq_handler_t handler, void *arg);
+/* Возвращает вектор, если устройство так и не включило MSI */
+void irq_free_msi(int vector);
+/* Число свободных векторов MSI */
+int irq_msi_available(void);
+
+void irq_dispatch(uint64_t irq);
+void msi_dispatch(uint64_t index);
+
+#endif // IRQ_H
@@ -39,6 +39,10 @@ extern void isr_stub_31();
 
 extern void isr32();
 extern void isr33();
+extern void isr46();
+extern void isr47();
 extern void isr80();
+extern void isr81();
+extern void isr255();
 
 #endif // ISR_H
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include "idt.h"
 #include "time/timer.h"
 #include "time/clock/clock.h"
+#include "time/timekeeping.h"
 #include "syscall/syscall.h"
 #include "malloc/malloc.h"
 #include "libc/string.h"
@@ -37,6 +38,8 @@
 #include "mm/vmm.h"
 #include "graphics/colors.h"
 #include "limine.h"
+#include "cpu/fpu.h"
+#include "vdso/vdso.h"
 
 __attribute__((used, section(".limine_requests")))
 static volatile LIMINE_BASE_REVISION(3);
@@ -77,6 +80,13 @@ static volatile struct limine_bootloader_info_request bl_request = {
 };
 struct limine_bootloader_info_response *bl_res;
 
+/* Нужен ради командной строки ядра (cmdline: в limine.conf) */
+__attribute__((used, section(".limine_requests")))
+static volatile struct limine_kernel_file_request kernel_file_request = {
+    .id = LIMINE_KERNEL_FILE_REQUEST,
+    .revision = 0
+};
+
 extern char _heap_start;
 
 uint64_t g_saved_user_rsp = 0;
@@ -170,21 +180,6 @@ int init_autorun(const char *autorun)
     return 0;
 }
 
-static void enable_sse(void)
-{
-    uint64_t cr0, cr4;
-
-    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
-    cr0 &= ~(1UL << 2);  // Clear EM
-    cr0 |= (1UL << 1);   // Set MP
-    __asm__ volatile("mov %0, %%cr0" ::  "r"(cr0));
-
-    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
-    cr4 |= (1UL << 9);   // Set OSFXSR
-    cr4 |= (1UL << 10);  // Set OSXMMEXCPT
-    __asm__ volatile("mov %0, %%cr4" :: "r"(cr4));
-}
-
 void kmain(void)
 {
     if (LIMINE_BASE_REVISION_SUPPORTED == false)
@@ -215,14 +210,20 @@ void kmain(void)
     rsdp_res = rsdp_request.response;
 
     idt_install();
-    enable_sse();
-    init_system_clock();
+    syscall_init();
+    fpu_init();
+    timekeeping_init();
     init_timer(1000);
     outb(0x21, 0xFC);
 
     pmm_init();
     malloc_init();
 
+    /* LAPIC one-shot вместо периодического PIT; без invariant TSC или при неудаче
+       остаётся PIT 1 кГц */
+    timer_init_tickless();
+    vdso_init();
+
     gfx_init(fb);
     pci_init();
 
@@ -326,6 +327,8 @@ void kmain(void)
     gfx_update_screen();
 
     scheduler_init();
+    if (kernel_file_request.response && kernel_file_request.response->kernel_file)
+        sched_parse_cmdline(kernel_file_request.response->kernel_file->cmdline);
     tasks_init();
 
     fs_init();
@@ -347,8 +350,5 @@ void kmain(void)
     /* Разрешаем прерывания */
     asm volatile("sti");
 
-    for (;;)
-    {
-        asm volatile("hlt");
-    }
+    scheduler_idle_loop();
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "string.h"
 #include <stdint.h>
 #include "../malloc/malloc.h"
+#include "../cpu/fpu.h"
 
 /* =================== MEM =================== */
 void *memcpy(void *dst_, const void *src_, size_t n)
@@ -72,6 +73,59 @@ void *memcpy(void *dst_, const void *src_, size_t n)
 #endif
 }
 
+#define MEMCPY_SIMD_THRESHOLD 1024
+/* kernel_fpu_begin выключает прерывания: кадр в несколько МБ копируем порциями */
+#define MEMCPY_SIMD_CHUNK     (8 * 1024)
+
+/* Копирование больших буферов (например, backbuffer -> framebuffer) через SSE2.
+   Ядро собрано с -mgeneral-regs-only, поэтому xmm-регистры используются только
+   здесь, внутри kernel_fpu_begin/kernel_fpu_end, и не объявляются в clobber. */
+void *memcpy_simd(void *dst_, const void *src_, size_t n)
+{
+    if (n < MEMCPY_SIMD_THRESHOLD)
+        return memcpy(dst_, src_, n);
+
+    unsigned char *dst = (unsigned char *)dst_;
+    const unsigned char *src = (const unsigned char *)src_;
+
+    size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    n -= head;
+
+    size_t total = n / 64;
+    while (total)
+    {
+        size_t blocks = total < MEMCPY_SIMD_CHUNK / 64 ? total : MEMCPY_SIMD_CHUNK / 64;
+        total -= blocks;
+
+        uint64_t flags = kernel_fpu_begin();
+        asm volatile(
+            "1:\n\t"
+            "movdqu   0(%1), %%xmm0\n\t"
+            "movdqu  16(%1), %%xmm1\n\t"
+            "movdqu  32(%1), %%xmm2\n\t"
+            "movdqu  48(%1), %%xmm3\n\t"
+            "movntdq %%xmm0,  0(%0)\n\t"
+            "movntdq %%xmm1, 16(%0)\n\t"
+            "movntdq %%xmm2, 32(%0)\n\t"
+            "movntdq %%xmm3, 48(%0)\n\t"
+            "add $64, %0\n\t"
+            "add $64, %1\n\t"
+            "dec %2\n\t"
+            "jnz 1b\n\t"
+            "sfence"
+            : "+r"(dst), "+r"(src), "+r"(blocks)
+            :
+            : "memory", "cc");
+        kernel_fpu_end(flags);
+    }
+
+    memcpy(dst, src, n & 63);
+    return dst_;
+}
+
 void *memset(void *s, int c, size_t n)
 {
     unsigned char *p = (unsigned char *)s;
@@ -9,6 +9,7 @@ void *memcpy(void *dst, const void *src, size_t n);
 void *memset(void *s, int c, size_t n);
 int memcmp(const void *ptr1, const void *ptr2, size_t num);
 void *memmove(void *dst0, const void *src0, size_t n);
+void *memcpy_simd(void *dst, const void *src, size_t n);
 
 size_t strlen(const char *s);
 char *strcpy(char *dst, const char *src);
@@ -102,8 +102,7 @@ void *b_malloc(size_t size)
     if (order >= MAX_ORDER)
         return NULL;
 
-    uint8_t irq_flags = save_irq_disable();
-    spin_lock(&allocator.lock);
+    uint64_t irq_flags = spin_lock_irqsave(&allocator.lock);
 
     for (int i = order; i < MAX_ORDER; i++)
     {
@@ -126,14 +125,12 @@ void *b_malloc(size_t size)
             pages_meta[i].is_free = false;
             pages_meta[i].order = order;
 
-            spin_unlock(&allocator.lock);
-            restore_irq(irq_flags);
+            spin_unlock_irqrestore(&allocator.lock, irq_flags);
             return (void*)block;
         }
     }
 
-    spin_unlock(&allocator.lock);
-    restore_irq(irq_flags);
+    spin_unlock_irqrestore(&allocator.lock, irq_flags);
     return NULL;
 }
 
@@ -156,8 +153,7 @@ void b_free(void *ptr) {
     uint8_t current_order = original_order;
     uintptr_t addr = (uintptr_t)ptr;
 
-    uint64_t irq_flags = save_irq_disable();
-    spin_lock(&allocator.lock);
+    uint64_t irq_flags = spin_lock_irqsave(&allocator.lock);
 
     while (current_order < MAX_ORDER - 1) {
         uintptr_t buddy_addr = get_buddy_addr(addr, current_order);
@@ -182,8 +178,7 @@ void b_free(void *ptr) {
 
     allocator.total_free += order_to_size(original_order);
 
-    spin_unlock(&allocator.lock);
-    restore_irq(irq_flags);
+    spin_unlock_irqrestore(&allocator.lock, irq_flags);
 }
 
 void *b_realloc(void *ptr, size_t size)
@@ -224,8 +219,7 @@ static struct slab *alloc_slab(struct mem_cache *cache)
 }
 
 void *cache_alloc(struct mem_cache* cache) {
-    uint8_t irq_flags = save_irq_disable();
-    spin_lock(&cache->lock);
+    uint64_t irq_flags = spin_lock_irqsave(&cache->lock);
 
     struct slab *s = cache->slabs_partial;
     if (!s) s = cache->slabs_free;
@@ -234,8 +228,7 @@ void *cache_alloc(struct mem_cache* cache) {
         s = alloc_slab(cache);
         if (!s)
         {
-            spin_unlock(&cache->lock);
-            restore_irq(irq_flags);
+            spin_unlock_irqrestore(&cache->lock, irq_flags);
             return NULL;
         }
         size_t page_i = get_page_index(s);
@@ -256,16 +249,14 @@ void *cache_alloc(struct mem_cache* cache) {
         move_slab(s, &cache->slabs_free, &cache->slabs_partial);
     }
 
-    spin_unlock(&cache->lock);
-    restore_irq(irq_flags);
+    spin_unlock_irqrestore(&cache->lock, irq_flags);
     return obj;
 }
 
 void cache_free(struct mem_cache *cache, void *obj) {
     if (!obj) return;
     
-    uint8_t irq_flags = save_irq_disable();
-    spin_lock(&cache->lock);
+    uint64_t irq_flags = spin_lock_irqsave(&cache->lock);
 
     struct slab *s = (struct slab *)((uintptr_t)obj & ~(PAGE_SIZE - 1));
 
@@ -280,8 +271,7 @@ void cache_free(struct mem_cache *cache, void *obj) {
         {
             slab_list_remove(&cache->slabs_free, s);
             b_free(s);
-            spin_unlock(&cache->lock);
-            restore_irq(irq_flags);
+            spin_unlock_irqrestore(&cache->lock, irq_flags);
             return;
         }
         move_slab(s, &cache->slabs_partial, &cache->slabs_free);
@@ -289,8 +279,7 @@ void cache_free(struct mem_cache *cache, void *obj) {
         move_slab(s, &cache->slabs_full, &cache->slabs_partial);
     }
 
-    spin_unlock(&cache->lock);
-    restore_irq(irq_flags);
+    spin_unlock_irqrestore(&cache->lock, irq_flags);
 }
 
 struct mem_cache *cache_create(size_t size)
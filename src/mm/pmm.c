@@ -113,8 +113,7 @@ void pmm_init()
 
 void *alloc_pages(size_t count)
 {
-    uint64_t irq_flags = save_irq_disable();
-    spin_lock(&pmm_lock);
+    uint64_t irq_flags = spin_lock_irqsave(&pmm_lock);
 
     for (uint64_t i = last_checked_page; i + count <= max_pages;)
     {
@@ -143,8 +142,7 @@ void *alloc_pages(size_t count)
                 }
                 last_checked_page = i + count;
                 allocated_pages += count;
-                spin_unlock(&pmm_lock);
-                restore_irq(irq_flags);
+                spin_unlock_irqrestore(&pmm_lock, irq_flags);
                 return (void*)((i * PAGE_SIZE) + hhdm_offset);
             }
 
@@ -182,8 +180,7 @@ void *alloc_pages(size_t count)
                 }
                 last_checked_page = i + count;
                 allocated_pages += count;
-                spin_unlock(&pmm_lock);
-                restore_irq(irq_flags);
+                spin_unlock_irqrestore(&pmm_lock, irq_flags);
                 return (void*)((i * PAGE_SIZE) + hhdm_offset);
             }
 
@@ -195,16 +192,14 @@ void *alloc_pages(size_t count)
         }
     }
 
-    spin_unlock(&pmm_lock);
-    restore_irq(irq_flags);
+    spin_unlock_irqrestore(&pmm_lock, irq_flags);
 
     return NULL;
 }
 
 void *alloc_page()
 {
-    uint64_t irq_flags = save_irq_disable();
-    spin_lock(&pmm_lock);
+    uint64_t irq_flags = spin_lock_irqsave(&pmm_lock);
 
     for (uint64_t i = last_checked_page; i < max_pages; i++)
     {
@@ -222,8 +217,7 @@ void *alloc_page()
             bitmap_set(i);
             last_checked_page = i;
             allocated_pages++;
-            spin_unlock(&pmm_lock);
-            restore_irq(irq_flags);
+            spin_unlock_irqrestore(&pmm_lock, irq_flags);
             return (void*)((i * PAGE_SIZE) + hhdm_offset);
         }
     }
@@ -243,22 +237,19 @@ void *alloc_page()
             bitmap_set(i);
             last_checked_page = i;
             allocated_pages++;
-            spin_unlock(&pmm_lock);
-            restore_irq(irq_flags);
+            spin_unlock_irqrestore(&pmm_lock, irq_flags);
             return (void*)((i * PAGE_SIZE) + hhdm_offset);
         }
     }
 
-    spin_unlock(&pmm_lock);
-    restore_irq(irq_flags);
+    spin_unlock_irqrestore(&pmm_lock, irq_flags);
 
     return NULL;
 }
 
 void *alloc_huge_page()
 {
-    uint64_t irq_flags = save_irq_disable();
-    spin_lock(&pmm_lock);
+    uint64_t irq_flags = spin_lock_irqsave(&pmm_lock);
 
     const uint64_t count = 512;
 
@@ -284,14 +275,12 @@ void *alloc_huge_page()
             allocated_pages += count;
             last_checked_page = i + count;
 
-            spin_unlock(&pmm_lock);
-            restore_irq(irq_flags);
+            spin_unlock_irqrestore(&pmm_lock, irq_flags);
             return (void*)((i * PAGE_SIZE) + hhdm_offset);
         }
     }
 
-    spin_unlock(&pmm_lock);
-    restore_irq(irq_flags);
+    spin_unlock_irqrestore(&pmm_lock, irq_flags);
     return NULL;
 }
 
@@ -306,8 +295,7 @@ int free_page(void *ptr)
 
     if (page >= max_pages) return -1;
 
-    uint64_t irq_flags = save_irq_disable();
-    spin_lock(&pmm_lock);
+    uint64_t irq_flags = spin_lock_irqsave(&pmm_lock);
 
     if (bitmap_test(page))
     {
@@ -315,8 +303,7 @@ int free_page(void *ptr)
         allocated_pages--;
     }
 
-    spin_unlock(&pmm_lock);
-    restore_irq(irq_flags);
+    spin_unlock_irqrestore(&pmm_lock, irq_flags);
     return 0;
 }
 
@@ -327,8 +314,7 @@ int free_huge_page(void *ptr)
 
     uint64_t start_page = addr / PAGE_SIZE;
     
-    uint64_t irq_flags = save_irq_disable();
-    spin_lock(&pmm_lock);
+    uint64_t irq_flags = spin_lock_irqsave(&pmm_lock);
 
     for (uint64_t i = 0; i < 512; i++)
     {
@@ -336,7 +322,6 @@ int free_huge_page(void *ptr)
     }
     allocated_pages -= 512;
 
-    spin_unlock(&pmm_lock);
-    restore_irq(irq_flags);
+    spin_unlock_irqrestore(&pmm_lock, irq_flags);
     return 0;
 }
\ No newline at end of file
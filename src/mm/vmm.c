@@ -2,6 +2,7 @@
 #include "pmm.h"
 #include "../libc/string.h"
 #include "../graphics/formatting.h"
+#include "../vdso/vdso.h"
 
 static uint64_t get_addr(pt_entry_t entry)
 {
@@ -10,16 +11,19 @@ static uint64_t get_addr(pt_entry_t entry)
 
 static page_table_t* get_next_table(page_table_t *current_table, uint64_t index, bool user) {
     if (!(current_table->entries[index] & PTE_PRESENT)) {
-        uint64_t new_table_phys = (uintptr_t)alloc_page();
-        if (!new_table_phys) return NULL;
+        void *new_table = alloc_page();
+        if (!new_table) return NULL;
 
-        memset(virt(new_table_phys), 0, PAGE_SIZE);
+        uint64_t new_table_phys = (uintptr_t)new_table - hhdm_offset;
+        memset(new_table, 0, PAGE_SIZE);
 
         uint64_t flags = PTE_PRESENT | PTE_WRITABLE;
         if (user) flags |= PTE_USER;
 
         current_table->entries[index] = new_table_phys | flags;
     }
+    /* Область уже покрыта большой страницей - спускаться некуда */
+    if (current_table->entries[index] & PTE_HUGE_PAGE) return NULL;
     return (page_table_t*)virt(get_addr(current_table->entries[index]));
 }
 
@@ -33,9 +37,13 @@ uint64_t vmm_get_phys(page_table_t *pml4, uint64_t virt_addr) {
     page_table_t *pdpt = virt(get_addr(pml4->entries[pml4_idx]));
 
     if (!(pdpt->entries[pdpt_idx] & PTE_PRESENT)) return 0;
+    if (pdpt->entries[pdpt_idx] & PTE_HUGE_PAGE)
+        return (get_addr(pdpt->entries[pdpt_idx]) & ~0x3FFFFFFFULL) | (virt_addr & 0x3FFFFFFF);
     page_table_t *pd = virt(get_addr(pdpt->entries[pdpt_idx]));
 
     if (!(pd->entries[pd_idx] & PTE_PRESENT)) return 0;
+    if (pd->entries[pd_idx] & PTE_HUGE_PAGE)
+        return (get_addr(pd->entries[pd_idx]) & ~0x1FFFFFULL) | (virt_addr & 0x1FFFFF);
     page_table_t *pt = virt(get_addr(pd->entries[pd_idx]));
 
     if (!(pt->entries[pt_idx] & PTE_PRESENT)) return 0;
@@ -52,7 +60,7 @@ void* find_free_area(size_t pages)
     return addr;
 }
 
-void mmap(page_table_t *pml4, uint64_t virt_addr, uint64_t phys_addr, uint64_t flags)
+bool mmap(page_table_t *pml4, uint64_t virt_addr, uint64_t phys_addr, uint64_t flags)
 {
     bool is_user = (flags & PTE_USER);
 
@@ -62,17 +70,22 @@ void mmap(page_table_t *pml4, uint64_t virt_addr, uint64_t phys_addr, uint64_t f
     uint64_t pt_i   = (virt_addr >> 12) & 0x1FF;
 
     page_table_t *pdpt = get_next_table(pml4, pml4_i, is_user);
+    if (!pdpt) return false;
     page_table_t *pd   = get_next_table(pdpt, pdpt_i, is_user);
+    if (!pd) return false;
     page_table_t *pt   = get_next_table(pd,   pd_i,   is_user);
+    if (!pt) return false;
 
     pt->entries[pt_i] = phys_addr | flags | PTE_PRESENT;
 
     asm volatile("invlpg (%0)" :: "r"(virt_addr) : "memory");
+    return true;
 }
 
 page_table_t *create_address_space()
 {
-    page_table_t *new_pml4 = virt((uintptr_t)alloc_page());
+    page_table_t *new_pml4 = alloc_page();
+    if (!new_pml4) return NULL;
     memset(new_pml4, 0, PAGE_SIZE);
 
     uint64_t current_pml4_phys;
@@ -84,6 +97,8 @@ page_table_t *create_address_space()
         new_pml4->entries[i] = old_pml4->entries[i];
     }
 
+    vdso_map(new_pml4);
+
     return new_pml4;
 }
 
@@ -105,7 +120,7 @@ static void cleanup_level(page_table_t *table, int level)
         {
             cleanup_level((page_table_t*)virt(entry & ~0xFFFULL), level - 1);
         }
-        else
+        else if (!(entry & PTE_SHARED))
         {
             free_page((void*)(entry & ~0xFFFULL));
         }
@@ -167,6 +182,28 @@ void *map_user_memory(page_table_t *pml4, uint64_t virt_start, size_t pages, uin
     return (void*)virt_start;
 }
 
+void *vmm_map_mmio(uint64_t phys, size_t size)
+{
+    page_table_t *kernel_pml4 = read_cr3_virt();
+    uint64_t start = ALIGN_DOWN(phys, PAGE_SIZE);
+    uint64_t end = ALIGN_UP(phys + size, PAGE_SIZE);
+
+    /* MMIO отображается в HHDM-окно, некэшируемым */
+    for (uint64_t p = start; p < end; p += PAGE_SIZE)
+    {
+        if (mmap(kernel_pml4, p + hhdm_offset, p, PTE_WRITABLE | PTE_PCD | PTE_PWT))
+            continue;
+        /* Страница могла быть уже покрыта большой страницей HHDM -
+           тогда адрес доступен и без нового PTE */
+        if (vmm_get_phys(kernel_pml4, p + hhdm_offset) == p)
+            continue;
+        kprint(KPRINT_ERROR, "vmm: failed to map MMIO page %x\n", p);
+        return NULL;
+    }
+
+    return virt(phys);
+}
+
 void page_fault_handler(uint64_t vector, uint64_t error_code)
 {
     uint64_t faulting_address;
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include "../limine.h"
 
 #define PAGE_SIZE 4096
@@ -15,8 +16,12 @@
 #define PTE_PRESENT     (1ULL << 0)
 #define PTE_WRITABLE    (1ULL << 1)
 #define PTE_USER        (1ULL << 2)
+#define PTE_PWT         (1ULL << 3)
+#define PTE_PCD         (1ULL << 4)
 #define PTE_NX          (1ULL << 63)
 #define PTE_HUGE_PAGE   (1ULL << 7)
+/* Бит, свободный для ОС: страница общая и не принадлежит адресному пространству */
+#define PTE_SHARED      (1ULL << 9)
 
 #define LEVEL_PML4      4
 #define LEVEL_PDPT      3
@@ -36,10 +41,12 @@ extern uint64_t hhdm_offset;
 
 void unmap(page_table_t *pml4, uint64_t virt_addr);
 page_table_t *create_address_space();
-void mmap(page_table_t *pml4, uint64_t virt_addr, uint64_t phys_addr, uint64_t flags);
+void destroy_address_space(page_table_t *pml4_virt);
+bool mmap(page_table_t *pml4, uint64_t virt_addr, uint64_t phys_addr, uint64_t flags);
 void* find_free_area(size_t pages);
 uint64_t vmm_get_phys(page_table_t *pml4, uint64_t virt_addr);
 void *map_user_memory(page_table_t *pml4, uint64_t virt_start, size_t pages, uint64_t flags);
+void *vmm_map_mmio(uint64_t phys, size_t size);
 
 void page_fault_handler(uint64_t vector, uint64_t error_code);
 
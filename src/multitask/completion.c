@@ -0,0 +1,37 @@
+#include "completion.h"
+#include "../spinlock/spinlock.h"
+#include "../time/timer.h"
+
+void completion_reinit(completion_t *c)
+{
+    uint64_t flags = save_irq_disable();
+    c->done = 0;
+    restore_irq(flags);
+}
+
+void complete(completion_t *c)
+{
+    uint64_t flags = save_irq_disable();
+    c->done++;
+    wait_queue_wake_one(&c->waiters);
+    restore_irq(flags);
+}
+
+bool wait_for_completion_timeout(completion_t *c, uint64_t timeout_ns)
+{
+    uint64_t deadline = timeout_ns ? timer_now_ns() + timeout_ns : 0;
+    uint64_t flags = save_irq_disable();
+
+    while (!c->done)
+    {
+        if (!wait_queue_sleep(&c->waiters, deadline))
+            break;
+    }
+
+    bool ok = c->done != 0;
+    if (ok)
+        c->done--;
+
+    restore_irq(flags);
+    return ok;
+}
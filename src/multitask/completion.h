@@ -0,0 +1,30 @@
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "waitqueue.h"
+
+/*
+ * Завершение запроса ввода-вывода: обработчик прерывания вызывает complete(),
+ * запросивший поток спит в wait_for_completion_timeout() и не занимает CPU.
+ * done считает завершения, поэтому прерывание до засыпания не теряется.
+ */
+typedef struct completion
+{
+    volatile uint32_t done;
+    wait_queue_t waiters;
+} completion_t;
+
+#define COMPLETION_INIT { 0, WAIT_QUEUE_INIT }
+
+/* Сбрасывает счётчик перед новым запросом; ждущих быть не должно */
+void completion_reinit(completion_t *c);
+
+/* Можно звать из обработчика прерывания */
+void complete(completion_t *c);
+
+/* Забирает одно завершение. false - истёк таймаут (0 - ждать без срока) */
+bool wait_for_completion_timeout(completion_t *c, uint64_t timeout_ns);
+
+#endif // COMPLETION_H
@@ -0,0 +1,140 @@
+#include "futex.h"
+#include "multitask.h"
+#include "waitqueue.h"
+#include "../spinlock/spinlock.h"
+#include "../time/timer.h"
+
+#define FUTEX_HASH_BITS 6
+#define FUTEX_HASH_SIZE (1 << FUTEX_HASH_BITS)
+
+#define USER_SPACE_END  0x0000800000000000ULL
+
+/* Ключ - физический адрес слова, поэтому общая память разных процессов
+   попадает в одну корзину */
+static wait_queue_t futex_buckets[FUTEX_HASH_SIZE];
+
+static wait_queue_t *futex_bucket(uint64_t key)
+{
+    return &futex_buckets[((key >> 2) * 0x9E3779B97F4A7C15ULL) >> (64 - FUTEX_HASH_BITS)];
+}
+
+static uint64_t futex_key(uint32_t *uaddr)
+{
+    uint64_t addr = (uint64_t)uaddr;
+    if (!uaddr || (addr & 3) || addr >= USER_SPACE_END)
+        return 0;
+
+    process_t *proc = get_current_process();
+    if (!proc || !proc->pml4)
+        return 0;
+
+    return vmm_get_phys(proc->pml4, addr);
+}
+
+static long futex_wait(uint32_t *uaddr, uint64_t key, uint32_t val, uint64_t timeout_ns)
+{
+    uint64_t deadline = timeout_ns ? timer_now_ns() + timeout_ns : 0;
+    wait_queue_t *wq = futex_bucket(key);
+
+    uint64_t flags = save_irq_disable();
+
+    /* Сравнение и постановка в очередь атомарны относительно FUTEX_WAKE */
+    if (*(volatile uint32_t *)uaddr != val)
+    {
+        restore_irq(flags);
+        return -FUTEX_EAGAIN;
+    }
+
+    thread_t *cur = get_current_thread();
+    cur->futex_key = key;
+    bool woken = wait_queue_sleep(wq, deadline);
+    cur->futex_key = 0;
+
+    restore_irq(flags);
+
+    /* Ложное пробуждение допустимо: пользователь всё равно перепроверяет слово */
+    if (!woken && deadline && timer_now_ns() >= deadline)
+        return -FUTEX_ETIMEDOUT;
+    return 0;
+}
+
+/* Будит до nr_wake ждущих на key, следующих до nr_requeue переносит на key2 */
+static long futex_wake_requeue(uint64_t key, uint32_t nr_wake, uint64_t key2, uint32_t nr_requeue)
+{
+    wait_queue_t *wq = futex_bucket(key);
+    wait_queue_t *wq2 = key2 ? futex_bucket(key2) : NULL;
+    long done = 0;
+    uint32_t woken = 0;
+    uint32_t moved = 0;
+
+    thread_t *thr = wq->head;
+    while (thr && (woken < nr_wake || (wq2 && moved < nr_requeue)))
+    {
+        thread_t *next = thr->wq_next;
+
+        if (thr->futex_key == key)
+        {
+            wait_queue_remove(wq, thr);
+
+            if (woken < nr_wake)
+            {
+                thread_wake(thr);
+                woken++;
+                done++;
+            }
+            else
+            {
+                thr->futex_key = key2;
+                wait_queue_push(wq2, thr);
+                moved++;
+                done++;
+            }
+        }
+
+        thr = next;
+    }
+
+    return done;
+}
+
+long sys_futex(uint32_t *uaddr, int op, uint32_t val, uint64_t val2, uint32_t *uaddr2, uint32_t val3)
+{
+    uint64_t key = futex_key(uaddr);
+    if (!key)
+        return -FUTEX_EFAULT;
+
+    switch (op)
+    {
+        case FUTEX_WAIT:
+            return futex_wait(uaddr, key, val, val2);
+
+        case FUTEX_WAKE:
+        {
+            uint64_t flags = save_irq_disable();
+            long n = futex_wake_requeue(key, val, 0, 0);
+            restore_irq(flags);
+            return n;
+        }
+
+        case FUTEX_REQUEUE:
+        case FUTEX_CMP_REQUEUE:
+        {
+            uint64_t key2 = futex_key(uaddr2);
+            if (!key2)
+                return -FUTEX_EFAULT;
+
+            uint64_t flags = save_irq_disable();
+            if (op == FUTEX_CMP_REQUEUE && *(volatile uint32_t *)uaddr != val3)
+            {
+                restore_irq(flags);
+                return -FUTEX_EAGAIN;
+            }
+            long n = futex_wake_requeue(key, val, key2, (uint32_t)val2);
+            restore_irq(flags);
+            return n;
+        }
+
+        default:
+            return -FUTEX_EINVAL;
+    }
+}
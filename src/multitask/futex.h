@@ -0,0 +1,25 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stdint.h>
+
+#define FUTEX_WAIT          0
+#define FUTEX_WAKE          1
+#define FUTEX_REQUEUE       3
+#define FUTEX_CMP_REQUEUE   4
+
+/* Коды ошибок совпадают с errno libc, возвращаются со знаком минус */
+#define FUTEX_EFAULT        14
+#define FUTEX_EAGAIN        11
+#define FUTEX_EINVAL        22
+#define FUTEX_ETIMEDOUT     110
+
+/*
+ * FUTEX_WAIT:        спать, пока *uaddr == val; val2 - таймаут в нс (0 - бесконечно)
+ * FUTEX_WAKE:        разбудить до val ждущих
+ * FUTEX_REQUEUE:     разбудить до val, остальных (до val2) перевесить на uaddr2
+ * FUTEX_CMP_REQUEUE: то же, но только если *uaddr == val3
+ */
+long sys_futex(uint32_t *uaddr, int op, uint32_t val, uint64_t val2, uint32_t *uaddr2, uint32_t val3);
+
+#endif // FUTEX_H
@@ -0,0 +1,122 @@
+#include "idmap.h"
+#include "../malloc/malloc.h"
+#include "../libc/string.h"
+#include "../mm/vmm.h"
+
+static inline idmap_leaf_t *leaf_of(const idmap_t *map, uint32_t index)
+{
+    return map->leaves[index >> IDMAP_LEAF_BITS];
+}
+
+static inline uint32_t slot_of(uint32_t index)
+{
+    return index & (IDMAP_LEAF_SIZE - 1);
+}
+
+static void free_list_push(idmap_t *map, uint32_t index)
+{
+    leaf_of(map, index)->next_free[slot_of(index)] = IDMAP_NONE;
+
+    if (map->free_tail == IDMAP_NONE)
+        map->free_head = index;
+    else
+        leaf_of(map, map->free_tail)->next_free[slot_of(map->free_tail)] = index;
+    map->free_tail = index;
+}
+
+static bool idmap_grow(idmap_t *map)
+{
+    if (map->grown >= map->capacity)
+        return false;
+
+    idmap_leaf_t *leaf = malloc(sizeof(idmap_leaf_t));
+    if (!leaf)
+        return false;
+    memset(leaf, 0, sizeof(*leaf));
+
+    uint32_t base = map->grown;
+    for (uint32_t i = 0; i < IDMAP_LEAF_SIZE; i++)
+        leaf->gen[i] = 1;
+
+    /* Лист виден idmap_lookup только после публикации grown */
+    map->leaves[base >> IDMAP_LEAF_BITS] = leaf;
+    __atomic_store_n(&map->grown, base + IDMAP_LEAF_SIZE, __ATOMIC_RELEASE);
+
+    /* Индекс 0 зарезервирован: id 0 означает ядро / "нет" */
+    for (uint32_t i = 0; i < IDMAP_LEAF_SIZE; i++)
+        if (base + i != 0)
+            free_list_push(map, base + i);
+    return true;
+}
+
+void idmap_init(idmap_t *map, uint32_t capacity)
+{
+    memset(map, 0, sizeof(*map));
+
+    capacity = ALIGN_UP(capacity, IDMAP_LEAF_SIZE);
+    if (capacity > (1u << IDMAP_INDEX_BITS))
+        capacity = 1u << IDMAP_INDEX_BITS;
+
+    map->capacity = capacity;
+    map->free_head = IDMAP_NONE;
+    map->free_tail = IDMAP_NONE;
+}
+
+int idmap_alloc(idmap_t *map, void *ptr)
+{
+    if (map->free_head == IDMAP_NONE && !idmap_grow(map))
+        return -1;
+
+    uint32_t index = map->free_head;
+    idmap_leaf_t *leaf = leaf_of(map, index);
+    uint32_t slot = slot_of(index);
+
+    map->free_head = leaf->next_free[slot];
+    if (map->free_head == IDMAP_NONE)
+        map->free_tail = IDMAP_NONE;
+
+    __atomic_store_n(&leaf->ptr[slot], ptr, __ATOMIC_RELEASE);
+    map->count++;
+
+    return (int)(((uint32_t)leaf->gen[slot] << IDMAP_INDEX_BITS) | index);
+}
+
+void idmap_free(idmap_t *map, int id)
+{
+    if (!idmap_lookup(map, id))
+        return;
+
+    uint32_t index = idmap_index(id);
+    idmap_leaf_t *leaf = leaf_of(map, index);
+    uint32_t slot = slot_of(index);
+
+    __atomic_store_n(&leaf->ptr[slot], NULL, __ATOMIC_RELAXED);
+    uint16_t gen = (leaf->gen[slot] >= IDMAP_GEN_MAX) ? 1 : leaf->gen[slot] + 1;
+    __atomic_store_n(&leaf->gen[slot], gen, __ATOMIC_RELEASE);
+    map->count--;
+
+    free_list_push(map, index);
+}
+
+void *idmap_lookup(const idmap_t *map, int id)
+{
+    if (id <= 0)
+        return NULL;
+
+    uint32_t index = idmap_index(id);
+    if (index >= __atomic_load_n(&map->grown, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    idmap_leaf_t *leaf = leaf_of(map, index);
+    uint32_t slot = slot_of(index);
+    uint32_t gen = (uint32_t)id >> IDMAP_INDEX_BITS;
+
+    /* Поколение проверяем до и после чтения указателя: если слот успели
+       освободить и занять снова, второе чтение увидит новое поколение */
+    if (__atomic_load_n(&leaf->gen[slot], __ATOMIC_ACQUIRE) != gen)
+        return NULL;
+    void *ptr = __atomic_load_n(&leaf->ptr[slot], __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&leaf->gen[slot], __ATOMIC_ACQUIRE) != gen)
+        return NULL;
+    return ptr;
+}
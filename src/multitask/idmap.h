@@ -0,0 +1,52 @@
+#ifndef IDMAP_H
+#define IDMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Таблица идентификаторов (PID/TID) с O(1) поиском.
+ * id = (поколение << IDMAP_INDEX_BITS) | индекс слота. Поколение растёт
+ * при каждом освобождении слота, поэтому устаревший id не найдёт чужой объект.
+ * Слоты лежат в двухуровневом радикс-дереве, листья выделяются по мере роста.
+ * Изменять с выключенными прерываниями. idmap_lookup можно звать и без них,
+ * внутри rcu_read_lock: объект при этом должен освобождаться через RCU.
+ */
+
+#define IDMAP_INDEX_BITS 16
+#define IDMAP_LEAF_BITS  8
+#define IDMAP_LEAF_SIZE  (1u << IDMAP_LEAF_BITS)
+#define IDMAP_TOP_SIZE   (1u << (IDMAP_INDEX_BITS - IDMAP_LEAF_BITS))
+#define IDMAP_GEN_MAX    0x7FFFu
+#define IDMAP_NONE       0xFFFFFFFFu
+
+typedef struct idmap_leaf
+{
+    void *ptr[IDMAP_LEAF_SIZE];
+    uint32_t next_free[IDMAP_LEAF_SIZE];
+    uint16_t gen[IDMAP_LEAF_SIZE];
+} idmap_leaf_t;
+
+typedef struct
+{
+    idmap_leaf_t *leaves[IDMAP_TOP_SIZE];
+    uint32_t capacity;   /* максимум слотов, кратно IDMAP_LEAF_SIZE */
+    uint32_t grown;      /* сколько слотов уже выделено листьями */
+    uint32_t free_head;  /* FIFO свободных слотов: освобождённые уходят в хвост */
+    uint32_t free_tail;
+    uint32_t count;
+} idmap_t;
+
+void idmap_init(idmap_t *map, uint32_t capacity);
+
+/* Возвращает новый id (> 0) или -1, если места нет */
+int idmap_alloc(idmap_t *map, void *ptr);
+void idmap_free(idmap_t *map, int id);
+void *idmap_lookup(const idmap_t *map, int id);
+
+static inline uint32_t idmap_index(int id)
+{
+    return (uint32_t)id & ((1u << IDMAP_INDEX_BITS) - 1);
+}
+
+#endif // IDMAP_H
@@ -59,7 +59,7 @@ int sys_ipc_send(int target_pid, int target_tid, ipc_msg_t *msg)
 
     if (target->state == THREAD_BLOCKED && target->ipc_blocked_on_pid == 0)
     {
-        target->state = THREAD_READY;
+        thread_wake(target);
     }
     else if (target->state == THREAD_BLOCKED && target->ipc_blocked_on_pid == current->tid)
     {
@@ -67,9 +67,9 @@ int sys_ipc_send(int target_pid, int target_tid, ipc_msg_t *msg)
         {
             memcpy(target->ipc_reply_msg, msg, sizeof(ipc_msg_t));
         }
-        target->state = THREAD_READY;
         target->ipc_blocked_on_pid = 0;
         target->ipc_reply_msg = NULL;
+        thread_wake(target);
     }
 
     return 0;
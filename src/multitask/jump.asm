@@ -5,16 +5,16 @@ jump_to_user:
 
     mov cr3, rdx
 
-    push 0x23       ; SS (User Data Selector | RPL 3)
+    push 0x1B       ; SS (User Data Selector | RPL 3)
     push rsi
     push 0x202      ; RFLAGS (Interrupts Enabled)
-    push 0x10       ; CS (User Code Selector | RPL 3)
+    push 0x23       ; CS (User Code Selector | RPL 3)
     push rdi        ; RIP
 
-    mov ax, 0x23
+    mov ax, 0x1B
     mov ds, ax
     mov es, ax
-    mov fs, ax
+    ; fs не трогаем: загрузка селектора обнулила бы FS base (TLS потока)
     mov gs, ax
 
     iretq
\ No newline at end of file
@@ -7,11 +7,24 @@
 #include <stddef.h>
 #include "../tss/tss.h"
 #include "../mm/vmm.h"
+#include "../idt.h"
+#include "../spinlock/spinlock.h"
+#include "../time/timer.h"
+#include "../time/tsc/tsc.h"
+#include "../cpu/fpu.h"
+#include "../vdso/vdso.h"
+#include "waitqueue.h"
+#include "idmap.h"
+#include "preempt.h"
+#include "schedstat.h"
+#include "tls.h"
+#include "rcu.h"
+#include "../graphics/formatting.h"
 
 static inline uint64_t read_pml4(void);
 
-#define USER_CS ((uint64_t)0x18 | 3) /* 0x1B */
-#define USER_SS ((uint64_t)0x20 | 3) /* 0x23 */
+#define USER_CS ((uint64_t)0x20 | 3) /* 0x23 */
+#define USER_SS ((uint64_t)0x18 | 3) /* 0x1B */
 
 extern char _heap_start;
 extern char _heap_end;
@@ -24,18 +37,311 @@ static uint8_t init_kstack[INIT_KSTACK_SIZE];
 static thread_t *thread_ring = NULL;
 static thread_t *current_thread = NULL;
 static thread_t *zombie_threads = NULL;
+static thread_t *idle_thread = NULL;
+static thread_t *sleep_queue = NULL;
+static volatile bool need_resched = false;
+/* Текущему потоку взведён конец кванта: без соперников таймер ждёт только спящих */
+static bool slice_armed = false;
 
+/* process_table индексируется слотом PID из pid_map */
 static process_t *process_table[MAX_PROCESSES] = { 0 };
 static process_t *current_process = NULL;
-static int next_pid = 1;
-static int next_tid = 1;
+static idmap_t pid_map;
+static idmap_t tid_map;
+
+/*
+ * Процессоры. SMP пока не поднят - всё выполняется на BSP (CPU 0), но маски
+ * уже учитываются при выборе потока. Зарезервированные (isolcpus=) ядра не
+ * входят в маску по умолчанию: на них попадают только явно привязанные потоки.
+ * BSP зарезервировать нельзя - общим потокам нужно хотя бы одно ядро
+ */
+static cpumask_t cpus_online = CPUMASK_CPU(0);
+static cpumask_t cpus_reserved = 0;
+
+static inline uint32_t this_cpu(void)
+{
+    return 0;
+}
+
+static inline cpumask_t default_affinity(void)
+{
+    return CPUMASK_ALL & ~cpus_reserved;
+}
+
+/* Реапер спит здесь, пока нет зомби */
+static wait_queue_t reaper_wq = WAIT_QUEUE_INIT;
+
+/* thread_join/process_wait ждут завершения здесь; корзина выбирается по слоту ID.
+   TID и PID делят корзины - лишнее пробуждение только перепроверит условие */
+#define EXIT_WQ_BUCKETS 64
+static wait_queue_t exit_wq[EXIT_WQ_BUCKETS];
+
+static inline wait_queue_t *exit_wq_for(int id)
+{
+    return &exit_wq[idmap_index(id) % EXIT_WQ_BUCKETS];
+}
+
+/* Пулы переиспользования: стеки ядра и структуры потоков не возвращаются в malloc */
+#define KSTACK_POOL_MAX 256
+#define THREAD_POOL_MAX 256
+
+static void *kstack_pool = NULL;
+static thread_t *thread_pool = NULL;
+static thread_pool_stats_t pool_stats = { 0 };
 
 /* CLI/STI */
 static inline void cli(void) { __asm__ volatile("cli" : :: "memory"); }
 static inline void sti(void) { __asm__ volatile("sti" ::: "memory"); }
 
-static int alloc_pid(void) { return next_pid++; }
-static int alloc_tid(void) { return next_tid++; }
+static int alloc_pid(process_t *p)
+{
+    uint64_t flags = save_irq_disable();
+    int pid = idmap_alloc(&pid_map, p);
+    restore_irq(flags);
+    return pid;
+}
+
+static int alloc_tid(thread_t *thr)
+{
+    uint64_t flags = save_irq_disable();
+    int tid = idmap_alloc(&tid_map, thr);
+    restore_irq(flags);
+    return tid;
+}
+
+/* Свободный стек хранит указатель на следующий в первых 8 байтах */
+static void *kstack_alloc(void)
+{
+    uint64_t flags = save_irq_disable();
+    void *stack = kstack_pool;
+    if (stack)
+    {
+        kstack_pool = *(void **)stack;
+        pool_stats.kstack_pooled--;
+        pool_stats.kstack_hits++;
+    }
+    else
+    {
+        pool_stats.kstack_misses++;
+    }
+    restore_irq(flags);
+
+    return stack ? stack : malloc(KSTACK_SIZE);
+}
+
+static void kstack_release(void *stack)
+{
+    uint64_t flags = save_irq_disable();
+    if (pool_stats.kstack_pooled < KSTACK_POOL_MAX)
+    {
+        *(void **)stack = kstack_pool;
+        kstack_pool = stack;
+        pool_stats.kstack_pooled++;
+        stack = NULL;
+    }
+    restore_irq(flags);
+
+    if (stack)
+        free(stack);
+}
+
+static thread_t *thread_struct_alloc(void)
+{
+    uint64_t flags = save_irq_disable();
+    thread_t *thr = thread_pool;
+    if (thr)
+    {
+        thread_pool = thr->next;
+        pool_stats.thread_pooled--;
+        pool_stats.thread_hits++;
+    }
+    else
+    {
+        pool_stats.thread_misses++;
+    }
+    restore_irq(flags);
+
+    return thr ? thr : malloc(sizeof(thread_t));
+}
+
+static void thread_struct_release(thread_t *thr)
+{
+    uint64_t flags = save_irq_disable();
+    if (pool_stats.thread_pooled < THREAD_POOL_MAX)
+    {
+        thr->next = thread_pool;
+        thread_pool = thr;
+        pool_stats.thread_pooled++;
+        thr = NULL;
+    }
+    restore_irq(flags);
+
+    if (thr)
+        free(thr);
+}
+
+/* Вызывается с выключенными прерываниями */
+static inline void sched_mark_ready(thread_t *thr, uint64_t tsc)
+{
+    seqlock_write_begin(&thr->sched_seq);
+    thr->sched_ready_since = tsc;
+    seqlock_write_end(&thr->sched_seq);
+}
+
+size_t sched_get_thread_stats(thread_stat_t *out, size_t max)
+{
+    if (!out || !max)
+        return 0;
+
+    /* Прерывания не запрещаем: кольцо обходим под RCU (реапер освобождает
+       потоки после периода ожидания), счётчики потока читаем под sched_seq */
+    rcu_read_lock();
+    size_t n = 0;
+
+    thread_t *start = rcu_dereference(thread_ring);
+    thread_t *it = start;
+    if (it) {
+        do {
+            thread_stat_t s;
+            unsigned seq;
+            do {
+                seq = seqlock_read_begin(&it->sched_seq);
+                uint64_t tsc = rdtsc();
+                uint64_t runtime = it->sched_runtime;
+                uint64_t wait = it->sched_wait;
+
+                /* Текущий запуск и текущее ожидание тоже учитываем */
+                if (it->sched_run_start)
+                    runtime += tsc - it->sched_run_start;
+                else if (it->sched_ready_since)
+                    wait += tsc - it->sched_ready_since;
+
+                s.last_cpu = it->last_cpu;
+                s.runtime_ns = runtime;
+                s.wait_ns = wait;
+                s.nr_voluntary = it->nr_voluntary;
+                s.nr_involuntary = it->nr_involuntary;
+            } while (seqlock_read_retry(&it->sched_seq, seq));
+
+            s.tid = it->tid;
+            s.pid = it->parent ? it->parent->pid : -1;
+            s.state = it->state;
+            s.runtime_ns = tsc_to_ns(s.runtime_ns);
+            s.wait_ns = tsc_to_ns(s.wait_ns);
+            out[n++] = s;
+            it = rcu_dereference(it->next);
+        } while (it != start && n < max);
+    }
+
+    rcu_read_unlock();
+    return n;
+}
+
+int sched_setaffinity(int tid, cpumask_t mask)
+{
+    /* Хотя бы один из разрешённых процессоров должен работать */
+    if (!(mask & cpus_online))
+        return -SCHED_EINVAL;
+
+    uint64_t flags = save_irq_disable();
+    thread_t *thr = tid ? idmap_lookup(&tid_map, tid) : current_thread;
+
+    int err = 0;
+    if (!thr || thr->state == THREAD_ZOMBIE)
+        err = -SCHED_ESRCH;
+    else if (current_thread->parent->pid != 0 && thr->parent != current_thread->parent)
+        err = -SCHED_EPERM;
+
+    if (!err) {
+        thr->affinity = mask;
+        /* Текущему потоку здесь больше нельзя - уходим при первой возможности */
+        if (thr == current_thread && !(mask & CPUMASK_CPU(this_cpu())))
+            need_resched = true;
+    }
+
+    restore_irq(flags);
+    return err;
+}
+
+int sched_getaffinity(int tid, cpumask_t *mask)
+{
+    if (!mask)
+        return -SCHED_EINVAL;
+
+    uint64_t flags = save_irq_disable();
+    thread_t *thr = tid ? idmap_lookup(&tid_map, tid) : current_thread;
+    if (thr)
+        *mask = thr->affinity & cpus_online;
+    restore_irq(flags);
+
+    return thr ? 0 : -SCHED_ESRCH;
+}
+
+cpumask_t sched_get_reserved_cpus(void)
+{
+    return cpus_reserved;
+}
+
+cpumask_t sched_get_online_cpus(void)
+{
+    return cpus_online;
+}
+
+uint32_t sched_current_cpu(void)
+{
+    return this_cpu();
+}
+
+static const char *parse_uint(const char *s, uint32_t *out)
+{
+    uint32_t v = 0;
+    const char *p = s;
+    while (*p >= '0' && *p <= '9')
+        v = v * 10 + (uint32_t)(*p++ - '0');
+    *out = v;
+    return p == s ? NULL : p;
+}
+
+void sched_parse_cmdline(const char *cmdline)
+{
+    if (!cmdline)
+        return;
+
+    const char *p = cmdline;
+    while (*p) {
+        if (strncmp(p, "isolcpus=", 9) == 0 && (p == cmdline || p[-1] == ' ')) {
+            p += 9;
+            cpumask_t mask = 0;
+            for (;;) {
+                uint32_t lo, hi;
+                const char *q = parse_uint(p, &lo);
+                if (!q)
+                    break;
+                hi = lo;
+                if (*q == '-' && !(q = parse_uint(q + 1, &hi)))
+                    break;
+                for (uint32_t n = lo; n <= hi && n < MAX_CPUS; n++)
+                    mask |= CPUMASK_CPU(n);
+                p = q;
+                if (*p != ',')
+                    break;
+                p++;
+            }
+
+            cpus_reserved = mask & ~CPUMASK_CPU(0);
+            kprint(KPRINT_LOG, "sched: reserved cpu mask 0x%lx\n", (unsigned long)cpus_reserved);
+            continue;
+        }
+        p++;
+    }
+}
+
+void thread_get_pool_stats(thread_pool_stats_t *out)
+{
+    uint64_t flags = save_irq_disable();
+    *out = pool_stats;
+    restore_irq(flags);
+}
 
 /* prepare_initial_stack:  остается без изменений */
 static uint64_t *prepare_initial_stack(void (*entry)(void*),
@@ -88,6 +394,9 @@ static uint64_t *prepare_initial_stack(void (*entry)(void*),
 
 void scheduler_init(void) 
 {
+    idmap_init(&pid_map, MAX_PROCESSES);
+    idmap_init(&tid_map, MAX_THREADS);
+
     process_t *kernel_proc = malloc(sizeof(process_t));
     memset(kernel_proc, 0, sizeof(*kernel_proc));
     kernel_proc->pid = 0;
@@ -99,11 +408,13 @@ void scheduler_init(void)
 
     thread_t *thr = malloc(sizeof(thread_t));
     memset(thr, 0, sizeof(*thr));
-    thr->tid = alloc_tid();
+    thr->tid = alloc_tid(thr);
     thr->parent = kernel_proc;
     thr->state = THREAD_RUNNING;
     thr->kstack = init_kstack;
     thr->kstack_size = sizeof(init_kstack);
+    thr->sched_run_start = rdtsc();
+    thr->affinity = CPUMASK_ALL;
     thr->next = thr;
     strcpy(thr->cwd_path, "/");
 
@@ -113,84 +424,167 @@ void scheduler_init(void)
 
     thread_ring = thr;
     current_thread = thr;
+    /* Поток kmain становится idle-потоком */
+    idle_thread = thr;
 
     tss_init();
 }
 
 void add_to_thread_ring(thread_t *thr) {
+    /* Читатели под RCU должны увидеть thr уже заполненным */
     if (!thread_ring) {
-        thread_ring = thr->next = thr;
+        thr->next = thr;
+        rcu_assign_pointer(thread_ring, thr);
     } else {
         thr->next = thread_ring->next;
-        thread_ring->next = thr;
-        thread_ring = thr;
+        rcu_assign_pointer(thread_ring->next, thr);
+        rcu_assign_pointer(thread_ring, thr);
     }
 }
 
 process_t *process_create(uint64_t flags)
 {
-    cli();
-    int pid = alloc_pid();
     process_t *p = malloc(sizeof(process_t));
+    if (!p)
+        return NULL;
     memset(p, 0, sizeof(process_t));
 
+    int pid = alloc_pid(p);
+    if (pid < 0)
+    {
+        free(p);
+        return NULL;
+    }
+
+    /* Страничные таблицы строим с включёнными прерываниями: процесс ещё не в process_table */
     p->pid = pid;
-    p->state = PROCESS_RUNNING;
+    p->state = PROCESS_STOPPED;
     p->pml4 = create_address_space();
     strcpy(p->cwd_path, "SYS:/");
 
-    for (int i = 0; i < MAX_PROCESSES; i++)
+    uint64_t irq = save_irq_disable();
+    if (!p->pml4)
     {
-        if (process_table[i] == NULL)
-        {
-            process_table[i] = p;
-            break;
-        }
+        idmap_free(&pid_map, pid);
+        restore_irq(irq);
+        free(p);
+        return NULL;
     }
-    sti();
+    p->state = PROCESS_RUNNING;
+    rcu_assign_pointer(process_table[idmap_index(pid)], p);
+    restore_irq(irq);
     return p;
 }
 
 thread_t *thread_create(process_t *parent, void(*entry)(void*), void *arg, bool is_user, uint64_t flags) {
-    thread_t *thr = malloc(sizeof(thread_t));
+    thread_t *thr = thread_struct_alloc();
+    if (!thr)
+        return NULL;
     memset(thr, 0, sizeof(*thr));
-    thr->tid = alloc_tid();
+
+    thr->kstack = kstack_alloc();
+    if (!thr->kstack)
+    {
+        thread_struct_release(thr);
+        return NULL;
+    }
+
+    thr->tid = alloc_tid(thr);
+    if (thr->tid < 0)
+    {
+        kstack_release(thr->kstack);
+        thread_struct_release(thr);
+        return NULL;
+    }
     thr->state = THREAD_READY;
+    thr->sched_ready_since = rdtsc();
+    thr->affinity = default_affinity();
     thr->parent = parent;
     thr->kstack_size = KSTACK_SIZE;
-    thr->kstack = malloc(KSTACK_SIZE);
     thr->arg = arg;
     thr->errno = 0;
+    thr->joinable = (flags & THREAD_FLAG_JOINABLE) != 0;
     strcpy(thr->cwd_path, parent->cwd_path);
 
+    /* Каждому пользовательскому потоку - свой TCB, libc читает его через %fs */
+    if (is_user && tls_thread_setup(thr) != 0)
+    {
+        uint64_t irq = save_irq_disable();
+        idmap_free(&tid_map, thr->tid);
+        restore_irq(irq);
+        kstack_release(thr->kstack);
+        thread_struct_release(thr);
+        return NULL;
+    }
+
     void *kstack_top = (char*)thr->kstack + thr->kstack_size;
     thr->regs = prepare_initial_stack(entry, kstack_top, NULL, (uint64_t)arg, 0, is_user);
 
+    uint64_t irq = save_irq_disable();
     thr->proc_next = parent->threads;
     parent->threads = thr;
     parent->thread_count++;
-
-    cli();
     add_to_thread_ring(thr);
-    sti();
+    restore_irq(irq);
 
     return thr;
 }
 
-static thread_t *pick_next_thread(void)
+static thread_t *pick_next_thread(bool *contended)
 {
+    *contended = false;
     if (!thread_ring) return NULL;
     thread_t *start = current_thread ? current_thread->next : thread_ring->next;
     thread_t *it = start;
+    thread_t *next = NULL;
+    cpumask_t cpu = CPUMASK_CPU(this_cpu());
     do {
-        if (it->state == THREAD_READY || it->state == THREAD_RUNNING) {
-            if (it->parent->pml4 != (page_table_t *)read_pml4())
-                vmm_switch_pml4(it->parent->pml4);
-            return it;
+        if (it != idle_thread && (it->affinity & cpu) &&
+            (it->state == THREAD_READY || it->state == THREAD_RUNNING)) {
+            if (next) {
+                *contended = true;
+                break;
+            }
+            next = it;
         }
         it = it->next;
     } while (it != start);
-    return NULL;
+
+    /* Idle-поток запускается только если больше некого */
+    if (!next)
+        next = idle_thread;
+
+    if (next && next->parent->pml4 != (page_table_t *)read_pml4())
+        vmm_switch_pml4(next->parent->pml4);
+    return next;
+}
+
+static void sleep_queue_remove(thread_t *thr)
+{
+    thread_t **pp = &sleep_queue;
+    while (*pp) {
+        if (*pp == thr) {
+            *pp = thr->snext;
+            break;
+        }
+        pp = &(*pp)->snext;
+    }
+    thr->snext = NULL;
+    thr->wake_at_ns = 0;
+}
+
+static void wake_expired_sleepers(uint64_t now)
+{
+    while (sleep_queue && sleep_queue->wake_at_ns <= now) {
+        thread_t *thr = sleep_queue;
+        sleep_queue = thr->snext;
+        thr->snext = NULL;
+        thr->wake_at_ns = 0;
+        if (thr->state == THREAD_BLOCKED) {
+            thr->state = THREAD_READY;
+            sched_mark_ready(thr, rdtsc());
+        }
+    }
 }
 
 static process_t *pick_next_process(void)
@@ -198,7 +592,7 @@ static process_t *pick_next_process(void)
     if (!current_process) return NULL;
 
     for (int i = 0; i < MAX_PROCESSES; i++) {
-        int idx = (current_process->pid + i + 1) % MAX_PROCESSES;
+        int idx = (idmap_index(current_process->pid) + i + 1) % MAX_PROCESSES;
         if (process_table[idx] && process_table[idx]->state == PROCESS_RUNNING) {
             return process_table[idx];
         }
@@ -206,34 +600,242 @@ static process_t *pick_next_process(void)
     return NULL;
 }
 
+/*
+ * Вызывается с выключенными прерываниями до смены current_thread.
+ * preempted - переключение затеял таймер: конец кванта или отложенный
+ * до preempt_enable запрос. Поток, сам отдавший процессор через
+ * thread_yield, остаётся READY, но уход всё равно добровольный
+ */
+static void account_switch(thread_t *prev, thread_t *next, bool preempted)
+{
+    uint64_t tsc = rdtsc();
+
+    if (prev) {
+        seqlock_write_begin(&prev->sched_seq);
+        prev->sched_runtime += tsc - prev->sched_run_start;
+        prev->sched_run_start = 0;
+        if (prev->state == THREAD_READY)
+            prev->sched_ready_since = tsc;
+        if (preempted && prev->state == THREAD_READY)
+            prev->nr_involuntary++;
+        else
+            prev->nr_voluntary++;
+        seqlock_write_end(&prev->sched_seq);
+    }
+
+    seqlock_write_begin(&next->sched_seq);
+    if (next->sched_ready_since) {
+        next->sched_wait += tsc - next->sched_ready_since;
+        next->sched_ready_since = 0;
+    }
+    next->sched_run_start = tsc;
+    next->last_cpu = this_cpu();
+    seqlock_write_end(&next->sched_seq);
+
+    sched_trace_record(prev, next, tsc);
+}
+
+/* Кадр isr32/isr81: regs[0] - номер вектора, regs[19] - RFLAGS прерванного кода */
+#define FRAME_INT_NO  0
+#define FRAME_RFLAGS  19
+
 void schedule_from_isr(uint64_t *regs, uint64_t **out_regs_ptr)
 {
+    /* Таймер не вытесняет поток с запрещённым вытеснением: переключимся в preempt_enable */
+    if (g_preempt_count && regs[FRAME_INT_NO] != YIELD) {
+        wake_expired_sleepers(timer_now_ns());
+        need_resched = true;
+#ifdef CONFIG_LATENCY_AUDIT
+        latency_resched_request();
+#endif
+        *out_regs_ptr = regs;
+        slice_armed = false;
+        timer_set_next_event(sleep_queue ? sleep_queue->wake_at_ns : 0);
+        return;
+    }
+
     if (current_thread) {
+        current_thread->preempt_count = g_preempt_count;
         current_thread->regs = regs;
         if (current_thread->state == THREAD_RUNNING)
             current_thread->state = THREAD_READY;
     }
 
-    thread_t *next = pick_next_thread();
+    /* need_resched: таймер сработал при запрещённом вытеснении, и поток
+       пришёл сюда через preempt_schedule - это тоже вытеснение */
+    bool preempted = regs[FRAME_INT_NO] != YIELD || need_resched;
+
+    uint64_t now = timer_now_ns();
+    wake_expired_sleepers(now);
+    need_resched = false;
+    rcu_note_context_switch(this_cpu());
+
+    bool contended;
+    thread_t *next = pick_next_thread(&contended);
     if (!next) {
         if (current_thread) current_thread->state = THREAD_RUNNING;
         *out_regs_ptr = regs;
+        slice_armed = false;
+        timer_set_next_event(sleep_queue ? sleep_queue->wake_at_ns : 0);
         return;
     }
 
+#ifdef CONFIG_LATENCY_AUDIT
+    latency_resched_done();
+    if (next != current_thread)
+        latency_switch(!(next->regs[FRAME_RFLAGS] & RFLAGS_IF), next->preempt_count != 0);
+#endif
+
+    if (next != current_thread)
+        account_switch(current_thread, next, preempted);
+
     current_thread = next;
     current_thread->state = THREAD_RUNNING;
+    g_preempt_count = current_thread->preempt_count;
     *out_regs_ptr = current_thread->regs;
+    fpu_switch_to(current_thread);
+    tls_switch_to(current_thread);
+    vdso_set_current(current_thread->tid, current_thread->parent ? current_thread->parent->pid : -1);
     g_syscall_kstack_top = (uint64_t)current_thread->kstack + current_thread->kstack_size;
     tss_update_rsp0(g_syscall_kstack_top);
+
+    /* Взводим one-shot на ближайшее событие: пробуждение или конец кванта */
+    uint64_t deadline = sleep_queue ? sleep_queue->wake_at_ns : 0;
+    if (contended) {
+        uint64_t slice_end = now + SCHED_TIMESLICE_NS;
+        if (deadline == 0 || slice_end < deadline)
+            deadline = slice_end;
+    }
+    slice_armed = contended;
+    timer_set_next_event(deadline);
+}
+
+void thread_yield(void)
+{
+    asm volatile("int %0" :: "i"(YIELD) : "memory");
+}
+
+/* Вызывается с выключенными прерываниями */
+void thread_block_current(void)
+{
+    current_thread->state = THREAD_BLOCKED;
+    thread_yield();
+}
+
+void thread_wake(thread_t *thr)
+{
+    if (!thr)
+        return;
+
+    uint64_t flags = save_irq_disable();
+    if (thr->state == THREAD_BLOCKED) {
+        if (thr->wake_at_ns)
+            sleep_queue_remove(thr);
+        thr->state = THREAD_READY;
+        sched_mark_ready(thr, rdtsc());
+        need_resched = true;
+#ifdef CONFIG_LATENCY_AUDIT
+        latency_resched_request();
+#endif
+        /*
+         * need_resched проверяет только preempt_enable и idle-цикл. Поток, который
+         * крутился один, без кванта вытеснится лишь на секундном тике - взводим
+         * таймер: idle уступает сразу, остальные - по концу кванта
+         */
+        if (current_thread && thr != current_thread && !slice_armed) {
+            uint64_t now = timer_now_ns();
+            uint64_t deadline = current_thread == idle_thread ? now : now + SCHED_TIMESLICE_NS;
+            if (sleep_queue && sleep_queue->wake_at_ns < deadline)
+                deadline = sleep_queue->wake_at_ns;
+            slice_armed = current_thread != idle_thread;
+            timer_set_next_event(deadline);
+        }
+    }
+    restore_irq(flags);
+}
+
+void preempt_schedule(void)
+{
+    uint64_t rflags;
+    asm volatile("pushfq; pop %0" : "=r"(rflags));
+
+    /* С IF = 0 вызывающий сам отвечает за атомарность - не переключаемся */
+    if (need_resched && (rflags & RFLAGS_IF) && current_thread)
+        thread_yield();
+}
+
+/* Вызывается с выключенными прерываниями; deadline_ns = 0 - без таймаута */
+void thread_block_current_until(uint64_t deadline_ns)
+{
+    if (deadline_ns)
+    {
+        thread_t *cur = current_thread;
+        cur->wake_at_ns = deadline_ns;
+
+        thread_t **pp = &sleep_queue;
+        while (*pp && (*pp)->wake_at_ns <= cur->wake_at_ns)
+            pp = &(*pp)->snext;
+        cur->snext = *pp;
+        *pp = cur;
+    }
+
+    thread_block_current();
+}
+
+void thread_sleep_until(uint64_t deadline_ns)
+{
+    uint64_t flags = save_irq_disable();
+    thread_block_current_until(deadline_ns ? deadline_ns : 1);
+    restore_irq(flags);
+}
+
+void thread_sleep_ms(uint32_t ms)
+{
+    thread_sleep_until(timer_now_ns() + (uint64_t)ms * NS_PER_MS);
+}
+
+void scheduler_idle_loop(void)
+{
+    for (;;)
+    {
+        cli();
+        if (need_resched)
+        {
+            sti();
+            thread_yield();
+            continue;
+        }
+        /* sti; hlt атомарны: прерывание не потеряется между ними */
+        __asm__ volatile("sti; hlt" ::: "memory");
+    }
 }
 
 thread_t *get_current_thread(void) { return current_thread; }
 process_t *get_current_process(void) { return current_process; }
 
+/* Вызывается с выключенными прерываниями */
 static void add_to_zombie_threads(thread_t *thr) {
     thr->znext = zombie_threads;
     zombie_threads = thr;
+    wait_queue_wake_one(&reaper_wq);
+}
+
+static void unlink_from_process(thread_t *thr)
+{
+    process_t *p = thr->parent;
+    if (!p)
+        return;
+
+    for (thread_t **pp = &p->threads; *pp; pp = &(*pp)->proc_next) {
+        if (*pp == thr) {
+            *pp = thr->proc_next;
+            p->thread_count--;
+            break;
+        }
+    }
+    if (p->main_thread == thr)
+        p->main_thread = NULL;
+    thr->proc_next = NULL;
 }
 
 static void remove_from_thread_ring(thread_t *thr) {
@@ -250,13 +852,85 @@ static void remove_from_thread_ring(thread_t *thr) {
     } while (it != thread_ring->next);
 }
 
+/* Вызывается с выключенными прерываниями: переводит поток в зомби и будит ждущих.
+   Присоединяемый поток освобождает thread_join, остальные - реапер */
+static void thread_retire(thread_t *thr, int exit_code)
+{
+    thr->exit_code = exit_code;
+    thr->state = THREAD_ZOMBIE;
+    remove_from_thread_ring(thr);
+    if (thr->wake_at_ns)
+        sleep_queue_remove(thr);
+    if (thr->wq)
+        wait_queue_remove(thr->wq, thr);
+    /* Ждущий thread_join убит: цель снова можно присоединить */
+    if (thr->joining)
+    {
+        thr->joining->join_claimed = false;
+        thr->joining = NULL;
+    }
+    if (!thr->joinable)
+        add_to_zombie_threads(thr);
+    wait_queue_wake_all(exit_wq_for(thr->tid));
+}
+
+/* Вызывается с выключенными прерываниями: процесс умирает, а ждущие thread_join
+   живут в нём же - неприсоединённых зомби отдаём реаперу */
+static void process_detach_threads(process_t *p)
+{
+    for (thread_t *thr = p->threads; thr; thr = thr->proc_next)
+    {
+        if (thr->state == THREAD_ZOMBIE && thr->joinable)
+            add_to_zombie_threads(thr);
+        thr->joinable = false;
+    }
+}
+
+/*
+ * Последний поток зомби-процесса освобождён: PID и слот process_table
+ * возвращаются, иначе pid_map кончился бы после MAX_PROCESSES запусков.
+ * Сам process_t остаётся - на него может смотреть process_wait.
+ * Вызывается с выключенными прерываниями
+ */
+static void process_release_id(process_t *p)
+{
+    int idx = idmap_index(p->pid);
+    if (process_table[idx] == p)
+        rcu_assign_pointer(process_table[idx], NULL);
+    idmap_free(&pid_map, p->pid);
+}
+
 static void free_thread_resources(thread_t *t)
 {
     if (!t)
         return;
 
-    if (t->kstack)
-        free(t->kstack);
+    /* Слот TLS выводится из индекса TID: освобождаем его, пока TID не занял новый поток */
+    tls_thread_release(t);
+
+    uint64_t flags = save_irq_disable();
+    idmap_free(&tid_map, t->tid);
+    process_t *p = t->parent;
+    unlink_from_process(t);
+    bool last = p && p->state == PROCESS_ZOMBIE && !p->threads;
+    if (last)
+        process_release_id(p);
+    restore_irq(flags);
+
+    /* Новых потоков у процесса не будет - шаблон TLS больше не нужен */
+    if (last && p->tls.image)
+    {
+        free(p->tls.image);
+        p->tls.image = NULL;
+    }
+
+    fpu_thread_exit(t);
+    if (t->fpu_state_raw)
+        free(t->fpu_state_raw);
+
+    /* Стек kmain-потока статический */
+    if (t->kstack && t->kstack != init_kstack)
+        kstack_release(t->kstack);
 
     if (t->user_stack)
     {
@@ -265,7 +939,7 @@ static void free_thread_resources(thread_t *t)
         t->user_stack_size = 0;
     }
 
-    free(t);
+    thread_struct_release(t);
 }
 
 void reap_zombie_processes(void)
@@ -293,19 +967,32 @@ void reap_zombie_processes(void)
 }
 
 void reap_zombie_threads(void) {
-    cli();
+    uint64_t flags = save_irq_disable();
     thread_t *z = zombie_threads;
     zombie_threads = NULL;
-    sti();
+    restore_irq(flags);
+
+    /* Из кольца зомби удалены ещё при выходе; sched_get_thread_stats
+       может стоять на них, пока не пройдёт период ожидания RCU */
+    if (z)
+        synchronize_rcu();
+
     while (z)
     {
         thread_t *next = z->znext;
-        remove_from_thread_ring(z);
         free_thread_resources(z);
         z = next;
     }
 }
 
+void wait_for_zombies(void)
+{
+    uint64_t flags = save_irq_disable();
+    while (!zombie_threads)
+        wait_queue_sleep(&reaper_wq, 0);
+    restore_irq(flags);
+}
+
 int process_stop(int pid)
 {
     if (pid == 0)
@@ -314,13 +1001,34 @@ int process_stop(int pid)
     process_t *p = find_process_by_pid(pid);
     if (!p) return -1;
 
-    thread_t *it = p->threads;
-    do
+    /* Список обходим целиком без прерываний: реапер не освободит узлы под нами */
+    uint64_t flags = save_irq_disable();
+    if (p->state == PROCESS_RUNNING)
     {
-        thread_stop(it->tid);
-        it = it->next;
-    } while (it);
+        p->exit_code = PROC_CODE_KERNEL_KILL;
+        p->state = PROCESS_ZOMBIE;
+        wait_queue_wake_all(exit_wq_for(p->pid));
+    }
+    process_detach_threads(p);
+
+    bool stop_self = false;
+    for (thread_t *it = p->threads; it; it = it->proc_next)
+    {
+        if (it == current_thread)
+            stop_self = true;
+        else if (it->state != THREAD_ZOMBIE)
+            thread_retire(it, PROC_CODE_KERNEL_KILL);
+    }
 
+    if (stop_self)
+    {
+        thread_retire(current_thread, PROC_CODE_KERNEL_KILL);
+        sti();
+        for (;;)
+            thread_yield();
+    }
+
+    restore_irq(flags);
     return 0;
 }
 
@@ -329,61 +1037,68 @@ int thread_stop(int tid)
     if (tid == 0)
         return -1;
 
-    reap_zombie_threads();
-
-    cli();
-    if (! thread_ring)
-    {
-        sti();
-        return -1;
-    }
-
-    thread_t *it = thread_ring->next;
-    thread_t *found = NULL;
-    do
-    {
-        if (it->tid == tid)
-        {
-            found = it;
-            break;
-        }
-        it = it->next;
-    } while (it != thread_ring->next);
+    uint64_t irq = save_irq_disable();
+    thread_t *found = idmap_lookup(&tid_map, tid);
 
-    if (! found)
+    if (! found || found->state == THREAD_ZOMBIE)
     {
-        sti();
+        restore_irq(irq);
         return -1;
     }
 
     if (found == current_thread)
     {
-        current_thread->state = THREAD_ZOMBIE;
-        add_to_zombie_threads(current_thread);
-        remove_from_thread_ring(current_thread);
-        sti();
+        thread_retire(current_thread, PROC_CODE_KERNEL_KILL);
         for (;;)
-        {
-            sti();
-            __asm__ volatile("hlt");
-        }
+            thread_yield();
     }
 
-    remove_from_thread_ring(found);
-    sti();
-    free_thread_resources(found);
+    thread_retire(found, PROC_CODE_KERNEL_KILL);
+    restore_irq(irq);
     return 0;
 }
 
 void thread_exit(int exit_code) {
     cli();
-    current_thread->exit_code = exit_code;
-    current_thread->state = THREAD_ZOMBIE;
-    add_to_zombie_threads(current_thread);
-    remove_from_thread_ring(current_thread);
+    thread_retire(current_thread, exit_code);
     sti();
     for (;;)
-        __asm__ volatile("hlt");
+        thread_yield();
+}
+
+int thread_join(int tid, int *status)
+{
+    uint64_t flags = save_irq_disable();
+    thread_t *thr = idmap_lookup(&tid_map, tid);
+
+    int err = 0;
+    if (!thr || thr->parent != current_thread->parent)
+        err = -WAIT_ESRCH;
+    else if (thr == current_thread)
+        err = -WAIT_EDEADLK;
+    else if (!thr->joinable || thr->join_claimed)
+        err = -WAIT_EINVAL;
+
+    if (err)
+    {
+        restore_irq(flags);
+        return err;
+    }
+
+    /* Структура не освободится, пока joinable: её отдаём реаперу только здесь */
+    thr->join_claimed = true;
+    current_thread->joining = thr;
+    wait_queue_t *wq = exit_wq_for(tid);
+    while (thr->state != THREAD_ZOMBIE)
+        wait_queue_sleep(wq, 0);
+    current_thread->joining = NULL;
+
+    if (status)
+        *status = thr->exit_code;
+    thr->joinable = false;
+    add_to_zombie_threads(thr);
+    restore_irq(flags);
+    return 0;
 }
 
 void process_exit(int exit_code)
@@ -392,14 +1107,20 @@ void process_exit(int exit_code)
     current_process->exit_code = exit_code;
     current_process->state = PROCESS_ZOMBIE;
     
+    process_detach_threads(current_process);
+
     thread_t *thr = current_process->threads;
     while (thr)
     {
-        thr->state = THREAD_ZOMBIE;
-        remove_from_thread_ring(thr);
-        add_to_zombie_threads(thr);
+        if (thr->state != THREAD_ZOMBIE)
+            thread_retire(thr, exit_code);
         thr = thr->proc_next;
     }
+    wait_queue_wake_all(exit_wq_for(current_process->pid));
+
+    /* Блоки TLS отображены в адресное пространство - снимаем их, пока оно живо */
+    for (thr = current_process->threads; thr; thr = thr->proc_next)
+        tls_thread_release(thr);
 
     if (current_process->pml4)
     {
@@ -411,7 +1132,7 @@ void process_exit(int exit_code)
     sti();
 
     while (1)
-        asm("hlt");
+        thread_yield();
 }
 
 int thread_is_alive(int tid)
@@ -422,29 +1143,11 @@ int thread_is_alive(int tid)
     if (tid == 0)
         return 1;
 
-    reap_zombie_threads();
-
-    cli();
-    if (!thread_ring)
-    {
-        sti();
-        return 0;
-    }
-
-    thread_t *it = thread_ring->next;
-    do
-    {
-        if (it->tid == tid)
-        {
-            int alive = (it->state != THREAD_ZOMBIE);
-            sti();
-            return alive;
-        }
-        it = it->next;
-    } while (it != thread_ring->next);
-
-    sti();
-    return 0;
+    uint64_t flags = save_irq_disable();
+    thread_t *thr = idmap_lookup(&tid_map, tid);
+    int alive = thr && thr->state != THREAD_ZOMBIE;
+    restore_irq(flags);
+    return alive;
 }
 
 int sys_chdir(const char *path)
@@ -487,18 +1190,24 @@ static inline uint64_t read_pml4(void) {
 }
 
 process_t *find_process_by_pid(int pid) {
-    for (int i = 0; i < MAX_PROCESSES; ++i)
-        if (process_table[i] && process_table[i]->pid == pid)
-            return process_table[i];
-    return NULL;
+    if (pid == 0)
+        return process_table[0];
+
+    /* Читатель без блокировок: process_t не освобождаются, а слот pid_map
+       читается idmap_lookup согласованно с изменениями (см. idmap.h) */
+    rcu_read_lock();
+    process_t *p = idmap_lookup(&pid_map, pid);
+    rcu_read_unlock();
+    return p;
 }
 
 thread_t *find_thread(int pid, int tid) {
-    process_t *p = find_process_by_pid(pid);
-    if (!p) return NULL;
-    for (thread_t *t = p->threads; t; t = t->proc_next)
-        if (t->tid == tid) return t;
-    return NULL;
+    uint64_t flags = save_irq_disable();
+    thread_t *t = idmap_lookup(&tid_map, tid);
+    if (t && t->parent->pid != pid)
+        t = NULL;
+    restore_irq(flags);
+    return t;
 }
 
 thread_t *get_all_threads(int pid) {
@@ -515,11 +1224,42 @@ process_t *get_all_processes(void)
 
 int process_is_alive(int pid)
 {
-    if (pid < 0 || pid >= MAX_PROCESSES || !process_table[pid]) {
+    process_t *p = find_process_by_pid(pid);
+    if (!p) {
         return 0;
     }
 
-    return process_table[pid]->state == PROCESS_RUNNING;
+    return p->state == PROCESS_RUNNING;
+}
+
+int process_wait(int pid, int *status)
+{
+    /* Процесс ядра не завершается */
+    if (pid == 0)
+        return -WAIT_EINVAL;
+
+    uint64_t flags = save_irq_disable();
+    process_t *p = idmap_lookup(&pid_map, pid);
+    if (!p)
+    {
+        restore_irq(flags);
+        return -WAIT_ESRCH;
+    }
+    if (p == current_thread->parent)
+    {
+        restore_irq(flags);
+        return -WAIT_EDEADLK;
+    }
+
+    /* Структуры процессов пока не освобождаются, указатель остаётся валидным */
+    wait_queue_t *wq = exit_wq_for(pid);
+    while (p->state == PROCESS_RUNNING)
+        wait_queue_sleep(wq, 0);
+
+    if (status)
+        *status = p->exit_code;
+    restore_irq(flags);
+    return 0;
 }
 
 thread_t *get_first_alive_thread(int pid)
@@ -6,10 +6,12 @@
 #include <stdbool.h>
 #include "../mm/vmm.h"
 #include "../mm/pmm.h"
+#include "../seqlock/seqlock.h"
 
 typedef struct thread thread_t;
 typedef struct process process_t;
 typedef struct window window_t;
+typedef struct wait_queue wait_queue_t;
 
 typedef enum {
     THREAD_RUNNING,
@@ -28,9 +30,21 @@ typedef enum {
 #define USTACK_SIZE      (64 * 1024)
 #define MAX_PROCESSES    1024
 #define MAX_THREADS_PER_PROCESS 128
+#define MAX_THREADS      65536
 #define CWD_PATH_MAX     256
 
+/* Маска процессоров: бит N - CPU N */
+typedef uint64_t cpumask_t;
+#define MAX_CPUS         64
+#define CPUMASK_ALL      (~(cpumask_t)0)
+#define CPUMASK_CPU(n)   ((cpumask_t)1 << (n))
+
+/* Квант времени при наличии нескольких готовых потоков */
+#define SCHED_TIMESLICE_NS (500ULL * 1000ULL)
+
 #include "ipc.h"
+#include "schedstat.h"
+#include "tls.h"
 #define MAILBOX_SIZE 16
 
 struct thread {
@@ -66,6 +80,39 @@ struct thread {
 
     int ipc_blocked_on_pid;
     ipc_msg_t *ipc_reply_msg;
+
+    uint64_t wake_at_ns;
+    thread_t *snext;
+
+    void *fpu_state;      /* XSAVE/FXSAVE-область, выровнена на 64 байта */
+    void *fpu_state_raw;  /* указатель от malloc для free */
+
+    wait_queue_t *wq;     /* очередь, в которой поток сейчас ждёт */
+    thread_t *wq_next;
+    uint64_t futex_key;   /* физический адрес слова futex */
+
+    bool joinable;        /* зомби держится до thread_join */
+    bool join_claimed;    /* уже есть ждущий thread_join */
+    thread_t *joining;    /* чей thread_join сейчас ждёт этот поток */
+
+    uint32_t preempt_count; /* g_preempt_count, пока поток не на процессоре */
+
+    /* Статистика планировщика, в тактах TSC. Пишется с IF = 0 под sched_seq,
+       sched_get_thread_stats читает её без блокировок */
+    seqlock_t sched_seq;
+    uint64_t sched_runtime;
+    uint64_t sched_wait;
+    uint64_t sched_run_start;   /* начало текущего запуска, 0 - не на процессоре */
+    uint64_t sched_ready_since; /* когда стал готовым, 0 - не ждёт */
+    uint64_t nr_voluntary;
+    uint64_t nr_involuntary;
+    uint32_t last_cpu;
+
+    cpumask_t affinity;   /* где потоку разрешено выполняться */
+
+    uint64_t fs_base;     /* MSR_FS_BASE потока: TCB или значение из arch_prctl */
+    uint64_t tls_base;    /* блок TLS в слоте TLS_AREA_BASE, 0 - не выделен */
+    size_t tls_pages;
 };
 
 struct process {
@@ -79,6 +126,7 @@ struct process {
     process_t *next;
     process_t *znext;
     int exit_code;
+    tls_template_t tls;   /* образ PT_TLS для новых потоков */
     // TODO: file descriptors, environment, etc.
 };
 
@@ -87,6 +135,15 @@ typedef struct thread_info {
     int state;
 } thread_info_t;
 
+typedef struct thread_pool_stats {
+    uint64_t kstack_hits;
+    uint64_t kstack_misses;
+    uint64_t thread_hits;
+    uint64_t thread_misses;
+    uint32_t kstack_pooled;
+    uint32_t thread_pooled;
+} thread_pool_stats_t;
+
 typedef struct process_info {
     int pid;
     int state;
@@ -106,9 +163,36 @@ typedef struct process_info {
 #define PROC_CODE_CRITICAL_ERROR     -500
 #define PROC_CODE_KERNEL_KILL        -600
 
+/* Поток не освобождается реапером, пока код завершения не заберёт thread_join */
+#define THREAD_FLAG_JOINABLE         (1 << 0)
+
+/* Ошибки thread_join/process_wait, возвращаются со знаком минус (как errno libc) */
+#define WAIT_ESRCH                   3
+#define WAIT_EINVAL                  22
+#define WAIT_EDEADLK                 35
+
+/* Ошибки sched_setaffinity/sched_getaffinity */
+#define SCHED_EPERM                  1
+#define SCHED_ESRCH                  3
+#define SCHED_EINVAL                 22
+
 void scheduler_init(void);
 void schedule_from_isr(uint64_t *regs, uint64_t **out_regs_ptr);
 void reap_zombie_threads(void);
+void wait_for_zombies(void);
+void thread_get_pool_stats(thread_pool_stats_t *out);
+size_t sched_get_thread_stats(thread_stat_t *out, size_t max);
+
+/* Привязка к процессорам. tid 0 - текущий поток */
+int sched_setaffinity(int tid, cpumask_t mask);
+int sched_getaffinity(int tid, cpumask_t *mask);
+/* Разбирает "isolcpus=1,3-5" из командной строки ядра */
+void sched_parse_cmdline(const char *cmdline);
+cpumask_t sched_get_reserved_cpus(void);
+cpumask_t sched_get_online_cpus(void);
+/* Процессор, на котором выполняется вызывающий */
+uint32_t sched_current_cpu(void);
+void scheduler_idle_loop(void);
 
 process_t *process_create(uint64_t flags);
 void process_exit(int exit_code);
@@ -116,6 +200,7 @@ int process_stop(int pid);
 process_t *get_current_process(void);
 process_t *find_process_by_pid(int pid);
 int process_is_alive(int pid);
+int process_wait(int pid, int *status);
 process_t *get_all_processes(void);
 
 thread_t *thread_create(
@@ -130,8 +215,16 @@ thread_t *get_current_thread(void);
 thread_t *find_thread(int pid, int tid);
 thread_t *get_all_threads(int pid);
 int thread_is_alive(int tid);
+int thread_join(int tid, int *status);
 thread_t *get_first_alive_thread(int pid);
 
+void thread_yield(void);
+void thread_block_current(void);
+void thread_block_current_until(uint64_t deadline_ns);
+void thread_wake(thread_t *thr);
+void thread_sleep_until(uint64_t deadline_ns);
+void thread_sleep_ms(uint32_t ms);
+
 int sys_chdir(const char *path);
 int sys_getcwd(char *buf, size_t size);
 
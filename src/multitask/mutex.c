@@ -0,0 +1,39 @@
+#include "mutex.h"
+#include "../spinlock/spinlock.h"
+
+void mutex_lock(mutex_t *m)
+{
+    thread_t *cur = get_current_thread();
+    uint64_t flags = save_irq_disable();
+
+    if (!m->owner)
+        m->owner = cur;
+    else
+        /* Владение приходит вместе с пробуждением, цикл - от ложных пробуждений */
+        while (m->owner != cur)
+            wait_queue_sleep(&m->waiters, 0);
+
+    restore_irq(flags);
+}
+
+bool mutex_trylock(mutex_t *m)
+{
+    uint64_t flags = save_irq_disable();
+    bool ok = m->owner == NULL;
+    if (ok)
+        m->owner = get_current_thread();
+    restore_irq(flags);
+    return ok;
+}
+
+void mutex_unlock(mutex_t *m)
+{
+    uint64_t flags = save_irq_disable();
+
+    thread_t *next = wait_queue_pop(&m->waiters);
+    m->owner = next;
+    if (next)
+        thread_wake(next);
+
+    restore_irq(flags);
+}
@@ -0,0 +1,29 @@
+#ifndef MUTEX_H
+#define MUTEX_H
+
+#include <stdbool.h>
+#include "waitqueue.h"
+
+/*
+ * Спящий мьютекс: держатель может блокироваться (ждать диск), ждущие не
+ * крутятся, а спят в FIFO. unlock передаёт владение первому ждущему
+ * напрямую, поэтому захват справедлив. Не рекурсивный, из прерываний нельзя.
+ */
+typedef struct mutex
+{
+    thread_t *owner;
+    wait_queue_t waiters;
+} mutex_t;
+
+#define MUTEX_INIT { NULL, WAIT_QUEUE_INIT }
+
+void mutex_lock(mutex_t *m);
+bool mutex_trylock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
+
+static inline bool mutex_is_locked(const mutex_t *m)
+{
+    return m->owner != NULL;
+}
+
+#endif // MUTEX_H
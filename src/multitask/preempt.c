@@ -0,0 +1,119 @@
+#include "preempt.h"
+#include "../libc/string.h"
+#include "../cpu/cpu.h"
+#include "../time/tsc/tsc.h"
+
+volatile uint32_t g_preempt_count = 0;
+
+#ifdef CONFIG_LATENCY_AUDIT
+
+/* Все поля меняются с IF = 0, кроме preempt-полей: их трогает только текущий поток */
+static latency_stats_t stats;
+
+static uint64_t irqoff_start;
+static uintptr_t irqoff_site;
+static uint64_t preemptoff_start;
+static uintptr_t preemptoff_site;
+static uint64_t resched_start;
+
+static inline void account(uint64_t start, uintptr_t site, uint64_t *max_ns, uint64_t *max_site)
+{
+    uint64_t ns = tsc_to_ns(rdtsc() - start);
+    if (ns > *max_ns)
+    {
+        *max_ns = ns;
+        *max_site = site;
+    }
+}
+
+void latency_irqs_off(uintptr_t site)
+{
+    irqoff_start = rdtsc();
+    irqoff_site = site;
+}
+
+void latency_irqs_on(void)
+{
+    if (!irqoff_start)
+        return;
+    account(irqoff_start, irqoff_site, &stats.irqoff_max_ns, &stats.irqoff_max_site);
+    stats.irqoff_sections++;
+    irqoff_start = 0;
+}
+
+void latency_preempt_off(uintptr_t site)
+{
+    preemptoff_start = rdtsc();
+    preemptoff_site = site;
+}
+
+void latency_preempt_on(void)
+{
+    if (!preemptoff_start)
+        return;
+    account(preemptoff_start, preemptoff_site, &stats.preemptoff_max_ns, &stats.preemptoff_max_site);
+    stats.preemptoff_sections++;
+    preemptoff_start = 0;
+}
+
+void latency_syscall(uint64_t num, uint64_t start_tsc)
+{
+    account(start_tsc, (uintptr_t)num, &stats.syscall_max_ns, &stats.syscall_max_num);
+}
+
+void latency_resched_request(void)
+{
+    if (!resched_start)
+        resched_start = rdtsc();
+}
+
+void latency_resched_done(void)
+{
+    if (!resched_start)
+        return;
+    uint64_t unused_site;
+    account(resched_start, 0, &stats.resched_max_ns, &unused_site);
+    resched_start = 0;
+}
+
+/*
+ * Переключение контекста: секции уходящего потока закрываются здесь, иначе в
+ * них попало бы время сна. Если следующий поток продолжит внутри своей секции,
+ * она отсчитывается заново от момента переключения (site = 0)
+ */
+void latency_switch(bool next_irqs_off, bool next_preempt_off)
+{
+    latency_irqs_on();
+    latency_preempt_on();
+
+    if (next_irqs_off)
+        latency_irqs_off(0);
+    if (next_preempt_off)
+        latency_preempt_off(0);
+}
+
+int latency_get_stats(latency_stats_t *out, bool reset)
+{
+    /* Мимо save_irq_disable, чтобы не засчитывать саму выборку */
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+
+    if (out)
+        *out = stats;
+    if (reset)
+        memset(&stats, 0, sizeof(stats));
+
+    asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
+    return 0;
+}
+
+#else
+
+int latency_get_stats(latency_stats_t *out, bool reset)
+{
+    (void)out;
+    (void)reset;
+    return -1;
+}
+
+#endif
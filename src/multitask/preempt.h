@@ -0,0 +1,86 @@
+#ifndef PREEMPT_H
+#define PREEMPT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Счётчик запрета вытеснения текущего потока. Пока он не ноль, таймер не
+ * переключает поток, а только взводит need_resched; переключение случится
+ * в preempt_enable(). Добровольная отдача (thread_yield, сон) разрешена -
+ * счётчик сохраняется в thread_t при переключении.
+ */
+extern volatile uint32_t g_preempt_count;
+
+#ifdef CONFIG_LATENCY_AUDIT
+void latency_preempt_off(uintptr_t site);
+void latency_preempt_on(void);
+#endif
+
+/* Точка вытеснения: переключает поток, если есть need_resched и IF = 1 */
+void preempt_schedule(void);
+
+static inline void preempt_disable(void)
+{
+    g_preempt_count++;
+#ifdef CONFIG_LATENCY_AUDIT
+    if (g_preempt_count == 1)
+    {
+        uintptr_t site;
+        asm volatile("lea (%%rip), %0" : "=r"(site));
+        latency_preempt_off(site);
+    }
+#endif
+    asm volatile("" ::: "memory");
+}
+
+/* Без точки вытеснения: для выхода из секции с ещё выключенными прерываниями */
+static inline void preempt_enable_no_resched(void)
+{
+    asm volatile("" ::: "memory");
+#ifdef CONFIG_LATENCY_AUDIT
+    if (g_preempt_count == 1)
+        latency_preempt_on();
+#endif
+    g_preempt_count--;
+}
+
+static inline void preempt_enable(void)
+{
+    preempt_enable_no_resched();
+    if (g_preempt_count == 0)
+        preempt_schedule();
+}
+
+static inline bool preemptible(void)
+{
+    return g_preempt_count == 0;
+}
+
+/* Аудит задержек (-DCONFIG_LATENCY_AUDIT): максимумы с момента последнего сброса */
+typedef struct latency_stats
+{
+    uint64_t irqoff_max_ns;       /* save_irq_disable .. restore_irq */
+    uint64_t irqoff_max_site;     /* адрес save_irq_disable */
+    uint64_t preemptoff_max_ns;   /* preempt_disable .. preempt_enable */
+    uint64_t preemptoff_max_site;
+    uint64_t syscall_max_ns;      /* системный вызов целиком с IF = 0 */
+    uint64_t syscall_max_num;
+    uint64_t resched_max_ns;      /* от взвода need_resched до переключения */
+    uint64_t irqoff_sections;
+    uint64_t preemptoff_sections;
+} latency_stats_t;
+
+/* Возвращает -1, если ядро собрано без CONFIG_LATENCY_AUDIT */
+int latency_get_stats(latency_stats_t *out, bool reset);
+
+#ifdef CONFIG_LATENCY_AUDIT
+void latency_irqs_off(uintptr_t site);
+void latency_irqs_on(void);
+void latency_syscall(uint64_t num, uint64_t start_tsc);
+void latency_resched_request(void);
+void latency_resched_done(void);
+void latency_switch(bool next_irqs_off, bool next_preempt_off);
+#endif
+
+#endif // PREEMPT_H
@@ -0,0 +1,82 @@
+#include "rcu.h"
+#include "multitask.h"
+#include "waitqueue.h"
+#include "../spinlock/spinlock.h"
+
+/* Номер последнего запрошенного периода ожидания */
+static uint64_t rcu_gp_seq = 0;
+/* Период, который процессор заведомо прошёл: переключался после его начала */
+static uint64_t rcu_qs_seq[MAX_CPUS];
+
+/* Очередь call_rcu, меняется с IF = 0 */
+static rcu_head_t *rcu_cb_head = NULL;
+static rcu_head_t **rcu_cb_tail = &rcu_cb_head;
+static wait_queue_t rcu_wq = WAIT_QUEUE_INIT;
+
+void rcu_note_context_switch(uint32_t cpu)
+{
+    __atomic_store_n(&rcu_qs_seq[cpu], __atomic_load_n(&rcu_gp_seq, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+static bool rcu_gp_done(uint64_t target)
+{
+    cpumask_t online = sched_get_online_cpus();
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        if ((online & CPUMASK_CPU(cpu)) &&
+            __atomic_load_n(&rcu_qs_seq[cpu], __ATOMIC_ACQUIRE) < target)
+            return false;
+    }
+    return true;
+}
+
+void synchronize_rcu(void)
+{
+    uint64_t target = __atomic_add_fetch(&rcu_gp_seq, 1, __ATOMIC_ACQ_REL);
+
+    /* Наш собственный yield - квиесцентное состояние этого процессора */
+    while (!rcu_gp_done(target))
+        thread_yield();
+}
+
+void call_rcu(rcu_head_t *head, rcu_callback_t func)
+{
+    head->func = func;
+    head->next = NULL;
+
+    uint64_t flags = save_irq_disable();
+    *rcu_cb_tail = head;
+    rcu_cb_tail = &head->next;
+    wait_queue_wake_one(&rcu_wq);
+    restore_irq(flags);
+}
+
+void rcu_wait_for_callbacks(void)
+{
+    uint64_t flags = save_irq_disable();
+    while (!rcu_cb_head)
+        wait_queue_sleep(&rcu_wq, 0);
+    restore_irq(flags);
+}
+
+void rcu_process_callbacks(void)
+{
+    /* Забираем накопленную пачку: один период ожидания на всех */
+    uint64_t flags = save_irq_disable();
+    rcu_head_t *list = rcu_cb_head;
+    rcu_cb_head = NULL;
+    rcu_cb_tail = &rcu_cb_head;
+    restore_irq(flags);
+
+    if (!list)
+        return;
+
+    synchronize_rcu();
+
+    while (list)
+    {
+        rcu_head_t *next = list->next;
+        list->func(list);
+        list = next;
+    }
+}
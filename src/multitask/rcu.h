@@ -0,0 +1,59 @@
+#ifndef RCU_H
+#define RCU_H
+
+#include <stdint.h>
+#include "preempt.h"
+
+/*
+ * RCU на квиесцентных состояниях: читатель не берёт блокировок, а лишь
+ * запрещает вытеснение. Каждое переключение контекста на процессоре -
+ * квиесцентное состояние: читателей, начавших секцию раньше, там уже нет.
+ * Писатель публикует новую версию через rcu_assign_pointer, а старую
+ * освобождает после synchronize_rcu или через call_rcu.
+ *
+ * Внутри rcu_read_lock нельзя спать и вызывать synchronize_rcu.
+ */
+
+typedef struct rcu_head rcu_head_t;
+typedef void (*rcu_callback_t)(rcu_head_t *head);
+
+struct rcu_head
+{
+    rcu_head_t *next;
+    rcu_callback_t func;
+};
+
+static inline void rcu_read_lock(void)
+{
+    preempt_disable();
+}
+
+static inline void rcu_read_unlock(void)
+{
+    preempt_enable();
+}
+
+/* Чтение указателя, опубликованного rcu_assign_pointer */
+#define rcu_dereference(p)       __atomic_load_n(&(p), __ATOMIC_CONSUME)
+/* Инициализация объекта видна читателю раньше, чем указатель на него */
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+#ifndef container_of
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - __builtin_offsetof(type, member)))
+#endif
+
+/* Ждёт, пока все читатели, вошедшие в секцию до вызова, из неё выйдут */
+void synchronize_rcu(void);
+
+/* Отложенный вызов func(head) после периода ожидания; можно звать с IF = 0 */
+void call_rcu(rcu_head_t *head, rcu_callback_t func);
+
+/* Вызывается планировщиком на каждом переключении */
+void rcu_note_context_switch(uint32_t cpu);
+
+/* Цикл потока обработки call_rcu (tasks.c) */
+void rcu_wait_for_callbacks(void);
+void rcu_process_callbacks(void);
+
+#endif // RCU_H
@@ -0,0 +1,71 @@
+#include "schedstat.h"
+#include "multitask.h"
+#include "../spinlock/spinlock.h"
+#include "../time/tsc/tsc.h"
+
+/* seq записи работает как seqlock на одну запись: пока запись
+   переписывается, там SCHED_TRACE_BUSY */
+#define SCHED_TRACE_BUSY UINT64_MAX
+
+typedef struct
+{
+    uint64_t seq;
+    uint64_t tsc;
+    int32_t prev_tid;
+    int32_t next_tid;
+    uint8_t prev_state;
+} sched_trace_entry_t;
+
+static sched_trace_entry_t trace_ring[SCHED_TRACE_SIZE];
+/* Номер следующей записи; запись seq лежит в trace_ring[seq % SCHED_TRACE_SIZE] */
+static uint64_t trace_seq = 0;
+
+void sched_trace_record(const thread_t *prev, const thread_t *next, uint64_t tsc)
+{
+    uint64_t seq = trace_seq;
+    sched_trace_entry_t *e = &trace_ring[seq % SCHED_TRACE_SIZE];
+
+    __atomic_store_n(&e->seq, SCHED_TRACE_BUSY, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    e->tsc = tsc;
+    e->prev_tid = prev ? prev->tid : -1;
+    e->next_tid = next->tid;
+    e->prev_state = prev ? (uint8_t)prev->state : 0;
+    __atomic_store_n(&e->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&trace_seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+size_t sched_trace_read(sched_event_t *out, size_t max, uint64_t from_seq)
+{
+    if (!out)
+        return 0;
+
+    /* Без запрета прерываний: запись, которую планировщик успел
+       перезаписать во время копирования, просто пропускается */
+    uint64_t head = __atomic_load_n(&trace_seq, __ATOMIC_ACQUIRE);
+    uint64_t oldest = head > SCHED_TRACE_SIZE ? head - SCHED_TRACE_SIZE : 0;
+    uint64_t seq = from_seq < oldest ? oldest : from_seq;
+
+    size_t n = 0;
+    for (; seq < head && n < max; seq++)
+    {
+        const sched_trace_entry_t *e = &trace_ring[seq % SCHED_TRACE_SIZE];
+        if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != seq)
+            continue;
+
+        sched_trace_entry_t copy = *e;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq)
+            continue;
+
+        out[n].seq = seq;
+        out[n].ts_ns = tsc_to_ns(copy.tsc - tsc_get_boot());
+        out[n].prev_tid = copy.prev_tid;
+        out[n].next_tid = copy.next_tid;
+        out[n].prev_state = copy.prev_state;
+        out[n].cpu = 0;
+        n++;
+    }
+
+    return n;
+}
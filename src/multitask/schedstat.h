@@ -0,0 +1,43 @@
+#ifndef SCHEDSTAT_H
+#define SCHEDSTAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct thread thread_t;
+
+/* Снимок счётчиков потока для SYSCALL_THREAD_STATS */
+typedef struct thread_stat
+{
+    int32_t tid;
+    int32_t pid;
+    uint32_t state;           /* thread_state_t */
+    uint32_t last_cpu;
+    uint64_t runtime_ns;      /* время на процессоре */
+    uint64_t wait_ns;         /* время в состоянии READY до запуска */
+    uint64_t nr_voluntary;    /* ушёл сам: сон, ожидание, выход, thread_yield */
+    uint64_t nr_involuntary;  /* вытеснен таймером, оставаясь готовым */
+} thread_stat_t;
+
+/* Событие переключения контекста */
+typedef struct sched_event
+{
+    uint64_t seq;
+    uint64_t ts_ns;           /* tsc_to_ns на момент чтения */
+    int32_t prev_tid;
+    int32_t next_tid;
+    uint32_t prev_state;      /* состояние уходящего потока: READY - вытеснен */
+    uint32_t cpu;
+} sched_event_t;
+
+/* Кольцо событий: старые записи затираются новыми */
+#define SCHED_TRACE_SIZE 1024
+
+/* Вызывается планировщиком с выключенными прерываниями */
+void sched_trace_record(const thread_t *prev, const thread_t *next, uint64_t tsc);
+
+/* Копирует до max событий с seq >= from_seq (или с самого старого из сохранённых).
+   Возвращает число скопированных событий */
+size_t sched_trace_read(sched_event_t *out, size_t max, uint64_t from_seq);
+
+#endif // SCHEDSTAT_H
@@ -0,0 +1,172 @@
+#include "tls.h"
+#include "multitask.h"
+#include "idmap.h"
+#include "../cpu/cpu.h"
+#include "../libc/string.h"
+#include "../malloc/malloc.h"
+
+#define TLS_SLOT_PAGES   (TLS_SLOT_SIZE / PAGE_SIZE)
+#define TLS_MIN_ALIGN    16
+
+/* Текущее значение MSR_FS_BASE: ядро %fs не использует, трогаем MSR только при смене */
+static uint64_t loaded_fs_base = 0;
+
+static inline bool is_user_addr(uint64_t addr)
+{
+    return addr < 0x0000800000000000ULL;
+}
+
+static inline size_t tls_align(const tls_template_t *t)
+{
+    return t->align > TLS_MIN_ALIGN ? t->align : TLS_MIN_ALIGN;
+}
+
+static inline size_t tls_static_size(const tls_template_t *t)
+{
+    return ALIGN_UP(t->memsz, tls_align(t));
+}
+
+int tls_set_template(process_t *p, const void *image, size_t filesz, size_t memsz, size_t align)
+{
+    if (!p || filesz > memsz)
+        return -TLS_EINVAL;
+
+    /* Выравнивание - степень двойки не больше страницы: слот выровнен на страницу */
+    if (align == 0)
+        align = 1;
+    if ((align & (align - 1)) || align > PAGE_SIZE)
+        return -TLS_EINVAL;
+
+    tls_template_t t = { .image = NULL, .filesz = filesz, .memsz = memsz, .align = align };
+    if (tls_static_size(&t) + sizeof(tls_tcb_t) > TLS_SLOT_SIZE)
+        return -TLS_EINVAL;
+
+    if (filesz)
+    {
+        t.image = malloc(filesz);
+        if (!t.image)
+            return -TLS_EINVAL;
+        memcpy(t.image, image, filesz);
+    }
+
+    if (p->tls.image)
+        free(p->tls.image);
+    p->tls = t;
+    return 0;
+}
+
+/* Копирует в блок, собранный из отдельных страниц (адреса HHDM) */
+static void tls_copy(void **pages, size_t off, const void *src, size_t len)
+{
+    const char *s = src;
+    while (len)
+    {
+        size_t in_page = PAGE_SIZE - off % PAGE_SIZE;
+        size_t n = len < in_page ? len : in_page;
+        memcpy((char *)pages[off / PAGE_SIZE] + off % PAGE_SIZE, s, n);
+        off += n;
+        s += n;
+        len -= n;
+    }
+}
+
+int tls_thread_setup(thread_t *thr)
+{
+    process_t *p = thr->parent;
+    const tls_template_t *t = &p->tls;
+
+    size_t tls_size = tls_static_size(t);
+    size_t pages = ALIGN_UP(tls_size + sizeof(tls_tcb_t), PAGE_SIZE) / PAGE_SIZE;
+    uint64_t base = TLS_AREA_BASE + (uint64_t)idmap_index(thr->tid) * TLS_SLOT_SIZE;
+
+    void *kpages[TLS_SLOT_PAGES];
+    for (size_t i = 0; i < pages; i++)
+    {
+        kpages[i] = alloc_page();
+        if (!kpages[i])
+        {
+            while (i--)
+            {
+                unmap(p->pml4, base + i * PAGE_SIZE);
+                free_page(kpages[i]);
+            }
+            return -TLS_EFAULT;
+        }
+        memset(kpages[i], 0, PAGE_SIZE);
+        mmap(p->pml4, base + i * PAGE_SIZE, (uint64_t)kpages[i] - hhdm_offset,
+            PTE_PRESENT | PTE_WRITABLE | PTE_USER);
+    }
+
+    /* .tbss уже обнулён вместе со страницами */
+    if (t->filesz)
+        tls_copy(kpages, 0, t->image, t->filesz);
+
+    tls_tcb_t tcb = { 0 };
+    tcb.self = base + tls_size;
+    tcb.tid = thr->tid;
+    tls_copy(kpages, tls_size, &tcb, sizeof(tcb));
+
+    thr->tls_base = base;
+    thr->tls_pages = pages;
+    thr->fs_base = tcb.self;
+    return 0;
+}
+
+void tls_thread_release(thread_t *thr)
+{
+    if (!thr->tls_pages)
+        return;
+
+    /* Без адресного пространства снимать нечего: process_exit освобождает блоки раньше */
+    page_table_t *pml4 = thr->parent->pml4;
+    if (!pml4)
+        return;
+
+    for (size_t i = 0; i < thr->tls_pages; i++)
+    {
+        uint64_t addr = thr->tls_base + i * PAGE_SIZE;
+        uint64_t phys = vmm_get_phys(pml4, addr);
+        unmap(pml4, addr);
+        if (phys)
+            free_page(virt(phys & ~(uint64_t)(PAGE_SIZE - 1)));
+    }
+
+    thr->tls_base = 0;
+    thr->tls_pages = 0;
+}
+
+void tls_switch_to(thread_t *next)
+{
+    if (next->fs_base != loaded_fs_base)
+    {
+        wrmsr(MSR_FS_BASE, next->fs_base);
+        loaded_fs_base = next->fs_base;
+    }
+}
+
+long tls_arch_prctl(int code, uint64_t addr)
+{
+    thread_t *cur = get_current_thread();
+    if (!cur)
+        return -TLS_EINVAL;
+
+    switch (code)
+    {
+        case ARCH_SET_FS:
+            if (!is_user_addr(addr))
+                return -TLS_EFAULT;
+            cur->fs_base = addr;
+            wrmsr(MSR_FS_BASE, addr);
+            loaded_fs_base = addr;
+            return 0;
+
+        case ARCH_GET_FS:
+            if (!addr || !is_user_addr(addr) || !is_user_addr(addr + sizeof(uint64_t) - 1))
+                return -TLS_EFAULT;
+            *(uint64_t *)(uintptr_t)addr = cur->fs_base;
+            return 0;
+
+        default:
+            return -TLS_EINVAL;
+    }
+}
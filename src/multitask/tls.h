@@ -0,0 +1,62 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct thread thread_t;
+typedef struct process process_t;
+
+/*
+ * TLS пользовательских потоков, вариант II x86-64: статический блок лежит
+ * сразу перед TCB, FS base указывает на TCB, первое слово TCB - он сам.
+ * Переменная потока доступна одной инструкцией через %fs:
+ *
+ *   slot_base        tcb - tls_size    tcb = FS base
+ *   | выравнивание    | .tdata | .tbss | tls_tcb_t |
+ */
+
+/* Окно блоков TLS в адресном пространстве процесса: слот на индекс TID */
+#define TLS_AREA_BASE    0x00007F0000000000ULL
+#define TLS_SLOT_SIZE    (64 * 1024)
+
+/* Раскладка TCB - общий ABI с libc/include/tls.h */
+typedef struct tls_tcb
+{
+    uint64_t self;       /* %fs:0  - адрес самого TCB */
+    uint64_t dtv;        /* %fs:8  - динамические модули не поддерживаются, 0 */
+    int32_t errno_val;   /* %fs:16 */
+    int32_t tid;         /* %fs:20 */
+    uint64_t user[5];    /* ядро только обнуляет: per-thread данные libc */
+} tls_tcb_t;
+
+/* Образ PT_TLS процесса: копируется в каждый новый пользовательский поток */
+typedef struct tls_template
+{
+    void *image;         /* .tdata, копия в памяти ядра */
+    size_t filesz;
+    size_t memsz;        /* .tdata + .tbss */
+    size_t align;
+} tls_template_t;
+
+/* Коды arch_prctl (как в Linux) */
+#define ARCH_SET_FS      0x1002
+#define ARCH_GET_FS      0x1003
+
+/* Ошибки, возвращаются со знаком минус (как errno libc) */
+#define TLS_EFAULT       14
+#define TLS_EINVAL       22
+
+/* Запоминает образ TLS процесса. 0 или -TLS_EINVAL, если блок не влезает в слот */
+int tls_set_template(process_t *p, const void *image, size_t filesz, size_t memsz, size_t align);
+
+/* Отображает блок TLS + TCB потока в адресное пространство процесса и выставляет fs_base */
+int tls_thread_setup(thread_t *thr);
+void tls_thread_release(thread_t *thr);
+
+/* Вызывается планировщиком: MSR пишется только при смене FS base */
+void tls_switch_to(thread_t *next);
+
+long tls_arch_prctl(int code, uint64_t addr);
+
+#endif // TLS_H
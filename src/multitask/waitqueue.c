@@ -0,0 +1,100 @@
+#include "waitqueue.h"
+
+void wait_queue_init(wait_queue_t *wq)
+{
+    wq->head = NULL;
+    wq->tail = NULL;
+}
+
+void wait_queue_push(wait_queue_t *wq, thread_t *thr)
+{
+    thr->wq = wq;
+    thr->wq_next = NULL;
+
+    if (wq->tail)
+        wq->tail->wq_next = thr;
+    else
+        wq->head = thr;
+    wq->tail = thr;
+}
+
+bool wait_queue_remove(wait_queue_t *wq, thread_t *thr)
+{
+    thread_t *prev = NULL;
+    thread_t *it = wq->head;
+
+    while (it && it != thr)
+    {
+        prev = it;
+        it = it->wq_next;
+    }
+
+    if (!it)
+        return false;
+
+    if (prev)
+        prev->wq_next = thr->wq_next;
+    else
+        wq->head = thr->wq_next;
+
+    if (wq->tail == thr)
+        wq->tail = prev;
+
+    thr->wq = NULL;
+    thr->wq_next = NULL;
+    return true;
+}
+
+thread_t *wait_queue_pop(wait_queue_t *wq)
+{
+    thread_t *thr = wq->head;
+    if (!thr)
+        return NULL;
+
+    wq->head = thr->wq_next;
+    if (!wq->head)
+        wq->tail = NULL;
+
+    thr->wq = NULL;
+    thr->wq_next = NULL;
+    return thr;
+}
+
+bool wait_queue_sleep(wait_queue_t *wq, uint64_t deadline_ns)
+{
+    thread_t *cur = get_current_thread();
+
+    wait_queue_push(wq, cur);
+    thread_block_current_until(deadline_ns);
+
+    /* Разбудил таймер, а не wake - поток всё ещё в очереди (или уже в другой после requeue) */
+    if (cur->wq)
+    {
+        wait_queue_remove(cur->wq, cur);
+        return false;
+    }
+    return true;
+}
+
+int wait_queue_wake_one(wait_queue_t *wq)
+{
+    thread_t *thr = wait_queue_pop(wq);
+    if (!thr)
+        return 0;
+
+    thread_wake(thr);
+    return 1;
+}
+
+int wait_queue_wake_all(wait_queue_t *wq)
+{
+    int woken = 0;
+    thread_t *thr;
+
+    while ((thr = wait_queue_pop(wq)) != NULL)
+    {
+        thread_wake(thr);
+        woken++;
+    }
+    return woken;
+}
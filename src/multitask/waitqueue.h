@@ -0,0 +1,34 @@
+#ifndef WAITQUEUE_H
+#define WAITQUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "multitask.h"
+
+/* FIFO ждущих потоков. Все функции вызываются с выключенными прерываниями */
+struct wait_queue
+{
+    thread_t *head;
+    thread_t *tail;
+};
+
+#define WAIT_QUEUE_INIT { NULL, NULL }
+
+void wait_queue_init(wait_queue_t *wq);
+void wait_queue_push(wait_queue_t *wq, thread_t *thr);
+bool wait_queue_remove(wait_queue_t *wq, thread_t *thr);
+thread_t *wait_queue_pop(wait_queue_t *wq);
+
+/* Блокирует текущий поток до пробуждения или дедлайна (0 - без таймаута).
+   Возвращает false, если поток проснулся по таймауту */
+bool wait_queue_sleep(wait_queue_t *wq, uint64_t deadline_ns);
+
+int wait_queue_wake_one(wait_queue_t *wq);
+int wait_queue_wake_all(wait_queue_t *wq);
+
+static inline bool wait_queue_empty(const wait_queue_t *wq)
+{
+    return wq->head == NULL;
+}
+
+#endif // WAITQUEUE_H
@@ -5,6 +5,7 @@
 #define ICW1_INIT 0x10
 #define ICW1_ICW4 0x01
 #define ICW4_8086 0x01
+#define OCW3_READ_ISR 0x0B
 
 void pic_remap(int offset1, int offset2)
 {
@@ -26,4 +27,30 @@ void pic_send_eoi(uint8_t irq)
     if (irq >= 8)
         outb(PIC2_COMMAND, 0x20);
     outb(PIC1_COMMAND, 0x20);
+}
+
+void pic_unmask(uint8_t irq)
+{
+    if (irq >= 8)
+    {
+        outb(PIC2_DATA, inb(PIC2_DATA) & ~(1u << (irq - 8)));
+        irq = 2;
+    }
+    outb(PIC1_DATA, inb(PIC1_DATA) & ~(1u << irq));
+}
+
+bool pic_is_spurious(uint8_t irq)
+{
+    if (irq != 7 && irq != 15)
+        return false;
+
+    uint16_t port = irq == 7 ? PIC1_COMMAND : PIC2_COMMAND;
+    outb(port, OCW3_READ_ISR);
+    if (inb(port) & 0x80)
+        return false;
+
+    /* Ведущий не знает, что IRQ 15 ложный: каскадную линию он обслужил */
+    if (irq == 15)
+        outb(PIC1_COMMAND, 0x20);
+    return true;
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #define PIC_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #define PIC1_COMMAND 0x20
 #define PIC1_DATA 0x21
@@ -12,4 +13,10 @@
 void pic_remap(int offset1, int offset2);
 void pic_send_eoi(uint8_t irq);
 
+/* Снимает маску линии; для линий ведомого контроллера открывает и каскад (IRQ 2) */
+void pic_unmask(uint8_t irq);
+
+/* Ложные IRQ 7/15: в ISR контроллера бит не стоит. Для 15 сам шлёт EOI ведущему */
+bool pic_is_spurious(uint8_t irq);
+
 #endif
\ No newline at end of file
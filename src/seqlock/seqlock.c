@@ -3,6 +3,8 @@
 void seqlock_write_begin(seqlock_t *s)
 {
     atomic_fetch_add_explicit(&s->seq, 1u, memory_order_relaxed);
+    /* Нечётный seq должен стать виден раньше изменённых данных */
+    atomic_thread_fence(memory_order_release);
 }
 
 void seqlock_write_end(seqlock_t *s)
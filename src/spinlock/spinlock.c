@@ -1,9 +1,43 @@
 #include "spinlock.h"
+#include "../cpu/cpu.h"
+#include "../libc/string.h"
 
 static atomic_flag g_fb_lock = ATOMIC_FLAG_INIT;
 
+#ifdef CONFIG_LOCK_STATS
+
+/* Вызываются держателем блокировки: сразу после захвата и перед освобождением */
+static inline void stats_acquired(lock_stats_t *s, uint64_t spins)
+{
+    s->acquisitions++;
+    if (spins)
+    {
+        s->contended++;
+        s->spins += spins;
+    }
+    s->hold_start = rdtsc();
+}
+
+static inline void stats_release(lock_stats_t *s)
+{
+    uint64_t held = rdtsc() - s->hold_start;
+    if (held > s->max_hold)
+        s->max_hold = held;
+}
+
+#define SPIN_COUNT(n) ((n)++)
+
+#else
+
+#define stats_acquired(s, spins) ((void)(spins))
+#define stats_release(s)         ((void)0)
+#define SPIN_COUNT(n)            ((void)0)
+
+#endif
+
 void fb_lock_acquire(void)
 {
+    preempt_disable();
     while (atomic_flag_test_and_set_explicit(&g_fb_lock, memory_order_acquire))
     {
         asm volatile("pause" ::: "memory");
@@ -13,37 +47,340 @@ void fb_lock_acquire(void)
 void fb_lock_release(void)
 {
     atomic_flag_clear_explicit(&g_fb_lock, memory_order_release);
+    preempt_enable();
 }
 
+/* --- Test-and-test-and-set --- */
+
 void spin_lock(spinlock_t *l)
 {
+    uint64_t spins = 0;
+    preempt_disable();
     while (atomic_exchange_explicit(&l->flag, true, memory_order_acquire))
     {
         while (atomic_load_explicit(&l->flag, memory_order_relaxed))
         {
             asm volatile("pause" ::: "memory");
+            SPIN_COUNT(spins);
         }
     }
+    stats_acquired(LOCK_STATS(l), spins);
 }
 
 void spin_unlock(spinlock_t *l)
 {
+    stats_release(LOCK_STATS(l));
     atomic_store_explicit(&l->flag, false, memory_order_release);
+    preempt_enable();
 }
 
 int spin_trylock(spinlock_t *l)
 {
+    preempt_disable();
     bool expected = false;
-    return atomic_compare_exchange_strong_explicit(
-               &l->flag, &expected, true,
-               memory_order_acquire,
-               memory_order_relaxed
-               )
-               ? 1
-               : 0;
+    if (atomic_compare_exchange_strong_explicit(
+            &l->flag, &expected, true,
+            memory_order_acquire,
+            memory_order_relaxed))
+    {
+        stats_acquired(LOCK_STATS(l), 0);
+        return 1;
+    }
+
+    preempt_enable();
+    return 0;
+}
+
+uint64_t spin_lock_irqsave(spinlock_t *l)
+{
+    uint64_t flags = save_irq_disable();
+    spin_lock(l);
+    return flags;
+}
+
+void spin_unlock_irqrestore(spinlock_t *l, uint64_t flags)
+{
+    stats_release(LOCK_STATS(l));
+    atomic_store_explicit(&l->flag, false, memory_order_release);
+    restore_irq(flags);
+    preempt_enable();
 }
 
 int spin_is_locked(spinlock_t *l)
 {
     return atomic_load_explicit(&l->flag, memory_order_relaxed) ? 1 : 0;
-}
\ No newline at end of file
+}
+
+/* --- Билетная блокировка --- */
+
+void ticket_lock(ticketlock_t *l)
+{
+    uint64_t spins = 0;
+    preempt_disable();
+    unsigned int ticket = atomic_fetch_add_explicit(&l->next, 1, memory_order_relaxed);
+    while (atomic_load_explicit(&l->owner, memory_order_acquire) != ticket)
+    {
+        asm volatile("pause" ::: "memory");
+        SPIN_COUNT(spins);
+    }
+    stats_acquired(LOCK_STATS(l), spins);
+}
+
+/* owner меняет только владелец, поэтому хватает обычной записи */
+static inline void ticket_release(ticketlock_t *l)
+{
+    stats_release(LOCK_STATS(l));
+    unsigned int owner = atomic_load_explicit(&l->owner, memory_order_relaxed);
+    atomic_store_explicit(&l->owner, owner + 1, memory_order_release);
+}
+
+void ticket_unlock(ticketlock_t *l)
+{
+    ticket_release(l);
+    preempt_enable();
+}
+
+int ticket_trylock(ticketlock_t *l)
+{
+    preempt_disable();
+    /* Свободна, если выданный билет никто не ждёт: next == owner */
+    unsigned int owner = atomic_load_explicit(&l->owner, memory_order_relaxed);
+    unsigned int expected = owner;
+    if (atomic_compare_exchange_strong_explicit(
+            &l->next, &expected, owner + 1,
+            memory_order_acquire,
+            memory_order_relaxed))
+    {
+        stats_acquired(LOCK_STATS(l), 0);
+        return 1;
+    }
+
+    preempt_enable();
+    return 0;
+}
+
+int ticket_is_locked(ticketlock_t *l)
+{
+    return atomic_load_explicit(&l->next, memory_order_relaxed) !=
+           atomic_load_explicit(&l->owner, memory_order_relaxed);
+}
+
+uint64_t ticket_lock_irqsave(ticketlock_t *l)
+{
+    uint64_t flags = save_irq_disable();
+    ticket_lock(l);
+    return flags;
+}
+
+void ticket_unlock_irqrestore(ticketlock_t *l, uint64_t flags)
+{
+    ticket_release(l);
+    restore_irq(flags);
+    preempt_enable();
+}
+
+/* --- MCS --- */
+
+void mcs_lock(mcs_lock_t *l, mcs_node_t *node)
+{
+    uint64_t spins = 0;
+    preempt_disable();
+
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&node->locked, true, memory_order_relaxed);
+
+    mcs_node_t *prev = atomic_exchange_explicit(&l->tail, node, memory_order_acq_rel);
+    if (prev)
+    {
+        /* Встаём в очередь и ждём, пока предшественник снимет наш флаг */
+        atomic_store_explicit(&prev->next, node, memory_order_release);
+        while (atomic_load_explicit(&node->locked, memory_order_acquire))
+        {
+            asm volatile("pause" ::: "memory");
+            SPIN_COUNT(spins);
+        }
+    }
+    stats_acquired(LOCK_STATS(l), spins);
+}
+
+static inline void mcs_release(mcs_lock_t *l, mcs_node_t *node)
+{
+    stats_release(LOCK_STATS(l));
+
+    mcs_node_t *next = atomic_load_explicit(&node->next, memory_order_acquire);
+    if (!next)
+    {
+        mcs_node_t *expected = node;
+        if (atomic_compare_exchange_strong_explicit(
+                &l->tail, &expected, NULL,
+                memory_order_release,
+                memory_order_relaxed))
+            return;
+
+        /* Преемник уже сделал exchange, но ещё не записал себя в next */
+        while (!(next = atomic_load_explicit(&node->next, memory_order_acquire)))
+            asm volatile("pause" ::: "memory");
+    }
+    atomic_store_explicit(&next->locked, false, memory_order_release);
+}
+
+void mcs_unlock(mcs_lock_t *l, mcs_node_t *node)
+{
+    mcs_release(l, node);
+    preempt_enable();
+}
+
+int mcs_trylock(mcs_lock_t *l, mcs_node_t *node)
+{
+    preempt_disable();
+
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&node->locked, true, memory_order_relaxed);
+
+    mcs_node_t *expected = NULL;
+    if (atomic_compare_exchange_strong_explicit(
+            &l->tail, &expected, node,
+            memory_order_acquire,
+            memory_order_relaxed))
+    {
+        stats_acquired(LOCK_STATS(l), 0);
+        return 1;
+    }
+
+    preempt_enable();
+    return 0;
+}
+
+int mcs_is_locked(mcs_lock_t *l)
+{
+    return atomic_load_explicit(&l->tail, memory_order_relaxed) ? 1 : 0;
+}
+
+uint64_t mcs_lock_irqsave(mcs_lock_t *l, mcs_node_t *node)
+{
+    uint64_t flags = save_irq_disable();
+    mcs_lock(l, node);
+    return flags;
+}
+
+void mcs_unlock_irqrestore(mcs_lock_t *l, mcs_node_t *node, uint64_t flags)
+{
+    mcs_release(l, node);
+    restore_irq(flags);
+    preempt_enable();
+}
+
+/* --- Читатели-писатели --- */
+
+void read_lock(rwlock_t *l)
+{
+    preempt_disable();
+    for (;;)
+    {
+        unsigned int s = atomic_load_explicit(&l->state, memory_order_relaxed);
+        if (!(s & (RWLOCK_WRITER | RWLOCK_WAITING)) &&
+            atomic_compare_exchange_weak_explicit(
+                &l->state, &s, s + 1,
+                memory_order_acquire,
+                memory_order_relaxed))
+            return;
+        asm volatile("pause" ::: "memory");
+    }
+}
+
+void read_unlock(rwlock_t *l)
+{
+    atomic_fetch_sub_explicit(&l->state, 1, memory_order_release);
+    preempt_enable();
+}
+
+int read_trylock(rwlock_t *l)
+{
+    preempt_disable();
+    unsigned int s = atomic_load_explicit(&l->state, memory_order_relaxed);
+    if (!(s & (RWLOCK_WRITER | RWLOCK_WAITING)) &&
+        atomic_compare_exchange_strong_explicit(
+            &l->state, &s, s + 1,
+            memory_order_acquire,
+            memory_order_relaxed))
+        return 1;
+
+    preempt_enable();
+    return 0;
+}
+
+void write_lock(rwlock_t *l)
+{
+    preempt_disable();
+    for (;;)
+    {
+        unsigned int s = atomic_load_explicit(&l->state, memory_order_relaxed);
+        if (!(s & (RWLOCK_WRITER | RWLOCK_READERS)))
+        {
+            /* Захват снимает WAITING: другие писатели выставят его заново */
+            if (atomic_compare_exchange_weak_explicit(
+                    &l->state, &s, RWLOCK_WRITER,
+                    memory_order_acquire,
+                    memory_order_relaxed))
+                return;
+        }
+        else if (!(s & RWLOCK_WAITING))
+        {
+            atomic_fetch_or_explicit(&l->state, RWLOCK_WAITING, memory_order_relaxed);
+        }
+        asm volatile("pause" ::: "memory");
+    }
+}
+
+void write_unlock(rwlock_t *l)
+{
+    atomic_fetch_and_explicit(&l->state, ~RWLOCK_WRITER, memory_order_release);
+    preempt_enable();
+}
+
+int write_trylock(rwlock_t *l)
+{
+    preempt_disable();
+    unsigned int expected = 0;
+    if (atomic_compare_exchange_strong_explicit(
+            &l->state, &expected, RWLOCK_WRITER,
+            memory_order_acquire,
+            memory_order_relaxed))
+        return 1;
+
+    preempt_enable();
+    return 0;
+}
+
+uint64_t write_lock_irqsave(rwlock_t *l)
+{
+    uint64_t flags = save_irq_disable();
+    write_lock(l);
+    return flags;
+}
+
+void write_unlock_irqrestore(rwlock_t *l, uint64_t flags)
+{
+    atomic_fetch_and_explicit(&l->state, ~RWLOCK_WRITER, memory_order_release);
+    restore_irq(flags);
+    preempt_enable();
+}
+
+int lock_stats_read(lock_stats_t *stats, lock_stats_t *out, bool reset)
+{
+#ifdef CONFIG_LOCK_STATS
+    if (!stats || !out)
+        return -1;
+
+    /* Снимок не атомарен относительно держателя: счётчики только растут, этого хватает */
+    *out = *stats;
+    if (reset)
+        memset(stats, 0, sizeof(*stats));
+    return 0;
+#else
+    (void)stats;
+    (void)out;
+    (void)reset;
+    return -1;
+#endif
+}
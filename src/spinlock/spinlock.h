@@ -3,23 +3,123 @@
 
 #include <stdatomic.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
+#include "../multitask/preempt.h"
 
+/*
+ * Счётчики конкуренции, только с -DCONFIG_LOCK_STATS (make lockstat).
+ * Меняются держателем блокировки, поэтому атомарность не нужна
+ */
+typedef struct lock_stats
+{
+    uint64_t acquisitions;
+    uint64_t contended;   /* захваты, которым пришлось ждать */
+    uint64_t spins;       /* итерации ожидания (pause) */
+    uint64_t max_hold;    /* максимум удержания, такты TSC */
+    uint64_t hold_start;
+} lock_stats_t;
+
+#ifdef CONFIG_LOCK_STATS
+#define LOCK_STATS_FIELD lock_stats_t stats;
+#define LOCK_STATS(l)    (&(l)->stats)
+#else
+#define LOCK_STATS_FIELD
+#define LOCK_STATS(l)    ((lock_stats_t *)0)
+#endif
+
+/* Test-and-test-and-set: самый дешёвый захват, но без очерёдности */
 typedef struct
 {
     volatile atomic_bool flag;
+    LOCK_STATS_FIELD
 } spinlock_t;
 
 #define SPINLOCK_INIT { false }
 
+/* Билетная блокировка: захват строго в порядке прихода (FIFO) */
+typedef struct
+{
+    atomic_uint next;     /* следующий выдаваемый билет */
+    atomic_uint owner;    /* билет текущего владельца */
+    LOCK_STATS_FIELD
+} ticketlock_t;
+
+#define TICKETLOCK_INIT { 0 }
+
+/*
+ * MCS: FIFO, как билетная, но каждый ждущий крутится на своём узле, а не на
+ * общей строке кэша. Узел живёт у вызывающего (обычно на стеке) до unlock
+ */
+typedef struct mcs_node
+{
+    struct mcs_node *_Atomic next;
+    atomic_bool locked;
+} mcs_node_t;
+
+typedef struct
+{
+    mcs_node_t *_Atomic tail;
+    LOCK_STATS_FIELD
+} mcs_lock_t;
+
+#define MCS_LOCK_INIT { NULL }
+
+/*
+ * Читатели-писатели: читатели входят параллельно, писатель - один.
+ * Ждущий писатель ставит RWLOCK_WAITING и новых читателей уже не пускают
+ */
+#define RWLOCK_WRITER    (1u << 31)
+#define RWLOCK_WAITING   (1u << 30)
+#define RWLOCK_READERS   (RWLOCK_WAITING - 1)
+
+typedef struct
+{
+    atomic_uint state;    /* RWLOCK_WRITER | RWLOCK_WAITING | число читателей */
+} rwlock_t;
+
+#define RWLOCK_INIT { 0 }
+
 void fb_lock_acquire(void);
 void fb_lock_release(void);
 
+/* Захват запрещает вытеснение, освобождение - точка вытеснения */
 void spin_lock(spinlock_t *l);
 void spin_unlock(spinlock_t *l);
 int spin_trylock(spinlock_t *l);
 int spin_is_locked(spinlock_t *l);
 
+/* Вместо пары save_irq_disable + spin_lock: вытеснение проверяется уже с IF = 1 */
+uint64_t spin_lock_irqsave(spinlock_t *l);
+void spin_unlock_irqrestore(spinlock_t *l, uint64_t flags);
+
+/* Тот же набор для билетной и MCS-блокировок */
+void ticket_lock(ticketlock_t *l);
+void ticket_unlock(ticketlock_t *l);
+int ticket_trylock(ticketlock_t *l);
+int ticket_is_locked(ticketlock_t *l);
+uint64_t ticket_lock_irqsave(ticketlock_t *l);
+void ticket_unlock_irqrestore(ticketlock_t *l, uint64_t flags);
+
+void mcs_lock(mcs_lock_t *l, mcs_node_t *node);
+void mcs_unlock(mcs_lock_t *l, mcs_node_t *node);
+int mcs_trylock(mcs_lock_t *l, mcs_node_t *node);
+int mcs_is_locked(mcs_lock_t *l);
+uint64_t mcs_lock_irqsave(mcs_lock_t *l, mcs_node_t *node);
+void mcs_unlock_irqrestore(mcs_lock_t *l, mcs_node_t *node, uint64_t flags);
+
+void read_lock(rwlock_t *l);
+void read_unlock(rwlock_t *l);
+int read_trylock(rwlock_t *l);
+void write_lock(rwlock_t *l);
+void write_unlock(rwlock_t *l);
+int write_trylock(rwlock_t *l);
+uint64_t write_lock_irqsave(rwlock_t *l);
+void write_unlock_irqrestore(rwlock_t *l, uint64_t flags);
+
+/* Копия счётчиков блокировки (LOCK_STATS(l)); без CONFIG_LOCK_STATS возвращает -1 */
+int lock_stats_read(lock_stats_t *stats, lock_stats_t *out, bool reset);
+
 static inline uint64_t save_irq_disable() {
     uint64_t flags;
     asm volatile(
@@ -27,10 +127,22 @@ static inline uint64_t save_irq_disable() {
         "pop %0\n\t"
         "cli" : "=r"(flags) : : "memory"
     );
+#ifdef CONFIG_LATENCY_AUDIT
+    if (flags & (1UL << 9))
+    {
+        uintptr_t site;
+        asm volatile("lea (%%rip), %0" : "=r"(site));
+        latency_irqs_off(site);
+    }
+#endif
     return flags;
 }
 
 static inline void restore_irq(uint64_t flags) {
+#ifdef CONFIG_LATENCY_AUDIT
+    if (flags & (1UL << 9))
+        latency_irqs_on();
+#endif
     asm volatile(
         "push %0\n\t"
         "popfq"
@@ -2,6 +2,7 @@
 #include "../graphics/graphics.h"
 #include "../keyboard/keyboard.h"
 #include "../time/clock/clock.h"
+#include "../time/timekeeping.h"
 #include "../malloc/malloc.h"
 #include "../power/poweroff.h"
 #include "../power/reboot.h"
@@ -15,26 +16,29 @@
 #include "../multitask/ipc.h"
 #include "../fs/vfs.h"
 #include "../multitask/eventbuf.h"
+#include "../multitask/futex.h"
+#include "../cpu/cpu.h"
+#include "../idt.h"
+#include "../multitask/preempt.h"
 
-extern uint32_t seconds;
 
-uintptr_t syscall_handler(const struct syscall_regs *regs)
+static uintptr_t syscall_dispatch(const struct syscall_regs *regs)
 {
     switch ((uint32_t)regs->rax)
     {        
+        case SYSCALL_NOP:
+            return 0;
+
         // --- Time ---
         case SYSCALL_GET_TIME:
             if (regs->rdi && regs->rsi >= sizeof(ClockTime))
             {
-                ClockTime* time_buf = (ClockTime*)(uintptr_t)regs->rdi;
-                time_buf->hh = system_clock.hh;
-                time_buf->mm = system_clock.mm;
-                time_buf->ss = system_clock.ss;
+                ktime_get_wall((ClockTime*)(uintptr_t)regs->rdi);
             }
             return 0;
 
         case SYSCALL_GET_TIME_UP:
-            return (uintptr_t)seconds;
+            return (uintptr_t)ktime_get_uptime_sec();
 
         // --- Memory ---
         case SYSCALL_MALLOC:
@@ -95,6 +99,24 @@ uintptr_t syscall_handler(const struct syscall_regs *regs)
         case SYSCALL_THREAD_IS_ALIVE:
             return (uintptr_t)thread_is_alive((int)regs->rdi);
 
+        case SYSCALL_THREAD_STATS:
+            return (uintptr_t)sched_get_thread_stats((thread_stat_t *)(uintptr_t)regs->rdi, (size_t)regs->rsi);
+
+        case SYSCALL_SCHED_TRACE:
+            return (uintptr_t)sched_trace_read((sched_event_t *)(uintptr_t)regs->rdi, (size_t)regs->rsi, (uint64_t)regs->rdx);
+
+        case SYSCALL_SCHED_SETAFFINITY:
+            return (uintptr_t)(long)sched_setaffinity((int)regs->rdi, (cpumask_t)regs->rsi);
+
+        case SYSCALL_SCHED_GETAFFINITY:
+            return (uintptr_t)(long)sched_getaffinity((int)regs->rdi, (cpumask_t *)(uintptr_t)regs->rsi);
+
+        case SYSCALL_ARCH_PRCTL:
+            return (uintptr_t)tls_arch_prctl((int)regs->rdi, (uint64_t)regs->rsi);
+
+        case SYSCALL_THREAD_JOIN:
+            return (uintptr_t)(long)thread_join((int)regs->rdi, (int*)(uintptr_t)regs->rsi);
+
         case SYSCALL_THREAD_GET_ERRNO_LOC:
         {
             thread_t *current = get_current_thread();
@@ -115,6 +137,16 @@ uintptr_t syscall_handler(const struct syscall_regs *regs)
             return (uintptr_t)-1;
         }
 
+        case SYSCALL_FUTEX:
+            return (uintptr_t)sys_futex(
+                (uint32_t*)(uintptr_t)regs->rdi,
+                (int)regs->rsi,
+                (uint32_t)regs->rdx,
+                (uint64_t)regs->r10,
+                (uint32_t*)(uintptr_t)regs->r8,
+                (uint32_t)regs->r9
+            );
+
         // --- Process Management ---
         case SYSCALL_PROCESS_CREATE:
             return (uintptr_t)process_create((uint64_t)regs->rdi);
@@ -126,6 +158,12 @@ uintptr_t syscall_handler(const struct syscall_regs *regs)
         case SYSCALL_PROCESS_IS_ALIVE:
             return (uintptr_t)process_is_alive((int)regs->rdi);
 
+        case SYSCALL_LATENCY_STATS:
+            return (uintptr_t)(long)latency_get_stats((latency_stats_t *)(uintptr_t)regs->rdi, regs->rsi != 0);
+
+        case SYSCALL_PROCESS_WAIT:
+            return (uintptr_t)(long)process_wait((int)regs->rdi, (int*)(uintptr_t)regs->rsi);
+
         case SYSCALL_PROCESS_STOP:
             return (uintptr_t)process_stop((int)regs->rdi);
 
@@ -251,6 +289,12 @@ uintptr_t syscall_handler(const struct syscall_regs *regs)
         case SYSCALL_VFS_FILE_SIZE:
             return (uintptr_t)vfs_get_file_size((const char*)(uintptr_t)regs->rdi);
 
+        case SYSCALL_VFS_SYNC:
+            return (uintptr_t)vfs_sync();
+
+        case SYSCALL_VFS_FSYNC:
+            return (uintptr_t)vfs_fsync((int)regs->rdi);
+
         // IPC
 
         case SYSCALL_IPC_SEND:
@@ -270,4 +314,69 @@ uintptr_t syscall_handler(const struct syscall_regs *regs)
         default:
             return (uintptr_t)-1;
     }
-}
\ No newline at end of file
+}
+
+/* Диск и VFS: долгие вызовы, которые не пересекаются с ISR */
+static inline bool syscall_is_long(uint32_t num)
+{
+    return (num >= SYSCALL_DISK_READ_SECTORS && num <= SYSCALL_DISK_GET_SIZE)
+        || (num >= SYSCALL_VFS_REGISTER && num <= SYSCALL_VFS_FSYNC);
+}
+
+/*
+ * Вход с IF = 0 (int 0x80 и SFMASK). Короткие вызовы так и выполняются целиком,
+ * долгие - с включёнными прерываниями, но без вытеснения: IRQ обслуживаются
+ * вовремя, а код ФС, рассчитанный на монопольный доступ, не прерывается другим
+ * потоком. Переключение, накопленное за вызов, происходит в preempt_enable()
+ */
+uintptr_t syscall_handler(const struct syscall_regs *regs)
+{
+    uint32_t num = (uint32_t)regs->rax;
+
+    if (!syscall_is_long(num))
+    {
+#ifdef CONFIG_LATENCY_AUDIT
+        uint64_t start = rdtsc();
+        uintptr_t ret = syscall_dispatch(regs);
+        latency_syscall(num, start);
+        return ret;
+#else
+        return syscall_dispatch(regs);
+#endif
+    }
+
+    preempt_disable();
+    asm volatile("sti" ::: "memory");
+
+    uintptr_t ret = syscall_dispatch(regs);
+
+    preempt_enable();
+    asm volatile("cli" ::: "memory");
+    return ret;
+}
+
+/* Селекторы для SYSRET: SS = база + 8, CS = база + 16 (см. gdt.c) */
+#define SYSRET_SEL_BASE 0x10
+
+/* Область под swapgs: syscall_entry сохраняет сюда rsp пользователя,
+   пока не переключится на стек ядра (прерывания в этот момент выключены) */
+struct syscall_cpu
+{
+    uint64_t user_rsp;
+};
+
+static struct syscall_cpu g_syscall_cpu;
+
+extern void syscall_entry(void);
+
+void syscall_init(void)
+{
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+    wrmsr(MSR_STAR, ((uint64_t)SYSRET_SEL_BASE << 48) | ((uint64_t)KERNEL_CODE_SEL << 32));
+    wrmsr(MSR_LSTAR, (uint64_t)syscall_entry);
+
+    /* Как и у шлюза int 0x80: обработчик выполняется с IF = 0 */
+    wrmsr(MSR_SFMASK, RFLAGS_IF | RFLAGS_TF | RFLAGS_DF | RFLAGS_AC);
+
+    wrmsr(MSR_KERNEL_GS_BASE, (uint64_t)&g_syscall_cpu);
+}
@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#define SYSCALL_NOP 1
+
 #define SYSCALL_GET_TIME 5
 #define SYSCALL_GET_TIME_UP 7
 
@@ -23,6 +25,7 @@
 #define SYSCALL_PROCESS_EXIT 203
 #define SYSCALL_PROCESS_IS_ALIVE 204
 #define SYSCALL_GETPID 205
+#define SYSCALL_PROCESS_WAIT 206
 
 #define SYSCALL_THREAD_CREATE 250
 #define SYSCALL_THREAD_LIST 251
@@ -32,8 +35,16 @@
 #define SYSCALL_THREAD_IS_ALIVE 255
 #define SYSCALL_THREAD_GET_ERRNO_LOC 256
 #define SYSCALL_GETTID 257
+#define SYSCALL_FUTEX 258
+#define SYSCALL_THREAD_JOIN 259
+#define SYSCALL_THREAD_STATS 260
+#define SYSCALL_SCHED_TRACE 261
+#define SYSCALL_SCHED_SETAFFINITY 262
+#define SYSCALL_SCHED_GETAFFINITY 263
+#define SYSCALL_ARCH_PRCTL 264
 
 #define THROW_AN_EXCEPTION 300
+#define SYSCALL_LATENCY_STATS 301
 
 #define SYSCALL_GFX_DRAW_POINT 400
 #define SYSCALL_GFX_DRAW_LINE 401
@@ -86,6 +97,8 @@
 #define SYSCALL_VFS_FIND        829
 #define SYSCALL_VFS_SEEK        830
 #define SYSCALL_VFS_FILE_SIZE   831
+#define SYSCALL_VFS_SYNC        832
+#define SYSCALL_VFS_FSYNC       833
 
 #define SYSCALL_GET_EVENTS 900
 
@@ -105,4 +118,7 @@ struct syscall_regs
 
 uintptr_t syscall_handler(const struct syscall_regs *regs);
 
+/* Быстрый вход через SYSCALL/SYSRET (int 0x80 остаётся для старых программ) */
+void syscall_init(void);
+
 #endif // SYSCALL_H
\ No newline at end of file
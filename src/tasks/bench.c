@@ -0,0 +1,328 @@
+#include "bench.h"
+
+#ifdef CONFIG_BENCH
+
+#include "../multitask/multitask.h"
+#include "../graphics/formatting.h"
+#include "../time/timer.h"
+#include "../time/tsc/tsc.h"
+#include "../spinlock/spinlock.h"
+#include "../cpu/cpu.h"
+#include "../fs/fs.h"
+#include "../fs/vfs.h"
+#include "../fs/ext4/include/ext4.h"
+#include "../malloc/malloc.h"
+
+/* --- Создание/завершение потоков --- */
+
+#define BENCH_THREADS      100000
+#define BENCH_THREAD_BATCH 64
+
+static void bench_empty_thread(void *_arg)
+{
+    thread_exit((int)(uintptr_t)_arg);
+}
+
+static void bench_thread_churn(void)
+{
+    thread_pool_stats_t before, after;
+    thread_get_pool_stats(&before);
+
+    uint32_t created = 0;
+    uint64_t start = timer_now_ns();
+
+    while (created < BENCH_THREADS)
+    {
+        uint32_t batch = BENCH_THREADS - created;
+        if (batch > BENCH_THREAD_BATCH)
+            batch = BENCH_THREAD_BATCH;
+
+        int tids[BENCH_THREAD_BATCH];
+        for (uint32_t i = 0; i < batch; i++)
+        {
+            thread_t *thr = thread_create(get_current_process(), bench_empty_thread,
+                                          (void *)(uintptr_t)i, false, THREAD_FLAG_JOINABLE);
+            if (!thr)
+            {
+                kprint(KPRINT_ERROR, "bench: thread_create failed after %u threads\n", created + i);
+                return;
+            }
+            tids[i] = thr->tid;
+        }
+
+        /* Ждём всю пачку и сверяем коды завершения */
+        for (uint32_t i = 0; i < batch; i++)
+        {
+            int status = -1;
+            if (thread_join(tids[i], &status) != 0 || status != (int)i)
+            {
+                kprint(KPRINT_ERROR, "bench: thread_join failed for tid %d\n", tids[i]);
+                return;
+            }
+        }
+
+        created += batch;
+    }
+
+    uint64_t elapsed_ns = timer_now_ns() - start;
+    thread_get_pool_stats(&after);
+
+    uint64_t per_sec = elapsed_ns ? (uint64_t)BENCH_THREADS * NS_PER_SEC / elapsed_ns : 0;
+    kprint(KPRINT_LOG, "bench: %u threads spawned+joined in %lu us, %lu threads/s\n",
+           BENCH_THREADS, elapsed_ns / 1000, per_sec);
+    kprint(KPRINT_LOG, "bench: kstack pool hits %lu misses %lu, thread_t pool hits %lu misses %lu\n",
+           after.kstack_hits - before.kstack_hits, after.kstack_misses - before.kstack_misses,
+           after.thread_hits - before.thread_hits, after.thread_misses - before.thread_misses);
+}
+
+/* --- Блокировки под нагрузкой --- */
+
+#define LOCK_BENCH_THREADS 4
+#define LOCK_BENCH_ITERS   200000
+
+typedef enum
+{
+    LOCK_KIND_SPIN,
+    LOCK_KIND_TICKET,
+    LOCK_KIND_MCS
+} lock_kind_t;
+
+static spinlock_t bench_spin = SPINLOCK_INIT;
+static ticketlock_t bench_ticket = TICKETLOCK_INIT;
+static mcs_lock_t bench_mcs = MCS_LOCK_INIT;
+
+static lock_kind_t bench_lock_kind;
+static volatile uint64_t bench_lock_counter;
+
+static void lock_stress_worker(void *_arg)
+{
+    (void)_arg;
+
+    for (uint32_t i = 0; i < LOCK_BENCH_ITERS; i++)
+    {
+        switch (bench_lock_kind)
+        {
+            case LOCK_KIND_SPIN:
+                spin_lock(&bench_spin);
+                bench_lock_counter++;
+                spin_unlock(&bench_spin);
+                break;
+
+            case LOCK_KIND_TICKET:
+                ticket_lock(&bench_ticket);
+                bench_lock_counter++;
+                ticket_unlock(&bench_ticket);
+                break;
+
+            case LOCK_KIND_MCS:
+            {
+                mcs_node_t node;
+                mcs_lock(&bench_mcs, &node);
+                bench_lock_counter++;
+                mcs_unlock(&bench_mcs, &node);
+                break;
+            }
+        }
+    }
+
+    thread_exit(0);
+}
+
+static void bench_lock_stress(lock_kind_t kind, const char *name, lock_stats_t *stats, uint32_t threads)
+{
+    int tids[LOCK_BENCH_THREADS];
+    lock_stats_t unused;
+    lock_stats_read(stats, &unused, true);
+
+    bench_lock_kind = kind;
+    bench_lock_counter = 0;
+
+    uint64_t start_ns = timer_now_ns();
+    uint64_t start_tsc = rdtsc();
+
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        thread_t *thr = thread_create(get_current_process(), lock_stress_worker,
+                                      NULL, false, THREAD_FLAG_JOINABLE);
+        if (!thr)
+        {
+            kprint(KPRINT_ERROR, "bench: thread_create failed\n");
+            threads = i;
+            break;
+        }
+        tids[i] = thr->tid;
+    }
+
+    for (uint32_t i = 0; i < threads; i++)
+        thread_join(tids[i], NULL);
+
+    uint64_t cycles = rdtsc() - start_tsc;
+    uint64_t elapsed_ns = timer_now_ns() - start_ns;
+    uint64_t ops = (uint64_t)threads * LOCK_BENCH_ITERS;
+
+    if (bench_lock_counter != ops)
+        kprint(KPRINT_ERROR, "bench: %s lock lost updates: %lu of %lu\n", name, bench_lock_counter, ops);
+
+    kprint(KPRINT_LOG, "bench: %s lock, %u threads: %lu ops in %lu us, %lu cycles/op\n",
+           name, threads, ops, elapsed_ns / 1000, ops ? cycles / ops : 0);
+
+    lock_stats_t s;
+    if (lock_stats_read(stats, &s, true) == 0)
+        kprint(KPRINT_LOG, "bench: %s lock: acquisitions %lu contended %lu spins %lu max hold %lu cycles\n",
+               name, s.acquisitions, s.contended, s.spins, s.max_hold);
+}
+
+static void bench_locks(void)
+{
+    /* Один поток - чистая цена захвата, несколько - очередь и переключения */
+    uint32_t counts[] = { 1, LOCK_BENCH_THREADS };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+    {
+        bench_lock_stress(LOCK_KIND_SPIN, "spin", LOCK_STATS(&bench_spin), counts[i]);
+        bench_lock_stress(LOCK_KIND_TICKET, "ticket", LOCK_STATS(&bench_ticket), counts[i]);
+        bench_lock_stress(LOCK_KIND_MCS, "mcs", LOCK_STATS(&bench_mcs), counts[i]);
+    }
+}
+
+/* --- Чтение с диска: PIO против bus-master DMA --- */
+
+#define DISK_BENCH_FILE  "SYS:/bench.dat"
+#define DISK_BENCH_BYTES (64ULL * 1024 * 1024)
+#define DISK_BENCH_CHUNK (128 * 1024)
+
+/* Файл создаётся один раз и остаётся на диске для следующих запусков */
+static int disk_bench_prepare(uint8_t *buf)
+{
+    vfs_stat_t st;
+    if (vfs_stat(DISK_BENCH_FILE, &st) == 0 && st.size >= DISK_BENCH_BYTES)
+        return 0;
+
+    int fd = vfs_open(DISK_BENCH_FILE, VFS_O_WRONLY | VFS_O_CREAT | VFS_O_TRUNC);
+    if (fd < 0)
+        return -1;
+
+    int rc = 0;
+    for (uint64_t off = 0; off < DISK_BENCH_BYTES && rc == 0; off += DISK_BENCH_CHUNK)
+    {
+        for (size_t i = 0; i < DISK_BENCH_CHUNK; i++)
+            buf[i] = (uint8_t)((off + i) * 31 + (off >> 17));
+        if (vfs_write(fd, buf, DISK_BENCH_CHUNK) != DISK_BENCH_CHUNK)
+            rc = -1;
+    }
+
+    vfs_close(fd);
+    return rc;
+}
+
+static void disk_bench_read(ide_disk_t *disk, int dma, const char *name, uint8_t *buf, uint64_t *sum)
+{
+    if (ide_set_dma(disk, dma) != IDE_OK)
+    {
+        kprint(KPRINT_LOG, "bench: %s unavailable, skipped\n", name);
+        return;
+    }
+
+    int fd = vfs_open(DISK_BENCH_FILE, VFS_O_RDONLY);
+    if (fd < 0)
+    {
+        kprint(KPRINT_ERROR, "bench: cannot open %s\n", DISK_BENCH_FILE);
+        return;
+    }
+
+    io_stats_t io;
+    ide_get_stats(disk, &io, true);
+
+    struct ext4_ra_stats ra;
+    vfs_mount_t *mnt = vfs_resolve_path(DISK_BENCH_FILE, NULL);
+    if (mnt)
+        ext4_ra_stats(mnt->mount_path, &ra, true);
+
+    uint64_t total = 0;
+    uint64_t s = 0;
+    uint64_t start = timer_now_ns();
+
+    while (total < DISK_BENCH_BYTES)
+    {
+        ssize_t n = vfs_read(fd, buf, DISK_BENCH_CHUNK);
+        if (n <= 0)
+            break;
+        for (ssize_t i = 0; i < n; i++)
+            s = s * 33 + buf[i];
+        total += (uint64_t)n;
+    }
+
+    uint64_t elapsed_ns = timer_now_ns() - start;
+    vfs_close(fd);
+
+    /* Свёртка входит в замер, но в обоих режимах стоит одинаково */
+    uint64_t kib_per_sec = elapsed_ns ? total * NS_PER_SEC / 1024 / elapsed_ns : 0;
+    kprint(KPRINT_LOG, "bench: ext4 read %s: %lu KiB in %lu us, %lu KiB/s\n",
+           name, total / 1024, elapsed_ns / 1000, kib_per_sec);
+
+    if (ide_get_stats(disk, &io, true) == IDE_OK && io.requests)
+        kprint(KPRINT_LOG, "bench: %s: %lu requests, %lu commands/MiB, avg %lu us, max %lu us, %lu irq waits, %lu errors\n",
+               name, io.requests, io_stats_cmds_per_mib(&io), io.total_ns / io.requests / 1000,
+               io.max_ns / 1000, io.irq_waits, io.errors);
+
+    if (mnt && ext4_ra_stats(mnt->mount_path, &ra, true) == EOK)
+        kprint(KPRINT_LOG, "bench: %s: read-ahead %lu blocks, %lu hits, %lu misses\n",
+               name, ra.issued, ra.hits, ra.misses);
+
+    vfs_mount_put(mnt);
+
+    if (total != DISK_BENCH_BYTES)
+        kprint(KPRINT_ERROR, "bench: %s short read: %lu of %lu bytes\n", name, total, DISK_BENCH_BYTES);
+    *sum = s;
+}
+
+static void bench_disk(void)
+{
+    ide_disk_t *disk = get_primary_master_disk();
+    if (!disk)
+    {
+        kprint(KPRINT_LOG, "bench: no IDE disk, disk bench skipped\n");
+        return;
+    }
+
+    uint8_t *buf = (uint8_t *)malloc(DISK_BENCH_CHUNK);
+    if (!buf)
+        return;
+
+    int saved_dma = disk->dma;
+    if (disk_bench_prepare(buf) != 0)
+    {
+        kprint(KPRINT_ERROR, "bench: cannot create %s, disk bench skipped\n", DISK_BENCH_FILE);
+        free(buf);
+        return;
+    }
+
+    uint64_t pio_sum = 0, dma_sum = 0;
+    disk_bench_read(disk, 0, "PIO", buf, &pio_sum);
+    disk_bench_read(disk, 1, "DMA", buf, &dma_sum);
+
+    if (disk->bm_port && pio_sum != dma_sum)
+        kprint(KPRINT_ERROR, "bench: PIO and DMA read different data\n");
+
+    ide_set_dma(disk, saved_dma);
+    free(buf);
+}
+
+void bench_thread(void *_arg)
+{
+    (void)_arg;
+
+    bench_thread_churn();
+    bench_locks();
+    bench_disk();
+
+    thread_exit(0);
+}
+
+#else
+
+void bench_thread(void *_arg)
+{
+    (void)_arg;
+}
+
+#endif
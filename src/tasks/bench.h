@@ -0,0 +1,7 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Встроенные бенчмарки ядра: собираются только с -DCONFIG_BENCH (make bench) */
+void bench_thread(void *_arg);
+
+#endif
@@ -8,17 +8,31 @@
 #include <stdint.h>
 #include "../graphics/formatting.h"
 #include "../graphics/colors.h"
-#include "../app_manager/elf.h"
-
-extern bool screen_refresh_status;
+#include "../elf/elf.h"
+#include "../time/timer.h"
+#include "../multitask/preempt.h"
+#include "../multitask/rcu.h"
+#include "bench.h"
 
 void zombie_reaper_thread(void *_arg)
 {
     (void)_arg;
     for (;;)
     {
+        /* Будит thread_exit/thread_stop/process_exit через очередь реапера */
+        wait_for_zombies();
         reap_zombie_threads();
-        asm volatile("hlt");
+    }
+}
+
+void rcu_callback_thread(void *_arg)
+{
+    (void)_arg;
+    for (;;)
+    {
+        /* Пачка call_rcu выполняется после одного общего периода ожидания */
+        rcu_wait_for_callbacks();
+        rcu_process_callbacks();
     }
 }
 
@@ -27,14 +41,46 @@ void screen_refresh_thread(void *_arg)
     (void)_arg;
     for (;;)
     {
-        if (screen_refresh_status)
-        {
-            gfx_update_screen();
-            screen_refresh_status = false;
-        }
-        asm volatile("hlt");
+        /* Спим, пока никто не рисовал; затем не чаще одного кадра за SCREEN_REFRESH_MS */
+        screen_refresh_wait();
+        gfx_update_screen();
+        thread_sleep_ms(SCREEN_REFRESH_MS);
+    }
+}
+
+static void writeback_thread(void *_arg)
+{
+    (void)_arg;
+    for (;;)
+    {
+        /* Запись мелких блоков откладывается в кэше ext4: раз в тик уносим устаревшие */
+        thread_sleep_ms(VFS_WRITEBACK_MS);
+        vfs_writeback();
+    }
+}
+
+#ifdef CONFIG_LATENCY_AUDIT
+#define LATENCY_REPORT_MS 5000
+
+/* Худшие секции за интервал; адреса сопоставляются с символами через nm kernel.elf */
+static void latency_report_thread(void *_arg)
+{
+    (void)_arg;
+    for (;;)
+    {
+        thread_sleep_ms(LATENCY_REPORT_MS);
+
+        latency_stats_t st;
+        latency_get_stats(&st, true);
+        kprint(KPRINT_LOG, "latency: irq-off max %lu ns at %p (%lu sections)\n",
+               st.irqoff_max_ns, (void *)st.irqoff_max_site, st.irqoff_sections);
+        kprint(KPRINT_LOG, "latency: preempt-off max %lu ns at %p (%lu sections)\n",
+               st.preemptoff_max_ns, (void *)st.preemptoff_max_site, st.preemptoff_sections);
+        kprint(KPRINT_LOG, "latency: syscall max %lu ns (num %lu), resched delay max %lu ns\n",
+               st.syscall_max_ns, st.syscall_max_num, st.resched_max_ns);
     }
 }
+#endif
 
 static void trim_string(char *str)
 {
@@ -58,6 +104,7 @@ static void trim_string(char *str)
 static int load_program_from_file(const char* file_path)
 {
     // TODO: boot from ELF
+    (void)file_path;
 
     return 0;
 }
@@ -151,6 +198,13 @@ void tasks_init(void)
         false, 
         0
     );
+    thread_create(
+        get_current_process(),
+        rcu_callback_thread,
+        NULL,
+        false,
+        0
+    );
     thread_create(
         get_current_process(),
         screen_refresh_thread,
@@ -158,6 +212,31 @@ void tasks_init(void)
         false, 
         0
     );
+    thread_create(
+        get_current_process(),
+        writeback_thread,
+        NULL,
+        false,
+        0
+    );
+#ifdef CONFIG_BENCH
+    thread_create(
+        get_current_process(),
+        bench_thread,
+        NULL,
+        false,
+        0
+    );
+#endif
+#ifdef CONFIG_LATENCY_AUDIT
+    thread_create(
+        get_current_process(),
+        latency_report_thread,
+        NULL,
+        false,
+        0
+    );
+#endif
     // thread_create(
     //     get_current_process(),
     //     delayed_app_loader,
@@ -1,40 +1,6 @@
 // clock.c
 
 #include "clock.h"
-#include "rtc.h"
-
-volatile ClockTime system_clock = {0, 0, 0};
-
-void init_system_clock(void)
-{
-    uint32_t h, m, s;
-    read_rtc_time(&h, &m, &s);
-    system_clock.hh = (uint8_t)h;
-    system_clock.mm = (uint8_t)m;
-    system_clock.ss = (uint8_t)s;
-}
-
-void clock_tick()
-{
-    system_clock.ss++;
-
-    if (system_clock.ss >= 60)
-    {
-        system_clock.ss = 0;
-        system_clock.mm++;
-
-        if (system_clock.mm >= 60)
-        {
-            system_clock.mm = 0;
-            system_clock.hh++;
-
-            if (system_clock.hh >= 24)
-            {
-                system_clock.hh = 0;
-            }
-        }
-    }
-}
 
 void format_clock(char *buffer, ClockTime t)
 {
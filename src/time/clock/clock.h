@@ -12,10 +12,7 @@ typedef struct
     uint8_t ss;
 } ClockTime;
 
-extern volatile ClockTime system_clock;
-
-void clock_tick();
+/* Текущее время - ktime_get_wall (time/timekeeping.h) */
 void format_clock(char *buffer, ClockTime t);
-void init_system_clock(void);
 
 #endif
\ No newline at end of file
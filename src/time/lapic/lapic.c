@@ -0,0 +1,134 @@
+#include "lapic.h"
+#include "../tsc/tsc.h"
+#include "../timer.h"
+#include "../../cpu/cpu.h"
+#include "../../mm/vmm.h"
+
+#define LAPIC_CALIBRATE_MS 10
+
+/* Минимальная задержка, чтобы не взвести таймер "в прошлое" */
+#define LAPIC_MIN_DELTA_NS 2000ULL
+
+static volatile uint32_t *lapic_base = NULL;
+static bool lapic_enabled = false;
+static bool tsc_deadline = false;
+static uint8_t timer_vector = 0;
+static uint64_t lapic_ticks_per_ms = 0;
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+    return lapic_base[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value)
+{
+    lapic_base[reg / 4] = value;
+}
+
+bool lapic_init(void)
+{
+    uint32_t edx;
+    cpuid(1, 0, NULL, NULL, NULL, &edx);
+    if (!(edx & (1u << 9)))
+        return false;
+
+    uint64_t base_msr = rdmsr(MSR_IA32_APIC_BASE);
+    uint64_t phys = base_msr & 0x000FFFFFFFFFF000ULL;
+
+    /* Limine не кладёт MMIO в HHDM, поэтому отображаем страницу сами */
+    lapic_base = (volatile uint32_t *)vmm_map_mmio(phys, PAGE_SIZE);
+    if (!lapic_base)
+        return false;
+
+    wrmsr(MSR_IA32_APIC_BASE, base_msr | (1ULL << 11));
+
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+
+    lapic_enabled = true;
+    return true;
+}
+
+bool lapic_is_enabled(void)
+{
+    return lapic_enabled;
+}
+
+void lapic_eoi(void)
+{
+    lapic_write(LAPIC_REG_EOI, 0);
+}
+
+uint32_t lapic_id(void)
+{
+    if (!lapic_enabled)
+        return 0;
+    return lapic_read(LAPIC_REG_ID) >> 24;
+}
+
+bool lapic_timer_init(uint8_t vector)
+{
+    if (!lapic_enabled || tsc_khz == 0)
+        return false;
+
+    timer_vector = vector;
+
+    uint32_t ecx;
+    cpuid(1, 0, NULL, NULL, &ecx, NULL);
+    tsc_deadline = (ecx & CPUID_1_ECX_TSC_DEADLINE) != 0;
+
+    if (tsc_deadline)
+    {
+        lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_TSC_DEADLINE | LAPIC_LVT_MASKED | vector);
+        return true;
+    }
+
+    /* Без TSC-deadline калибруем счётчик LAPIC по PIT */
+    lapic_write(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_ONESHOT | LAPIC_LVT_MASKED | vector);
+    lapic_write(LAPIC_REG_TIMER_INIT, 0xFFFFFFFF);
+
+    pit_wait_ms(LAPIC_CALIBRATE_MS);
+
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_REG_TIMER_CUR);
+    lapic_write(LAPIC_REG_TIMER_INIT, 0);
+
+    lapic_ticks_per_ms = elapsed / LAPIC_CALIBRATE_MS;
+    return lapic_ticks_per_ms != 0;
+}
+
+bool lapic_timer_has_tsc_deadline(void)
+{
+    return tsc_deadline;
+}
+
+void lapic_timer_oneshot_ns(uint64_t delta_ns)
+{
+    if (delta_ns < LAPIC_MIN_DELTA_NS)
+        delta_ns = LAPIC_MIN_DELTA_NS;
+
+    if (tsc_deadline)
+    {
+        lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_TSC_DEADLINE | timer_vector);
+        wrmsr(MSR_IA32_TSC_DEADLINE, rdtsc() + tsc_ns_to_cycles(delta_ns));
+        return;
+    }
+
+    uint64_t ticks = (delta_ns / NS_PER_MS) * lapic_ticks_per_ms
+                   + ((delta_ns % NS_PER_MS) * lapic_ticks_per_ms) / NS_PER_MS;
+    if (ticks == 0)
+        ticks = 1;
+    if (ticks > 0xFFFFFFFF)
+        ticks = 0xFFFFFFFF;
+
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_ONESHOT | timer_vector);
+    lapic_write(LAPIC_REG_TIMER_INIT, (uint32_t)ticks);
+}
+
+void lapic_timer_stop(void)
+{
+    if (tsc_deadline)
+        wrmsr(MSR_IA32_TSC_DEADLINE, 0);
+    else
+        lapic_write(LAPIC_REG_TIMER_INIT, 0);
+}
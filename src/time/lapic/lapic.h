@@ -0,0 +1,34 @@
+#ifndef LAPIC_H
+#define LAPIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Смещения регистров Local APIC */
+#define LAPIC_REG_ID          0x020
+#define LAPIC_REG_EOI         0x0B0
+#define LAPIC_REG_SVR         0x0F0
+#define LAPIC_REG_LVT_TIMER   0x320
+#define LAPIC_REG_TIMER_INIT  0x380
+#define LAPIC_REG_TIMER_CUR   0x390
+#define LAPIC_REG_TIMER_DIV   0x3E0
+
+#define LAPIC_SVR_ENABLE      (1u << 8)
+#define LAPIC_LVT_MASKED      (1u << 16)
+#define LAPIC_TIMER_ONESHOT   (0u << 17)
+#define LAPIC_TIMER_TSC_DEADLINE (2u << 17)
+#define LAPIC_TIMER_DIV_16    0x3
+
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+bool lapic_init(void);
+bool lapic_is_enabled(void);
+void lapic_eoi(void);
+uint32_t lapic_id(void);
+
+bool lapic_timer_init(uint8_t vector);
+bool lapic_timer_has_tsc_deadline(void);
+void lapic_timer_oneshot_ns(uint64_t delta_ns);
+void lapic_timer_stop(void);
+
+#endif
@@ -0,0 +1,69 @@
+#include "timekeeping.h"
+#include "timer.h"
+#include "tsc/tsc.h"
+#include "clock/rtc.h"
+#include "../seqlock/seqlock.h"
+#include "../spinlock/spinlock.h"
+
+typedef struct
+{
+    seqlock_t lock;
+    uint64_t wall_base_ns;   /* ktime_get_ns в момент установки часов */
+    uint32_t wall_base_sec;  /* время суток в этот момент */
+} timekeeper_t;
+
+static timekeeper_t tk = { SEQLOCK_INIT, 0, 0 };
+
+void timekeeping_init(void)
+{
+    uint32_t h, m, s;
+    read_rtc_time(&h, &m, &s);
+    timekeeping_set_wall(h * 3600 + m * 60 + s);
+}
+
+void timekeeping_set_wall(uint32_t sec_of_day)
+{
+    /* Писатель один: с IF = 0 таймер не вклинится между половинами пары */
+    uint64_t flags = save_irq_disable();
+    seqlock_write_begin(&tk.lock);
+    tk.wall_base_ns = ktime_get_ns();
+    tk.wall_base_sec = sec_of_day % SEC_PER_DAY;
+    seqlock_write_end(&tk.lock);
+    restore_irq(flags);
+}
+
+uint64_t ktime_get_ns(void)
+{
+    return timer_now_ns();
+}
+
+uint64_t ktime_get_uptime_sec(void)
+{
+    return ktime_get_ns() / NS_PER_SEC;
+}
+
+uint32_t ktime_get_wall_sec(void)
+{
+    uint64_t base_ns;
+    uint32_t base_sec;
+    unsigned seq;
+
+    do
+    {
+        seq = seqlock_read_begin(&tk.lock);
+        base_ns = tk.wall_base_ns;
+        base_sec = tk.wall_base_sec;
+    } while (seqlock_read_retry(&tk.lock, seq));
+
+    uint64_t now = ktime_get_ns();
+    uint64_t elapsed = now > base_ns ? (now - base_ns) / NS_PER_SEC : 0;
+    return (uint32_t)((base_sec + elapsed) % SEC_PER_DAY);
+}
+
+void ktime_get_wall(ClockTime *out)
+{
+    uint32_t sec = ktime_get_wall_sec();
+    out->hh = (uint8_t)(sec / 3600);
+    out->mm = (uint8_t)(sec / 60 % 60);
+    out->ss = (uint8_t)(sec % 60);
+}
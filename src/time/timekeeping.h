@@ -0,0 +1,31 @@
+#ifndef TIMEKEEPING_H
+#define TIMEKEEPING_H
+
+#include <stdint.h>
+#include "clock/clock.h"
+
+#define SEC_PER_DAY 86400U
+
+/*
+ * Ядро учёта времени. Монотонное время берётся из timer_now_ns (TSC или
+ * счётчик тиков PIT), настенное считается от пары (время суток, момент
+ * монотонного времени), которую пишут под seqlock. Читатели не берут
+ * блокировок и не запрещают прерывания: при гонке с писателем они просто
+ * перечитывают пару
+ */
+
+/* Читает RTC и запоминает настенное время на текущий момент */
+void timekeeping_init(void);
+
+/* Перевод часов: секунды от полуночи (местное время) */
+void timekeeping_set_wall(uint32_t sec_of_day);
+
+/* Наносекунды с загрузки, не убывают */
+uint64_t ktime_get_ns(void);
+uint64_t ktime_get_uptime_sec(void);
+
+/* Местное время суток */
+uint32_t ktime_get_wall_sec(void);
+void ktime_get_wall(ClockTime *out);
+
+#endif // TIMEKEEPING_H
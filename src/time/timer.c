@@ -1,46 +1,135 @@
 #include "../portio/portio.h"
 #include "timer.h"
 #include "../pic.h"
-#include "clock/clock.h"
+#include "../idt.h"
+#include "tsc/tsc.h"
+#include "lapic/lapic.h"
 #include "../multitask/multitask.h"
+#include "../spinlock/spinlock.h"
 #include "../graphics/graphics.h"
+#include "../vdso/vdso.h"
 #include <stdint.h>
 
 #define PIT_CMD_PORT 0x43
 #define PIT_COUNTER0 0x40
+#define PIT_COUNTER2 0x42
 #define PIT_CMD_VALUE 0x36
+#define PIT_CMD_CH2_ONESHOT 0xB0
+#define PIT_GATE_PORT 0x61
 
-volatile uint16_t tick_time = 0;
 volatile uint64_t last_ms = 0;
-volatile uint32_t seconds = 0;
 volatile uint32_t current_ms = 0;
 volatile bool screen_refresh_status = true;
 
+static bool timer_tickless = false;
+static uint64_t next_second_ns = NS_PER_SEC;
+static thread_t *screen_refresh_waiter = NULL;
+
 uint32_t get_millis(void)
 {
     return current_ms;
 }
 
+uint64_t timer_now_ns(void)
+{
+    if (timer_tickless)
+        return tsc_now_ns();
+    return (uint64_t)current_ms * NS_PER_MS;
+}
+
+bool timer_is_tickless(void)
+{
+    return timer_tickless;
+}
+
 void timer_tick(void)
 {
-    tick_time++;
-    current_ms++;
-    if (tick_time >= 1000)
+    if (timer_tickless)
     {
-        tick_time = 0;
-        seconds++;
-        clock_tick();
-    }
+        /* One-shot: время берём из TSC, а не из числа прерываний */
+        uint64_t now = tsc_now_ns();
+        current_ms = (uint32_t)(now / NS_PER_MS);
 
-    /* Update frame every 16 ms */
-    if ((tick_time % 16) == 0)
-    {
-        screen_refresh_status = true;
+        bool second_passed = false;
+        while (now >= next_second_ns)
+        {
+            next_second_ns += NS_PER_SEC;
+            second_passed = true;
+        }
+
+        /* uptime_ns пользователь считает сам по TSC, тут только часы */
+        if (second_passed)
+            vdso_update_time();
+
+        lapic_eoi();
+        return;
     }
 
+    current_ms++;
+
+    /* Без TSC vDSO отдаёт время с точностью до тика */
+    vdso_update_time();
+
     pic_send_eoi(0);
 }
 
+void timer_set_next_event(uint64_t deadline_ns)
+{
+    if (!timer_tickless)
+        return;
+
+    uint64_t event = next_second_ns;
+    if (deadline_ns != 0 && deadline_ns < event)
+        event = deadline_ns;
+
+    uint64_t now = tsc_now_ns();
+    lapic_timer_oneshot_ns(event > now ? event - now : 0);
+}
+
+void pit_wait_ms(uint32_t ms)
+{
+    uint32_t count = (PIT_FREQUENCY / 1000) * ms;
+    if (count > 0xFFFF)
+        count = 0xFFFF;
+
+    /* Канал 2, режим 0: выход поднимается по истечении счёта */
+    outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~0x02) | 0x01);
+    outb(PIT_CMD_PORT, PIT_CMD_CH2_ONESHOT);
+    outb(PIT_COUNTER2, (uint8_t)(count & 0xFF));
+    outb(PIT_COUNTER2, (uint8_t)((count >> 8) & 0xFF));
+
+    while (!(inb(PIT_GATE_PORT) & 0x20))
+        asm volatile("pause");
+}
+
+bool timer_init_tickless(void)
+{
+    if (!tsc_init())
+        return false;
+
+    /* В tickless-режиме часы идут только по TSC: без invariant TSC его частота
+       плавает вместе с P-состояниями и он стоит в глубоких C-состояниях,
+       поэтому тогда остаёмся на периодическом PIT */
+    if (!tsc_is_invariant())
+        return false;
+
+    if (!lapic_init())
+        return false;
+
+    if (!lapic_timer_init(TIMER))
+        return false;
+
+    /* PIT больше не нужен как источник тиков */
+    outb(PIC1_DATA, inb(PIC1_DATA) | 0x01);
+
+    next_second_ns = (tsc_now_ns() / NS_PER_SEC + 1) * NS_PER_SEC;
+    current_ms = (uint32_t)(tsc_now_ns() / NS_PER_MS);
+    timer_tickless = true;
+
+    timer_set_next_event(0);
+    return true;
+}
+
 void init_timer(uint32_t frequency)
 {
     if (frequency == 0 || frequency > PIT_FREQUENCY)
@@ -58,4 +147,26 @@ void init_timer(uint32_t frequency)
     outb(PIT_CMD_PORT, PIT_CMD_VALUE);                    // Command port
     outb(PIT_COUNTER0, (uint8_t)(divisor & 0xFF));        // Low byte
     outb(PIT_COUNTER0, (uint8_t)((divisor >> 8) & 0xFF)); // High byte
-}
\ No newline at end of file
+}
+
+void screen_refresh_request(void)
+{
+    uint64_t flags = save_irq_disable();
+    screen_refresh_status = true;
+    if (screen_refresh_waiter)
+        thread_wake(screen_refresh_waiter);
+    restore_irq(flags);
+}
+
+void screen_refresh_wait(void)
+{
+    uint64_t flags = save_irq_disable();
+    while (!screen_refresh_status)
+    {
+        screen_refresh_waiter = get_current_thread();
+        thread_block_current();
+    }
+    screen_refresh_waiter = NULL;
+    screen_refresh_status = false;
+    restore_irq(flags);
+}
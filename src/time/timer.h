@@ -6,9 +6,21 @@
 
 #define PIT_FREQUENCY 1193180U
 
+/* Период обновления экрана (~60 кадров/с) */
+#define SCREEN_REFRESH_MS 16
+
 extern volatile bool screen_refresh_status;
 
 void init_timer(uint32_t frequency);
+bool timer_init_tickless(void);
+bool timer_is_tickless(void);
+void pit_wait_ms(uint32_t ms);
+
 uint32_t get_millis(void);
+uint64_t timer_now_ns(void);
+void timer_set_next_event(uint64_t deadline_ns);
+
+void screen_refresh_request(void);
+void screen_refresh_wait(void);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,66 @@
+#include "tsc.h"
+#include "../timer.h"
+
+#define TSC_CALIBRATE_MS 10
+
+uint64_t tsc_khz = 0;
+
+static uint64_t tsc_boot = 0;
+/* ns = (cycles * tsc_mult) >> 32 */
+static uint64_t tsc_mult = 0;
+static bool tsc_invariant = false;
+
+bool tsc_init(void)
+{
+    if (cpuid_max_leaf(0x80000000) >= 0x80000007)
+    {
+        uint32_t edx;
+        cpuid(0x80000007, 0, NULL, NULL, NULL, &edx);
+        tsc_invariant = (edx & CPUID_80000007_EDX_INVARIANT_TSC) != 0;
+    }
+
+    uint64_t start = rdtsc();
+    pit_wait_ms(TSC_CALIBRATE_MS);
+    uint64_t end = rdtsc();
+
+    if (end <= start)
+        return false;
+
+    tsc_khz = (end - start) / TSC_CALIBRATE_MS;
+    if (tsc_khz == 0)
+        return false;
+
+    tsc_mult = (NS_PER_MS << 32) / tsc_khz;
+    tsc_boot = start;
+    return true;
+}
+
+bool tsc_is_invariant(void)
+{
+    return tsc_invariant;
+}
+
+uint64_t tsc_to_ns(uint64_t cycles)
+{
+    return (uint64_t)(((unsigned __int128)cycles * tsc_mult) >> 32);
+}
+
+uint64_t tsc_ns_to_cycles(uint64_t ns)
+{
+    return (ns / NS_PER_MS) * tsc_khz + ((ns % NS_PER_MS) * tsc_khz) / NS_PER_MS;
+}
+
+uint64_t tsc_now_ns(void)
+{
+    return tsc_to_ns(rdtsc() - tsc_boot);
+}
+
+uint64_t tsc_get_boot(void)
+{
+    return tsc_boot;
+}
+
+uint64_t tsc_get_mult(void)
+{
+    return tsc_mult;
+}
@@ -0,0 +1,26 @@
+#ifndef TSC_H
+#define TSC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../../cpu/cpu.h"
+
+#define NS_PER_MS  1000000ULL
+#define NS_PER_SEC 1000000000ULL
+
+extern uint64_t tsc_khz;
+
+bool tsc_init(void);
+bool tsc_is_invariant(void);
+
+uint64_t tsc_to_ns(uint64_t cycles);
+uint64_t tsc_ns_to_cycles(uint64_t ns);
+
+/* Наносекунды с момента калибровки TSC */
+uint64_t tsc_now_ns(void);
+
+/* Параметры пересчёта для vDSO: ns = ((tsc - boot) * mult) >> 32 */
+uint64_t tsc_get_boot(void);
+uint64_t tsc_get_mult(void);
+
+#endif
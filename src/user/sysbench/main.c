@@ -0,0 +1,71 @@
+#include <stdint.h>
+#include <stdio.h>
+#include "syscall.h"
+
+/* Микробенчмарк пустого системного вызова: int 0x80 против SYSCALL/SYSRET */
+
+#define ITERATIONS 100000
+#define ROUNDS     5
+
+static inline uint64_t bench_rdtsc(void)
+{
+    uint32_t lo, hi;
+    asm volatile("lfence; rdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline long nop_int80(void)
+{
+    long ret;
+    asm volatile("int $0x80"
+                 : "=a"(ret)
+                 : "a"((uint64_t)SYSCALL_NOP)
+                 : "memory");
+    return ret;
+}
+
+static inline long nop_syscall(void)
+{
+    long ret;
+    asm volatile("syscall"
+                 : "=a"(ret)
+                 : "a"((uint64_t)SYSCALL_NOP)
+                 : "rcx", "r11", "memory");
+    return ret;
+}
+
+/* Лучший из ROUNDS прогонов - отсекаем прерывания и переключения задач */
+static uint64_t measure(long (*fn)(void))
+{
+    uint64_t best = (uint64_t)-1;
+
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        uint64_t start = bench_rdtsc();
+        for (int i = 0; i < ITERATIONS; i++)
+            fn();
+        uint64_t cycles = (bench_rdtsc() - start) / ITERATIONS;
+
+        if (cycles < best)
+            best = cycles;
+    }
+
+    return best;
+}
+
+void _start(void)
+{
+    /* Прогрев: TLB, кэш, ленивые страницы стека */
+    nop_int80();
+    nop_syscall();
+
+    uint64_t int80 = measure(nop_int80);
+    uint64_t fast = measure(nop_syscall);
+
+    printf("null syscall, cycles/call: int 0x80 = %lu, syscall = %lu\n", int80, fast);
+
+    syscall_process_exit(0);
+
+    for (;;)
+        asm volatile("pause");
+}
@@ -0,0 +1,163 @@
+#include <stdint.h>
+#include <stdio.h>
+#include "syscall.h"
+#include "sched.h"
+#include "futex.h"
+#include "vdso.h"
+
+/* Снимок потоков раз в секунду: доля CPU, время ожидания, переключения,
+   плюс хвост трассы переключений планировщика */
+
+#define MAX_THREADS    128
+#define REFRESHES      5
+#define INTERVAL_NS    1000000000ULL
+#define TRACE_TAIL     8
+
+static thread_stat_t prev[MAX_THREADS];
+static thread_stat_t cur[MAX_THREADS];
+static sched_event_t trace[SCHED_TRACE_SIZE];
+
+static const char *state_name(uint32_t state)
+{
+    switch (state)
+    {
+        case THREAD_STATE_RUNNING: return "R";
+        case THREAD_STATE_READY:   return "r";
+        case THREAD_STATE_BLOCKED: return "S";
+        case THREAD_STATE_ZOMBIE:  return "Z";
+        default:                   return "?";
+    }
+}
+
+/* printf умеет только %lu без ширины - выравниваем вручную */
+static void put_num(uint64_t v, int width)
+{
+    char buf[24];
+    int n = 0;
+    do
+    {
+        buf[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v && n < (int)sizeof(buf));
+
+    char out[48];
+    int o = 0;
+    for (int i = n; i < width && o < (int)sizeof(out) - 1; i++)
+        out[o++] = ' ';
+    while (n > 0 && o < (int)sizeof(out) - 1)
+        out[o++] = buf[--n];
+    out[o] = '\0';
+    printf("%s", out);
+}
+
+/* -1 в трассе - переключение без предыдущего потока (первый запуск) */
+static void put_tid(int32_t tid)
+{
+    if (tid < 0)
+        printf("-");
+    else
+        put_num((uint32_t)tid, 0);
+}
+
+static const thread_stat_t *find_prev(size_t count, int32_t tid)
+{
+    for (size_t i = 0; i < count; i++)
+        if (prev[i].tid == tid)
+            return &prev[i];
+    return NULL;
+}
+
+static void sleep_ns(uint64_t ns)
+{
+    /* Никто не будит: FUTEX_WAIT вернётся по таймауту */
+    static uint32_t never = 0;
+    futex_wait(&never, 0, ns);
+}
+
+static void print_frame(size_t prev_count, size_t count, uint64_t elapsed_ns)
+{
+    printf("  TID  PID S  CPU%%   RUN ms  WAIT ms   WAIT/s ms   VCSW   ICSW\n");
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const thread_stat_t *t = &cur[i];
+        const thread_stat_t *p = find_prev(prev_count, t->tid);
+
+        uint64_t d_run = p ? t->runtime_ns - p->runtime_ns : 0;
+        uint64_t d_wait = p ? t->wait_ns - p->wait_ns : 0;
+        uint64_t cpu = elapsed_ns ? d_run * 100 / elapsed_ns : 0;
+
+        put_num((uint32_t)t->tid, 5);
+        put_num((uint32_t)t->pid, 5);
+        printf(" %s", state_name(t->state));
+        put_num(cpu, 6);
+        put_num(t->runtime_ns / 1000000, 9);
+        put_num(t->wait_ns / 1000000, 9);
+        put_num(elapsed_ns ? d_wait * 1000 / elapsed_ns : 0, 12);
+        put_num(t->nr_voluntary, 7);
+        put_num(t->nr_involuntary, 7);
+        printf("\n");
+    }
+}
+
+static uint64_t print_trace(uint64_t from_seq, uint64_t elapsed_ns)
+{
+    size_t n = sched_trace(trace, SCHED_TRACE_SIZE, from_seq);
+    if (n == 0)
+        return from_seq;
+
+    /* Счёт по seq точен, даже если кольцо успело перезаписаться */
+    uint64_t next_seq = trace[n - 1].seq + 1;
+    uint64_t switches = next_seq - from_seq;
+
+    printf("switches: %lu", switches);
+    if (elapsed_ns)
+        printf(" (%lu/s)", switches * 1000000000ULL / elapsed_ns);
+    printf("\n");
+
+    size_t start = n > TRACE_TAIL ? n - TRACE_TAIL : 0;
+    for (size_t i = start; i < n; i++)
+    {
+        const sched_event_t *e = &trace[i];
+        printf("  %lu us: ", e->ts_ns / 1000);
+        put_tid(e->prev_tid);
+        printf(" [%s] -> ", state_name(e->prev_state));
+        put_tid(e->next_tid);
+        printf("\n");
+    }
+
+    return next_seq;
+}
+
+void _start(void)
+{
+    size_t prev_count = sched_thread_stats(prev, MAX_THREADS);
+    uint64_t prev_ns = vdso_uptime_ns();
+
+    /* Трассу показываем только за интервалы наблюдения */
+    size_t n = sched_trace(trace, SCHED_TRACE_SIZE, 0);
+    uint64_t seq = n ? trace[n - 1].seq + 1 : 0;
+
+    for (int r = 0; r < REFRESHES; r++)
+    {
+        sleep_ns(INTERVAL_NS);
+
+        size_t count = sched_thread_stats(cur, MAX_THREADS);
+        uint64_t now_ns = vdso_uptime_ns();
+        uint64_t elapsed = now_ns - prev_ns;
+
+        printf("\ntop: %lu threads, uptime %lu s\n", (uint64_t)count, now_ns / 1000000000ULL);
+        print_frame(prev_count, count, elapsed);
+        seq = print_trace(seq, elapsed);
+
+        for (size_t i = 0; i < count; i++)
+            prev[i] = cur[i];
+        prev_count = count;
+        prev_ns = now_ns;
+    }
+
+    syscall_process_exit(0);
+
+    for (;;)
+        asm volatile("pause");
+}
@@ -0,0 +1,68 @@
+#include "vdso.h"
+#include "../mm/pmm.h"
+#include "../libc/string.h"
+#include "../time/timer.h"
+#include "../time/tsc/tsc.h"
+#include "../time/timekeeping.h"
+
+static vdso_data_t *vdso_data = NULL;
+
+void vdso_init(void)
+{
+    vdso_data = alloc_page();
+    if (!vdso_data)
+        return;
+
+    memset(vdso_data, 0, PAGE_SIZE);
+
+    if (timer_is_tickless())
+    {
+        vdso_data->tsc_valid = 1;
+        vdso_data->tsc_base = tsc_get_boot();
+        vdso_data->tsc_mult = tsc_get_mult();
+    }
+
+    vdso_data->tid = -1;
+    vdso_data->pid = -1;
+
+    vdso_update_time();
+}
+
+void vdso_map(page_table_t *pml4)
+{
+    if (!vdso_data || !pml4)
+        return;
+
+    /* Без PTE_WRITABLE: пользователь может только читать. Страница одна на всех -
+       destroy_address_space её не освобождает */
+    mmap(pml4, VDSO_USER_ADDR, (uint64_t)vdso_data - hhdm_offset, PTE_USER | PTE_SHARED);
+}
+
+/* Вызывается из timer_tick с выключенными прерываниями */
+void vdso_update_time(void)
+{
+    if (!vdso_data)
+        return;
+
+    seqlock_write_begin(&vdso_data->lock);
+
+    ClockTime wall;
+    ktime_get_wall(&wall);
+
+    vdso_data->uptime_ns = ktime_get_ns();
+    vdso_data->uptime_sec = (uint32_t)ktime_get_uptime_sec();
+    vdso_data->hh = wall.hh;
+    vdso_data->mm = wall.mm;
+    vdso_data->ss = wall.ss;
+
+    seqlock_write_end(&vdso_data->lock);
+}
+
+void vdso_set_current(int tid, int pid)
+{
+    if (!vdso_data)
+        return;
+
+    vdso_data->tid = tid;
+    vdso_data->pid = pid;
+}
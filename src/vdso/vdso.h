@@ -0,0 +1,40 @@
+#ifndef VDSO_H
+#define VDSO_H
+
+#include <stdint.h>
+#include "../seqlock/seqlock.h"
+#include "../mm/vmm.h"
+
+/* Страница только для чтения, общая для всех процессов.
+   Раскладка должна совпадать с libc/include/vdso.h */
+#define VDSO_USER_ADDR 0x00007FFFFF000000ULL
+
+typedef struct
+{
+    seqlock_t lock;
+    uint32_t tsc_valid;   /* 0 - TSC не откалиброван, берём uptime_ns */
+
+    /* uptime_ns = ((rdtsc() - tsc_base) * tsc_mult) >> 32 */
+    uint64_t tsc_base;
+    uint64_t tsc_mult;
+
+    uint64_t uptime_ns;   /* на момент последнего обновления */
+    uint32_t uptime_sec;
+
+    uint8_t hh;
+    uint8_t mm;
+    uint8_t ss;
+    uint8_t reserved;
+
+    /* Текущий поток; читается без seqlock (одно выровненное слово) */
+    volatile int32_t tid;
+    volatile int32_t pid;
+} vdso_data_t;
+
+void vdso_init(void);
+void vdso_map(page_table_t *pml4);
+
+void vdso_update_time(void);
+void vdso_set_current(int tid, int pid);
+
+#endif